@@ -28,6 +28,7 @@
 #define COM_DAT             0x00
 #define COM_IEN             0x01    // interrupt enable register
 #define COM_FCR             0x02    // FIFO Control Register
+#define COM_IIR             0x02    // interrupt identification register (read)
 #define COM_LCR             0x03    // line control registers
 #define COM_MCR             0x04    // modem control reg
 #define COM_LSR             0x05    // line status register
@@ -36,15 +37,26 @@
 #define COM_DLL             0x00    // divisor latch least sig
 #define COM_DLM             0x01    // divisor latch most sig
 
-const UINT16 BaudRate = 1;          // 115200 bps
+#define KD_COM_BAUD_RATE    921600  // highest rate; keep in step with blkdcom.cpp
 
 #define COM_DATRDY          0x01
 #define COM_OUTRDY          0x20
 
 #define LC_DLAB             0x80
 
+#define FC_ENABLE           0x01    // enable both FIFOs
+#define FC_CLEAR_RX         0x02
+#define FC_CLEAR_TX         0x04
+#define FC_TRIGGER_14       0xC0    // receive interrupt at 14 bytes
+#define II_FIFO_ENABLED     0xC0    // both bits set on a working 16550A FIFO
+
+#define COM_FIFO_DEPTH      16
+
 #define CLOCK_RATE          0x1C200 // USART clock rate
 
+// Divisor for a standard clock, if the boot loader left none.
+const UINT16 BaudRate = (CLOCK_RATE + KD_COM_BAUD_RATE - 1) / KD_COM_BAUD_RATE;
+
 #define MC_DTRRTS           0x03    // Control bits to assert DTR and RTS
 #define MS_DSRCTSCD         0xB0    // Status bits for DSR, CTS and CD
 #define MS_CD               0x80
@@ -60,6 +72,8 @@ const UINT16 BaudRate = 1;          // 115200 bps
 // Globals
 //
 static UINT16 KdBasePort = COM2_PORT;
+static UINT8 KdTxFifoDepth = 1;     // bytes the transmitter takes once it is empty
+static UINT8 KdTxFifoRoom = 0;      // bytes that can still be written without polling
 
 ////////////////////////////////////////////////// Serial Port Input & Output.
 //
@@ -83,6 +97,16 @@ bool KdpSerialInit(Class_Microsoft_Singularity_Hal_Platform *nbi)
         return false;
     }
 
+    // Keep the divisor the boot loader connected to the host with.  The
+    // loader measured the UART's clock and chose the fastest rate up to
+    // KD_COM_BAUD_RATE; the kernel has no clock to measure against this early.
+    KdWriteInt8(KdBasePort + COM_LCR, LC_DLAB);
+    UINT16 divisor = (UINT16)(KdReadInt8(KdBasePort + COM_DLL) |
+                              (KdReadInt8(KdBasePort + COM_DLM) << 8));
+    if (divisor == 0 || divisor == 0xffff) {
+        divisor = BaudRate;
+    }
+
     // turn off interrupts
     KdWriteInt8(KdBasePort + COM_LCR, 0x00);
     KdWriteInt8(KdBasePort + COM_IEN, 0x00);
@@ -90,13 +114,22 @@ bool KdpSerialInit(Class_Microsoft_Singularity_Hal_Platform *nbi)
     // Turn on DTS/RTS
     KdWriteInt8(KdBasePort + COM_MCR, MC_DTRRTS); // Needed for VirtualPC PIPE/Serial
 
-    // Turn on FIFO
-    //KdWriteInt8(KdBasePort + COM_FCR, 1);
+    // Turn on the FIFOs. Only a 16550A reports them as enabled; anything
+    // older gets them turned off again and is fed a byte at a time.
+    KdWriteInt8(KdBasePort + COM_FCR, FC_ENABLE | FC_CLEAR_RX | FC_CLEAR_TX | FC_TRIGGER_14);
+    if ((KdReadInt8(KdBasePort + COM_IIR) & II_FIFO_ENABLED) == II_FIFO_ENABLED) {
+        KdTxFifoDepth = COM_FIFO_DEPTH;
+    }
+    else {
+        KdWriteInt8(KdBasePort + COM_FCR, 0);
+        KdTxFifoDepth = 1;
+    }
+    KdTxFifoRoom = 0;
 
     // Set the baud rate
     KdWriteInt8(KdBasePort + COM_LCR, LC_DLAB);  // Divisor latch access bit
-    KdWriteInt8(KdBasePort + COM_DLM, (UINT8)(BaudRate >> 8));
-    KdWriteInt8(KdBasePort + COM_DLL, (UINT8)(BaudRate & 0xFF));
+    KdWriteInt8(KdBasePort + COM_DLM, (UINT8)(divisor >> 8));
+    KdWriteInt8(KdBasePort + COM_DLL, (UINT8)(divisor & 0xFF));
 
     // initialize the LCR
     KdWriteInt8(KdBasePort + COM_LCR, 0x03);
@@ -146,13 +179,19 @@ KDP_STATUS KdpSerialGetByte(OUT PUCHAR Input, BOOL WaitForByte)
 
 void KdpSerialPutByte(IN UCHAR Output)
 {
-    // wait for the com port to be ready
-    while ((KdReadInt8( KdBasePort + COM_LSR ) & COM_OUTRDY) == 0) {
-        // nop;
+    // Once the transmitter reports empty, the whole FIFO is free, so the
+    // next KdTxFifoDepth bytes go out without polling the LSR again.
+    if (KdTxFifoRoom == 0) {
+        // wait for the com port to be ready
+        while ((KdReadInt8( KdBasePort + COM_LSR ) & COM_OUTRDY) == 0) {
+            // nop;
+        }
+        KdTxFifoRoom = KdTxFifoDepth;
     }
 
     // write a single char
     KdWriteInt8(KdBasePort + COM_DAT, Output);
+    KdTxFifoRoom--;
 }
 //
 ///////////////////////////////////////////////////////////////// End of File.
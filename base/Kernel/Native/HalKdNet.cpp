@@ -0,0 +1,626 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Microsoft Research Singularity
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  File:   halkdnet.cpp: polled UDP transport over an Intel 8254x (e1000).
+//
+//  The serial packet layer (halkdserial.cpp) runs unchanged on top of this
+//  file: each UDP datagram carries a slice of the same byte stream a COM
+//  port would, so KD_PACKET framing, checksums, ACKs and resends all stay
+//  in that layer.  On the host, kdnetbridge turns the datagrams back into
+//  a TCP stream for the debugger's "com:ipport" transport.
+//
+//  The addresses below are the defaults of QEMU's user-mode network
+//  (-netdev user), where the gateway forwards 10.0.2.2 to the host's
+//  loopback, so no host configuration is needed.
+//
+//  Note:   Kernel Only
+//
+
+#include "hal.h"
+#include "halkd.h"
+
+//
+// Debugger Debugging
+//
+#define KDDBG if (0) kdprintf
+#define KDDBG2 if (0) kdprintf
+
+////////////////////////////////////////////////////////// e1000 Constants.
+//
+#define E1000_CTRL          0x0000
+#define E1000_STATUS        0x0008
+#define E1000_EERD          0x0014
+#define E1000_ICR           0x00C0
+#define E1000_IMC           0x00D8
+#define E1000_RCTL          0x0100
+#define E1000_TCTL          0x0400
+#define E1000_TIPG          0x0410
+#define E1000_RDBAL         0x2800
+#define E1000_RDBAH         0x2804
+#define E1000_RDLEN         0x2808
+#define E1000_RDH           0x2810
+#define E1000_RDT           0x2818
+#define E1000_TDBAL         0x3800
+#define E1000_TDBAH         0x3804
+#define E1000_TDLEN         0x3808
+#define E1000_TDH           0x3810
+#define E1000_TDT           0x3818
+#define E1000_MTA           0x5200
+#define E1000_RAL0          0x5400
+#define E1000_RAH0          0x5404
+
+#define CTRL_ASDE           0x00000020  // auto-speed detection
+#define CTRL_SLU            0x00000040  // set link up
+#define CTRL_RST            0x04000000
+
+#define EERD_START          0x00000001
+#define EERD_DONE           0x00000010
+
+#define RCTL_EN             0x00000002
+#define RCTL_BAM            0x00008000  // accept broadcast (ARP)
+#define RCTL_SECRC          0x04000000  // strip the ethernet CRC
+                                        // BSIZE left at 0: 2048-byte buffers
+#define TCTL_EN             0x00000002
+#define TCTL_PSP            0x00000008  // pad short packets
+#define TCTL_CT             0x00000100  // collision threshold 0x10
+#define TCTL_COLD           0x00040000  // collision distance 0x40
+#define TIPG_DEFAULT        0x0060200A
+
+#define RAH_AV              0x80000000
+
+#define RXD_DD              0x01
+#define RXD_EOP             0x02
+
+#define TXD_CMD_EOP         0x01
+#define TXD_CMD_IFCS        0x02
+#define TXD_CMD_RS          0x08
+#define TXD_DD              0x01
+
+#define KDNET_RX_COUNT      8           // descriptor rings are 128-byte multiples
+#define KDNET_TX_COUNT      8
+#define KDNET_BUFFER_SIZE   2048
+
+///////////////////////////////////////////////////////// Protocol Constants.
+//
+#define ETH_TYPE_IP         0x0800
+#define ETH_TYPE_ARP        0x0806
+#define ARP_REQUEST         1
+#define ARP_REPLY           2
+#define IP_PROTO_UDP        17
+
+#define KDNET_IP(a,b,c,d)   ((UINT32)(((a) << 24) | ((b) << 16) | ((c) << 8) | (d)))
+
+#define KDNET_LOCAL_IP      KDNET_IP(10,0,2,15)     // user-net's first guest
+#define KDNET_HOST_IP       KDNET_IP(10,0,2,2)      // user-net's host alias
+#define KDNET_PORT          50000                   // same port on both ends
+
+#define KDNET_SIGNATURE     0x544e444b              // "KDNT"
+#define KDNET_MAX_PAYLOAD   1464                    // 1500 MTU - IP - UDP - KDNET
+
+#define KDNET_ARP_RETRIES   8
+
+#pragma pack(push, 1)
+
+struct E1000_RX_DESC {
+    UINT64              Buffer;
+    UINT16              Length;
+    UINT16              Checksum;
+    UINT8               Status;
+    UINT8               Errors;
+    UINT16              Special;
+};
+STATIC_ASSERT(sizeof(E1000_RX_DESC) == 16);
+
+struct E1000_TX_DESC {
+    UINT64              Buffer;
+    UINT16              Length;
+    UINT8               Cso;
+    UINT8               Cmd;
+    UINT8               Status;
+    UINT8               Css;
+    UINT16              Special;
+};
+STATIC_ASSERT(sizeof(E1000_TX_DESC) == 16);
+
+struct KDNET_ETH_HEADER {
+    UINT8               Destination[6];
+    UINT8               Source[6];
+    UINT16              Type;
+};
+
+struct KDNET_ARP_PACKET {
+    KDNET_ETH_HEADER    Eth;
+    UINT16              HardwareType;
+    UINT16              ProtocolType;
+    UINT8               HardwareLength;
+    UINT8               ProtocolLength;
+    UINT16              Operation;
+    UINT8               SenderMac[6];
+    UINT32              SenderIp;
+    UINT8               TargetMac[6];
+    UINT32              TargetIp;
+};
+
+// Every datagram starts with this; Sequence lets each end drop duplicates
+// and count datagrams the network lost.  Lost bytes are recovered by the
+// KD_PACKET checksum/resend logic, not here.
+struct KDNET_UDP_PACKET {
+    KDNET_ETH_HEADER    Eth;
+    UINT8               VersionLength;
+    UINT8               Tos;
+    UINT16              TotalLength;
+    UINT16              Id;
+    UINT16              Fragment;
+    UINT8               Ttl;
+    UINT8               Protocol;
+    UINT16              HeaderChecksum;
+    UINT32              SourceIp;
+    UINT32              DestinationIp;
+    UINT16              SourcePort;
+    UINT16              DestinationPort;
+    UINT16              UdpLength;
+    UINT16              UdpChecksum;
+    UINT32              Signature;
+    UINT32              Sequence;
+    UCHAR               Payload[1];
+};
+
+#pragma pack(pop)
+
+#define KDNET_HEADER_SIZE   offsetof(KDNET_UDP_PACKET, Payload)
+#define KDNET_IP_OFFSET     sizeof(KDNET_ETH_HEADER)
+#define KDNET_UDP_OFFSET    offsetof(KDNET_UDP_PACKET, SourcePort)
+
+STATIC_ASSERT(KDNET_HEADER_SIZE == 14 + 20 + 8 + 8);
+STATIC_ASSERT(KDNET_HEADER_SIZE + KDNET_MAX_PAYLOAD <= 1514);
+
+// Lives in the buffer the boot loader sets aside (identity mapped, below
+// 4GB, physically contiguous).  The rings come first so they keep the
+// buffer's page alignment.
+struct KDNET_BUFFERS {
+    E1000_RX_DESC       RxRing[KDNET_RX_COUNT];
+    E1000_TX_DESC       TxRing[KDNET_TX_COUNT];
+    UCHAR               RxBuffers[KDNET_RX_COUNT][KDNET_BUFFER_SIZE];
+    UCHAR               TxBuffers[KDNET_TX_COUNT][KDNET_BUFFER_SIZE];
+};
+STATIC_ASSERT(sizeof(KDNET_BUFFERS) <= 9 * 4096);   // we allocate 36KB in boot.
+
+//////////////////////////////////////////////////////////////////////////////
+//
+#define TIMEOUT_COUNT       1024 * 1000
+
+//
+// Global Data Structures
+//
+static volatile UINT8 *     KdNetRegisters;
+static KDNET_BUFFERS *      KdNetBuffers;
+static UINT8                KdNetLocalMac[6];
+static UINT8                KdNetHostMac[6];
+static bool                 KdNetHostMacValid;
+
+static UINT32               KdNetRxNext;            // next descriptor to look at
+static PUCHAR               KdNetRxData;            // unread payload, or NULL
+static UINT32               KdNetRxLength;
+static UINT32               KdNetRxSequence;
+static UINT32               KdNetRxLost;
+
+static UINT32               KdNetTxNext;            // descriptor being filled
+static UINT32               KdNetTxLength;          // payload bytes in it so far
+static UINT32               KdNetTxSequence;
+static UINT16               KdNetTxId;
+
+//
+static ULONG_PTR MmGetPhysicalAddress(PVOID pv)
+{
+    return (ULONG_PTR)pv;
+}
+
+static UINT32 KdNetReadReg(UINT32 offset)
+{
+    return *(volatile UINT32 *)(KdNetRegisters + offset);
+}
+
+static void KdNetWriteReg(UINT32 offset, UINT32 value)
+{
+    *(volatile UINT32 *)(KdNetRegisters + offset) = value;
+}
+
+static UINT16 KdNetSwap16(UINT16 value)
+{
+    return (UINT16)((value << 8) | (value >> 8));
+}
+
+static UINT32 KdNetSwap32(UINT32 value)
+{
+    return ((value << 24) |
+            ((value << 8) & 0x00ff0000) |
+            ((value >> 8) & 0x0000ff00) |
+            (value >> 24));
+}
+
+static UINT16 KdNetChecksum(PVOID buffer, UINT32 length)
+{
+    UINT16 *words = (UINT16 *)buffer;
+    UINT32 sum = 0;
+
+    for (; length > 1; length -= 2) {
+        sum += *words++;
+    }
+    if (length) {
+        sum += *(UINT8 *)words;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (UINT16)~sum;
+}
+
+static void KdNetStall(UINT32 LoopCount)
+{
+    // Each status read is a bus cycle, which is the only clock we have here.
+    while (LoopCount-- != 0) {
+        KdNetReadReg(E1000_STATUS);
+    }
+}
+
+////////////////////////////////////////////////////////////// Transmit Side.
+//
+
+// Waits for the NIC to finish with a descriptor it was handed, so that the
+// descriptor and its buffer can be reused.
+static void KdNetTxReclaim(UINT32 index)
+{
+    volatile E1000_TX_DESC *desc = &KdNetBuffers->TxRing[index];
+
+    if (desc->Cmd != 0) {
+        for (UINT32 limit = TIMEOUT_COUNT; (desc->Status & TXD_DD) == 0 && limit != 0; limit--) {
+            KdNetReadReg(E1000_TDH);
+        }
+        desc->Cmd = 0;
+    }
+}
+
+// Returns the buffer of the descriptor being filled.  KdNetTransmit has
+// already reclaimed it.
+static PUCHAR KdNetTxBuffer()
+{
+    return KdNetBuffers->TxBuffers[KdNetTxNext];
+}
+
+static void KdNetTransmit(UINT32 length)
+{
+    volatile E1000_TX_DESC *desc = &KdNetBuffers->TxRing[KdNetTxNext];
+
+    desc->Length = (UINT16)length;
+    desc->Status = 0;
+    desc->Cmd = TXD_CMD_EOP | TXD_CMD_IFCS | TXD_CMD_RS;
+
+    // TDT == TDH means an empty ring to the NIC, so one descriptor always
+    // stays free: the one TDT moves to must be done before TDT moves.
+    KdNetTxNext = (KdNetTxNext + 1) % KDNET_TX_COUNT;
+    KdNetTxReclaim(KdNetTxNext);
+    KdNetWriteReg(E1000_TDT, KdNetTxNext);
+}
+
+static void KdNetFillEth(KDNET_ETH_HEADER *eth, const UINT8 *destination, UINT16 type)
+{
+    for (int i = 0; i < 6; i++) {
+        eth->Destination[i] = destination[i];
+        eth->Source[i] = KdNetLocalMac[i];
+    }
+    eth->Type = KdNetSwap16(type);
+}
+
+static void KdNetSendArp(UINT16 operation, const UINT8 *targetMac, UINT32 targetIp)
+{
+    static const UINT8 Broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    KDNET_ARP_PACKET *arp = (KDNET_ARP_PACKET *)KdNetTxBuffer();
+
+    KdNetFillEth(&arp->Eth, (operation == ARP_REQUEST) ? Broadcast : targetMac, ETH_TYPE_ARP);
+    arp->HardwareType = KdNetSwap16(1);
+    arp->ProtocolType = KdNetSwap16(ETH_TYPE_IP);
+    arp->HardwareLength = 6;
+    arp->ProtocolLength = 4;
+    arp->Operation = KdNetSwap16(operation);
+    for (int i = 0; i < 6; i++) {
+        arp->SenderMac[i] = KdNetLocalMac[i];
+        arp->TargetMac[i] = (operation == ARP_REQUEST) ? 0 : targetMac[i];
+    }
+    arp->SenderIp = KdNetSwap32(KDNET_LOCAL_IP);
+    arp->TargetIp = KdNetSwap32(targetIp);
+
+    KdNetTransmit(sizeof(*arp));
+}
+
+// Sends the KdNetTxLength payload bytes gathered in the current descriptor.
+static void KdNetSendDatagram()
+{
+    KDNET_UDP_PACKET *udp = (KDNET_UDP_PACKET *)KdNetTxBuffer();
+    UINT32 ipLength = KdNetTxLength + KDNET_HEADER_SIZE - KDNET_IP_OFFSET;
+
+    KdNetFillEth(&udp->Eth, KdNetHostMac, ETH_TYPE_IP);
+    udp->VersionLength = 0x45;
+    udp->Tos = 0;
+    udp->TotalLength = KdNetSwap16((UINT16)ipLength);
+    udp->Id = KdNetSwap16(KdNetTxId++);
+    udp->Fragment = 0;
+    udp->Ttl = 64;
+    udp->Protocol = IP_PROTO_UDP;
+    udp->HeaderChecksum = 0;
+    udp->SourceIp = KdNetSwap32(KDNET_LOCAL_IP);
+    udp->DestinationIp = KdNetSwap32(KDNET_HOST_IP);
+    udp->HeaderChecksum = KdNetChecksum(&udp->VersionLength, KDNET_UDP_OFFSET - KDNET_IP_OFFSET);
+    udp->SourcePort = KdNetSwap16(KDNET_PORT);
+    udp->DestinationPort = KdNetSwap16(KDNET_PORT);
+    udp->UdpLength = KdNetSwap16((UINT16)(KdNetTxLength + KDNET_HEADER_SIZE - KDNET_UDP_OFFSET));
+    udp->UdpChecksum = 0;                       // optional for IPv4
+    udp->Signature = KDNET_SIGNATURE;
+    udp->Sequence = ++KdNetTxSequence;
+
+    KDDBG2("KdNetSendDatagram %d bytes seq %d\n", KdNetTxLength, KdNetTxSequence);
+
+    KdNetTransmit(KdNetTxLength + KDNET_HEADER_SIZE);
+    KdNetTxLength = 0;
+}
+
+void KdpNetFlush()
+{
+    if (KdNetTxLength != 0) {
+        KdNetSendDatagram();
+    }
+}
+
+void KdpNetPutByte(IN UCHAR Output)
+{
+    PUCHAR buffer = KdNetTxBuffer();
+
+    buffer[KDNET_HEADER_SIZE + KdNetTxLength++] = Output;
+    if (KdNetTxLength == KDNET_MAX_PAYLOAD) {
+        KdpNetFlush();
+    }
+}
+
+/////////////////////////////////////////////////////////////// Receive Side.
+//
+
+static void KdNetReleaseRx()
+{
+    volatile E1000_RX_DESC *desc = &KdNetBuffers->RxRing[KdNetRxNext];
+
+    desc->Status = 0;
+    KdNetWriteReg(E1000_RDT, KdNetRxNext);
+    KdNetRxNext = (KdNetRxNext + 1) % KDNET_RX_COUNT;
+}
+
+static void KdNetReceiveArp(KDNET_ARP_PACKET *arp, UINT32 length)
+{
+    if (length < sizeof(*arp) ||
+        arp->ProtocolType != KdNetSwap16(ETH_TYPE_IP) ||
+        arp->TargetIp != KdNetSwap32(KDNET_LOCAL_IP)) {
+        return;
+    }
+
+    if (arp->SenderIp == KdNetSwap32(KDNET_HOST_IP)) {
+        for (int i = 0; i < 6; i++) {
+            KdNetHostMac[i] = arp->SenderMac[i];
+        }
+        KdNetHostMacValid = true;
+    }
+
+    if (arp->Operation == KdNetSwap16(ARP_REQUEST)) {
+        UINT8 mac[6];
+        for (int i = 0; i < 6; i++) {
+            mac[i] = arp->SenderMac[i];
+        }
+        KdNetSendArp(ARP_REPLY, mac, KdNetSwap32(arp->SenderIp));
+    }
+}
+
+// Returns true if the frame carried KD bytes; they are then left in the
+// receive buffer and the descriptor is released once they are consumed.
+static bool KdNetReceiveUdp(KDNET_UDP_PACKET *udp, UINT32 length)
+{
+    if (length < KDNET_HEADER_SIZE ||
+        udp->VersionLength != 0x45 ||
+        udp->Protocol != IP_PROTO_UDP ||
+        (udp->Fragment & KdNetSwap16(0x3fff)) != 0 ||
+        udp->DestinationIp != KdNetSwap32(KDNET_LOCAL_IP) ||
+        udp->DestinationPort != KdNetSwap16(KDNET_PORT) ||
+        udp->Signature != KDNET_SIGNATURE) {
+        return false;
+    }
+
+    UINT32 udpLength = KdNetSwap16(udp->UdpLength);
+    if (udpLength < KDNET_HEADER_SIZE - KDNET_UDP_OFFSET ||
+        udpLength > length - KDNET_UDP_OFFSET) {
+        return false;
+    }
+
+    if (udp->Sequence == KdNetRxSequence) {
+        KDDBG("KdNet: duplicate datagram %d\n", udp->Sequence);
+        return false;
+    }
+    if (udp->Sequence != KdNetRxSequence + 1 && udp->Sequence != 1) {
+        KdNetRxLost++;
+        KDDBG("KdNet: lost datagrams before %d\n", udp->Sequence);
+    }
+    KdNetRxSequence = udp->Sequence;
+
+    KdNetRxData = udp->Payload;
+    KdNetRxLength = udpLength - (KDNET_HEADER_SIZE - KDNET_UDP_OFFSET);
+    return (KdNetRxLength != 0);
+}
+
+// Processes at most one received frame.  Returns true if it left KD bytes
+// in KdNetRxData.
+static bool KdNetPollReceive()
+{
+    volatile E1000_RX_DESC *desc = &KdNetBuffers->RxRing[KdNetRxNext];
+
+    // The head register read also paces the caller's timeout loop.
+    if (KdNetReadReg(E1000_RDH) == KdNetRxNext || (desc->Status & RXD_DD) == 0) {
+        return false;
+    }
+
+    PUCHAR frame = KdNetBuffers->RxBuffers[KdNetRxNext];
+    UINT32 length = desc->Length;
+
+    if ((desc->Status & RXD_EOP) != 0 && desc->Errors == 0 &&
+        length >= sizeof(KDNET_ETH_HEADER)) {
+
+        UINT16 type = KdNetSwap16(((KDNET_ETH_HEADER *)frame)->Type);
+
+        if (type == ETH_TYPE_ARP) {
+            KdNetReceiveArp((KDNET_ARP_PACKET *)frame, length);
+        }
+        else if (type == ETH_TYPE_IP && KdNetReceiveUdp((KDNET_UDP_PACKET *)frame, length)) {
+            return true;
+        }
+    }
+
+    KdNetReleaseRx();
+    return false;
+}
+
+KDP_STATUS KdpNetGetByte(OUT PUCHAR Input, BOOL WaitForByte)
+{
+    UINT32 limitcount = WaitForByte ? TIMEOUT_COUNT : 1;
+
+    // A reader is waiting on a reply, so whatever it wrote must go out now.
+    KdpNetFlush();
+
+    while (KdNetRxData == NULL) {
+        if (limitcount == 0) {
+            return KDP_PACKET_TIMEOUT;
+        }
+        limitcount--;
+        KdNetPollReceive();
+    }
+
+    *Input = *KdNetRxData++;
+    if (--KdNetRxLength == 0) {
+        KdNetRxData = NULL;
+        KdNetReleaseRx();
+    }
+    return KDP_PACKET_RECEIVED;
+}
+
+/////////////////////////////////////////////////////  Initialize the adapter.
+//
+bool KdpNetInit(Class_Microsoft_Singularity_Hal_Platform *nbi)
+{
+    if (nbi->KdNicBase == 0 ||
+        nbi->KdNicBufferAddr32 == 0 ||
+        nbi->KdNicBufferSize32 < sizeof(KDNET_BUFFERS)) {
+
+        return false;
+    }
+
+    KdNetRegisters = (volatile UINT8 *)(ULONG_PTR)nbi->KdNicBase;
+    KdNetBuffers = (KDNET_BUFFERS *)(ULONG_PTR)nbi->KdNicBufferAddr32;
+    memset(KdNetBuffers, 0, sizeof(*KdNetBuffers));
+
+    // Reset, then bring the link up with interrupts masked; we only poll.
+    KdNetWriteReg(E1000_IMC, 0xffffffff);
+    KdNetWriteReg(E1000_CTRL, KdNetReadReg(E1000_CTRL) | CTRL_RST);
+    KdNetStall(1000);
+    for (UINT32 retry = 100000; (KdNetReadReg(E1000_CTRL) & CTRL_RST) != 0; retry--) {
+        if (retry == 0) {
+            kdprintf("KdNet: Reset failed\n");
+            return false;
+        }
+    }
+    KdNetWriteReg(E1000_IMC, 0xffffffff);
+    KdNetReadReg(E1000_ICR);
+    KdNetWriteReg(E1000_CTRL, KdNetReadReg(E1000_CTRL) | CTRL_SLU | CTRL_ASDE);
+
+    // The reset reloads the receive address from the EEPROM; read the
+    // EEPROM ourselves if it did not.
+    UINT32 ral = KdNetReadReg(E1000_RAL0);
+    UINT32 rah = KdNetReadReg(E1000_RAH0);
+    if ((rah & RAH_AV) == 0) {
+        UINT16 words[3];
+        for (UINT32 i = 0; i < 3; i++) {
+            KdNetWriteReg(E1000_EERD, EERD_START | (i << 8));
+            UINT32 eerd;
+            UINT32 retry = 100000;
+            while (((eerd = KdNetReadReg(E1000_EERD)) & EERD_DONE) == 0 && --retry) {
+            }
+            words[i] = (UINT16)(eerd >> 16);
+        }
+        ral = words[0] | ((UINT32)words[1] << 16);
+        rah = words[2] | RAH_AV;
+        KdNetWriteReg(E1000_RAL0, ral);
+        KdNetWriteReg(E1000_RAH0, rah);
+    }
+    for (int i = 0; i < 4; i++) {
+        KdNetLocalMac[i] = (UINT8)(ral >> (i * 8));
+    }
+    KdNetLocalMac[4] = (UINT8)rah;
+    KdNetLocalMac[5] = (UINT8)(rah >> 8);
+
+    for (UINT32 i = 0; i < 128; i++) {
+        KdNetWriteReg(E1000_MTA + i * 4, 0);
+    }
+
+    // Receive ring: hand every descriptor but one to the NIC.
+    for (UINT32 i = 0; i < KDNET_RX_COUNT; i++) {
+        KdNetBuffers->RxRing[i].Buffer = MmGetPhysicalAddress(KdNetBuffers->RxBuffers[i]);
+    }
+    UINT64 rings = MmGetPhysicalAddress(KdNetBuffers->RxRing);
+    KdNetWriteReg(E1000_RDBAL, (UINT32)rings);
+    KdNetWriteReg(E1000_RDBAH, (UINT32)(rings >> 32));
+    KdNetWriteReg(E1000_RDLEN, sizeof(KdNetBuffers->RxRing));
+    KdNetWriteReg(E1000_RDH, 0);
+    KdNetWriteReg(E1000_RDT, KDNET_RX_COUNT - 1);
+    KdNetRxNext = 0;
+    KdNetRxData = NULL;
+    KdNetWriteReg(E1000_RCTL, RCTL_EN | RCTL_BAM | RCTL_SECRC);
+
+    // Transmit ring: empty.
+    for (UINT32 i = 0; i < KDNET_TX_COUNT; i++) {
+        KdNetBuffers->TxRing[i].Buffer = MmGetPhysicalAddress(KdNetBuffers->TxBuffers[i]);
+    }
+    rings = MmGetPhysicalAddress(KdNetBuffers->TxRing);
+    KdNetWriteReg(E1000_TDBAL, (UINT32)rings);
+    KdNetWriteReg(E1000_TDBAH, (UINT32)(rings >> 32));
+    KdNetWriteReg(E1000_TDLEN, sizeof(KdNetBuffers->TxRing));
+    KdNetWriteReg(E1000_TDH, 0);
+    KdNetWriteReg(E1000_TDT, 0);
+    KdNetTxNext = 0;
+    KdNetTxLength = 0;
+    KdNetWriteReg(E1000_TIPG, TIPG_DEFAULT);
+    KdNetWriteReg(E1000_TCTL, TCTL_EN | TCTL_PSP | TCTL_CT | TCTL_COLD);
+
+    kdprintf("KdNet: %02x:%02x:%02x:%02x:%02x:%02x\n",
+             KdNetLocalMac[0], KdNetLocalMac[1], KdNetLocalMac[2],
+             KdNetLocalMac[3], KdNetLocalMac[4], KdNetLocalMac[5]);
+
+    // Resolve the host.  This also puts our own address in the gateway's
+    // ARP cache, which user-mode networking needs before it will forward
+    // anything back to us.
+    for (UINT32 retry = 0; retry < KDNET_ARP_RETRIES && !KdNetHostMacValid; retry++) {
+        KdNetSendArp(ARP_REQUEST, NULL, KDNET_HOST_IP);
+        for (UINT32 limit = TIMEOUT_COUNT / KDNET_ARP_RETRIES; limit != 0 && !KdNetHostMacValid; limit--) {
+            if (KdNetPollReceive()) {
+                // KD bytes before we are up: nothing can be expecting them.
+                KdNetRxData = NULL;
+                KdNetReleaseRx();
+            }
+        }
+    }
+    if (!KdNetHostMacValid) {
+        kdprintf("KdNet: No reply from the host\n");
+        return false;
+    }
+
+    // An empty datagram tells the bridge where we are.
+    KdNetSendDatagram();
+
+    return true;
+}
+//
+///////////////////////////////////////////////////////////////// End of File.
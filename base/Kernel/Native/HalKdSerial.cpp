@@ -34,8 +34,16 @@ static BOOL  KdStateChange64Sent = false;
 /////////////////////////////////////////////////////////////////////////////
 
 
-KDP_STATUS KdpSerialGetByte(OUT PUCHAR Input, BOOL WaitForByte);
-void KdpSerialPutByte(IN UCHAR Output);
+// Any transport that can carry the serial byte stream plugs in here;
+// KdInitialize points these at the network transport when it is in use.
+// Flush marks the end of each packet for transports that send in blocks.
+static void KdpSerialFlush()
+{
+}
+
+KDP_STATUS (*KdpChannelGetByte)(OUT PUCHAR Input, BOOL WaitForByte) = KdpSerialGetByte;
+void (*KdpChannelPutByte)(IN UCHAR Output) = KdpSerialPutByte;
+void (*KdpChannelFlush)() = KdpSerialFlush;
 
 //++
 //
@@ -65,7 +73,7 @@ static KDP_STATUS KdpSerialReceiveString(OUT PUCHAR Destination, IN UINT32 Lengt
     while (Length > 0) {
         KdpSpin();
 
-        ReturnCode = KdpSerialGetByte(&Input, WaitForInput);
+        ReturnCode = KdpChannelGetByte(&Input, WaitForInput);
         if (ReturnCode != KDP_PACKET_RECEIVED) {
             break;
         }
@@ -113,7 +121,7 @@ static void KdpSerialSendString(IN PUCHAR Source, IN UINT32 Length)
 
     while (Length > 0) {
         Output = *Source++;
-        KdpSerialPutByte(Output);
+        KdpChannelPutByte(Output);
         Length -= 1;
     }
 
@@ -271,6 +279,7 @@ KdpSendControlPacket(
     PacketHeader.Checksum = 0;
     PacketHeader.PacketType = PacketType;
     KdpSerialSendString((PUCHAR)&PacketHeader, sizeof(KD_PACKET));
+    KdpChannelFlush();
 
     return;
 }
@@ -417,6 +426,7 @@ KdpSerialSendPacket(
         {
             UCHAR b = PACKET_TRAILING_BYTE;
             KdpSerialSendString(&b, 1);
+            KdpChannelFlush();
         }
 
         //
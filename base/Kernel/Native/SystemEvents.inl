@@ -256,7 +256,7 @@ DECLARE_STRUCTURE_BEGIN(MEMORY_STORAGE, "")
     DECLARE_SPECIAL_FIELD(MEMORY_STORAGE, PMEMORY_ZONE, MemoryZoneLink)
     DECLARE_SPECIAL_FIELD(MEMORY_STORAGE, PMEMORY_ZONE, BkLink)
     DECLARE_SPECIAL_FIELD(MEMORY_STORAGE, PMEMORY_ZONE, ZoneCursor)
-    DECLARE_SPECIAL_FIELD(MEMORY_ZONE, TYPE_uint32, Generation)
+    DECLARE_SPECIAL_FIELD(MEMORY_STORAGE, TYPE_uint32, Generation)
 DECLARE_STRUCTURE_END(MEMORY_STORAGE)
 
 DECLARE_STRUCTURE_BEGIN(SOURCE_DESCRIPTOR, "")
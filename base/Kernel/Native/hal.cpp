@@ -149,6 +149,12 @@ void InitPlatform(Class_Microsoft_Singularity_Hal_Platform *bi,
     if (KdpSerialInit(nbi)) {
         nbi->DebuggerType = Class_Microsoft_Singularity_Hal_Platform_DEBUGGER_SERIAL;
     }
+#if ISA_IX86 || ISA_IX64
+    else if (nbi->DebuggerType == Class_Microsoft_Singularity_Hal_Platform_DEBUGGER_NET &&
+             KdpNetInit(nbi)) {
+        // Keep DEBUGGER_NET from the boot loader.
+    }
+#endif
     else {
         nbi->DebuggerType = Class_Microsoft_Singularity_Hal_Platform_DEBUGGER_NONE;
     }
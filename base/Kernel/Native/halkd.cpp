@@ -44,6 +44,16 @@ BOOL KdAlwaysPrintOutput = FALSE;
 
 #define KDP_MESSAGE_BUFFER_SIZE 4096
 static CHAR KdpMessageBuffer[KDP_MESSAGE_BUFFER_SIZE];
+
+#define KDP_PAGE_SIZE 4096
+
+// Outgoing data and skipped-span table for DbgKdReadMemoryRangesApi, and
+// the page read ahead of packing for DbgKdReadPackedMemoryRangesApi.
+#define KDP_MAX_RANGE_DATA (PACKET_MAX_SIZE - sizeof(DBGKD_MANIPULATE_STATE64))
+#define KDP_MAX_SKIPPED_RANGES (KDP_MAX_RANGE_DATA / sizeof(DBGKD_MEMORY_RANGE))
+static CHAR KdpRangeBuffer[KDP_MAX_RANGE_DATA];
+static CHAR KdpPackBuffer[KDP_PAGE_SIZE];
+static DBGKD_MEMORY_RANGE KdpSkippedRanges[KDP_MAX_SKIPPED_RANGES];
 static BOOL KdpContextSent;
 
 static KPROCESSOR_STATE KdpProcessorState[MAX_CPU];
@@ -332,6 +342,23 @@ void KdInitialize(Class_Microsoft_Singularity_Hal_Platform *platform)
 
         KdDebuggerNotPresent = FALSE;
         break;
+
+#if ISA_IX86 || ISA_IX64
+    case Class_Microsoft_Singularity_Hal_Platform_DEBUGGER_NET:
+        kdprintf("Network Debugger:\n");
+
+        // Same packet layer as serial, with UDP datagrams underneath.
+        KdpChannelGetByte = KdpNetGetByte;
+        KdpChannelPutByte = KdpNetPutByte;
+        KdpChannelFlush = KdpNetFlush;
+
+        KdSendPacket = KdpSerialSendPacket;
+        KdReceivePacket = KdpSerialReceivePacket;
+        KdPollBreakIn = KdpSerialPollBreakIn;
+
+        KdDebuggerNotPresent = FALSE;
+        break;
+#endif
     }
 
     // Retries are set to this after boot
@@ -609,6 +636,26 @@ ProbeMemoryRange(UINT64 address, UINT32 length)
     return false;
 }
 
+// True if the range lies in RAM the SMAP reports as usable, where any
+// access width is safe (unlike device memory).
+static BOOL
+KdpIsRamRange(UINT64 address, UINT32 length)
+{
+    Struct_Microsoft_Singularity_SMAPINFO *sm =
+        (Struct_Microsoft_Singularity_SMAPINFO *)Class_Microsoft_Singularity_Hal_Platform::c_thePlatform->Smap32;
+    int smapCount = Class_Microsoft_Singularity_Hal_Platform::c_thePlatform->SmapCount;
+
+    for (int32 i = 0; i < smapCount; i++) {
+        if ((sm[i].type == Struct_Microsoft_Singularity_SMAPINFO_AddressTypeFree) &&
+            (sm[i].addr <= address) &&
+            (sm[i].addr + sm[i].size) >= (address + length)) {
+
+            return true;
+        }
+    }
+    return false;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 UINT32 KdpComputeChecksum(IN PCHAR Buffer, IN UINT32 Length)
@@ -657,12 +704,21 @@ KdpCopyMemoryChunks(
     //      TotalSize - Number of bytes to read/write.
     //      ChunkSize - Maximum single item transfer size, must
     //                  be 1, 2, 4 or 8.
-    //                  0 means choose a default.
+    //                  0 means choose a default, and lets RAM be
+    //                  copied a page at a time.
     //      Flags - MMDBG_COPY flags for MmDbgCopyMemory.
     //      ActualSize - Number of bytes actually read/written.
 {
     UINT32 Length;
     UINT32 CopyChunk;
+#if PAGING
+    // The SMAP describes physical memory, so only a physical copy can be
+    // checked against it; a virtual address may map to anything.
+    BOOL WideRam = (ChunkSize == 0) && (Flags & MMDBG_COPY_PHYSICAL) != 0;
+#else
+    // Without paging every address is identity-mapped.
+    BOOL WideRam = (ChunkSize == 0);
+#endif
 
     if (ChunkSize > MMDBG_COPY_MAX_SIZE) {
         ChunkSize = MMDBG_COPY_MAX_SIZE;
@@ -681,7 +737,8 @@ KdpCopyMemoryChunks(
     // Mm from having to worry about more than a page at a time.
     // Additionally, it is important that we access memory with the
     // largest size possible because we could be accessing
-    // memory-mapped I/O space.
+    // memory-mapped I/O space.  Usable RAM has no such constraint,
+    // so it goes to memcpy up to a page at a time.
     //
 
     Length = TotalSize;
@@ -689,19 +746,34 @@ KdpCopyMemoryChunks(
 
     while (Length > 0) {
 
-        // Expand the chunk size as long as:
-        //   We haven't hit the chunk limit.
-        //   We have enough data left.
-        //   The address is properly aligned.
-        while (CopyChunk < ChunkSize &&
-               (CopyChunk << 1) <= Length &&
-               (Address & ((CopyChunk << 1) - 1)) == 0) {
-            CopyChunk <<= 1;
+        UINT32 PageLeft = KDP_PAGE_SIZE - (UINT32)(Address & (KDP_PAGE_SIZE - 1));
+        if (PageLeft > Length) {
+            PageLeft = Length;
         }
 
-        // Shrink the chunk size to fit the available data.
-        while (CopyChunk > Length) {
-            CopyChunk >>= 1;
+        if (WideRam && KdpIsRamRange(Address, PageLeft)) {
+            CopyChunk = PageLeft;
+        }
+        else {
+            // Start over in case the last copy was page-sized.
+            if (CopyChunk > ChunkSize || (CopyChunk & (CopyChunk - 1)) != 0) {
+                CopyChunk = 1;
+            }
+
+            // Expand the chunk size as long as:
+            //   We haven't hit the chunk limit.
+            //   We have enough data left.
+            //   The address is properly aligned.
+            while (CopyChunk < ChunkSize &&
+                   (CopyChunk << 1) <= Length &&
+                   (Address & ((CopyChunk << 1) - 1)) == 0) {
+                CopyChunk <<= 1;
+            }
+
+            // Shrink the chunk size to fit the available data.
+            while (CopyChunk > Length) {
+                CopyChunk >>= 1;
+            }
         }
 
         if (Address < Class_Microsoft_Singularity_Hal_Platform::c_thePlatform->PhysicalBase) {
@@ -1188,6 +1260,257 @@ KdpWritePhysicalMemory(
     return;
 }
 
+static
+void
+KdpSendMemoryRanges(
+    IN PDBGKD_MANIPULATE_STATE64 m,
+    IN UINT32 RangeIndex,
+    IN UINT32 RangeOffset,
+    IN PCHAR Data,
+    IN UINT32 Length
+    )
+    //  Routine Description:
+    //      Sends one packet of a DbgKdReadMemoryRangesApi reply.
+{
+    STRING MessageHeader;
+    STRING MessageData;
+
+    m->ReadMemoryRanges.RangeIndex = RangeIndex;
+    m->ReadMemoryRanges.RangeOffset = RangeOffset;
+
+    MessageHeader.Length = sizeof(DBGKD_MANIPULATE_STATE64);
+    MessageHeader.Buffer = (PCHAR)m;
+    MessageData.Length = (UINT16)Length;
+    MessageData.Buffer = Data;
+    KdSendPacket(PACKET_TYPE_KD_STATE_MANIPULATE,
+                 &MessageHeader,
+                 &MessageData,
+                 &KdpContext);
+}
+
+#define KDP_PACK_MIN_RUN        3
+#define KDP_PACK_MAX_RUN        (0xff - 0x80 + KDP_PACK_MIN_RUN)
+#define KDP_PACK_MAX_LITERAL    0x80
+
+static
+UINT32
+KdpPackBytes(
+    IN PCHAR Source,
+    IN UINT32 Length,
+    OUT PCHAR Dest,
+    IN UINT32 Room,
+    OUT PUINT32 Used
+    )
+    //  Routine Description:
+    //      Run-length packs as much of Source as fits in Room bytes of Dest,
+    //      in the format described with DbgKdReadPackedMemoryRangesApi.
+    //
+    //  Arguments:
+    //      Source - Supplies the bytes to pack.
+    //      Length - Supplies the number of bytes to pack.
+    //      Dest - Receives the packed bytes.
+    //      Room - Supplies the size of Dest.
+    //      Used - Receives the number of bytes of Source that were packed.
+    //
+    //  Return Value:
+    //      Number of bytes written to Dest.
+{
+    UINT32 In = 0;
+    UINT32 Out = 0;
+
+    while (In < Length) {
+        UINT32 Count = 1;
+
+        while (In + Count < Length && Count < KDP_PACK_MAX_RUN &&
+               Source[In + Count] == Source[In]) {
+            Count++;
+        }
+
+        if (Count >= KDP_PACK_MIN_RUN) {
+            if (Out + 2 > Room) {
+                break;
+            }
+            Dest[Out++] = (CHAR)(0x80 + Count - KDP_PACK_MIN_RUN);
+            Dest[Out++] = Source[In];
+            In += Count;
+            continue;
+        }
+
+        // Literals run up to the next stretch worth packing.
+        Count = 0;
+        while (In + Count < Length && Count < KDP_PACK_MAX_LITERAL) {
+            if (In + Count + 2 < Length &&
+                Source[In + Count] == Source[In + Count + 1] &&
+                Source[In + Count] == Source[In + Count + 2]) {
+                break;
+            }
+            Count++;
+        }
+
+        if (Out + 2 > Room) {
+            break;
+        }
+        if (Count > Room - Out - 1) {
+            Count = Room - Out - 1;
+        }
+        Dest[Out++] = (CHAR)(Count - 1);
+        KdpQuickMoveMemory(Dest + Out, Source + In, Count);
+        Out += Count;
+        In += Count;
+    }
+
+    *Used = In;
+    return Out;
+}
+
+static
+void
+KdpReadMemoryRanges(
+    IN PDBGKD_MANIPULATE_STATE64 m,
+    IN PSTRING AdditionalData,
+    IN BOOL Packed
+    )
+    //  Routine Description:
+    //      This function is called in response to a read memory ranges
+    //      state manipulation message.  It reads every range in the request
+    //      and streams the readable bytes back in full packets, so a large
+    //      read costs one request instead of one per packet.  Pages that
+    //      fail to read are skipped and reported in the final packet, whose
+    //      RangeIndex/RangeOffset say how far the read got.
+    //
+    //  Arguments:
+    //      m - Supplies a pointer to the state manipulation message.
+    //      AdditionalData - Supplies a pointer to a descriptor for the ranges.
+    //      Packed - Supplies whether to run-length pack the data packets.
+{
+    PDBGKD_MEMORY_RANGE Ranges = (PDBGKD_MEMORY_RANGE)AdditionalData->Buffer;
+    UINT32 Count = m->ReadMemoryRanges.RangeCount;
+    UINT32 Flags = MMDBG_COPY_UNSAFE | (m->ReadMemoryRanges.Flags & MMDBG_COPY_PHYSICAL);
+    UINT32 Skipped = 0;
+    UINT32 Filled = 0;
+    UINT32 FirstIndex = 0;
+    UINT32 FirstOffset = 0;
+    UINT32 Index;
+    UINT32 Left = 0;
+
+    if (Count > AdditionalData->Length / sizeof(DBGKD_MEMORY_RANGE)) {
+        Count = AdditionalData->Length / sizeof(DBGKD_MEMORY_RANGE);
+    }
+
+    m->ReturnStatus = STATUS_SUCCESS;
+    m->ReadMemoryRanges.Final = 0;
+
+    for (Index = 0; Index < Count; Index++) {
+        UINT64 Address = Ranges[Index].BaseAddress;
+        Left = Ranges[Index].Length;
+
+        while (Left > 0) {
+            UINT32 Want = Packed ? sizeof(KdpPackBuffer) : KDP_MAX_RANGE_DATA - Filled;
+            UINT32 Done;
+
+            if (Want > Left) {
+                Want = Left;
+            }
+
+            if (Packed) {
+                UINT32 Taken = 0;
+
+                KdpCopyMemoryChunks(Address, KdpPackBuffer, Want, 0, Flags, &Done);
+
+                // Pack what was read into the packet, sending it each time
+                // it fills.
+                while (Taken < Done) {
+                    UINT32 Used;
+
+                    if (Filled == 0) {
+                        FirstIndex = Index;
+                        FirstOffset = Ranges[Index].Length - Left + Taken;
+                    }
+
+                    Filled += KdpPackBytes(KdpPackBuffer + Taken,
+                                           Done - Taken,
+                                           KdpRangeBuffer + Filled,
+                                           KDP_MAX_RANGE_DATA - Filled,
+                                           &Used);
+                    Taken += Used;
+
+                    if (Taken < Done) {
+                        KdpSendMemoryRanges(m, FirstIndex, FirstOffset, KdpRangeBuffer, Filled);
+                        Filled = 0;
+                    }
+                }
+
+                Address += Done;
+                Left -= Done;
+            }
+            else {
+                if (Filled == 0) {
+                    FirstIndex = Index;
+                    FirstOffset = Ranges[Index].Length - Left;
+                }
+
+                KdpCopyMemoryChunks(Address, KdpRangeBuffer + Filled, Want, 0, Flags, &Done);
+
+                Filled += Done;
+                Address += Done;
+                Left -= Done;
+
+                if (Filled == KDP_MAX_RANGE_DATA) {
+                    KdpSendMemoryRanges(m, FirstIndex, FirstOffset, KdpRangeBuffer, Filled);
+                    Filled = 0;
+                }
+            }
+
+            if (Done < Want) {
+                //
+                // Give up on the rest of the page that failed, and merge it
+                // with the previous skipped span when they touch.
+                //
+
+                UINT32 Skip = KDP_PAGE_SIZE - (UINT32)(Address & (KDP_PAGE_SIZE - 1));
+                if (Skip > Left) {
+                    Skip = Left;
+                }
+
+                if (Skipped > 0 &&
+                    KdpSkippedRanges[Skipped - 1].Flags == Index &&
+                    KdpSkippedRanges[Skipped - 1].BaseAddress +
+                    KdpSkippedRanges[Skipped - 1].Length == Address) {
+
+                    KdpSkippedRanges[Skipped - 1].Length += Skip;
+                }
+                else if (Skipped < KDP_MAX_SKIPPED_RANGES) {
+                    KdpSkippedRanges[Skipped].BaseAddress = Address;
+                    KdpSkippedRanges[Skipped].Length = Skip;
+                    KdpSkippedRanges[Skipped].Flags = Index;
+                    Skipped++;
+                }
+                else {
+                    // No room to report it; stop, and let the host ask again
+                    // from RangeIndex/RangeOffset.
+                    m->ReturnStatus = STATUS_BUFFER_OVERFLOW;
+                    goto Exit;
+                }
+
+                Address += Skip;
+                Left -= Skip;
+            }
+        }
+    }
+
+  Exit:
+    if (Filled > 0) {
+        KdpSendMemoryRanges(m, FirstIndex, FirstOffset, KdpRangeBuffer, Filled);
+    }
+
+    m->ReadMemoryRanges.Final = 1;
+    KdpSendMemoryRanges(m,
+                        Index,
+                        (Index < Count) ? Ranges[Index].Length - Left : 0,
+                        (PCHAR)KdpSkippedRanges,
+                        Skipped * sizeof(DBGKD_MEMORY_RANGE));
+}
+
 static
 void
 KdpReadMachineSpecificRegister(
@@ -2140,6 +2463,20 @@ KdpSendWaitContinue(
                   ManipulateState.ReadMemory.TransferCount);
             break;
 
+          case DbgKdReadMemoryRangesApi:
+            KDDBG("KdReadRanges(%d%s)\n",
+                  ManipulateState.ReadMemoryRanges.RangeCount,
+                  (ManipulateState.ReadMemoryRanges.Flags & MMDBG_COPY_PHYSICAL) ? " phys" : "");
+            KdpReadMemoryRanges(&ManipulateState, &MessageData, FALSE);
+            break;
+
+          case DbgKdReadPackedMemoryRangesApi:
+            KDDBG("KdReadPackedRanges(%d%s)\n",
+                  ManipulateState.ReadMemoryRanges.RangeCount,
+                  (ManipulateState.ReadMemoryRanges.Flags & MMDBG_COPY_PHYSICAL) ? " phys" : "");
+            KdpReadMemoryRanges(&ManipulateState, &MessageData, TRUE);
+            break;
+
           case DbgKdSwitchProcessor:
               {
                   // KdRestore(FALSE);
@@ -313,6 +313,37 @@ typedef struct _DBGKD_READ_WRITE_IO64 {
     UINT32 DataValue;
 } DBGKD_READ_WRITE_IO64, *PDBGKD_READ_WRITE_IO64;
 
+//
+// DbgKdReadMemoryRangesApi: the request data is RangeCount DBGKD_MEMORY_RANGEs.
+// The reply is a stream of full packets holding the readable bytes of all
+// ranges back to back; RangeIndex/RangeOffset locate each packet's first
+// byte.  The last packet has Final set and the skipped (unmapped) spans as
+// its data, with Flags holding the index of the range each span belongs
+// to.  Its RangeIndex/RangeOffset are where the read stopped: RangeCount
+// and 0, unless ReturnStatus is STATUS_BUFFER_OVERFLOW.
+//
+// DbgKdReadPackedMemoryRangesApi is the same, except that the data of every
+// packet but the last is run-length packed, and RangeIndex/RangeOffset
+// locate its first unpacked byte.  A control byte below 0x80 is followed by
+// that many plus one literal bytes; a control byte of 0x80 or more is
+// followed by one byte that repeats (control - 0x80 + 3) times.  Only a host
+// that asks for it gets packed data, so it is worth its cost on slow links.
+//
+
+typedef struct _DBGKD_MEMORY_RANGE {
+    UINT64  BaseAddress;
+    UINT32  Length;
+    UINT32  Flags;
+} DBGKD_MEMORY_RANGE, *PDBGKD_MEMORY_RANGE;
+
+typedef struct _DBGKD_READ_MEMORY_RANGES {
+    UINT32  RangeCount;
+    UINT32  Flags;                       // MMDBG_COPY_PHYSICAL
+    UINT32  RangeIndex;
+    UINT32  RangeOffset;
+    UINT32  Final;
+} DBGKD_READ_MEMORY_RANGES, *PDBGKD_READ_MEMORY_RANGES;
+
 //
 // Response is a get context message with a full context record following
 //
@@ -462,6 +493,7 @@ typedef struct _DBGKD_MANIPULATE_STATE64 {
         DBGKD_CONTINUE2 Continue2;
         DBGKD_READ_WRITE_MSR ReadWriteMsr;
         DBGKD_READ_WRITE_IO64 ReadWriteIo;
+        DBGKD_READ_MEMORY_RANGES ReadMemoryRanges;
 #if 0
         DBGKD_READ_WRITE_IO_EXTENDED64 ReadWriteIoExtended;
         DBGKD_QUERY_SPECIAL_CALLS QuerySpecialCalls;
@@ -667,6 +699,11 @@ typedef struct _KD_PACKET {
 
 #define DbgKdMaximumManipulate              0x0000315EL
 
+// Singularity extensions, kept above DbgKdMaximumManipulate so they are
+// never advertised to debuggers that do not know them.
+#define DbgKdReadMemoryRangesApi            0x000031F0L
+#define DbgKdReadPackedMemoryRangesApi      0x000031F1L
+
 typedef struct _KD_CONTEXT {
     UINT32 KdpDefaultRetries;
     BOOLEAN KdpControlCPending;
@@ -753,6 +790,9 @@ typedef enum {
 //  The operation that was requested is pending completion.
 #define STATUS_PENDING                  ((NTSTATUS)0x00000103L)     // winnt
 
+//  The data was too large to fit into the specified buffer.
+#define STATUS_BUFFER_OVERFLOW          ((NTSTATUS)0x80000005L)     // winnt
+
 //  The requested operation was unsuccessful.
 #define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
 
@@ -857,6 +897,10 @@ bool KdpSerialInit(Class_Microsoft_Singularity_Hal_Platform *nbi);
 KDP_STATUS KdpSerialGetByte(OUT PUCHAR Input, BOOL WaitForByte);
 void KdpSerialPutByte(IN UCHAR Output);
 
+extern KDP_STATUS (*KdpChannelGetByte)(OUT PUCHAR Input, BOOL WaitForByte);
+extern void (*KdpChannelPutByte)(IN UCHAR Output);
+extern void (*KdpChannelFlush)();
+
 void KdpSerialSendPacket(UINT32 PacketType,
                          IN PSTRING MessageHeader,
                          IN PSTRING MessageData OPTIONAL,
@@ -881,6 +925,11 @@ KDP_STATUS Kdp1394ReceivePacket(IN UINT32 PacketType,
                                 IN OUT PKD_CONTEXT KdContext);
 bool Kdp1394PollBreakIn();
 
+bool KdpNetInit(Class_Microsoft_Singularity_Hal_Platform *nbi);
+KDP_STATUS KdpNetGetByte(OUT PUCHAR Input, BOOL WaitForByte);
+void KdpNetPutByte(IN UCHAR Output);
+void KdpNetFlush();
+
 ///////////////////////////////////////////////// Processor Specific Routines.
 //
 bool KdpDisableInterruptsInline();
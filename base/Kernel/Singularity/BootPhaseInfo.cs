@@ -0,0 +1,46 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  Microsoft Research Singularity
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  File:   BootPhaseInfo.cs
+//
+//  Note:
+//       Mirrors BL_PROF_PHASE in the boot loader.  Ticks are raw time stamp
+//       counter values; Platform.BootTscFrequency converts them to time.
+
+using System;
+using System.Runtime.InteropServices;
+using System.Runtime.CompilerServices;
+
+namespace Microsoft.Singularity
+{
+    [StructLayout(LayoutKind.Sequential)]
+    [CLSCompliant(false)]
+    [AccessedByRuntime("referenced from c++")]
+    public struct BOOTPHASEINFO
+    {
+        [AccessedByRuntime("referenced from c++")]
+        public const uint NoParent = 0xffffffff;
+
+        [AccessedByRuntime("referenced from c++")]
+        public ulong      startTicks;
+        [AccessedByRuntime("referenced from c++")]
+        public ulong      endTicks;
+        [AccessedByRuntime("referenced from c++")]
+        public ulong      ioBytes;
+        [AccessedByRuntime("referenced from c++")]
+        public uint       biosCalls;
+        [AccessedByRuntime("referenced from c++")]
+        public uint       parent;
+
+        // NUL-padded ASCII phase name, 24 bytes.
+        [AccessedByRuntime("referenced from c++")]
+        public ulong      name0;
+        [AccessedByRuntime("referenced from c++")]
+        public ulong      name1;
+        [AccessedByRuntime("referenced from c++")]
+        public ulong      name2;
+    }
+}
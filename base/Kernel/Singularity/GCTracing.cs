@@ -210,7 +210,7 @@ namespace Microsoft.Singularity
         private uint        nextTypeNo;               // hand out IDs monotonically
 
         private Hashtable   stackTable;               // hash of stacks->ids
-        private uint        nextStackNo;
+        private uint        nextStackNo;              // 0 is logged for allocations without a stack
         private const int   stackSize = 16;           // increase for bigger / slower stack traces
         private UIntPtr[]   stackEips;
         private uint[]      stackNos;
@@ -303,6 +303,7 @@ namespace Microsoft.Singularity
             options = Flags;
             typeTable = new Hashtable();
             stackTable = new Hashtable();
+            nextStackNo = 1;
             funcTable = new Hashtable();
             stackEips = new UIntPtr[stackSize];
             stackNos = new uint[stackSize];
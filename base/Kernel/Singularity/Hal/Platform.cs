@@ -139,6 +139,58 @@ namespace Microsoft.Singularity.Hal
         [AccessedByRuntime("referenced in c++")]
         public readonly int         SmapCount;
 
+        // NUMA topology from the ACPI SRAT and SLIT.  The distance matrix holds
+        // NumaDomainCount * NumaDomainCount bytes, indexed [from * count + to].
+        [AccessedByRuntime("referenced in c++")]
+        public readonly UIntPtr     NumaProcessors32;
+
+        public unsafe Microsoft.Singularity.NUMAPROCESSORINFO *NumaProcessors {
+            [NoHeapAllocation]
+                get {
+                return (Microsoft.Singularity.NUMAPROCESSORINFO *) NumaProcessors32;
+            }
+        }
+
+        [AccessedByRuntime("referenced in c++")]
+        public readonly int         NumaProcessorCount;
+
+        [AccessedByRuntime("referenced in c++")]
+        public readonly UIntPtr     NumaMemory32;
+
+        public unsafe Microsoft.Singularity.NUMAMEMORYINFO *NumaMemory {
+            [NoHeapAllocation]
+                get {
+                return (Microsoft.Singularity.NUMAMEMORYINFO *) NumaMemory32;
+            }
+        }
+
+        [AccessedByRuntime("referenced in c++")]
+        public readonly int         NumaMemoryCount;
+
+        [AccessedByRuntime("referenced in c++")]
+        public readonly UIntPtr     NumaDistance32;
+
+        [AccessedByRuntime("referenced in c++")]
+        public readonly int         NumaDomainCount;
+
+        // Boot phase profile recorded by the loader; see BootPhaseInfo.cs.
+        [AccessedByRuntime("referenced in c++")]
+        public readonly UIntPtr     BootPhases32;
+
+        public unsafe Microsoft.Singularity.BOOTPHASEINFO *BootPhases {
+            [NoHeapAllocation]
+                get {
+                return (Microsoft.Singularity.BOOTPHASEINFO *) BootPhases32;
+            }
+        }
+
+        [AccessedByRuntime("referenced in c++")]
+        public readonly int         BootPhaseCount;
+
+        // Time stamp counter frequency used for the boot phase ticks.
+        [AccessedByRuntime("referenced in c++")]
+        public readonly ulong       BootTscFrequency;
+
         // Lowest address which should be accessed as physical memory
         [AccessedByRuntime("referenced in c++")]
         public readonly UIntPtr     PhysicalBase;
@@ -282,6 +334,8 @@ namespace Microsoft.Singularity.Hal
         public const int            DEBUGGER_SERIAL     = 1;
         [AccessedByRuntime("referenced in c++")]
         public const int            DEBUGGER_1394       = 2;
+        [AccessedByRuntime("referenced in c++")]
+        public const int            DEBUGGER_NET        = 3;
 
         // EntryPoint return values
         [AccessedByRuntime("referenced in c++")]
@@ -451,6 +505,11 @@ namespace Microsoft.Singularity.Hal
         public ulong    Ohci1394BufferAddr32;
         public uint     Ohci1394BufferSize32;
 
+        // Network Debugger Information (e1000 registers and DMA buffer)
+        public ulong    KdNicBase;
+        public ulong    KdNicBufferAddr32;
+        public uint     KdNicBufferSize32;
+
         // VESA Information
         public ulong    VesaBuffer;
 
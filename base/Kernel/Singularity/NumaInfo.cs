@@ -0,0 +1,52 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//  Microsoft Research Singularity
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  File:   NumaInfo.cs
+//
+//  Note:
+//       Section 5.2.16 System Resource Affinity Table and
+//       Section 5.2.17 System Locality Distance Information Table,
+//       ACPI revision 3.0, September 2, 2004
+
+using System;
+using System.Runtime.InteropServices;
+using System.Runtime.CompilerServices;
+
+namespace Microsoft.Singularity
+{
+    [StructLayout(LayoutKind.Sequential)]
+    [CLSCompliant(false)]
+    [AccessedByRuntime("referenced from c++")]
+    public struct NUMAPROCESSORINFO
+    {
+        [AccessedByRuntime("referenced from c++")]
+        public uint       apicId;
+        [AccessedByRuntime("referenced from c++")]
+        public uint       domain;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    [CLSCompliant(false)]
+    [AccessedByRuntime("referenced from c++")]
+    public struct NUMAMEMORYINFO
+    {
+        [AccessedByRuntime("referenced from c++")]
+        public const uint FlagsEnabled      = 1;
+        [AccessedByRuntime("referenced from c++")]
+        public const uint FlagsHotPluggable = 2;
+        [AccessedByRuntime("referenced from c++")]
+        public const uint FlagsNonVolatile  = 4;
+
+        [AccessedByRuntime("referenced from c++")]
+        public ulong      addr;
+        [AccessedByRuntime("referenced from c++")]
+        public ulong      size;
+        [AccessedByRuntime("referenced from c++")]
+        public uint       domain;
+        [AccessedByRuntime("referenced from c++")]
+        public uint       flags;
+    }
+}
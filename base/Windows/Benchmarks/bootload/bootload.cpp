@@ -0,0 +1,827 @@
+////////////////////////////////////////////////////////////////////////////
+//
+// Load generator for bootd: emulates many PXE clients at once, each doing a
+// DHCP DISCOVER/REQUEST and then reading one or more files over TFTP, and
+// reports how long the clients took and the aggregate throughput.
+//
+// Copyright Microsoft Corporation
+//
+// Builds with nmake on Windows, or stand-alone elsewhere:
+//
+//      g++ -O2 -o bootload bootload.cpp
+//
+// Everything runs on one thread over non-blocking sockets, so hundreds of
+// clients can run against a server on the loopback interface.
+//
+#ifdef _WIN32
+#include <winlean.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef int socklen_t;
+#define poll        WSAPoll
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <strings.h>
+typedef int             BOOL;
+typedef int             INT;
+typedef unsigned int    UINT;
+typedef unsigned char   BYTE;
+typedef unsigned char * PBYTE;
+typedef unsigned short  UINT16;
+typedef unsigned int    UINT32;
+typedef unsigned long long UINT64;
+typedef char            CHAR;
+typedef char *          PCHAR;
+typedef const char *    PCSTR;
+typedef void            VOID;
+typedef int             SOCKET;
+#define TRUE            1
+#define FALSE           0
+#define INVALID_SOCKET  (-1)
+#define closesocket     close
+#define _stricmp        strcasecmp
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#define ARRAYOF(x)          (sizeof(x)/sizeof(x[0]))
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Protocol constants, as in bootd's dhcpd.cpp and tftpd.cpp.
+//
+#define DHCP_MAGIC_COOKIE   0x63825363
+#define DHCPDISCOVER        1
+#define DHCPOFFER           2
+#define DHCPREQUEST         3
+#define DHCPACK             5
+#define DHCPNAK             6
+
+#define TFTP_RRQ            1
+#define TFTP_DATA           3
+#define TFTP_ACK            4
+#define TFTP_ERROR          5
+#define TFTP_OACK           6
+
+#define MAX_FILES           16
+#define MAX_PACKET          65536
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Settings.
+//
+static UINT32   s_nServer       = 0x7f000001;   // 127.0.0.1
+static UINT16   s_nDhcpPort     = 67;
+static UINT16   s_nClientPort   = 68;
+static UINT16   s_nTftpPort     = 69;
+static UINT     s_nClients      = 100;
+static UINT     s_nBlockSize    = 0;            // 0: don't ask, 512.
+static UINT     s_nWindowSize   = 0;            // 0: don't ask, 1.
+static UINT     s_nLossPercent  = 0;
+static UINT     s_nTimeout      = 1000;         // Milliseconds.
+static UINT     s_nRetries      = 6;
+static BOOL     s_fDhcp         = TRUE;
+static PCSTR    s_rpszFiles[MAX_FILES];
+static UINT     s_nFiles        = 0;
+
+//////////////////////////////////////////////////////////////////////////////
+//
+static double Now()
+{
+#ifdef _WIN32
+    LARGE_INTEGER now;
+    LARGE_INTEGER freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static UINT32 s_nRandom = 0x2545f491;
+
+static UINT Random(UINT nRange)
+{
+    // xorshift32
+    s_nRandom ^= s_nRandom << 13;
+    s_nRandom ^= s_nRandom >> 17;
+    s_nRandom ^= s_nRandom << 5;
+    return s_nRandom % nRange;
+}
+
+static SOCKET OpenSocket(UINT16 nPort, BOOL fBroadcast)
+{
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    int one = 1;
+    if (fBroadcast) {
+        setsockopt(s, SOL_SOCKET, SO_BROADCAST, (char *)&one, sizeof(one));
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *)&one, sizeof(one));
+    }
+
+    // Big receive buffers, so a burst of windows isn't lost in the kernel.
+    int cbBuffer = 1024 * 1024;
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, (char *)&cbBuffer, sizeof(cbBuffer));
+
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(nPort);
+
+    if (bind(s, (struct sockaddr *)&local, sizeof(local)) != 0) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+
+#ifdef _WIN32
+    u_long nonblocking = 1;
+    ioctlsocket(s, FIONBIO, &nonblocking);
+#else
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    return s;
+}
+
+static VOID SendTo(SOCKET s, UINT32 nAddr, UINT16 nPort, PBYTE pbData, UINT cbData)
+{
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = htonl(nAddr);
+    to.sin_port = htons(nPort);
+
+    sendto(s, (char *)pbData, cbData, 0, (struct sockaddr *)&to, sizeof(to));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// One emulated client.
+//
+enum ClientState {
+    CLIENT_DISCOVER,
+    CLIENT_REQUEST,
+    CLIENT_TFTP,
+    CLIENT_DONE,
+    CLIENT_FAILED,
+};
+
+struct Client
+{
+    UINT        nIndex;
+    ClientState eState;
+    BYTE        rbMac[6];
+    UINT32      nXid;
+    UINT32      nOffered;       // yiaddr of the OFFER.
+    UINT32      nServerId;      // Server identifier of the OFFER.
+    CHAR        szBootFile[128];
+
+    double      start;
+    double      dhcpDone;
+    double      done;
+    double      lastSend;
+    UINT        nRetries;
+
+    // TFTP transfer of rpszFiles[nFile].
+    SOCKET      s;
+    UINT        nFile;
+    UINT16      nServerTid;     // 0 until the server's first reply.
+    UINT32      nBlockNext;     // Next block expected, counted from 1.
+    UINT        nBlockSize;
+    UINT        nWindowSize;
+    UINT        nInWindow;      // Blocks received since the last ACK.
+    BOOL        fGapAcked;      // Already asked for the missing block.
+    BYTE        rbLast[512];    // Last packet sent, for retransmission.
+    UINT        cbLast;
+};
+
+static Client * s_pClients;
+static SOCKET   s_sDhcp = INVALID_SOCKET;
+
+// Totals.
+static UINT64   s_cbData;
+static UINT     s_nDataPackets;
+static UINT     s_nDropped;         // Thrown away to emulate loss.
+static UINT     s_nOutOfOrder;
+static UINT     s_nResent;          // Our retransmissions.
+static UINT     s_nFilesRead;
+
+static PCSTR FileName(Client *pClient)
+{
+    return s_nFiles ? s_rpszFiles[pClient->nFile] : pClient->szBootFile;
+}
+
+static UINT FileCount()
+{
+    return s_nFiles ? s_nFiles : 1;
+}
+
+static VOID Fail(Client *pClient, PCSTR pszReason)
+{
+    printf("client %4d: %s\n", pClient->nIndex, pszReason);
+    pClient->eState = CLIENT_FAILED;
+    pClient->done = Now();
+    if (pClient->s != INVALID_SOCKET) {
+        closesocket(pClient->s);
+        pClient->s = INVALID_SOCKET;
+    }
+}
+
+static VOID SendLast(Client *pClient, UINT32 nAddr, UINT16 nPort)
+{
+    SendTo(pClient->s, nAddr, nPort, pClient->rbLast, pClient->cbLast);
+    pClient->lastSend = Now();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// DHCP.
+//
+static UINT BuildDhcp(Client *pClient, BYTE nType, PBYTE pb)
+{
+    memset(pb, 0, 240);
+    pb[0] = 1;                                      // BOOTREQUEST
+    pb[1] = 1;                                      // Ethernet
+    pb[2] = 6;
+    memcpy(pb + 4, &pClient->nXid, 4);
+    pb[10] = 0x80;                                  // Broadcast replies.
+    memcpy(pb + 28, pClient->rbMac, 6);
+
+    UINT32 nCookie = htonl(DHCP_MAGIC_COOKIE);
+    memcpy(pb + 236, &nCookie, 4);
+
+    UINT cb = 240;
+    pb[cb++] = 53;                                  // Message type.
+    pb[cb++] = 1;
+    pb[cb++] = nType;
+
+    pb[cb++] = 60;                                  // Class identifier.
+    pb[cb++] = 32;
+    memcpy(pb + cb, "PXEClient:Arch:00000:UNDI:002001", 32);
+    cb += 32;
+
+    pb[cb++] = 93;                                  // Client architecture.
+    pb[cb++] = 2;
+    pb[cb++] = 0;
+    pb[cb++] = 0;
+
+    pb[cb++] = 97;                                  // Client GUID.
+    pb[cb++] = 17;
+    pb[cb++] = 0;
+    for (UINT n = 0; n < 16; n++) {
+        pb[cb++] = (BYTE)(pClient->nIndex >> (8 * (n % 4)));
+    }
+
+    if (nType == DHCPREQUEST) {
+        UINT32 nAddr = htonl(pClient->nOffered);
+        pb[cb++] = 50;                              // Requested address.
+        pb[cb++] = 4;
+        memcpy(pb + cb, &nAddr, 4);
+        cb += 4;
+
+        nAddr = htonl(pClient->nServerId);
+        pb[cb++] = 54;                              // Server identifier.
+        pb[cb++] = 4;
+        memcpy(pb + cb, &nAddr, 4);
+        cb += 4;
+    }
+
+    pb[cb++] = 255;
+    return cb;
+}
+
+static VOID SendDhcp(Client *pClient)
+{
+    BYTE rb[512];
+    UINT cb = BuildDhcp(pClient,
+                        pClient->eState == CLIENT_DISCOVER ? DHCPDISCOVER : DHCPREQUEST,
+                        rb);
+    SendTo(s_sDhcp, s_nServer, s_nDhcpPort, rb, cb);
+    pClient->lastSend = Now();
+}
+
+static VOID StartTftp(Client *pClient);
+
+static VOID OnDhcpRecv(PBYTE pb, UINT cb)
+{
+    if (cb < 240 || pb[0] != 2) {
+        return;
+    }
+
+    UINT32 nXid;
+    memcpy(&nXid, pb + 4, 4);
+    UINT nIndex = ntohl(nXid) & 0xffffff;
+    if (nIndex >= s_nClients || s_pClients[nIndex].nXid != nXid) {
+        return;
+    }
+    Client *pClient = &s_pClients[nIndex];
+
+    BYTE nType = 0;
+    UINT32 nServerId = 0;
+
+    for (UINT n = 240; n < cb && pb[n] != 255;) {
+        if (pb[n] == 0) {
+            n++;
+            continue;
+        }
+        if (n + 2 > cb || n + 2 + pb[n + 1] > cb) {
+            break;
+        }
+        if (pb[n] == 53 && pb[n + 1] >= 1) {
+            nType = pb[n + 2];
+        }
+        else if (pb[n] == 54 && pb[n + 1] >= 4) {
+            memcpy(&nServerId, pb + n + 2, 4);
+            nServerId = ntohl(nServerId);
+        }
+        n += 2 + pb[n + 1];
+    }
+
+    if (pClient->eState == CLIENT_DISCOVER && nType == DHCPOFFER) {
+        memcpy(&pClient->nOffered, pb + 16, 4);
+        pClient->nOffered = ntohl(pClient->nOffered);
+        pClient->nServerId = nServerId;
+        memcpy(pClient->szBootFile, pb + 108, sizeof(pClient->szBootFile) - 1);
+
+        pClient->eState = CLIENT_REQUEST;
+        pClient->nRetries = 0;
+        SendDhcp(pClient);
+    }
+    else if (pClient->eState == CLIENT_REQUEST && nType == DHCPACK) {
+        pClient->dhcpDone = Now();
+        StartTftp(pClient);
+    }
+    else if (pClient->eState == CLIENT_REQUEST && nType == DHCPNAK) {
+        Fail(pClient, "DHCP NAK");
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// TFTP, with the windowsize option of RFC 7440.
+//
+static UINT AddOption(PBYTE pb, UINT cb, PCSTR pszName, UINT nValue)
+{
+    cb += sprintf((PCHAR)pb + cb, "%s", pszName) + 1;
+    cb += sprintf((PCHAR)pb + cb, "%u", nValue) + 1;
+    return cb;
+}
+
+static VOID SendRrq(Client *pClient)
+{
+    PBYTE pb = pClient->rbLast;
+    UINT cb = 0;
+
+    pb[cb++] = 0;
+    pb[cb++] = TFTP_RRQ;
+    cb += sprintf((PCHAR)pb + cb, "%s", FileName(pClient)) + 1;
+    cb += sprintf((PCHAR)pb + cb, "octet") + 1;
+    if (s_nBlockSize) {
+        cb = AddOption(pb, cb, "blksize", s_nBlockSize);
+    }
+    if (s_nWindowSize) {
+        cb = AddOption(pb, cb, "windowsize", s_nWindowSize);
+    }
+    pClient->cbLast = cb;
+
+    pClient->nServerTid = 0;
+    pClient->nBlockNext = 1;
+    pClient->nBlockSize = 512;
+    pClient->nWindowSize = 1;
+    pClient->nInWindow = 0;
+    pClient->fGapAcked = FALSE;
+    SendLast(pClient, s_nServer, s_nTftpPort);
+}
+
+static VOID SendAck(Client *pClient, UINT16 nBlock)
+{
+    pClient->rbLast[0] = 0;
+    pClient->rbLast[1] = TFTP_ACK;
+    pClient->rbLast[2] = (BYTE)(nBlock >> 8);
+    pClient->rbLast[3] = (BYTE)nBlock;
+    pClient->cbLast = 4;
+    pClient->nInWindow = 0;
+    SendLast(pClient, s_nServer, pClient->nServerTid);
+}
+
+static VOID StartTftp(Client *pClient)
+{
+    pClient->eState = CLIENT_TFTP;
+    pClient->nRetries = 0;
+    pClient->nFile = 0;
+
+    pClient->s = OpenSocket(0, FALSE);
+    if (pClient->s == INVALID_SOCKET) {
+        Fail(pClient, "can't open a TFTP socket");
+        return;
+    }
+    SendRrq(pClient);
+}
+
+static VOID OnTftpRecv(Client *pClient, UINT16 nPort, PBYTE pb, UINT cb)
+{
+    if (cb < 4) {
+        return;
+    }
+    if (pClient->nServerTid == 0) {
+        // The server answers from its transfer ID.
+        pClient->nServerTid = nPort;
+    }
+    else if (nPort != pClient->nServerTid) {
+        return;
+    }
+
+    UINT16 nOpcode = (UINT16)((pb[0] << 8) | pb[1]);
+    UINT16 nBlock = (UINT16)((pb[2] << 8) | pb[3]);
+
+    switch (nOpcode) {
+      case TFTP_OACK:
+        for (UINT n = 2; n < cb;) {
+            PCSTR pszName = (PCSTR)pb + n;
+            n += strlen(pszName) + 1;
+            if (n >= cb) {
+                break;
+            }
+            UINT nValue = atoi((PCSTR)pb + n);
+            n += strlen((PCSTR)pb + n) + 1;
+
+            if (_stricmp(pszName, "blksize") == 0) {
+                pClient->nBlockSize = nValue;
+            }
+            else if (_stricmp(pszName, "windowsize") == 0) {
+                pClient->nWindowSize = nValue;
+            }
+        }
+        pClient->nRetries = 0;
+        SendAck(pClient, 0);
+        break;
+
+      case TFTP_DATA:
+        s_nDataPackets++;
+        if (s_nLossPercent && Random(100) < s_nLossPercent) {
+            s_nDropped++;
+            break;
+        }
+        if (nBlock != (UINT16)pClient->nBlockNext) {
+            // Ask for the window again from the first block we're missing,
+            // but only once: acking every stray block of the same window
+            // would make the server send it over and over.
+            s_nOutOfOrder++;
+            if (!pClient->fGapAcked) {
+                SendAck(pClient, (UINT16)(pClient->nBlockNext - 1));
+                pClient->fGapAcked = TRUE;
+            }
+            break;
+        }
+
+        pClient->nRetries = 0;
+        pClient->fGapAcked = FALSE;
+        pClient->nBlockNext++;
+        pClient->nInWindow++;
+        s_cbData += cb - 4;
+
+        if (cb - 4 < pClient->nBlockSize) {
+            SendAck(pClient, nBlock);
+            s_nFilesRead++;
+
+            if (++pClient->nFile < FileCount()) {
+                // Next file from a fresh transfer ID, like the loader does.
+                closesocket(pClient->s);
+                pClient->s = OpenSocket(0, FALSE);
+                if (pClient->s == INVALID_SOCKET) {
+                    Fail(pClient, "can't open a TFTP socket");
+                    return;
+                }
+                SendRrq(pClient);
+            }
+            else {
+                pClient->eState = CLIENT_DONE;
+                pClient->done = Now();
+                closesocket(pClient->s);
+                pClient->s = INVALID_SOCKET;
+            }
+        }
+        else if (pClient->nInWindow >= pClient->nWindowSize) {
+            SendAck(pClient, nBlock);
+        }
+        break;
+
+      case TFTP_ERROR:
+        {
+            CHAR szReason[600];
+            sprintf(szReason, "TFTP error %d reading %s: %.512s",
+                    nBlock, FileName(pClient), cb > 4 ? (PCSTR)pb + 4 : "");
+            Fail(pClient, szReason);
+        }
+        break;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+static VOID OnTimeouts(double now)
+{
+    for (UINT n = 0; n < s_nClients; n++) {
+        Client *pClient = &s_pClients[n];
+
+        if (pClient->eState >= CLIENT_DONE ||
+            (now - pClient->lastSend) * 1000 < s_nTimeout) {
+            continue;
+        }
+        if (++pClient->nRetries > s_nRetries) {
+            Fail(pClient, pClient->eState == CLIENT_TFTP ? "TFTP timed out" : "DHCP timed out");
+            continue;
+        }
+
+        s_nResent++;
+        if (pClient->eState == CLIENT_TFTP) {
+            SendLast(pClient, s_nServer,
+                     pClient->nServerTid ? pClient->nServerTid : s_nTftpPort);
+            pClient->nInWindow = 0;
+        }
+        else {
+            SendDhcp(pClient);
+        }
+    }
+}
+
+static int CompareDouble(const void *a, const void *b)
+{
+    double d = *(const double *)a - *(const double *)b;
+    return (d < 0) ? -1 : (d > 0) ? 1 : 0;
+}
+
+static double Percentile(double *pTimes, UINT nTimes, UINT nPercent)
+{
+    if (nTimes == 0) {
+        return 0;
+    }
+    UINT n = (nTimes * nPercent + 99) / 100;
+    return pTimes[(n == 0 ? 1 : n) - 1];
+}
+
+static VOID Report(double start, double end)
+{
+    double *pTotal = new double [s_nClients];
+    double *pDhcp = new double [s_nClients];
+    UINT nDone = 0;
+    UINT nFailed = 0;
+
+    for (UINT n = 0; n < s_nClients; n++) {
+        Client *pClient = &s_pClients[n];
+        if (pClient->eState == CLIENT_DONE) {
+            pTotal[nDone] = (pClient->done - pClient->start) * 1000;
+            pDhcp[nDone] = s_fDhcp ? (pClient->dhcpDone - pClient->start) * 1000 : 0;
+            nDone++;
+        }
+        else {
+            nFailed++;
+        }
+    }
+    qsort(pTotal, nDone, sizeof(double), CompareDouble);
+    qsort(pDhcp, nDone, sizeof(double), CompareDouble);
+
+    double seconds = end - start;
+
+    printf("\n");
+    printf("Clients:    %d done, %d failed, %d files\n", nDone, nFailed, s_nFilesRead);
+    printf("Packets:    %d DATA received, %d dropped (%d%% loss), "
+           "%d out of order, %d resent\n",
+           s_nDataPackets, s_nDropped, s_nLossPercent, s_nOutOfOrder, s_nResent);
+    if (s_fDhcp) {
+        printf("DHCP (ms):  p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f\n",
+               Percentile(pDhcp, nDone, 50),
+               Percentile(pDhcp, nDone, 90),
+               Percentile(pDhcp, nDone, 99),
+               Percentile(pDhcp, nDone, 100));
+    }
+    printf("Boot (ms):  p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f\n",
+           Percentile(pTotal, nDone, 50),
+           Percentile(pTotal, nDone, 90),
+           Percentile(pTotal, nDone, 99),
+           Percentile(pTotal, nDone, 100));
+    printf("Throughput: %.1f MB in %.2f s, %.2f MB/s\n",
+           s_cbData / 1048576.0, seconds,
+           seconds > 0 ? s_cbData / 1048576.0 / seconds : 0);
+
+    delete[] pTotal;
+    delete[] pDhcp;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+static VOID Usage()
+{
+    printf("Usage:\n"
+           "    bootload [options]\n"
+           "Options:\n"
+           "    /s:a.b.c.d   - Server address (default 127.0.0.1).\n"
+           "    /n:clients   - Number of emulated clients (default 100).\n"
+           "    /f:file      - File to read; repeat for several (default: the\n"
+           "                   boot file from the DHCP reply).\n"
+           "    /b:blksize   - Ask for a TFTP block size.\n"
+           "    /w:window    - Ask for a TFTP window size.\n"
+           "    /l:percent   - Drop this percentage of DATA packets.\n"
+           "    /t:ms        - Retransmission timeout (default 1000).\n"
+           "    /x           - Skip DHCP, read the files straight away.\n"
+           "    /d:port      - DHCP server port (default 67).\n"
+           "    /c:port      - DHCP client port (default 68).\n"
+           "    /p:port      - TFTP server port (default 69).\n"
+           "    /i:a.b.c.d   - Print dhcpd.ini lines for the clients, with\n"
+           "                   addresses from a.b.c.d up, and exit.\n"
+           "\n"
+           "Client N uses MAC 02-00-00-xx-xx-xx with N in the low bytes.\n");
+}
+
+int main(int argc, char **argv)
+{
+    UINT32 nIniBase = 0;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (argv[arg][0] != '-' && argv[arg][0] != '/') {
+            Usage();
+            return 1;
+        }
+
+        char *argn = argv[arg] + 1;                     // Argument name
+        char *argp = argn;                              // Argument parameter
+
+        while (*argp && *argp != ':') {
+            argp++;
+        }
+        if (*argp == ':') {
+            *argp++ = '\0';
+        }
+
+        switch (argn[0]) {
+          case 's': case 'S': s_nServer = ntohl(inet_addr(argp)); break;
+          case 'n': case 'N': s_nClients = atoi(argp); break;
+          case 'b': case 'B': s_nBlockSize = atoi(argp); break;
+          case 'w': case 'W': s_nWindowSize = atoi(argp); break;
+          case 'l': case 'L': s_nLossPercent = atoi(argp); break;
+          case 't': case 'T': s_nTimeout = atoi(argp); break;
+          case 'x': case 'X': s_fDhcp = FALSE; break;
+          case 'd': case 'D': s_nDhcpPort = (UINT16)atoi(argp); break;
+          case 'c': case 'C': s_nClientPort = (UINT16)atoi(argp); break;
+          case 'p': case 'P': s_nTftpPort = (UINT16)atoi(argp); break;
+          case 'i': case 'I': nIniBase = ntohl(inet_addr(argp)); break;
+          case 'f': case 'F':
+            if (s_nFiles < MAX_FILES) {
+                s_rpszFiles[s_nFiles++] = argp;
+            }
+            break;
+          default:
+            Usage();
+            return 1;
+        }
+    }
+
+    if (s_nClients == 0 || s_nClients > 0xffffff ||
+        (!s_fDhcp && s_nFiles == 0)) {
+        Usage();
+        return 1;
+    }
+
+    if (nIniBase != 0) {
+        for (UINT n = 0; n < s_nClients; n++) {
+            UINT32 nAddr = nIniBase + n;
+            printf("02-00-00-%02x-%02x-%02x %d.%d.%d.%d name=load%d\n",
+                   (n >> 16) & 0xff, (n >> 8) & 0xff, n & 0xff,
+                   (nAddr >> 24) & 0xff, (nAddr >> 16) & 0xff,
+                   (nAddr >> 8) & 0xff, nAddr & 0xff, n);
+        }
+        return 0;
+    }
+
+#ifdef _WIN32
+    WSADATA WSAData;
+    if (WSAStartup(MAKEWORD(2,2), &WSAData) != 0) {
+        printf("WSAStartup failed.\n");
+        return 1;
+    }
+#endif
+
+    if (s_fDhcp) {
+        s_sDhcp = OpenSocket(s_nClientPort, TRUE);
+        if (s_sDhcp == INVALID_SOCKET) {
+            printf("Can't bind the DHCP client port %d.\n", s_nClientPort);
+            return 1;
+        }
+    }
+
+    s_pClients = new Client [s_nClients];
+    memset(s_pClients, 0, sizeof(Client) * s_nClients);
+
+    double start = Now();
+
+    for (UINT n = 0; n < s_nClients; n++) {
+        Client *pClient = &s_pClients[n];
+
+        pClient->nIndex = n;
+        pClient->s = INVALID_SOCKET;
+        pClient->rbMac[0] = 0x02;
+        pClient->rbMac[3] = (BYTE)(n >> 16);
+        pClient->rbMac[4] = (BYTE)(n >> 8);
+        pClient->rbMac[5] = (BYTE)n;
+        pClient->nXid = htonl((Random(256) << 24) | n);
+        pClient->start = Now();
+
+        if (s_fDhcp) {
+            pClient->eState = CLIENT_DISCOVER;
+            SendDhcp(pClient);
+        }
+        else {
+            StartTftp(pClient);
+        }
+    }
+
+    struct pollfd *pPoll = new struct pollfd [s_nClients + 1];
+    UINT *pnPollClient = new UINT [s_nClients + 1];
+    PBYTE pbRecv = new BYTE [MAX_PACKET];
+
+    for (;;) {
+        UINT nPoll = 0;
+        UINT nRunning = 0;
+
+        if (s_sDhcp != INVALID_SOCKET) {
+            pPoll[nPoll].fd = s_sDhcp;
+            pPoll[nPoll].events = POLLIN;
+            pnPollClient[nPoll++] = ~0u;
+        }
+        for (UINT n = 0; n < s_nClients; n++) {
+            if (s_pClients[n].eState < CLIENT_DONE) {
+                nRunning++;
+            }
+            if (s_pClients[n].eState == CLIENT_TFTP) {
+                pPoll[nPoll].fd = s_pClients[n].s;
+                pPoll[nPoll].events = POLLIN;
+                pnPollClient[nPoll++] = n;
+            }
+        }
+        if (nRunning == 0) {
+            break;
+        }
+
+        int nReady = poll(pPoll, nPoll, 10);
+
+        for (UINT p = 0; nReady > 0 && p < nPoll; p++) {
+            if ((pPoll[p].revents & POLLIN) == 0) {
+                continue;
+            }
+
+            // Drain the socket; the clients can't keep up otherwise.
+            for (UINT nBatch = 0; nBatch < 64; nBatch++) {
+                struct sockaddr_in from;
+                socklen_t cbFrom = sizeof(from);
+                SOCKET s = pPoll[p].fd;
+
+                int cb = recvfrom(s, (char *)pbRecv, MAX_PACKET, 0,
+                                  (struct sockaddr *)&from, &cbFrom);
+                if (cb <= 0) {
+                    break;
+                }
+
+                if (pnPollClient[p] == ~0u) {
+                    OnDhcpRecv(pbRecv, cb);
+                }
+                else {
+                    Client *pClient = &s_pClients[pnPollClient[p]];
+                    if (pClient->eState != CLIENT_TFTP || pClient->s != s) {
+                        break;
+                    }
+                    OnTftpRecv(pClient, ntohs(from.sin_port), pbRecv, cb);
+                }
+            }
+        }
+
+        OnTimeouts(Now());
+    }
+
+    double end = Now();
+    Report(start, end);
+
+    delete[] pPoll;
+    delete[] pnPollClient;
+    delete[] pbRecv;
+    delete[] s_pClients;
+
+    if (s_sDhcp != INVALID_SOCKET) {
+        closesocket(s_sDhcp);
+    }
+    return 0;
+}
@@ -0,0 +1,224 @@
+////////////////////////////////////////////////////////////////////////////
+//
+// Correctness and lookup throughput of bootd's hash tables.
+//
+// Copyright Microsoft Corporation
+//
+// Builds with nmake on Windows, or stand-alone elsewhere:
+//
+//      g++ -O2 -o hashbench hashbench.cpp
+//
+#ifdef _WIN32
+#include <winlean.h>
+#else
+#include <time.h>
+typedef int             BOOL;
+typedef int             INT;
+typedef unsigned int    UINT;
+typedef unsigned int    UINT32;
+typedef unsigned long long UINT64;
+typedef void            VOID;
+typedef const char *    PCSTR;
+#define TRUE            1
+#define FALSE           0
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+
+#include "../../bootd/hashtab.h"
+
+#define ARRAYOF(x)      (sizeof(x)/sizeof(x[0]))
+
+//////////////////////////////////////////////////////////////////////////////
+//
+static UINT64 s_nRandom = 0x2545f4914f6cdd1dull;
+
+static UINT64 Random64()
+{
+    // xorshift64*
+    s_nRandom ^= s_nRandom >> 12;
+    s_nRandom ^= s_nRandom << 25;
+    s_nRandom ^= s_nRandom >> 27;
+    return s_nRandom * 0x2545f4914f6cdd1dull;
+}
+
+static double Seconds()
+{
+#ifdef _WIN32
+    LARGE_INTEGER now;
+    LARGE_INTEGER freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Random inserts, changes, deletes and lookups checked against std::map.
+// Keys come from a small range so that runs collide and deletes have to
+// shift entries back.
+//
+template<class K> static BOOL Verify(PCSTR pszName, UINT nOps, UINT64 nRange)
+{
+    CHashTable<K, UINT64> table;
+    std::map<K, UINT64> reference;
+
+    for (UINT op = 0; op < nOps; op++) {
+        K key = (K)(Random64() % nRange);
+        UINT64 value = Random64() | 1;
+        BOOL fPresent = reference.find(key) != reference.end();
+        BOOL fOk;
+
+        switch (Random64() % 4) {
+          case 0:
+            fOk = table.Insert(key, value);
+            if (fOk != (key != 0 && !fPresent)) {
+                printf("%s: Insert(%llx) returned %d.\n", pszName, (UINT64)key, fOk);
+                return FALSE;
+            }
+            if (fOk) {
+                reference[key] = value;
+            }
+            break;
+          case 1:
+            fOk = table.Change(key, value);
+            if (fOk != (key != 0)) {
+                printf("%s: Change(%llx) returned %d.\n", pszName, (UINT64)key, fOk);
+                return FALSE;
+            }
+            if (fOk) {
+                reference[key] = value;
+            }
+            break;
+          case 2:
+            fOk = table.Delete(key);
+            if (fOk != fPresent) {
+                printf("%s: Delete(%llx) returned %d.\n", pszName, (UINT64)key, fOk);
+                return FALSE;
+            }
+            reference.erase(key);
+            break;
+          case 3:
+            if (table.Find(key) != (fPresent ? reference[key] : 0)) {
+                printf("%s: Find(%llx) is wrong.\n", pszName, (UINT64)key);
+                return FALSE;
+            }
+            break;
+        }
+
+        if (table.Count() != (INT)reference.size()) {
+            printf("%s: Count() is %d, expected %d.\n",
+                   pszName, table.Count(), (INT)reference.size());
+            return FALSE;
+        }
+    }
+
+    // Everything in the table, exactly once.
+    UINT nSeen = 0;
+    K key;
+    for (INT nIt = 0; table.Enumerate(key, nIt) != 0;) {
+        if (reference.find(key) == reference.end()) {
+            printf("%s: Enumerate returned stray key %llx.\n", pszName, (UINT64)key);
+            return FALSE;
+        }
+        nSeen++;
+    }
+    if (nSeen != reference.size()) {
+        printf("%s: Enumerate returned %d keys, expected %d.\n",
+               pszName, nSeen, (INT)reference.size());
+        return FALSE;
+    }
+
+    printf("%s: %d operations ok, %d keys left.\n", pszName, nOps, nSeen);
+    return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Lookups of present and absent keys in a table of nKeys entries, then the
+// insert/delete churn of sessions coming and going.
+//
+template<class K> static VOID Measure(PCSTR pszName, UINT nKeys, UINT nLookups)
+{
+    CHashTable<K, UINT64> table;
+    K *pKeys = new K [nKeys];
+    K *pMisses = new K [nKeys];
+
+    for (UINT n = 0; n < nKeys; n++) {
+        do {
+            pKeys[n] = (K)Random64();
+        } while (pKeys[n] == 0 || !table.Insert(pKeys[n], n + 1));
+    }
+    for (UINT n = 0; n < nKeys; n++) {
+        do {
+            pMisses[n] = (K)Random64();
+        } while (pMisses[n] == 0 || table.Find(pMisses[n]) != 0);
+    }
+
+    UINT64 nSum = 0;
+    double start = Seconds();
+    for (UINT n = 0; n < nLookups; n++) {
+        nSum += table.Find(pKeys[n % nKeys]);
+    }
+    double hit = Seconds() - start;
+
+    start = Seconds();
+    for (UINT n = 0; n < nLookups; n++) {
+        nSum += table.Find(pMisses[n % nKeys]);
+    }
+    double miss = Seconds() - start;
+
+    start = Seconds();
+    for (UINT n = 0; n < nLookups; n++) {
+        UINT i = n % nKeys;
+        table.Delete(pKeys[i]);
+        table.Insert(pMisses[i], i);
+        K t = pKeys[i];
+        pKeys[i] = pMisses[i];
+        pMisses[i] = t;
+    }
+    double churn = Seconds() - start;
+
+    printf("%s %7d keys: hit %6.1f ns, miss %6.1f ns, delete+insert %6.1f ns  [%llx]\n",
+           pszName, nKeys,
+           hit * 1e9 / nLookups,
+           miss * 1e9 / nLookups,
+           churn * 1e9 / nLookups,
+           nSum & 0xf);
+
+    delete[] pKeys;
+    delete[] pMisses;
+}
+
+int main(int argc, char **argv)
+{
+    UINT nLookups = 10000000;
+
+    if (argc > 1) {
+        nLookups = atoi(argv[1]);
+    }
+
+    if (!Verify<UINT32>("CHashTable32", 1000000, 2000) ||
+        !Verify<UINT64>("CHashTable64", 1000000, 2000) ||
+        !Verify<UINT32>("CHashTable32", 100000, 100000) ||
+        !Verify<UINT64>("CHashTable64", 100000, 100000)) {
+        return 1;
+    }
+
+    static const UINT rnSizes[] = { 16, 256, 4096, 65536, 1048576 };
+
+    for (UINT n = 0; n < ARRAYOF(rnSizes); n++) {
+        Measure<UINT32>("CHashTable32", rnSizes[n], nLookups);
+    }
+    for (UINT n = 0; n < ARRAYOF(rnSizes); n++) {
+        Measure<UINT64>("CHashTable64", rnSizes[n], nLookups);
+    }
+    return 0;
+}
@@ -18,8 +18,6 @@
 #define ARRAYOF(x)      (sizeof(x)/sizeof(x[0]))
 #define ASSERT(a)       assert(a)
 
-#define WM_SOCKET_EVENT  (WM_USER+101)
-
 void SocketErrorBox(DWORD dwWSALastError, PCSTR pszFile, INT nLine)
 {
     CHAR *szError = NULL;
@@ -210,8 +208,8 @@ UINT32 GetIpAddr(PCSTR pszAddr)
 
 PCSTR FileTimeToString(UINT64 ftTime)
 {
-    static CHAR rszTimes[16][48];
-    static int nTimes = 0;
+    static __declspec(thread) CHAR rszTimes[16][48];
+    static __declspec(thread) int nTimes = 0;
 
     static BOOL bGotTzi = FALSE;
     static DWORD dwTzi = TIME_ZONE_ID_UNKNOWN;
@@ -426,6 +424,7 @@ VOID Usage(VOID)
            "    /tftp ... - Set TFTP Daemon Options\n"
            "        /e - Exit on first attempt to read an invalid file.\n"
            "        /r - Disable rename of *.x86 files to pxe.com.N.\n"
+           "        /t:threads - Serve transfers on worker threads.\n"
            "        /v - Verbose output.\n"
            "        /w:directory - Allow writes to the specified directory.\n"
            "        {directories} - Directories to serve read only.\n"
@@ -434,20 +433,45 @@ VOID Usage(VOID)
 
 //////////////////////////////////////////////////////////////////////////////
 //
-static HWND s_hWndMain;
-
-BOOL TimerSet(ITimerSink *pTimerSink, UINT nMilliseconds)
+// Rescans the network interfaces every few seconds.
+//
+class CScanTimer : public ITimerSink
 {
-    if (!::SetTimer(s_hWndMain, (UINT_PTR)pTimerSink, nMilliseconds, NULL)) {
-        return FALSE;
+  public:
+    CScanTimer()
+        : m_fScan(TRUE)
+    {
     }
-    return TRUE;
-}
 
-BOOL TimerClr(ITimerSink *pTimerSink)
+    VOID OnTimerFired()
+    {
+        m_fScan = TRUE;
+    }
+
+  public:
+    BOOL    m_fScan;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Reports TFTP worker counters every minute while there is traffic.
+//
+class CStatsTimer : public ITimerSink
 {
-    return ::KillTimer(s_hWndMain, (UINT_PTR)pTimerSink);
-}
+  public:
+    CStatsTimer(ITftpSink *pSink)
+        : m_pSink(pSink)
+    {
+    }
+
+    VOID OnTimerFired()
+    {
+        CTftp::ReportStats(m_pSink);
+    }
+
+  public:
+    ITftpSink * m_pSink;
+};
 
 int main(int argc, char **argv)
 {
@@ -455,6 +479,8 @@ int main(int argc, char **argv)
     CDhcpSink dhcpSink;
     CPxepSink pxepSink;
     CTftpSink tftpSink;
+    CScanTimer scanTimer;
+    CStatsTimer statsTimer(&tftpSink);
 
     CDhcpState *m_pDhcpState = NULL;
     CDhcp * m_pDhcpRaw = NULL;
@@ -576,21 +602,10 @@ int main(int argc, char **argv)
         printf("Failed to set non-buffered output.");
     }
 
-    // Create a message window.
-    //
-    WNDCLASS wc;
-    ZeroMemory(&wc, sizeof(wc));
-
-    wc.lpfnWndProc   = DefWindowProc;   // Function to retrieve messages for    
-    wc.lpszClassName = "bootd";  // Name used in call to CreateWindow.   
-
-    ATOM atomClass = RegisterClass(&wc);
-    assert(atomClass);
-
-    s_hWndMain = CreateWindow("bootd", NULL, 0, 0, 0, 0, 0, NULL, NULL, NULL, NULL);
-    assert(s_hWndMain);
-
-    SocketInit(s_hWndMain, WM_SOCKET_EVENT);
+    if (!SocketInit()) {
+        printf("Failed to create the socket event.\n");
+        return 1;
+    }
 
     UINT nError;
 
@@ -601,16 +616,14 @@ int main(int argc, char **argv)
     m_pDhcpState->Configure(&dhcpSink, nDhcpArgs, rpszDhcpArgs);
     printf("\n");
 
-    TimerSet(NULL, 10000);
+    TimerSet(&scanTimer, 10000);
+    TimerSet(&statsTimer, 60000);
 
     ////////////////////////////////////////////////////////// Process Events.
     //
-    MSG msg;
-    BOOL fScanNetwork = TRUE;
-
     for (;;) {
-        if (fScanNetwork) {
-            fScanNetwork = FALSE;
+        if (scanTimer.m_fScan) {
+            scanTimer.m_fScan = FALSE;
 
             CNetwork *pNetworks = NULL;
             SocketLoadNetworks(&pNetworks);
@@ -702,34 +715,12 @@ int main(int argc, char **argv)
             }
         }
 
-        DWORD what = MsgWaitForMultipleObjectsEx(0, NULL, INFINITE, QS_ALLEVENTS,
-                                                 MWMO_ALERTABLE | MWMO_INPUTAVAILABLE);
-
-        if (what == WAIT_OBJECT_0) {
-            if (!GetMessage(&msg, NULL, 0, 0)) {
-                break;
-            }
-
-            if (msg.hwnd == s_hWndMain) {
-                switch (msg.message) {
-                  case WM_SOCKET_EVENT:
-                    SocketEvent(msg.wParam, msg.lParam);
-                    break;
-                  case WM_TIMER:
-                    if (msg.wParam == 0) {
-                        fScanNetwork = TRUE;
-                    }
-                    else {
-                        ITimerSink *pTimerSink = (ITimerSink *)msg.wParam;
-                        pTimerSink->OnTimerFired();
-                    }
-                    break;
-                }
-            }
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
+        if (!SocketPoll()) {
+            break;
         }
     }
+    TimerClr(&scanTimer);
+    TimerClr(&statsTimer);
 
   abort:
     if (m_pDhcpPxe)
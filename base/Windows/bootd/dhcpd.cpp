@@ -195,6 +195,37 @@ struct DHCP_CMD {
 
 #pragma pack(pop)
 
+//
+// The options of a request that we act on or log.  The pointers are into the
+// request packet, and the option data isn't NUL terminated.
+//
+struct DHCP_REQUEST_OPTIONS {
+    BYTE        nType;          // DHCP message type, 0 if not given.
+    BOOL        fPxe;           // Class identifier is "PXEClient...".
+    OPTIONS *   pName;          // Host name.
+    OPTIONS *   pClass;         // Class identifier.
+    OPTIONS *   pClientId;      // PXE client machine identifier (GUID).
+};
+
+//
+// A reply to one node from one server address.  It is built the first time
+// the node asks that server, and after that each OFFER or ACK only patches
+// the fields that come from the request before it is sent.
+//
+#define DHCP_REPLY_SIZE     1600
+
+struct DHCP_REPLY {
+    DHCP_REPLY *pNext;
+    UINT32      nAddr;          // Server address, mask and gateway the
+    UINT32      nMask;          // reply was built for.
+    UINT32      nGate;
+    BOOL        fPxe;
+    UINT32      cbPacket;
+    PBYTE       pbType;         // Message type in rbPacket.
+    PBYTE       pbClientId;     // PXE client GUID in rbPacket, or NULL.
+    BYTE        rbPacket[DHCP_REPLY_SIZE];
+};
+
 typedef enum {
     BOOTREQUEST = 1,
     BOOTREPLY   = 2
@@ -280,6 +311,17 @@ CDhcpNode::CDhcpNode()
     idMac = 0;
     iaLast = 0;
     iaAssigned = 0;
+
+    pReplies = NULL;
+}
+
+CDhcpNode::~CDhcpNode()
+{
+    while (pReplies != NULL) {
+        DHCP_REPLY *pReply = pReplies;
+        pReplies = pReply->pNext;
+        delete pReply;
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -409,6 +451,22 @@ BOOL CDhcpState::AddMacEntry(PCSTR psz)
 
     CheckMacFlags(pNode);
 
+    if (!m_MacsById.Insert(pNode->idMac, pNode)) {
+        if (m_pSink) {
+            m_pSink->OnDhcpMessage(pNode->iaAssigned,
+                                   "Duplicate mac %02x-%02x-%02x-%02x-%02x-%02x ignored",
+                                   ((PBYTE)&pNode->idMac)[5],
+                                   ((PBYTE)&pNode->idMac)[4],
+                                   ((PBYTE)&pNode->idMac)[3],
+                                   ((PBYTE)&pNode->idMac)[2],
+                                   ((PBYTE)&pNode->idMac)[1],
+                                   ((PBYTE)&pNode->idMac)[0]
+                                  );
+        }
+        delete pNode;
+        return FALSE;
+    }
+
     if (m_pSink) {
         m_pSink->OnDhcpMessage(pNode->iaAssigned,
                                "Added mac %02x-%02x-%02x-%02x-%02x-%02x",
@@ -420,8 +478,6 @@ BOOL CDhcpState::AddMacEntry(PCSTR psz)
                                ((PBYTE)&pNode->idMac)[0]
                               );
     }
-
-    m_MacsById.Insert(pNode->idMac, pNode);
     return TRUE;
 }
 
@@ -477,7 +533,13 @@ BOOL CDhcpState::ReadMacEntries(PCSTR pszFile)
                     ReadMacFlags(pNode, flags);
                     CheckMacFlags(pNode);
 
-                    m_MacsById.Insert(pNode->idMac, pNode);
+                    if (!m_MacsById.Insert(pNode->idMac, pNode)) {
+                        delete pNode;
+
+                        if (m_pSink) {
+                            m_pSink->OnDhcpMessage(0, "INI Error: duplicate mac: %s", psz);
+                        }
+                    }
                     pNode = NULL;
                 }
                 else {
@@ -502,114 +564,55 @@ CDhcpNode *CDhcpState::FindMacEntry(UINT64 idMac)
     return m_MacsById.Find(idMac);
 }
 
-BOOL CDhcpState::IsPxeDhcpPacket(PBYTE pbPacket, UINT32 cbPacket)
-{
-    DHCP_CMD *dhcpPacket = (DHCP_CMD *)pbPacket;
-    OPTIONS *pOption = NULL;
-    OPTIONS *pOptionEnd = (OPTIONS *)(pbPacket + cbPacket);
-
-    if (DHCP_MAGIC_COOKIE == ntohl(dhcpPacket->DHCP.cookie)) {
-        pOption = &dhcpPacket->DHCP.options;
-    }
-    else {
-        pOption = &dhcpPacket->BOOTP.options;
-    }
-
-    while (pOption < pOptionEnd) {
-        if (pOption->Code == DHCP_OPTION_CLIENT_CLASS_INFO) {
-            if (pOption->Length >= 9 &&
-                memcmp(pOption->Data, "PXEClient", 9) == 0) {
-                return TRUE;
-            }
-        }
-
-        if (pOption->Code == 0)
-            pOption = (OPTIONS *)(((CHAR *)pOption) + 1);
-        else
-            pOption = (OPTIONS *)(((CHAR *)pOption) + pOption->Length + 2);
-    }
-    return FALSE;
-}
-
-static BOOL GetDhcpOptions(DHCP_CMD *dhcpPacket,
-                           UINT32 cbPacket,
-                           PCHAR pszName,
-                           PCHAR pszType,
-                           PCHAR pszClas,
-                           PUINT16 pusPxeArch,
-                           PUINT16 pusPxeVers,
-                           GUID * pguidPxeClientId
-                          )
+//
+// One pass over the options of a DHCP request, picking out only the ones we
+// use.  Returns FALSE if an option runs past the end of the packet.
+//
+static BOOL ParseDhcpOptions(DHCP_CMD *dhcpPacket,
+                             UINT32 cbPacket,
+                             DHCP_REQUEST_OPTIONS *pOptions)
 {
-    OPTIONS *pOptionEnd = (OPTIONS *)(((CHAR *)dhcpPacket) + cbPacket);
+    PBYTE pbOption = (PBYTE)&dhcpPacket->DHCP.options;
+    PBYTE pbEnd = (PBYTE)dhcpPacket + cbPacket;
 
-    // dump all the options
-    OPTIONS *pOption = NULL;
-    if (DHCP_MAGIC_COOKIE == ntohl(dhcpPacket->DHCP.cookie)) {
-        pOption = &dhcpPacket->DHCP.options;
-    }
-    else {
-        pOption = &dhcpPacket->BOOTP.options;
-    }
+    memset(pOptions, 0, sizeof(*pOptions));
 
-    CHAR szTemp[256];
-    if (pszName == NULL) {
-        pszName = szTemp;
-    }
-    if (pszType == NULL) {
-        pszType = szTemp;
-    }
-    if (pszClas == NULL) {
-        pszClas = szTemp;
-    }
+    while (pbOption < pbEnd) {
+        OPTIONS *pOption = (OPTIONS *)pbOption;
 
-    pszName[0] = pszType[0] = pszClas[0] = '\0';
-    *pusPxeArch = 0;
-    *pusPxeVers = 0;
-    memset(pguidPxeClientId, 0, sizeof(*pguidPxeClientId));
+        if (pOption->Code == DHCP_OPTION_PAD) {
+            pbOption++;
+            continue;
+        }
+        if (pOption->Code == DHCP_OPTION_END) {
+            break;
+        }
+        if (pbOption + 2 > pbEnd || pbOption + 2 + pOption->Length > pbEnd) {
+            return FALSE;
+        }
 
-    while (pOption < pOptionEnd) {
         switch (pOption->Code) {
-          case DHCP_OPTION_HOST_NAME: // HOST NAME
-            strncpy(pszName, (PCHAR)pOption->Data, pOption->Length);
-            pszName[pOption->Length] = '\0';
-            break;
           case DHCP_OPTION_MESSAGE_TYPE:
-            if ((MESSAGE_TYPE_MAX >= pOption->Data[0]) &&
-                (MESSAGE_TYPE_MIN <= pOption->Data[0])) {
-                strcpy(pszType, szMessageTypes[pOption->Data[0] - MESSAGE_TYPE_MIN]);
+            if (pOption->Length >= 1) {
+                pOptions->nType = pOption->Data[0];
             }
-            else {
-                sprintf(pszType, "UNKNOWN (0x%02x)", pOption->Data[0]);
-            }
-            break;
-          case DHCP_OPTION_CLIENT_CLASS_INFO: // CLASS IDENTIFIER
-            strncpy(pszClas, (PCHAR)pOption->Data, pOption->Length);
-            pszClas[pOption->Length] = '\0';
             break;
-          case DHCP_OPTION_PXE_CLIENT_ARCH_ID:
-            *pusPxeArch = ntohs(*(PUINT16)pOption->Data);
+          case DHCP_OPTION_HOST_NAME:
+            pOptions->pName = pOption;
             break;
-          case DHCP_OPTION_PXE_CLIENT_NIC_ID:
-            if (pOption->Data[0] == 1) {
-                *pusPxeArch = ntohs(*(PUINT16)(pOption->Data + 1));
-            }
+          case DHCP_OPTION_CLIENT_CLASS_INFO:
+            pOptions->pClass = pOption;
+            pOptions->fPxe = (pOption->Length >= 9 &&
+                              memcmp(pOption->Data, "PXEClient", 9) == 0);
             break;
           case DHCP_OPTION_PXE_CLIENT_ID:
-            if (pOption->Data[0] == 0) {
-                memcpy(pguidPxeClientId, pOption->Data + 1, 16);
+            if (pOption->Length >= 17 && pOption->Data[0] == 0) {
+                pOptions->pClientId = pOption;
             }
             break;
-          case DHCP_OPTION_END:
-            pOption = pOptionEnd;
-            break;
         }
-        if (0 == pOption->Code)
-            pOption = (OPTIONS *)(((CHAR *)pOption) + 1);
-        else
-            pOption = (OPTIONS *)(((CHAR *)pOption) + pOption->Length + 2);
+        pbOption += 2 + pOption->Length;
     }
-
     return TRUE;
 }
 
@@ -797,38 +800,30 @@ VOID CDhcp::OnSocketRecv(UINT dwError,
         nAddr = INADDR_BROADCAST;
     }
 
-    CHAR szName[256];
-    CHAR szType[256];
-    CHAR szClas[256];
-    UINT16 usPxeArchId;
-    UINT16 usPxeUndiId;
-    GUID guidPxeClientId;
-
     DHCP_CMD *dhcpRequest = (DHCP_CMD *)pbData;
-    UINT64 idMac = IdFromMac(dhcpRequest->chaddr);
-    CDhcpNode *pEntry = m_pState->FindMacEntry(idMac);
-    BOOL fIsPxe = m_pState->IsPxeDhcpPacket(pbData, cbData);
+    DHCP_REQUEST_OPTIONS options;
 
-    if (idMac == 0) {
-        // Ignore requests without the ETHERNET Address.
+    if (cbData < FIELD_OFFSET(DHCP_CMD, DHCP.options) ||
+        BOOTREQUEST != dhcpRequest->op ||
+        DHCP_MAGIC_COOKIE != ntohl(dhcpRequest->DHCP.cookie)) {
         goto done;
     }
 
-    GetDhcpOptions(dhcpRequest, cbData, szName, szType, szClas,
-                   &usPxeArchId, &usPxeUndiId, &guidPxeClientId);
-
-    if (BOOTREQUEST != dhcpRequest->op ||
-        DHCP_MAGIC_COOKIE != ntohl(dhcpRequest->DHCP.cookie)) {
+    UINT64 idMac = IdFromMac(dhcpRequest->chaddr);
+    if (idMac == 0) {
+        // Ignore requests without the ETHERNET Address.
         goto done;
     }
 
-    if ((DHCP_OPTION_MESSAGE_TYPE != dhcpRequest->DHCP.options.Code) ||
-        (DHCPREQUEST != dhcpRequest->DHCP.options.Data[0] &&
-         DHCPDISCOVER != dhcpRequest->DHCP.options.Data[0])) {
+    if (!ParseDhcpOptions(dhcpRequest, cbData, &options) ||
+        (DHCPREQUEST != options.nType && DHCPDISCOVER != options.nType)) {
         goto done;
     }
 
-    if (pEntry == NULL && DHCPDISCOVER != dhcpRequest->DHCP.options.Data[0]) {
+    CDhcpNode *pEntry = m_pState->FindMacEntry(idMac);
+    BOOL fIsPxe = options.fPxe;
+
+    if (pEntry == NULL && DHCPDISCOVER != options.nType) {
         goto done;
     }
 
@@ -839,7 +834,7 @@ VOID CDhcp::OnSocketRecv(UINT dwError,
     if (m_pSink) {
         m_pSink->OnDhcpMessage(nAddr,
                                "=> %s from %02x-%02x-%02x-%02x-%02x-%02x port %d",
-                               szType,
+                               szMessageTypes[options.nType - MESSAGE_TYPE_MIN],
                                ((PBYTE)&idMac)[5],
                                ((PBYTE)&idMac)[4],
                                ((PBYTE)&idMac)[3],
@@ -848,35 +843,33 @@ VOID CDhcp::OnSocketRecv(UINT dwError,
                                ((PBYTE)&idMac)[0],
                                nPort);
         m_pSink->OnDhcpMessage(nAddr,
-                               "   %s%s %s",
+                               "   %s%.*s %.*s",
                                fIsPxe ? "[PXE] " : "",
-                               szClas,
-                               szName);
+                               options.pClass ? options.pClass->Length : 0,
+                               options.pClass ? (PCHAR)options.pClass->Data : "",
+                               options.pName ? options.pName->Length : 0,
+                               options.pName ? (PCHAR)options.pName->Data : "");
     }
 
     if (pEntry == NULL || pEntry->Enabled == FALSE) {
         goto done;
     }
 
-    ///// Send the Reply.
-    BYTE PacketOut[1600];
-
-    // fill in packet before sending
-    DHCP_CMD *pdhcpReply = (DHCP_CMD *)PacketOut;
-
-    memset(pdhcpReply, 0, sizeof(*pdhcpReply));
-
     // broadcast, or use the client specified address for replies
     if (dhcpRequest->ciaddr) {
         pEntry->iaLast = ntohl(dhcpRequest->ciaddr);
     }
 
-    pdhcpReply->op     = BOOTREPLY; // REPLY
-    pdhcpReply->htype  = 1; // ETHERNET
-    pdhcpReply->hlen   = 6; // 6 BYTE HARDWARE ADDRESS LENGTH (MAC)
-    pdhcpReply->hops   = 0;
+    ///// Send the Reply.
+    DHCP_REPLY *pReply = GetReply(pEntry, fIsPxe);
+    if (pReply == NULL) {
+        m_pSink->OnDhcpMessage(nAddr, "Out of memory!");
+        goto done;
+    }
+
+    DHCP_CMD *pdhcpReply = (DHCP_CMD *)pReply->rbPacket;
+
     pdhcpReply->xid    = dhcpRequest->xid;
-    pdhcpReply->secs   = 0;
     pdhcpReply->flags  = dhcpRequest->flags;
     pdhcpReply->ciaddr = dhcpRequest->ciaddr;
     if (fIsPxe && dhcpRequest->ciaddr == htonl(pEntry->iaAssigned)) {
@@ -885,9 +878,107 @@ VOID CDhcp::OnSocketRecv(UINT dwError,
     else {
         pdhcpReply->yiaddr = htonl(pEntry->iaAssigned);
     }
+    memcpy(pdhcpReply->chaddr, dhcpRequest->chaddr, 16);
+
+    if (pReply->pbClientId != NULL) {
+        if (options.pClientId != NULL) {
+            memcpy(pReply->pbClientId, options.pClientId->Data + 1, 16);
+        }
+        else {
+            memset(pReply->pbClientId, 0, 16);
+        }
+    }
+
+    if (options.nType == DHCPREQUEST) {
+        *pReply->pbType = DHCPACK;
+        if (m_pSink) {
+            m_pSink->OnDhcpAck(pEntry->iaAssigned, idMac);
+        }
+    }
+    else {
+        *pReply->pbType = DHCPOFFER;
+        if (m_pSink) {
+            m_pSink->OnDhcpOffer(pEntry->iaAssigned, idMac);
+        }
+    }
+
+    // always AF_INET
+    if (nAddr == 0) {
+        nAddr = INADDR_BROADCAST;
+    }
+
+    // broadcast, or use the client specified address for replies
+    if (ntohs(dhcpRequest->flags) & 0x8000) {
+        nAddr = INADDR_BROADCAST;
+    }
+    else {
+        if (dhcpRequest->ciaddr) {
+            nAddr = pEntry->iaLast;
+        }
+        else {
+            nAddr = INADDR_BROADCAST;
+        }
+    }
+#if 0
+    nAddr = INADDR_BROADCAST;
+#endif
+    m_pSink->OnDhcpMessage(nAddr, "<= Reply to %02x-%02x-%02x-%02x-%02x-%02x\n",
+                           ((PBYTE)&pEntry->idMac)[5],
+                           ((PBYTE)&pEntry->idMac)[4],
+                           ((PBYTE)&pEntry->idMac)[3],
+                           ((PBYTE)&pEntry->idMac)[2],
+                           ((PBYTE)&pEntry->idMac)[1],
+                           ((PBYTE)&pEntry->idMac)[0]);
+
+    SocketSend(nAddr, DHCP_CLIENT_PORT, pReply->rbPacket, pReply->cbPacket);
+    goto done;
+}
+
+//
+// Returns the node's reply template for this server, building it if the node
+// hasn't asked this server before or the network has changed since.  The
+// fields taken from each request are filled in by the caller.
+//
+DHCP_REPLY *CDhcp::GetReply(CDhcpNode *pEntry, BOOL fIsPxe)
+{
+    DHCP_REPLY *pReply;
+
+    for (pReply = pEntry->pReplies; pReply != NULL; pReply = pReply->pNext) {
+        if (pReply->nAddr == m_nAddr && pReply->fPxe == fIsPxe) {
+            if (pReply->nMask == m_nMask && pReply->nGate == m_nGate) {
+                return pReply;
+            }
+            break;                                      // Stale, rebuild.
+        }
+    }
+
+    if (pReply == NULL) {
+        pReply = new DHCP_REPLY;
+        if (pReply == NULL) {
+            return NULL;
+        }
+        pReply->pNext = pEntry->pReplies;
+        pEntry->pReplies = pReply;
+    }
+
+    pReply->nAddr = m_nAddr;
+    pReply->nMask = m_nMask;
+    pReply->nGate = m_nGate;
+    pReply->fPxe = fIsPxe;
+    pReply->pbClientId = NULL;
+
+    // fill in packet before sending
+    DHCP_CMD *pdhcpReply = (DHCP_CMD *)pReply->rbPacket;
+
+    memset(pdhcpReply, 0, sizeof(*pdhcpReply));
+
+    pdhcpReply->op     = BOOTREPLY; // REPLY
+    pdhcpReply->htype  = 1; // ETHERNET
+    pdhcpReply->hlen   = 6; // 6 BYTE HARDWARE ADDRESS LENGTH (MAC)
+    pdhcpReply->hops   = 0;
+    pdhcpReply->secs   = 0;
     pdhcpReply->siaddr = htonl(m_nAddr);
     pdhcpReply->giaddr = 0;
-    memcpy(pdhcpReply->chaddr, dhcpRequest->chaddr, 16);
     sprintf(pdhcpReply->sname, "%d.%d.%d.%d",
             ((BYTE *)&m_nAddr)[3],
             ((BYTE *)&m_nAddr)[2],
@@ -902,20 +993,9 @@ VOID CDhcp::OnSocketRecv(UINT dwError,
     // START OF OPTION ADDITIONS
 
     // DHCP MESSAGE TYPE OPTION - MUST BE FIRST OPTION
-    BYTE data[1] = { DHCPACK };
-    if (dhcpRequest->DHCP.options.Data[0] == DHCPREQUEST) {
-        data[0] = DHCPACK;
-        if (m_pSink) {
-            m_pSink->OnDhcpAck(pEntry->iaAssigned, idMac);
-        }
-    }
-    else if (dhcpRequest->DHCP.options.Data[0] == DHCPDISCOVER) {
-        data[0] = DHCPOFFER;
-        if (m_pSink) {
-            m_pSink->OnDhcpOffer(pEntry->iaAssigned, idMac);
-        }
-    }
+    BYTE data[1] = { DHCPOFFER };
 
+    pReply->pbType = pOptions->Data;
     AddOption(pOptions, DHCP_OPTION_MESSAGE_TYPE, 1, data);
     if (fIsPxe) {
         AddOption(pOptions, DHCP_OPTION_SERVER_IDENTIFIER, m_nAddr);
@@ -930,9 +1010,9 @@ VOID CDhcp::OnSocketRecv(UINT dwError,
         AddOption(pOptions, DHCP_OPTION_SUBNET_MASK, m_nMask);
 
         BYTE ClientId[17];
-        ClientId[0] = 0x00;
-        memcpy(ClientId + 1, &guidPxeClientId, sizeof(guidPxeClientId));
+        memset(ClientId, 0, sizeof(ClientId));
 
+        pReply->pbClientId = pOptions->Data + 1;
         AddOption(pOptions, DHCP_OPTION_PXE_CLIENT_ID, sizeof(ClientId), ClientId);
         AddOption(pOptions, DHCP_OPTION_CLIENT_CLASS_INFO, 9, (BYTE*)"PXEClient");
         AddOption(pOptions, DHCP_OPTION_HOST_NAME,
@@ -955,40 +1035,11 @@ VOID CDhcp::OnSocketRecv(UINT dwError,
     // END OF OPTION ADDITIONS
 
     // calc size of added options, minus the single option already included
-    UINT32 dwOptionSize = (UINT32)pOptions - (UINT32)&pdhcpReply->DHCP.options;
-    UINT32 dwPacketOutSize = sizeof(*pdhcpReply) + dwOptionSize - 3;
+    UINT32 dwOptionSize = (UINT32)((PBYTE)pOptions - (PBYTE)&pdhcpReply->DHCP.options);
+    pReply->cbPacket = sizeof(*pdhcpReply) + dwOptionSize - 3;
     // 3 since first option is already included in structure
 
-    // always AF_INET
-    if (nAddr == 0) {
-        nAddr = INADDR_BROADCAST;
-    }
-
-    // broadcast, or use the client specified address for replies
-    if (ntohs(dhcpRequest->flags) & 0x8000) {
-        nAddr = INADDR_BROADCAST;
-    }
-    else {
-        if (dhcpRequest->ciaddr) {
-            nAddr = pEntry->iaLast;
-        }
-        else {
-            nAddr = INADDR_BROADCAST;
-        }
-    }
-#if 0
-    nAddr = INADDR_BROADCAST;
-#endif
-    m_pSink->OnDhcpMessage(nAddr, "<= Reply to %02x-%02x-%02x-%02x-%02x-%02x\n",
-                           ((PBYTE)&pEntry->idMac)[5],
-                           ((PBYTE)&pEntry->idMac)[4],
-                           ((PBYTE)&pEntry->idMac)[3],
-                           ((PBYTE)&pEntry->idMac)[2],
-                           ((PBYTE)&pEntry->idMac)[1],
-                           ((PBYTE)&pEntry->idMac)[0]);
-
-    SocketSend(nAddr, DHCP_CLIENT_PORT, (PBYTE)PacketOut, dwPacketOutSize);
-    goto done;
+    return pReply;
 }
 
 //
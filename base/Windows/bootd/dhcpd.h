@@ -13,6 +13,7 @@
 //
 class CDhcp;
 class CDhcpNode;
+struct DHCP_REPLY;
 
 class IDhcpSink
 {
@@ -29,6 +30,7 @@ class CDhcpNode
   public:
     friend class CDhcpNode;
     CDhcpNode();
+    ~CDhcpNode();
 
   public:
     BOOL    Enabled;
@@ -38,6 +40,8 @@ class CDhcpNode
 
     UINT32  iaLast;                                     // Last known good addr.
     UINT32  iaAssigned;                                 // Addr we want to assign.
+
+    DHCP_REPLY *pReplies;                               // Built replies, per server.
 };
 
 class CDhcpState
@@ -58,8 +62,6 @@ class CDhcpState
     BOOL    ReadMacEntries(PCSTR pszFile);
     BOOL    AddMacEntry(PCSTR psz);
 
-    BOOL    IsPxeDhcpPacket(PBYTE pbPacket, UINT32 cbPacket);
-
   protected:
     CHAR    m_szBootFile[MAX_PATH];
     CHAR    m_szCommand[MAX_PATH];
@@ -84,6 +86,9 @@ class CDhcp : public CSocketSink
     VOID    OnNetworkChange(UINT32 nAddr, UINT32 nMask, UINT32 nGate);
     VOID    OnNetworkDelete(UINT32 nAddr, CDhcp **ppNext);
 
+  protected:
+    DHCP_REPLY *GetReply(CDhcpNode *pEntry, BOOL fIsPxe);
+
   protected:
     UINT32  m_nAddr;
     UINT32  m_nMask;
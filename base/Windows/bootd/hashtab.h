@@ -1,124 +1,397 @@
 //////////////////////////////////////////////////////////////////////////////
 //
-//  Abstract:   Definition of Template CHashTable32<> and class CHashTable32PVOID.
+//  Abstract:   Definition of Templates CHashTable<>, CHashTable32<> and
+//              CHashTable64<>.
 //
-//  NOTE: The keys 0 and ~0 are both reserved for internal use.
+//  Open addressing with linear probing over a power-of-two table.  Keys are
+//  kept apart from values so that a probe compares a 16-byte group of keys
+//  at a time (SSE2 where available).  The first GROUP-1 keys are mirrored
+//  past the end of the key array, so a group never has to wrap.  Deletion
+//  shifts the rest of the probe run back instead of leaving tombstones, so
+//  lookups never slow down as sessions come and go.
+//
+//  NOTE: The key 0 is reserved for internal use.
+//
+//  NOTE: Deleting during Enumerate may move an entry the iterator has not
+//        reached yet into a slot it has passed.  Callers that delete while
+//        enumerating must restart the enumeration after each delete.
 //
 
 #pragma once
 
-//////////////////////////////////////////////////////////////// Base Classes.
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define HASHTAB_SSE2 1
+#endif
+
+//////////////////////////////////////////////////////////////////// Hashing.
+//
+// MurmurHash3 finalizers: every key bit affects every hash bit, so the low
+// bits used to index the table are well mixed even for sequential keys.
+//
+inline UINT32 HashTableMix(UINT32 key)
+{
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+    return key;
+}
+
+inline UINT32 HashTableMix(UINT64 key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return (UINT32)key;
+}
+
+inline UINT HashTableFirstBit(UINT mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/////////////////////////////////////////////////////////////////// Templates.
 //
-class CHashTable32PVOID
+template<class K, class T> class CHashTable
 {
   public:
-    CHashTable32PVOID();
-    CHashTable32PVOID(INT nInitialSize);
-    ~CHashTable32PVOID();
+    CHashTable()
+    {
+        m_pKeys = NULL;
+        m_pValues = NULL;
+        m_nSize = 0;
+        m_nMask = 0;
+        m_nValid = 0;
+    }
+
+    CHashTable(INT nInitialSize)
+    {
+        m_pKeys = NULL;
+        m_pValues = NULL;
+        m_nSize = 0;
+        m_nMask = 0;
+        m_nValid = 0;
+        Resize(nInitialSize);
+    }
 
-    BOOL    Insert(UINT32 key, PVOID value);
-    BOOL    Change(UINT32 key, PVOID value);
-    BOOL    Delete(UINT32 key);
+    ~CHashTable()
+    {
+        delete[] m_pKeys;
+        delete[] m_pValues;
+        m_pKeys = NULL;
+        m_pValues = NULL;
+        m_nSize = 0;
+        m_nMask = 0;
+        m_nValid = 0;
+    }
+
+    BOOL    Insert(K key, T value);         // FALSE if key is already present.
+    BOOL    Change(K key, T value);
+    BOOL    Delete(K key);
 
-    PVOID   Find(UINT32 key);
-    PVOID   Enumerate(UINT32& key, INT& nIterator);
+    T       Find(K key);
+    T       Enumerate(K& key, INT& nIterator);
 
     INT     Count(void) { return m_nValid; }
 
   protected:
-    struct Entry
-    {
-        UINT32  key;
-        PVOID   value;
+    enum {
+        GROUP = 16 / sizeof(K),             // Keys compared per probe.
+        MIN_SIZE = 32,
     };
 
-    INT     Offset(UINT32 key) { return (INT)((key*1000000007L)%m_nSize); }
-    VOID    Swap(Entry& a, Entry& b) { Entry t = a; a = b; b = t; }
+    UINT    Home(K key) { return HashTableMix(key) & m_nMask; }
+    VOID    MatchGroup(UINT nSlot, K key, UINT *pnMatch, UINT *pnEmpty);
+    INT     Probe(K key, UINT *pnEmpty);
+    VOID    SetKey(UINT nSlot, K key);
     BOOL    Resize(INT nNewSize);
-    Entry * FindEntry(UINT32 key);
 
   protected:
-    Entry * m_pTable;
+    K *     m_pKeys;                        // m_nSize + GROUP - 1 keys.
+    T *     m_pValues;
     INT     m_nSize;
+    UINT    m_nMask;
     INT     m_nValid;
 };
 
-class CHashTable64PVOID
+//
+// Compares the group of keys starting at nSlot with key and with 0.  The
+// masks have a bit per byte of the group, so key n of the group is at bit
+// n * sizeof(K).
+//
+template<class K, class T>
+VOID CHashTable<K,T>::MatchGroup(UINT nSlot, K key, UINT *pnMatch, UINT *pnEmpty)
 {
-  public:
-    CHashTable64PVOID();
-    CHashTable64PVOID(INT nInitialSize);
-    ~CHashTable64PVOID();
+#ifdef HASHTAB_SSE2
+    __m128i group = _mm_loadu_si128((__m128i *)&m_pKeys[nSlot]);
+    __m128i zero = _mm_setzero_si128();
+    __m128i match;
+    __m128i empty;
 
-    BOOL    Insert(UINT64 key, PVOID value);
-    BOOL    Change(UINT64 key, PVOID value);
-    BOOL    Delete(UINT64 key);
+    if (sizeof(K) == 4) {
+        match = _mm_cmpeq_epi32(group, _mm_set1_epi32((int)key));
+        empty = _mm_cmpeq_epi32(group, zero);
+    }
+    else {
+        // No 64-bit compare in SSE2: both halves of a key have to match.
+        __m128i needle = _mm_unpacklo_epi32(_mm_set1_epi32((int)(UINT32)key),
+                                            _mm_set1_epi32((int)(UINT32)((UINT64)key >> 32)));
+        match = _mm_cmpeq_epi32(group, needle);
+        match = _mm_and_si128(match, _mm_shuffle_epi32(match, _MM_SHUFFLE(2, 3, 0, 1)));
+        empty = _mm_cmpeq_epi32(group, zero);
+        empty = _mm_and_si128(empty, _mm_shuffle_epi32(empty, _MM_SHUFFLE(2, 3, 0, 1)));
+    }
 
-    PVOID   Find(UINT64 key);
-    PVOID   Enumerate(UINT64& key, INT& nIterator);
+    *pnMatch = (UINT)_mm_movemask_epi8(match);
+    *pnEmpty = (UINT)_mm_movemask_epi8(empty);
+#else
+    *pnMatch = 0;
+    *pnEmpty = 0;
 
-    INT     Count(void) { return m_nValid; }
+    for (UINT n = 0; n < GROUP; n++) {
+        if (m_pKeys[nSlot + n] == key) {
+            *pnMatch |= 1u << (n * sizeof(K));
+        }
+        else if (m_pKeys[nSlot + n] == 0) {
+            *pnEmpty |= 1u << (n * sizeof(K));
+        }
+    }
+#endif
+}
 
-  protected:
-    struct Entry
-    {
-        UINT64  key;
-        PVOID   value;
-    };
+//
+// Walks the probe run for key a group at a time.  Returns the slot holding
+// key, or -1 with *pnEmpty set to the first free slot of the run.
+//
+template<class K, class T>
+INT CHashTable<K,T>::Probe(K key, UINT *pnEmpty)
+{
+    UINT nSlot = Home(key);
 
-    INT     Offset(UINT64 key) { return (INT)((key*1000000007UL)%m_nSize); }
-    VOID    Swap(Entry& a, Entry& b) { Entry t = a; a = b; b = t; }
-    BOOL    Resize(INT nNewSize);
-    Entry * FindEntry(UINT64 key);
+    for (;;) {
+        UINT match;
+        UINT empty;
 
-  protected:
-    Entry * m_pTable;
-    INT     m_nSize;
-    INT     m_nValid;
-};
+        MatchGroup(nSlot, key, &match, &empty);
 
-/////////////////////////////////////////////////////////////////// Templates.
-//
-template<class T> class CHashTable32 : public CHashTable32PVOID
+        if (match != 0) {
+            UINT n = HashTableFirstBit(match);
+
+            // Keys past the end of the run belong to other runs.
+            if (empty == 0 || n < HashTableFirstBit(empty)) {
+                return (INT)((nSlot + n / sizeof(K)) & m_nMask);
+            }
+        }
+        if (empty != 0) {
+            *pnEmpty = (nSlot + HashTableFirstBit(empty) / sizeof(K)) & m_nMask;
+            return -1;
+        }
+        nSlot = (nSlot + GROUP) & m_nMask;
+    }
+}
+
+template<class K, class T>
+VOID CHashTable<K,T>::SetKey(UINT nSlot, K key)
 {
-  public:
-    CHashTable32()
-        : CHashTable32PVOID() {}
-    CHashTable32(INT nInitialSize)
-        : CHashTable32PVOID(nInitializeSize) {}
+    m_pKeys[nSlot] = key;
+    if (nSlot < GROUP - 1) {
+        m_pKeys[m_nSize + nSlot] = key;
+    }
+}
 
-    BOOL Insert(UINT32 key, T value)
-    { return CHashTable32PVOID::Insert(key, (PVOID)value); }
+template<class K, class T>
+T CHashTable<K,T>::Find(K key)
+{
+    UINT nEmpty;
 
-    BOOL Change(UINT32 key, T value)
-    { return CHashTable32PVOID::Change(key, (PVOID)value); }
+    if (key == 0 || m_nSize == 0) {
+        return T();
+    }
 
-    T Find(UINT32 key)
-    { return (T)CHashTable32PVOID::Find(key); }
+    INT nSlot = Probe(key, &nEmpty);
+    return (nSlot >= 0) ? m_pValues[nSlot] : T();
+}
 
-    T Enumerate(UINT32& key, INT& nIterator)
-    { return (T)CHashTable32PVOID::Enumerate(key, nIterator); }
-};
+template<class K, class T>
+BOOL CHashTable<K,T>::Change(K key, T value)
+{
+    UINT nEmpty;
 
-template<class T> class CHashTable64 : public CHashTable64PVOID
+    if (key != 0 && m_nSize != 0) {
+        INT nSlot = Probe(key, &nEmpty);
+        if (nSlot >= 0) {
+            m_pValues[nSlot] = value;
+            return TRUE;
+        }
+    }
+    return Insert(key, value);
+}
+
+template<class K, class T>
+BOOL CHashTable<K,T>::Insert(K key, T value)
 {
-  public:
-    CHashTable64()
-        : CHashTable64PVOID() {}
-    CHashTable64(INT nInitialSize)
-        : CHashTable64PVOID(nInitializeSize) {}
+    UINT nEmpty;
+
+    if (key == 0) {
+        return FALSE;
+    }
+
+    if ((m_nValid + 1) > (m_nSize / 2)) {               // Table is never > 1/2 full!
+        if (!Resize(m_nSize == 0 ? MIN_SIZE : m_nSize * 2)) {
+            return FALSE;
+        }
+    }
+
+    if (Probe(key, &nEmpty) >= 0) {
+        return FALSE;
+    }
+
+    SetKey(nEmpty, key);
+    m_pValues[nEmpty] = value;
+    m_nValid++;
+    return TRUE;
+}
+
+template<class K, class T>
+BOOL CHashTable<K,T>::Delete(K key)
+{
+    UINT nEmpty;
+
+    if (key == 0 || m_nSize == 0) {
+        return FALSE;
+    }
+
+    INT nFound = Probe(key, &nEmpty);
+    if (nFound < 0) {
+        return FALSE;
+    }
+
+    //
+    // Close the gap: move back each later key of the run that is allowed to
+    // live in the hole, i.e. whose home isn't between the hole and itself.
+    //
+    UINT nHole = (UINT)nFound;
+    UINT nNext = nHole;
+
+    for (;;) {
+        nNext = (nNext + 1) & m_nMask;
+
+        K next = m_pKeys[nNext];
+        if (next == 0) {
+            break;
+        }
+
+        UINT nHome = Home(next);
+        if (((nNext - nHome) & m_nMask) >= ((nNext - nHole) & m_nMask)) {
+            SetKey(nHole, next);
+            m_pValues[nHole] = m_pValues[nNext];
+            nHole = nNext;
+        }
+    }
+
+    SetKey(nHole, 0);
+    m_pValues[nHole] = T();
+    m_nValid--;
+    return TRUE;
+}
 
-    BOOL Insert(UINT64 key, T value)
-    { return CHashTable64PVOID::Insert(key, (PVOID)value); }
+template<class K, class T>
+BOOL CHashTable<K,T>::Resize(INT nNewSize)
+{
+    K *pOldKeys = m_pKeys;
+    T *pOldValues = m_pValues;
+    INT nOldSize = m_nSize;
+    INT nSize = MIN_SIZE;
+
+    while (nSize < nNewSize) {
+        nSize *= 2;
+    }
+
+    K *pKeys = new K[nSize + GROUP - 1];
+    T *pValues = new T[nSize];
+    if (pKeys == NULL || pValues == NULL) {
+        delete[] pKeys;
+        delete[] pValues;
+        return FALSE;
+    }
+
+    for (INT i = 0; i < nSize + GROUP - 1; i++) {
+        pKeys[i] = 0;
+    }
+    for (INT i = 0; i < nSize; i++) {
+        pValues[i] = T();
+    }
+
+    m_pKeys = pKeys;
+    m_pValues = pValues;
+    m_nSize = nSize;
+    m_nMask = (UINT)nSize - 1;
+    m_nValid = 0;
+
+    if (pOldKeys) {
+        for (INT i = 0; i < nOldSize; i++) {
+            if (pOldKeys[i] != 0) {
+                UINT nEmpty;
+
+                Probe(pOldKeys[i], &nEmpty);
+                SetKey(nEmpty, pOldKeys[i]);
+                m_pValues[nEmpty] = pOldValues[i];
+                m_nValid++;
+            }
+        }
+        delete[] pOldKeys;
+        delete[] pOldValues;
+    }
+
+    return TRUE;
+}
+
+template<class K, class T>
+T CHashTable<K,T>::Enumerate(K& key, INT& nIterator)
+{
+    for (; nIterator < m_nSize; nIterator++) {
+        if (m_pKeys[nIterator] == 0) {
+            continue;
+        }
 
-    BOOL Change(UINT64 key, T value)
-    { return CHashTable64PVOID::Change(key, (PVOID)value); }
+        key = m_pKeys[nIterator];
+        return m_pValues[nIterator++];
+    }
 
-    T Find(UINT64 key)
-    { return (T)CHashTable64PVOID::Find(key); }
+    key = 0;
+    nIterator = 0;
+    return T();
+}
 
-    T Enumerate(UINT64& key, INT& nIterator)
-    { return (T)CHashTable64PVOID::Enumerate(key, nIterator); }
+template<class T> class CHashTable32 : public CHashTable<UINT32, T>
+{
+  public:
+    CHashTable32()
+        : CHashTable<UINT32, T>() {}
+    CHashTable32(INT nInitialSize)
+        : CHashTable<UINT32, T>(nInitialSize) {}
+};
+
+template<class T> class CHashTable64 : public CHashTable<UINT64, T>
+{
+  public:
+    CHashTable64()
+        : CHashTable<UINT64, T>() {}
+    CHashTable64(INT nInitialSize)
+        : CHashTable<UINT64, T>(nInitialSize) {}
 };
 //
 ///////////////////////////////////////////////////////////////// End of File.
@@ -9,7 +9,7 @@
 //
 //
 #include <winlean.h>
-#include <winsock.h>
+#include <winsock2.h>
 #include <iphlpapi.h>
 #include <assert.h>
 #include <stdio.h>
@@ -65,8 +65,9 @@ static int __cdecl cmpIpForwardRow(const void *fvp, const void *svp)
 
 PCSTR SocketToString(UINT32 dwAddr)
 {
-    static CHAR rszAddrs[16][32];
-    static int nAddrs = 0;
+    // Per thread, so TFTP workers can log.
+    static __declspec(thread) CHAR rszAddrs[16][32];
+    static __declspec(thread) int nAddrs = 0;
 
     CHAR *pszAddr = rszAddrs[nAddrs];
     nAddrs = (nAddrs + 1) % ARRAYOF(rszAddrs);
@@ -424,10 +425,13 @@ struct CSocketSource : public ISocketSource
     // ISocketSource
   public:
     virtual UINT    SocketSend(UINT32 nAddr, UINT16 nPort, PBYTE pbData, UINT cbData);
+    virtual UINT    SocketSendGather(UINT32 nAddr, UINT16 nPort,
+                                     PBYTE pbHead, UINT cbHead,
+                                     PBYTE pbData, UINT cbData);
     virtual UINT    SocketClose(UINT dwError);
 
   public:
-    VOID OnRecv();
+    BOOL OnRecv();
 
     SOCKET          m_nSocket;
     ISocketSink *   m_pSink;
@@ -435,9 +439,50 @@ struct CSocketSource : public ISocketSource
 
 //////////////////////////////////////////////////////////////////////////////
 //
-static HWND             s_hWnd;                         // Host Window
-static UINT             s_nMsg;                         // Host Event
-static CHashTable32<CSocketSource*> s_Sockets;
+// Every socket signals the same event on FD_READ.  SocketPoll wakes on it and
+// drains each socket of up to SOCKET_RECV_BATCH datagrams, rather than taking
+// one datagram per window message.
+//
+#define SOCKET_RECV_BATCH   64
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Timers live on a hashed timing wheel of TIMER_WHEEL_SLOTS slots, one per
+// TIMER_TICK milliseconds, with a count of whole revolutions for timers set
+// further out.  Setting, clearing and firing a timer are all O(1) however
+// many sessions are waiting.  Like the window timers they replace, timers
+// are periodic and keep firing until cleared.
+//
+#define TIMER_TICK          50
+#define TIMER_WHEEL_SLOTS   256
+
+struct CTimer
+{
+    CTimer *        pNext;
+    CTimer *        pPrev;
+    ITimerSink *    pSink;
+    UINT            nTicks;                             // Period.
+    UINT            nRounds;                            // Revolutions to go.
+};
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Each thread that calls SocketInit gets its own event loop.  Sockets and
+// timers belong to the loop of the thread that created them and must only be
+// used from that thread.
+//
+struct CEventLoop
+{
+    HANDLE                          m_hEvent;           // FD_READ on any socket
+    CHashTable32<CSocketSource*>    m_Sockets;
+    CTimer                          m_rTimerWheel[TIMER_WHEEL_SLOTS];
+    UINT                            m_nTimerSlot;       // Next slot to expire.
+    DWORD                           m_dwTimerLast;      // Time of last tick.
+    CHashTable64<CTimer*>           m_Timers;           // Keyed by sink.
+    BYTE                            m_rbRecv[65536];    // Largest UDP datagram
+};
+
+static __declspec(thread) CEventLoop * s_pLoop;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -475,26 +520,54 @@ UINT CSocketSource::SocketSend(UINT32 nAddr, UINT16 nPort, PBYTE pbData, UINT cb
     return (SOCKET_ERROR == iRes) ? WSAGetLastError() : 0;
 }
 
-VOID CSocketSource::OnRecv()
+UINT CSocketSource::SocketSendGather(UINT32 nAddr, UINT16 nPort,
+                                     PBYTE pbHead, UINT cbHead,
+                                     PBYTE pbData, UINT cbData)
+{
+    // Fill out server socket's address information.
+    SOCKADDR_IN server_sin;
+    server_sin.sin_family = AF_INET;
+    server_sin.sin_port = htons(nPort);
+    server_sin.sin_addr.s_addr = htonl(nAddr);
+
+    WSABUF rBuffers[2];
+    rBuffers[0].buf = (CHAR *)pbHead;
+    rBuffers[0].len = cbHead;
+    rBuffers[1].buf = (CHAR *)pbData;
+    rBuffers[1].len = cbData;
+
+    DWORD cbSent = 0;
+    int iRes = WSASendTo(m_nSocket, rBuffers, ARRAYOF(rBuffers), &cbSent,
+                         0, (struct sockaddr FAR *) &server_sin, sizeof(server_sin),
+                         NULL, NULL);
+    return (SOCKET_ERROR == iRes) ? WSAGetLastError() : 0;
+}
+
+// Returns FALSE once the socket has nothing more to read.
+BOOL CSocketSource::OnRecv()
 {
     SOCKADDR_IN from;
     int fromlen = sizeof(from);
 
-    BYTE rbData[2048];
-    int iRes = recvfrom(m_nSocket, (char *)rbData, sizeof(rbData), 0,
+    int iRes = recvfrom(m_nSocket,
+                        (char *)s_pLoop->m_rbRecv, sizeof(s_pLoop->m_rbRecv), 0,
                         (struct sockaddr *)&from, &fromlen);
     int nErr = (iRes == SOCKET_ERROR) ? WSAGetLastError() : 0;
 
-    if (nErr == WSAECONNRESET || nErr == WSAEWOULDBLOCK) {
+    if (nErr == WSAEWOULDBLOCK) {
+        return FALSE;
+    }
+    else if (nErr == WSAECONNRESET) {
         // Lost a packet.  Don't worry about it.
     }
     else {
         m_pSink->OnSocketRecv(nErr,
                               ntohl(from.sin_addr.s_addr),
                               ntohs(from.sin_port),
-                              rbData,
+                              s_pLoop->m_rbRecv,
                               iRes);
     }
+    return TRUE;
 }
 
 UINT CSocketSource::SocketClose(UINT dwError)
@@ -504,7 +577,7 @@ UINT CSocketSource::SocketClose(UINT dwError)
         ISocketSink *pSink = m_pSink;
         m_pSink = NULL;
 
-        s_Sockets.Delete(m_nSocket);
+        s_pLoop->m_Sockets.Delete(m_nSocket);
         pSink->OnSocketClose(dwError);
         delete this;
     }
@@ -513,29 +586,194 @@ UINT CSocketSource::SocketClose(UINT dwError)
 
 //////////////////////////////////////////////////////////////////////////////
 //
-VOID SocketInit(HWND hWnd, UINT nMsg)
+BOOL SocketInit(VOID)
 {
-    s_hWnd = hWnd;
-    s_nMsg = nMsg;
+    if ((s_pLoop = new CEventLoop) == NULL) {
+        return FALSE;
+    }
+
+    for (UINT n = 0; n < TIMER_WHEEL_SLOTS; n++) {
+        s_pLoop->m_rTimerWheel[n].pNext = &s_pLoop->m_rTimerWheel[n];
+        s_pLoop->m_rTimerWheel[n].pPrev = &s_pLoop->m_rTimerWheel[n];
+    }
+    s_pLoop->m_nTimerSlot = 0;
+    s_pLoop->m_dwTimerLast = GetTickCount();
+
+    s_pLoop->m_hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    return s_pLoop->m_hEvent != NULL;
 }
 
-LRESULT SocketEvent(WPARAM wParam, LPARAM lParam)
+static VOID TimerUnlink(CTimer *pTimer)
 {
-    WORD wSelectError = HIWORD(lParam);
-    WORD wSelectEvent = LOWORD(lParam);
-    DWORD dwSocket = wParam;
+    pTimer->pPrev->pNext = pTimer->pNext;
+    pTimer->pNext->pPrev = pTimer->pPrev;
+    pTimer->pNext = pTimer;
+    pTimer->pPrev = pTimer;
+}
 
-    (void)wSelectError;
+static VOID TimerInsert(CTimer *pHead, CTimer *pTimer)
+{
+    pTimer->pNext = pHead;
+    pTimer->pPrev = pHead->pPrev;
+    pHead->pPrev->pNext = pTimer;
+    pHead->pPrev = pTimer;
+}
 
-    CSocketSource *pSource = s_Sockets.Find(dwSocket);
-    if (pSource == NULL) {
-        return 0;
+// Put the timer on the wheel one period from now.
+static VOID TimerLink(CTimer *pTimer)
+{
+    UINT nTicks = pTimer->nTicks - 1;
+    UINT nSlot = (s_pLoop->m_nTimerSlot + nTicks) % TIMER_WHEEL_SLOTS;
+
+    pTimer->nRounds = nTicks / TIMER_WHEEL_SLOTS;
+    TimerInsert(&s_pLoop->m_rTimerWheel[nSlot], pTimer);
+}
+
+BOOL TimerSet(ITimerSink *pTimerSink, UINT nMilliseconds)
+{
+    UINT64 nKey = (UINT64)(ULONG_PTR)pTimerSink;
+    CTimer *pTimer = s_pLoop->m_Timers.Find(nKey);
+
+    if (pTimer != NULL) {
+        TimerUnlink(pTimer);
     }
+    else {
+        if ((pTimer = new CTimer) == NULL) {
+            return FALSE;
+        }
+        pTimer->pNext = pTimer;
+        pTimer->pPrev = pTimer;
+        pTimer->pSink = pTimerSink;
 
-    if (wSelectEvent & FD_READ) {
-        pSource->OnRecv();
+        if (s_pLoop->m_Timers.Count() == 0) {
+            // The wheel has been idle, don't make it catch up.
+            s_pLoop->m_dwTimerLast = GetTickCount();
+        }
+        s_pLoop->m_Timers.Insert(nKey, pTimer);
     }
-    return 0;
+
+    pTimer->nTicks = max((nMilliseconds + TIMER_TICK - 1) / TIMER_TICK, 1);
+    TimerLink(pTimer);
+    return TRUE;
+}
+
+BOOL TimerClr(ITimerSink *pTimerSink)
+{
+    UINT64 nKey = (UINT64)(ULONG_PTR)pTimerSink;
+    CTimer *pTimer = s_pLoop->m_Timers.Find(nKey);
+
+    if (pTimer == NULL) {
+        return FALSE;
+    }
+    TimerUnlink(pTimer);
+    s_pLoop->m_Timers.Delete(nKey);
+    delete pTimer;
+    return TRUE;
+}
+
+//
+// Fire every timer due since the last call.  Due timers move to a private list
+// and are re-armed before their sink runs, so a sink can set or clear any
+// timer, including its own, from OnTimerFired.
+//
+static VOID TimerRun()
+{
+    DWORD dwNow = GetTickCount();
+
+    while (dwNow - s_pLoop->m_dwTimerLast >= TIMER_TICK) {
+        CTimer *pHead = &s_pLoop->m_rTimerWheel[s_pLoop->m_nTimerSlot];
+        CTimer Expired;
+        CTimer *pTimer;
+        CTimer *pNext;
+
+        s_pLoop->m_dwTimerLast += TIMER_TICK;
+        s_pLoop->m_nTimerSlot = (s_pLoop->m_nTimerSlot + 1) % TIMER_WHEEL_SLOTS;
+
+        Expired.pNext = &Expired;
+        Expired.pPrev = &Expired;
+
+        for (pTimer = pHead->pNext; pTimer != pHead; pTimer = pNext) {
+            pNext = pTimer->pNext;
+
+            if (pTimer->nRounds > 0) {
+                pTimer->nRounds--;
+            }
+            else {
+                TimerUnlink(pTimer);
+                TimerInsert(&Expired, pTimer);
+            }
+        }
+
+        while (Expired.pNext != &Expired) {
+            pTimer = Expired.pNext;
+            TimerUnlink(pTimer);
+            TimerLink(pTimer);
+            pTimer->pSink->OnTimerFired();
+        }
+    }
+}
+
+static VOID SocketDrain()
+{
+    INT nSockets = s_pLoop->m_Sockets.Count();
+    if (nSockets == 0) {
+        return;
+    }
+
+    // Snapshot the sockets; a sink may close its socket while we drain it.
+    UINT32 *pSockets = new UINT32 [nSockets];
+    if (pSockets == NULL) {
+        SetEvent(s_pLoop->m_hEvent);
+        return;
+    }
+
+    INT nFound = 0;
+    UINT32 nKey;
+    for (INT nIt = 0; nFound < nSockets && s_pLoop->m_Sockets.Enumerate(nKey, nIt) != NULL;) {
+        pSockets[nFound++] = nKey;
+    }
+
+    for (INT n = 0; n < nFound; n++) {
+        UINT nRecv = 0;
+        CSocketSource *pSource;
+
+        while ((pSource = s_pLoop->m_Sockets.Find(pSockets[n])) != NULL && pSource->OnRecv()) {
+            if (++nRecv == SOCKET_RECV_BATCH) {
+                // Give the other sockets a turn, then come back.
+                SetEvent(s_pLoop->m_hEvent);
+                break;
+            }
+        }
+    }
+    delete[] pSockets;
+}
+
+//
+// Wait for socket traffic, I/O completion routines or the next timer tick,
+// then dispatch whatever is ready.  Returns FALSE if the wait fails.
+//
+BOOL SocketPoll(VOID)
+{
+    DWORD dwTimeout = INFINITE;
+
+    if (s_pLoop->m_Timers.Count() != 0) {
+        DWORD dwElapsed = GetTickCount() - s_pLoop->m_dwTimerLast;
+        dwTimeout = (dwElapsed < TIMER_TICK) ? TIMER_TICK - dwElapsed : 0;
+    }
+
+    // Alertable, so overlapped file I/O completion routines run here.
+    DWORD dwWait = WaitForSingleObjectEx(s_pLoop->m_hEvent, dwTimeout, TRUE);
+
+    if (dwWait == WAIT_FAILED) {
+        return FALSE;
+    }
+    if (dwWait == WAIT_OBJECT_0) {
+        SocketDrain();
+    }
+    if (s_pLoop->m_Timers.Count() != 0) {
+        TimerRun();
+    }
+    return TRUE;
 }
 
 UINT SocketCreate(UINT32 nLocalAddr, UINT16 wLocalPort, ISocketSink *pSink)
@@ -580,6 +818,14 @@ UINT SocketCreate(UINT32 nLocalAddr, UINT16 wLocalPort, ISocketSink *pSink)
         goto SocketError;
     }
 
+    // leave room for a full TFTP window (up to 1MB) in the send queue.
+    INT optINT = 1024 * 1024;
+    iRes = setsockopt(s, SOL_SOCKET, SO_SNDBUF,
+                      (char *)&optINT, sizeof(optINT));
+    if (0 != iRes) {
+        goto SocketError;
+    }
+
     // Fill out the client socket's address information.
     SOCKADDR_IN client_sin;
     client_sin.sin_family = AF_INET;
@@ -599,9 +845,8 @@ UINT SocketCreate(UINT32 nLocalAddr, UINT16 wLocalPort, ISocketSink *pSink)
         goto SocketError;
     }
 
-    // Set windows for async event..
-    iRes = WSAAsyncSelect(s, s_hWnd, s_nMsg,
-                          FD_READ | FD_WRITE | FD_OOB | FD_ACCEPT | FD_CONNECT);
+    // Signal the poll event when datagrams arrive.
+    iRes = WSAEventSelect(s, s_pLoop->m_hEvent, FD_READ);
     if (SOCKET_ERROR == iRes) {
         goto SocketError;
     }
@@ -621,7 +866,7 @@ UINT SocketCreate(UINT32 nLocalAddr, UINT16 wLocalPort, ISocketSink *pSink)
     }
 #endif
 
-    s_Sockets.Insert(s, pSource);
+    s_pLoop->m_Sockets.Insert(s, pSource);
 
     pSink->OnSocketCreate(pSource);
     return 0;
@@ -666,6 +911,13 @@ struct CSocketFactory : public ISocketSink,
             return m_pOwner->SocketSend(m_nPeerAddr, m_nPeerPort, pbData, cbData);
         }
 
+        virtual UINT    SessionSendGather(PBYTE pbHead, UINT cbHead,
+                                          PBYTE pbData, UINT cbData)
+        {
+            return m_pOwner->SocketSendGather(m_nPeerAddr, m_nPeerPort,
+                                              pbHead, cbHead, pbData, cbData);
+        }
+
         virtual UINT    SessionClose(UINT dwError)
         {
             if (m_pSink) {
@@ -716,10 +968,15 @@ struct CSocketFactory : public ISocketSink,
             CSocketSession *pSession;
             UINT64 nKey;
 
-            for (INT nIt = 0; (pSession = m_Sessions.Enumerate(nKey, nIt)) != NULL;) {
+            // Sessions delete themselves from the m_Sessions, which can move
+            // the others around, so start from the top each time.
+            for (;;) {
+                INT nIt = 0;
+                if ((pSession = m_Sessions.Enumerate(nKey, nIt)) == NULL) {
+                    break;
+                }
                 pSession->SessionClose(dwError);
                 pSession = NULL;
-                // Sessions delete themselves from the m_Sessions.
             }
             pSink->OnFactoryClose(dwError);
 
@@ -824,6 +1081,12 @@ struct CSocketFactory : public ISocketSink,
         return m_pSource->SocketSend(nAddr, nPort, pbData, cbData);
     }
 
+    UINT    SocketSendGather(UINT32 nAddr, UINT16 nPort,
+                             PBYTE pbHead, UINT cbHead, PBYTE pbData, UINT cbData)
+    {
+        return m_pSource->SocketSendGather(nAddr, nPort, pbHead, cbHead, pbData, cbData);
+    }
+
   public:
     ISessionFactorySink *           m_pSink;
     ISocketSource *                 m_pSource;
@@ -850,5 +1113,111 @@ UINT SessionFactoryCreate(UINT32 nLocalAddr, UINT16 nLocalPort,
     return nError;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// A session with its own socket on an ephemeral port, talking to one peer.
+// This is what TFTP calls a transfer ID: the peer sends the rest of the
+// exchange to the port we answer from.
+//
+struct CPeerSession : public ISocketSink,
+                      public ISessionSource
+{
+    CPeerSession(UINT32 nPeerAddr, UINT16 nPeerPort, ISessionSink *pSink)
+        : m_pSource(NULL),
+          m_pSink(pSink),
+          m_nPeerAddr(nPeerAddr),
+          m_nPeerPort(nPeerPort)
+    {
+    }
+
+    // ISocketSink
+  public:
+    virtual VOID    OnSocketCreate(ISocketSource *pSource)
+    {
+        m_pSource = pSource;
+    }
+
+    virtual VOID    OnSocketRecv(UINT dwError,
+                                 UINT32 nAddr, UINT16 nPort,
+                                 PBYTE pbData, UINT cbData)
+    {
+        // Anything not from the peer's transfer ID isn't ours.
+        if (m_pSink && nAddr == m_nPeerAddr && nPort == m_nPeerPort) {
+            m_pSink->OnSessionRecv(dwError, pbData, cbData);
+        }
+    }
+
+    virtual VOID    OnSocketClose(UINT dwError)
+    {
+        if (m_pSource == NULL) {
+            // SocketCreate failed; SessionCreate cleans up.
+            return;
+        }
+        m_pSource = NULL;
+        SessionClose(dwError);
+        delete this;
+    }
+
+    // ISessionSource
+  public:
+    virtual UINT    SessionSend(PBYTE pbData, UINT cbData)
+    {
+        if (m_pSource == NULL) {
+            return WSAENOTSOCK;
+        }
+        return m_pSource->SocketSend(m_nPeerAddr, m_nPeerPort, pbData, cbData);
+    }
+
+    virtual UINT    SessionSendGather(PBYTE pbHead, UINT cbHead,
+                                      PBYTE pbData, UINT cbData)
+    {
+        if (m_pSource == NULL) {
+            return WSAENOTSOCK;
+        }
+        return m_pSource->SocketSendGather(m_nPeerAddr, m_nPeerPort,
+                                           pbHead, cbHead, pbData, cbData);
+    }
+
+    virtual UINT    SessionClose(UINT dwError)
+    {
+        if (m_pSink) {
+            ISessionSink *pSink = m_pSink;
+            m_pSink = NULL;
+
+            pSink->OnSessionClose(dwError);
+        }
+        if (m_pSource) {
+            // Calls back OnSocketClose, which deletes this.
+            m_pSource->SocketClose(0);
+        }
+        return 0;
+    }
+
+  public:
+    ISocketSource * m_pSource;
+    ISessionSink *  m_pSink;
+    UINT32          m_nPeerAddr;
+    UINT16          m_nPeerPort;
+};
+
+UINT SessionCreate(UINT32 nLocalAddr, UINT32 nPeerAddr, UINT16 nPeerPort,
+                   ISessionSink *pSink)
+{
+    CPeerSession *pSession = new CPeerSession(nPeerAddr, nPeerPort, pSink);
+    if (pSession == NULL) {
+        return (UINT)E_OUTOFMEMORY;
+    }
+
+    UINT nError = SocketCreate(nLocalAddr, 0, pSession);
+
+    if (nError != 0) {
+        delete pSession;
+        return nError;
+    }
+
+    pSink->OnSessionCreate(pSession, NULL);
+    return 0;
+}
+
 //
 ///////////////////////////////////////////////////////////////// End of File.
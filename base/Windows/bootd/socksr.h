@@ -45,6 +45,14 @@ class ISocketSource
                                PBYTE pbData,
                                UINT cbData) = 0;
 
+    // Sends one datagram made of pbHead followed by pbData.
+    virtual UINT    SocketSendGather(UINT32 nAddr,
+                                     UINT16 nPort,
+                                     PBYTE pbHead,
+                                     UINT cbHead,
+                                     PBYTE pbData,
+                                     UINT cbData) = 0;
+
     virtual UINT    SocketClose(UINT dwError) = 0;
 };
 
@@ -68,6 +76,8 @@ class ISessionSource
 {
   public:
     virtual UINT    SessionSend(PBYTE pbData, UINT cbData) = 0;
+    virtual UINT    SessionSendGather(PBYTE pbHead, UINT cbHead,
+                                      PBYTE pbData, UINT cbData) = 0;
     virtual UINT    SessionClose(UINT dwError) = 0;
 };
 
@@ -277,12 +287,14 @@ class CSessionFactorySink : public ISessionFactorySink
 BOOL    TimerSet(ITimerSink *pTimerSink, UINT nMilliseconds);
 BOOL    TimerClr(ITimerSink *pTimerSink);
 
-VOID    SocketInit(HWND hWnd, UINT nMsg);
-LRESULT SocketEvent(WPARAM wParam, LPARAM lParam);
+BOOL    SocketInit(VOID);
+BOOL    SocketPoll(VOID);
 UINT    SocketCreate(UINT32 nLocalAddr, UINT16 wLocalPort,
                      ISocketSink *pSink);
 UINT    SessionFactoryCreate(UINT32 nLocalAddr, UINT16 wLocalPort,
                              ISessionFactorySink *pFactorySink);
+UINT    SessionCreate(UINT32 nLocalAddr, UINT32 nPeerAddr, UINT16 nPeerPort,
+                      ISessionSink *pSink);
 
 BOOL    SocketLoadNetworks(CNetwork ** ppNetworks);
 
@@ -30,20 +30,18 @@
 #define ARRAYOF(x)          (sizeof(x)/sizeof(x[0]))
 #define OFFSETOF(s,m)       ((unsigned)&(((s *)0)->m))
 #define assert(x)           if (!(x)) __asm int 3
-#define WM_SOCKET_EVENT     (WM_USER+101)
 
 typedef USHORT UINT16;
 
 #include "hashtab.h"
 #include "tftpd.h"
 
-#include "hashtab.cpp"
-
 //////////////////////////////////////////////////////////////////////////////
 //
 
 //
-// Trivial File Transfer Protocol (TFTP) as per RFCs 1350, 1782, 1783 & 1784.
+// Trivial File Transfer Protocol (TFTP) as per RFCs 1350, 1782, 1783 & 1784,
+// plus the "windowsize" option of RFC 7440.
 //
 
 //
@@ -79,7 +77,7 @@ struct TftpHdr {
     CHAR        Data[1];        // data/error string
 
     PCSTR Dump(UINT cbData) {
-        static CHAR szBuffer[2048];
+        static __declspec(thread) CHAR szBuffer[2048];
         PCHAR pszBuffer = szBuffer;
 
         // In network order
@@ -131,7 +129,19 @@ struct TftpHdr {
 // option in the request packet, this number is 512.
 //
 #define DEFAULT_BLOCKSIZE   512
-#define MAX_BLOCKSIZE       8192
+#define MAX_BLOCKSIZE       65464   // RFC 2348 limit
+
+//
+// RFC 7440 lets the client ask for several DATA packets per ACK.  Without a
+// "windowsize" option the window is one block, which is plain lock-step TFTP.
+// We cap the window so that a session never has more than MAX_WINDOW_BYTES in
+// flight, and read ahead a second window into the ring while the first one is
+// on the wire.
+//
+#define DEFAULT_WINDOWSIZE  1
+#define MAX_WINDOWSIZE      64
+#define MAX_WINDOW_BYTES    (1024 * 1024)
+#define RING_WINDOWS        2
 
 //
 // The TFTP spec says nothing about default timeout values or retransmission
@@ -149,12 +159,29 @@ struct TftpHdr {
 #define DEFAULT_TIMEOUT     1  // in seconds
 #define MAX_RETRIES         4
 
+//
+// A read request for "<ini>.distro" returns every file listed in the distro
+// INI file (Singboot.ini), concatenated in INI order, so that the boot loader
+// can fetch the whole distro in one transfer.  Member names go through
+// ValidateName, so pxe.com.* renames apply just as they do for single reads.
+//
+#define DISTRO_STREAM_SUFFIX    ".distro"
+#define MAX_DISTRO_INI_SIZE     (1024 * 1024)
+
+struct DistroMember {
+    CHAR    szName[MAX_PATH];
+    UINT    cbSize;
+};
+
 //////////////////////////////////////////////////////////////////////////////
 //
+// The rename table is rebuilt by OnFilesChange while worker threads look
+// names up in it, so it is guarded by a critical section.
 CHAR s_rszRenames[64][64];
 UINT s_nRenames     = 0;
 UINT s_nRenamesBase = 0;
 BOOL s_fRenames     = TRUE;
+CRITICAL_SECTION s_csRenames;
 
 CHAR s_rszReadPaths[16][MAX_PATH];
 CHAR s_szWritePath[MAX_PATH];
@@ -163,6 +190,244 @@ UINT s_nPaths = 0;
 BOOL s_fExitOnENotFound = FALSE;
 BOOL s_fVerboseOutput   = FALSE;
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Files read by TFTP are mapped once and shared by every session reading
+// them, so a rack booting at once reads each file from disk once.  Entries
+// are keyed by resolved path, size and last write time: a file rebuilt on
+// disk gets a new mapping on the next request, while sessions still reading
+// the old one keep theirs.  The mapping is dropped when its last session
+// releases it, so files are never held open between boots.
+//
+// Sessions on TFTP worker threads share the cache, so it is guarded by a
+// critical section.  Mapping a file is done under the lock too, so two
+// workers asked for the same new file don't both map it.
+//
+class CFileCache
+{
+  public:
+    static VOID         Initialize();
+    static CFileCache * Open(PCSTR pszPath);
+    static VOID         Invalidate();
+
+    VOID    Release();
+
+  public:
+    PBYTE   m_pbData;
+    UINT    m_cbData;
+
+  protected:
+    CFileCache(PCSTR pszPath);
+    ~CFileCache();
+
+  protected:
+    CFileCache *    m_pNext;
+    UINT            m_nRefs;
+    BOOL            m_fStale;
+    FILETIME        m_ftWrite;
+    HANDLE          m_hMapping;
+    CHAR            m_szPath[MAX_PATH * 2];
+
+    static CFileCache * s_pFiles;
+    static CRITICAL_SECTION s_csFiles;
+};
+
+CFileCache * CFileCache::s_pFiles = NULL;
+CRITICAL_SECTION CFileCache::s_csFiles;
+
+VOID CFileCache::Initialize()
+{
+    InitializeCriticalSection(&s_csFiles);
+}
+
+CFileCache::CFileCache(PCSTR pszPath)
+{
+    m_pNext = NULL;
+    m_nRefs = 1;
+    m_fStale = FALSE;
+    m_hMapping = NULL;
+    m_pbData = NULL;
+    m_cbData = 0;
+    strcpy(m_szPath, pszPath);
+}
+
+CFileCache::~CFileCache()
+{
+    if (m_pbData != NULL) {
+        UnmapViewOfFile(m_pbData);
+        m_pbData = NULL;
+    }
+    if (m_hMapping != NULL) {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+}
+
+CFileCache * CFileCache::Open(PCSTR pszPath)
+{
+    WIN32_FILE_ATTRIBUTE_DATA wfad;
+
+    if (!GetFileAttributesEx(pszPath, GetFileExInfoStandard, &wfad) ||
+        (wfad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 ||
+        wfad.nFileSizeHigh != 0) {
+        return NULL;
+    }
+
+    CFileCache *pFile;
+
+    EnterCriticalSection(&s_csFiles);
+
+    for (pFile = s_pFiles; pFile != NULL; pFile = pFile->m_pNext) {
+        if (!pFile->m_fStale &&
+            pFile->m_cbData == wfad.nFileSizeLow &&
+            CompareFileTime(&pFile->m_ftWrite, &wfad.ftLastWriteTime) == 0 &&
+            _stricmp(pFile->m_szPath, pszPath) == 0) {
+
+            pFile->m_nRefs++;
+            LeaveCriticalSection(&s_csFiles);
+            return pFile;
+        }
+    }
+
+    HANDLE hFile = CreateFile(pszPath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        LeaveCriticalSection(&s_csFiles);
+        return NULL;
+    }
+
+    pFile = new CFileCache(pszPath);
+    if (pFile == NULL) {
+        CloseHandle(hFile);
+        LeaveCriticalSection(&s_csFiles);
+        return NULL;
+    }
+
+    // Key on what we actually mapped, in case the file changed since the stat.
+    GetFileTime(hFile, NULL, NULL, &pFile->m_ftWrite);
+    pFile->m_cbData = GetFileSize(hFile, NULL);
+
+    if (pFile->m_cbData != 0) {
+        // Empty files can't be mapped, and don't need to be.
+        pFile->m_hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (pFile->m_hMapping != NULL) {
+            pFile->m_pbData = (PBYTE)MapViewOfFile(pFile->m_hMapping,
+                                                   FILE_MAP_READ, 0, 0, 0);
+        }
+        if (pFile->m_cbData == INVALID_FILE_SIZE || pFile->m_pbData == NULL) {
+            CloseHandle(hFile);
+            delete pFile;
+            LeaveCriticalSection(&s_csFiles);
+            return NULL;
+        }
+    }
+    CloseHandle(hFile);
+
+    pFile->m_pNext = s_pFiles;
+    s_pFiles = pFile;
+
+    LeaveCriticalSection(&s_csFiles);
+    return pFile;
+}
+
+VOID CFileCache::Release()
+{
+    EnterCriticalSection(&s_csFiles);
+
+    if (--m_nRefs != 0) {
+        LeaveCriticalSection(&s_csFiles);
+        return;
+    }
+
+    for (CFileCache **ppFile = &s_pFiles; *ppFile != NULL; ppFile = &(*ppFile)->m_pNext) {
+        if (*ppFile == this) {
+            *ppFile = m_pNext;
+            break;
+        }
+    }
+
+    LeaveCriticalSection(&s_csFiles);
+
+    // Unmapping can be slow, so do it outside the lock.
+    delete this;
+}
+
+//
+// Stop handing out the current mappings.  Sessions already reading a file
+// keep their mapping until they finish with it.
+//
+VOID CFileCache::Invalidate()
+{
+    EnterCriticalSection(&s_csFiles);
+
+    for (CFileCache *pFile = s_pFiles; pFile != NULL; pFile = pFile->m_pNext) {
+        pFile->m_fStale = TRUE;
+    }
+
+    LeaveCriticalSection(&s_csFiles);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// With /t:N, new requests are handed off to N worker threads.  Each worker
+// runs its own socket loop, and each of its sessions answers from its own
+// socket on an ephemeral port, which becomes the session's TFTP transfer ID.
+// The well-known port then only sees new requests, and a rack booting at once
+// is spread over all the workers.  Requests are queued to a worker as APCs,
+// which run while the worker waits in SocketPoll.
+//
+// A worker's counters are only written by the worker's own thread; the main
+// thread reads them for the periodic stats report.
+//
+#define MAX_WORKERS             32
+
+class CTftpWorker
+{
+  public:
+    BOOL    Start(UINT nIndex);
+    BOOL    Queue(ITftpSink *pSink, UINT32 nLocalAddr,
+                  UINT32 nPeerAddr, UINT16 nPeerPort, PBYTE pbData, UINT cbData);
+    LONG    Load()      { return m_nActive + (m_nQueued - m_nSessions); }
+
+  protected:
+    static DWORD WINAPI ThreadProc(PVOID pvContext);
+    static VOID CALLBACK OnRequest(ULONG_PTR dwContext);
+
+  public:
+    UINT            m_nIndex;
+    HANDLE          m_hThread;
+    HANDLE          m_hReady;
+    BOOL            m_fReady;
+
+    // Written by the worker thread.
+    volatile LONG   m_nSessions;        // Sessions opened.
+    volatile LONG   m_nActive;          // Sessions still open.
+    volatile LONG   m_nFinished;        // Transfers completed.
+    volatile LONG   m_nFailed;          // Transfers NAK'd.
+    volatile LONG   m_nPackets;         // DATA packets sent.
+    volatile LONG   m_nResends;         // DATA packets sent more than once.
+    volatile UINT64 m_cbSent;           // DATA payload bytes sent.
+
+    // Written by the main thread.
+    LONG            m_nQueued;          // Requests handed to the worker.
+    LONG            m_nReported;        // m_nPackets at the last report.
+};
+
+struct TftpRequest
+{
+    CTftpWorker *   pWorker;
+    ITftpSink *     pSink;
+    UINT32          nLocalAddr;
+    UINT32          nPeerAddr;
+    UINT16          nPeerPort;
+    UINT            cbData;
+    BYTE            rbData[1];
+};
+
+CTftpWorker s_rWorkers[MAX_WORKERS];
+UINT s_nWorkers     = 0;
+UINT s_nNextWorker  = 0;
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Structure for handing incoming requests off to per-connection threads.
@@ -176,7 +441,9 @@ class CTftpNode : public ITimerSink,
     ~CTftpNode();
 
     UINT    CheckAndOpenFile(PCHAR pszName, HANDLE *phFile);
+    UINT    CheckAndOpenCached(PCHAR pszName);
     UINT    CheckAndCreateFile(PCHAR pszName, BOOL fWrite, HANDLE *phFile);
+    UINT    CheckAndOpenStream(PCHAR pszName);
 
     // Events:
     VOID    ResendPacket(BOOL fTimeout);
@@ -198,27 +465,43 @@ class CTftpNode : public ITimerSink,
     VOID    Nak(UINT16 nErrorCode);
     VOID    OAck();
     VOID    Data(UINT16 nBlock, PVOID pvPacket, UINT cbData);
+    VOID    MappedData(UINT16 nBlock, PBYTE pbData, UINT cbData);
 
     VOID    SetTimeout();
     VOID    ClrTimeout();
 
-    UINT    SocketSend(PVOID pbData, UINT cbData);
-    BOOL    ReadBlock(UINT nBlock);
+    UINT    SocketSend(PVOID pbData, UINT cbData, PVOID pbTail = NULL, UINT cbTail = 0);
+    BOOL    AllocateRing();
+    VOID    ReadAhead();
+    BOOL    ReadBlock(UINT32 nBlock);
+    BOOL    ReadStreamBlock(PBYTE pbData);
+    VOID    SendWindow();
+    VOID    AckWindow(UINT16 nBlock);
+    VOID    CloseStream();
     BOOL    WriteBlock(INT cbData);
     VOID    WriteFinished(DWORD dwErrorCode, DWORD dwDone);
 
     BOOL    IsActiveSession()       { return m_szFilename[0] != '\0'; }
+    PBYTE   RingPacket(UINT32 nBlock) {
+        return m_pbRing + (nBlock % m_nRingSlots) * (m_cbBlock + OFFSETOF(TftpHdr, Data));
+    }
     VOID    DeactivateSession();
+    VOID    WaitForIo();
 
     VOID    Log(PCSTR pszMsg, ...);
 
     BOOL    ValidateName(PCHAR pszDst, PCHAR pszSrc);
 
+    static HANDLE OpenSyncFile(PCSTR pszName);
+    static CFileCache * OpenCachedFile(PCSTR pszName);
+    static BOOL IsStreamName(PCSTR pszName);
+
     static VOID CALLBACK ReadCallback(DWORD dwErr, DWORD dwDone, LPOVERLAPPED lpOvrlap);
     static VOID CALLBACK WriteCallback(DWORD dwErrorCode, DWORD dwDone, LPOVERLAPPED lpOverlap);
 
   public:
     UINT32  m_nSession;
+    CTftpWorker *       m_pWorker;  // NULL if on the main thread.
 
   protected:
     ISessionSource *    m_pSource;
@@ -227,6 +510,7 @@ class CTftpNode : public ITimerSink,
     UINT32  m_nAddr;
     UINT16  m_nPort;
     HANDLE  m_hFile;
+    CFileCache *    m_pFile;    // Set instead of m_hFile for cached reads.
     CHAR    m_szFilename[MAX_PATH];
 
     BOOL    m_fWrite;
@@ -239,22 +523,48 @@ class CTftpNode : public ITimerSink,
     UINT    m_cbBlockOpt;
     UINT    m_cbBlockRead;
 
+    UINT    m_nWindow;
+    UINT    m_nWindowOpt;
+
     UINT    m_nTimeout;
     UINT    m_nTimeoutOpt;
     UINT    m_nTimeoutCount;
     UINT    m_nTimeoutValue;
     BOOL    m_fTimedOut;        // Set if a timeout was triggered since last recv.
 
-    // n_nBlock the next block to read and wait for ACK.
+    // m_nBlock is the last block received and ACK'd by a write.
     UINT16  m_nBlock;
     UINT32  m_nBlockLogLow;
     UINT32  m_nBlockLogHigh;
 
+    // Read window.  Blocks are numbered from 1 without wrapping; only the low
+    // 16 bits go on the wire.  Blocks up to m_nBlockAcked have been ACK'd, up
+    // to m_nBlockSent have been sent, and blocks before m_nBlockRead are in the
+    // ring.  m_nBlockLast is the final (short) block, or 0 until it is read.
+    BOOL    m_fOackPending;
+    UINT32  m_nBlockAcked;
+    UINT32  m_nBlockSent;
+    UINT32  m_nBlockRead;
+    UINT32  m_nBlockLast;
+
     BOOL    m_fIoDone;
     UINT    m_nIoOffset;
-    BYTE    m_bIoBuffer[MAX_BLOCKSIZE + OFFSETOF(TftpHdr, Data)];
+
+    // Ring of packet buffers, RING_WINDOWS windows deep for reads and a single
+    // block for writes.  Each slot has room for the TFTP header.
+    PBYTE   m_pbRing;
+    UINT    m_cbRing;
+    UINT    m_nRingSlots;
+    UINT    m_rcbRingData[RING_WINDOWS * MAX_WINDOWSIZE];
 
     OVERLAPPED m_Overlapped;
+
+    // Distro stream state (m_pMembers is NULL for ordinary files).
+    DistroMember *  m_pMembers;
+    UINT    m_nMembers;
+    UINT    m_nMember;
+    UINT    m_cbMemberDone;
+    CFileCache *    m_pMember;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -267,16 +577,38 @@ CTftpNode::CTftpNode(ISessionSource *pSource, ITftpSink *pEventSink,
       m_nPort(nPort),
       m_nSession(nSession)
 {
+    m_pWorker = NULL;
     m_szFilename[0] = '\0';
     m_hFile = INVALID_HANDLE_VALUE;
+    m_pFile = NULL;
     m_nTimeout = DEFAULT_TIMEOUT;
     m_fUseOack = FALSE;
     m_fTimedOut = FALSE;
+    m_fIoDone = TRUE;
+    m_pbRing = NULL;
+    m_cbRing = 0;
+    m_nRingSlots = 0;
+    m_pMembers = NULL;
+    m_nMembers = 0;
+    m_pMember = NULL;
 }
 
 CTftpNode::~CTftpNode()
 {
     ClrTimeout();
+    CloseStream();
+
+    if (m_pFile != NULL) {
+        m_pFile->Release();
+        m_pFile = NULL;
+    }
+
+    delete[] m_pbRing;
+    m_pbRing = NULL;
+
+    if (m_pWorker != NULL) {
+        m_pWorker->m_nActive--;
+    }
 }
 
 UINT CTftpNode::CheckAndCreateFile(PCHAR pszName, BOOL fWrite, HANDLE *phFile)
@@ -368,6 +700,193 @@ UINT CTftpNode::CheckAndOpenFile(PCHAR pszName, HANDLE *phFile)
     return EACCESS;
 }
 
+HANDLE CTftpNode::OpenSyncFile(PCSTR pszName)
+{
+    for (UINT n = 0; n < s_nPaths; n++)
+    {
+        CHAR szPath[MAX_PATH * 2];
+
+        strcpy(szPath, s_rszReadPaths[n]);
+        strcat(szPath, pszName);
+
+        HANDLE hFile = CreateFile(szPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                  FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+        if (hFile != INVALID_HANDLE_VALUE) {
+            return hFile;
+        }
+    }
+    return INVALID_HANDLE_VALUE;
+}
+
+CFileCache * CTftpNode::OpenCachedFile(PCSTR pszName)
+{
+    for (UINT n = 0; n < s_nPaths; n++)
+    {
+        CHAR szPath[MAX_PATH * 2];
+
+        strcpy(szPath, s_rszReadPaths[n]);
+        strcat(szPath, pszName);
+
+        CFileCache *pFile = CFileCache::Open(szPath);
+        if (pFile != NULL) {
+            return pFile;
+        }
+    }
+    return NULL;
+}
+
+UINT CTftpNode::CheckAndOpenCached(PCHAR pszName)
+{
+    for (UINT n = 0; n < s_nPaths; n++)
+    {
+        CHAR szPath[MAX_PATH * 2];
+
+        strcpy(szPath, s_rszReadPaths[n]);
+        strcat(szPath, pszName);
+
+        m_pFile = CFileCache::Open(szPath);
+        if (m_pFile != NULL) {
+            Log("   %02d Read `%s'", m_nSession, szPath);
+            return 0;
+        }
+    }
+    return EACCESS;
+}
+
+BOOL CTftpNode::IsStreamName(PCSTR pszName)
+{
+    UINT cbName = strlen(pszName);
+    UINT cbSuffix = sizeof(DISTRO_STREAM_SUFFIX) - 1;
+
+    return (cbName > cbSuffix &&
+            _stricmp(pszName + cbName - cbSuffix, DISTRO_STREAM_SUFFIX) == 0);
+}
+
+//
+// Parse the distro INI file named by a stream request and size every member.
+// The loader lays files out back to back using the INI sizes, so any member
+// whose size has changed since the INI was written fails the request and the
+// loader falls back to reading files one at a time.
+//
+UINT CTftpNode::CheckAndOpenStream(PCHAR pszName)
+{
+    CHAR szIni[MAX_PATH];
+    strcpy(szIni, pszName);
+    szIni[strlen(szIni) - (sizeof(DISTRO_STREAM_SUFFIX) - 1)] = '\0';
+
+    HANDLE hIni = OpenSyncFile(szIni);
+    if (hIni == INVALID_HANDLE_VALUE) {
+        Log("   %02d Failed stream `%s'", m_nSession, szIni);
+        return ENOTFOUND;
+    }
+
+    DWORD cbIni = GetFileSize(hIni, NULL);
+    DWORD cbRead = 0;
+    PCHAR pszIni = NULL;
+
+    if (cbIni != INVALID_FILE_SIZE && cbIni < MAX_DISTRO_INI_SIZE) {
+        pszIni = new CHAR [cbIni + 1];
+    }
+    if (pszIni == NULL ||
+        !ReadFile(hIni, pszIni, cbIni, &cbRead, NULL) || cbRead != cbIni) {
+        CloseHandle(hIni);
+        delete[] pszIni;
+        return EACCESS;
+    }
+    CloseHandle(hIni);
+    pszIni[cbIni] = '\0';
+
+    UINT nLines = 1;
+    for (PCHAR psz = pszIni; *psz; psz++) {
+        if (*psz == '\n') {
+            nLines++;
+        }
+    }
+
+    m_pMembers = new DistroMember [nLines];
+    m_nMembers = 0;
+    m_cbFileSize = 0;
+
+    UINT nErr = 0;
+    PCHAR pszNext = pszIni;
+
+    while (*pszNext && nErr == 0) {
+        PCHAR pszLine = pszNext;
+        while (*pszNext && *pszNext != '\r' && *pszNext != '\n') {
+            pszNext++;
+        }
+        while (*pszNext == '\r' || *pszNext == '\n') {
+            *pszNext++ = '\0';
+        }
+
+        PCHAR pszSize = strstr(pszLine, "Size=");
+        PCHAR pszPath = pszSize ? strstr(pszSize, "Path=") : NULL;
+        if (pszPath == NULL) {
+            continue;
+        }
+        pszPath += 5;
+        while (*pszPath == '/' || *pszPath == '\\') {
+            pszPath++;
+        }
+
+        DistroMember *pMember = &m_pMembers[m_nMembers];
+        if (strlen(pszPath) >= ARRAYOF(pMember->szName) ||
+            !ValidateName(pMember->szName, pszPath)) {
+            Log("   %02d Bad stream member `%s'", m_nSession, pszPath);
+            nErr = EACCESS;
+            break;
+        }
+
+        HANDLE hFile = OpenSyncFile(pMember->szName);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            Log("   %02d Failed stream member `%s'", m_nSession, pMember->szName);
+            nErr = ENOTFOUND;
+            break;
+        }
+        pMember->cbSize = GetFileSize(hFile, NULL);
+        CloseHandle(hFile);
+
+        // DistroBuilder lists the INI file itself with a size of zero.
+        UINT cbExpected = atoi(pszSize + 5);
+        if (cbExpected != 0 && cbExpected != pMember->cbSize) {
+            Log("   %02d Stream member `%s' is %d bytes, INI says %d",
+                m_nSession, pMember->szName, pMember->cbSize, cbExpected);
+            nErr = EACCESS;
+            break;
+        }
+
+        m_cbFileSize += pMember->cbSize;
+        m_nMembers++;
+    }
+    delete[] pszIni;
+
+    if (nErr != 0) {
+        CloseStream();
+        return nErr;
+    }
+
+    m_nMember = 0;
+    m_cbMemberDone = 0;
+
+    Log("   %02d Stream `%s' (%d files, %d bytes)",
+        m_nSession, szIni, m_nMembers, m_cbFileSize);
+    return 0;
+}
+
+VOID CTftpNode::CloseStream()
+{
+    if (m_pMember != NULL) {
+        m_pMember->Release();
+        m_pMember = NULL;
+    }
+    if (m_pMembers != NULL) {
+        delete[] m_pMembers;
+        m_pMembers = NULL;
+        m_nMembers = 0;
+    }
+}
+
 VOID CTftpNode::OnSessionCreate(ISessionSource *pSource, PVOID pvContext)
 {
     (void)pvContext;
@@ -397,7 +916,7 @@ VOID CTftpNode::Log(PCSTR pszMsg, ...)
     }
 }
 
-UINT CTftpNode::SocketSend(PVOID pbData, UINT cbData)
+UINT CTftpNode::SocketSend(PVOID pbData, UINT cbData, PVOID pbTail, UINT cbTail)
 {
     TftpHdr *pPacket = (TftpHdr*)pbData;
 
@@ -406,14 +925,22 @@ UINT CTftpNode::SocketSend(PVOID pbData, UINT cbData)
 
         if (nBlock <= m_nBlockLogLow || nBlock >= m_nBlockLogHigh ||
             nBlock % 250 == 0 || m_fTimedOut) {
-            Log("<= %02d %s%s", m_nSession, pPacket->Dump(cbData),
+            Log("<= %02d %s%s", m_nSession, pPacket->Dump(cbData + cbTail),
                 m_fTimedOut ? " [Resend]" : "");
         }
+        if (m_pWorker != NULL) {
+            m_pWorker->m_nPackets++;
+            m_pWorker->m_cbSent += cbData + cbTail - OFFSETOF(TftpHdr, Data);
+        }
     }
     else {
         Log("<= %02d %s", m_nSession, pPacket->Dump(cbData));
     }
 
+    if (cbTail != 0) {
+        return m_pSource->SessionSendGather((PBYTE)pbData, cbData,
+                                            (PBYTE)pbTail, cbTail);
+    }
     return m_pSource->SessionSend((PBYTE)pbData, cbData);
 }
 
@@ -425,41 +952,167 @@ VOID CTftpNode::DeactivateSession()
         m_szFilename[0] = 0;
         if (m_hFile != INVALID_HANDLE_VALUE) {
             CancelIo(m_hFile);
+            WaitForIo();
             CloseHandle(m_hFile);
             m_hFile = INVALID_HANDLE_VALUE;
         }
+        if (m_pFile != NULL) {
+            m_pFile->Release();
+            m_pFile = NULL;
+        }
+        CloseStream();
         SetTimeout();
     }
 }
 
-BOOL CTftpNode::ReadBlock(UINT nBlock)
+//
+// Wait for the outstanding file read or write, if any.  Its completion routine
+// runs as an APC on this thread, so the wait must be alertable.
+//
+VOID CTftpNode::WaitForIo()
 {
-    (void)nBlock;
+    while (!m_fIoDone) {
+        SleepEx(INFINITE, TRUE);
+    }
+}
+
+//
+// Size the packet ring for the negotiated block and window sizes.  The ring
+// is kept across requests on the same session and only grows.  A read into
+// the old ring must have completed before it is freed; DeactivateSession
+// already waits for cancelled reads, so the wait here is normally a no-op.
+//
+BOOL CTftpNode::AllocateRing()
+{
+    m_nRingSlots = m_fWrite ? 1 : m_nWindow * RING_WINDOWS;
+
+    if (m_pFile != NULL) {
+        // Blocks are sent straight out of the file cache.
+        return TRUE;
+    }
+
+    UINT cbRing = m_nRingSlots * (m_cbBlock + OFFSETOF(TftpHdr, Data));
+
+    if (cbRing > m_cbRing) {
+        WaitForIo();
+        delete[] m_pbRing;
+        m_pbRing = new BYTE [cbRing];
+        m_cbRing = (m_pbRing != NULL) ? cbRing : 0;
+    }
+    return m_pbRing != NULL;
+}
+
+//
+// Keep reads going until the ring is full.  A slot can be refilled once the
+// block it held has been ACK'd.  Stream reads complete synchronously, so this
+// loops; file reads complete in ReadCallback, which calls back in here.
+//
+VOID CTftpNode::ReadAhead()
+{
+    while (IsActiveSession() &&
+           m_fIoDone &&
+           m_nBlockLast == 0 &&
+           m_nBlockRead <= m_nBlockAcked + m_nRingSlots) {
+
+        if (!ReadBlock(m_nBlockRead)) {
+            return;
+        }
+    }
+}
 
+BOOL CTftpNode::ReadBlock(UINT32 nBlock)
+{
     VERBOSE(Log("   %02d ReadBlock(%d at %d)",
                 m_nSession, nBlock, m_nIoOffset));
 
+    if (m_pFile != NULL) {
+        // The data is already mapped; just account for the block.
+        m_fIoDone = FALSE;
+        ReadFinished(0, min(m_cbBlock, m_pFile->m_cbData - m_nIoOffset));
+        return TRUE;
+    }
+
+    PBYTE pbData = RingPacket(nBlock) + OFFSETOF(TftpHdr, Data);
+
+    if (m_pMembers != NULL) {
+        return ReadStreamBlock(pbData);
+    }
+
     m_fIoDone = FALSE;
     m_Overlapped.hEvent = (HANDLE)this;
     m_Overlapped.Offset = m_nIoOffset;
     m_Overlapped.OffsetHigh = 0;
 
-    if (!ReadFileEx(m_hFile, m_bIoBuffer + OFFSETOF(TftpHdr, Data),
-                    m_cbBlock, &m_Overlapped, ReadCallback)) {
+    if (!ReadFileEx(m_hFile, pbData, m_cbBlock, &m_Overlapped, ReadCallback)) {
         ReadFinished(GetLastError(), 0);
         return FALSE;
     }
     return TRUE;
 }
 
+//
+// Fill the next block from the stream members.  Blocks can span several small
+// files, so these reads are synchronous; the files are normally in the cache.
+//
+BOOL CTftpNode::ReadStreamBlock(PBYTE pbData)
+{
+    UINT cbDone = 0;
+
+    m_fIoDone = FALSE;
+
+    while (cbDone < m_cbBlock && m_nMember < m_nMembers) {
+        DistroMember *pMember = &m_pMembers[m_nMember];
+
+        if (m_pMember == NULL) {
+            m_pMember = OpenCachedFile(pMember->szName);
+            if (m_pMember == NULL) {
+                ReadFinished(ERROR_FILE_NOT_FOUND, cbDone);
+                return FALSE;
+            }
+            if (m_pMember->m_cbData != pMember->cbSize) {
+                ReadFinished(ERROR_READ_FAULT, cbDone);
+                return FALSE;
+            }
+        }
+
+        DWORD cbWant = min(m_cbBlock - cbDone, pMember->cbSize - m_cbMemberDone);
+
+        if (cbWant != 0) {
+            CopyMemory(pbData + cbDone, m_pMember->m_pbData + m_cbMemberDone, cbWant);
+        }
+
+        cbDone += cbWant;
+        m_cbMemberDone += cbWant;
+
+        if (m_cbMemberDone == pMember->cbSize) {
+            m_pMember->Release();
+            m_pMember = NULL;
+            m_cbMemberDone = 0;
+            m_nMember++;
+        }
+    }
+
+    ReadFinished(0, cbDone);
+    return TRUE;
+}
+
 VOID CTftpNode::ReadFinished(DWORD dwErrorCode, DWORD dwDone)
 {
     VERBOSE(Log("   %02d ReadFinished(%d, %d)",
                 m_nSession, dwErrorCode, dwDone));
 
+    if (m_fIoDone) {
+        return;
+    }
+
     m_fIoDone = TRUE;
+
+    if (!IsActiveSession()) {
+        // Completion of a read cancelled by DeactivateSession.
+        return;
+    }
+
     m_nIoOffset += dwDone;
-    m_cbBlockRead = dwDone;
 
     if (dwErrorCode == ERROR_HANDLE_EOF) {
         dwErrorCode = 0;
@@ -468,16 +1121,23 @@ VOID CTftpNode::ReadFinished(DWORD dwErrorCode, DWORD dwDone)
     if (dwErrorCode != 0) {
         VERBOSE(Log("   %02d Read failed: %d", m_nSession, dwErrorCode));
         Nak(ENOSPACE);
+        return;
     }
-    else {
-        ResendPacket(FALSE);
+
+    m_rcbRingData[m_nBlockRead % m_nRingSlots] = dwDone;
+    if (dwDone < m_cbBlock) {
+        m_nBlockLast = m_nBlockRead;
     }
+    m_nBlockRead++;
+
+    SendWindow();
 }
 
 VOID CTftpNode::ReadCallback(DWORD dwErrorCode, DWORD dwDone, LPOVERLAPPED lpOverlap)
 {
     CTftpNode *pInfo = (CTftpNode *)lpOverlap->hEvent;
     pInfo->ReadFinished(dwErrorCode, dwDone);
+    pInfo->ReadAhead();
 }
 
 BOOL CTftpNode::WriteBlock(INT cbData)
@@ -490,7 +1150,7 @@ BOOL CTftpNode::WriteBlock(INT cbData)
     if (cbData == 0) {
         WriteFinished(0, 0);
     }
-    else if (!WriteFileEx(m_hFile, m_bIoBuffer, cbData, &m_Overlapped, WriteCallback)) {
+    else if (!WriteFileEx(m_hFile, m_pbRing, cbData, &m_Overlapped, WriteCallback)) {
         WriteFinished(GetLastError(), 0);
         return FALSE;
     }
@@ -502,6 +1162,12 @@ VOID CTftpNode::WriteFinished(DWORD dwErrorCode, DWORD dwDone)
     VERBOSE(Log("%08x WriteFinished(%d, %d)\n", this, dwErrorCode, dwDone));
 
     m_fIoDone = TRUE;
+
+    if (!IsActiveSession()) {
+        // Completion of a write cancelled by DeactivateSession.
+        return;
+    }
+
     m_nIoOffset += dwDone;
 
     if (dwErrorCode != 0) {
@@ -574,6 +1240,21 @@ VOID CTftpNode::Data(UINT16 nBlock, PVOID pvPacket, UINT cbData)
     SetTimeout();
 }
 
+//
+// Send a TFTP_DATA packet whose payload is in the file cache, without copying
+// it next to the header.
+//
+VOID CTftpNode::MappedData(UINT16 nBlock, PBYTE pbData, UINT cbData)
+{
+    BYTE Buffer[8];
+    TftpHdr *pPacket = (TftpHdr *)Buffer;
+
+    pPacket->Opcode = htons((UINT16)TFTP_DATA);
+    pPacket->Block = htons(nBlock);
+    SocketSend(pPacket, OFFSETOF(TftpHdr, Data), pbData, cbData);
+    SetTimeout();
+}
+
 //
 // Send a TFTP_NAK packet (i.e. an error message).
 // Error code passed in is one of the standard TFTP codes,
@@ -609,6 +1290,9 @@ VOID CTftpNode::Nak(UINT16 nErrorCode)
     if (m_pEventSink) {
         m_pEventSink->OnTftpAccessEnd(m_nAddr, m_nPort, 0);
     }
+    if (m_pWorker != NULL) {
+        m_pWorker->m_nFailed++;
+    }
 
     // We don't call SetTimeout here because DeactivateSession does.
     DeactivateSession();
@@ -647,6 +1331,10 @@ VOID CTftpNode::OAck()
         cbData += sprintf(pPacket->Options + cbData, "tsize") + 1;
         cbData += sprintf(pPacket->Options + cbData, "%d", m_cbFileSize) + 1;
     }
+    if (m_nWindowOpt) {
+        cbData += sprintf(pPacket->Options + cbData, "windowsize") + 1;
+        cbData += sprintf(pPacket->Options + cbData, "%d", m_nWindowOpt) + 1;
+    }
 
     SocketSend(Buffer, cbData + OFFSETOF(TftpHdr, Options));
     SetTimeout();
@@ -707,7 +1395,7 @@ VOID CTftpNode::ResendPacket(BOOL fTimeout)
             Ack(m_nBlock);
         }
         else {
-            Data(m_nBlock, m_bIoBuffer, m_cbBlockRead);
+            Data(m_nBlock, m_pbRing, m_cbBlockRead);
         }
     }
 #endif
@@ -724,34 +1412,116 @@ VOID CTftpNode::ResendPacket(BOOL fTimeout)
         m_fTimedOut = TRUE;
     }
 
-    if (m_nBlock == 0 && m_nIoOffset == 0) {
-        if (m_fUseOack) {
-            //printf("Oacking\n");
+    if (m_fWrite) {
+        if (m_nBlock == 0 && m_nIoOffset == 0 && m_fUseOack) {
             OAck();
-            return;
         }
-        else if (m_fWrite) {
+        else {
             Ack(m_nBlock);
-            return;
         }
+        return;
     }
-    else if (m_fWrite) {
-        Ack(m_nBlock);
+    else if (m_fOackPending) {
+        //printf("Oacking\n");
+        OAck();
         return;
     }
-    else if (m_fIoDone) {
-        //printf("m_fIoDone\n");
-        Data(m_nBlock, m_bIoBuffer, m_cbBlockRead);
+    else if (m_nBlockSent > m_nBlockAcked) {
+        //
+        // Go back to the oldest block the client hasn't ACK'd and send the
+        // window again from there.  Blocks already ACK'd are never resent.
+        //
+        if (m_pWorker != NULL) {
+            m_pWorker->m_nResends += m_nBlockSent - m_nBlockAcked;
+        }
+        m_nBlockSent = m_nBlockAcked;
+        SendWindow();
         return;
     }
-    else {
+    else if (!m_fIoDone) {
         // we only get here if we timed out, but the read also hasn't completed.
         Log("   %02d timeout with read pending (block=%d, count=%d, value=%d)",
-            m_nSession, m_nBlock, m_nTimeoutCount, m_nTimeoutValue);
+            m_nSession, m_nBlockAcked + 1, m_nTimeoutCount, m_nTimeoutValue);
     }
 #endif
 }
 
+//
+// Send every block that has been read and fits in the window.
+//
+VOID CTftpNode::SendWindow()
+{
+    if (m_fOackPending) {
+        return;
+    }
+
+    while (m_nBlockSent < m_nBlockAcked + m_nWindow && m_nBlockSent + 1 < m_nBlockRead) {
+        m_nBlockSent++;
+        if (m_pFile != NULL) {
+            MappedData((UINT16)m_nBlockSent,
+                       m_pFile->m_pbData + (m_nBlockSent - 1) * m_cbBlock,
+                       m_rcbRingData[m_nBlockSent % m_nRingSlots]);
+        }
+        else {
+            Data((UINT16)m_nBlockSent,
+                 RingPacket(m_nBlockSent),
+                 m_rcbRingData[m_nBlockSent % m_nRingSlots]);
+        }
+    }
+}
+
+//
+// Handle an ACK on a read.  With RFC 7440 an ACK covers every block up to and
+// including the one it names.  The client drops everything after a lost
+// block, so an ACK that stops short of the last block sent means the rest of
+// the window must go again; an ACK of a block already ACK'd is the client
+// timing out, and gets the same treatment.
+//
+VOID CTftpNode::AckWindow(UINT16 nBlock)
+{
+    if ((INT16)(nBlock - (UINT16)m_nBlockAcked) < 0) {
+        // A delayed ACK for an earlier window; a later ACK already covered it.
+        VERBOSE(Log("   %02d Stale ACK %d before %d",
+                    m_nSession, nBlock, (UINT16)m_nBlockAcked));
+        return;
+    }
+
+    UINT32 nNewlyAcked = (UINT16)(nBlock - (UINT16)m_nBlockAcked);
+
+    if (nNewlyAcked > m_nBlockSent - m_nBlockAcked) {
+        VERBOSE(Log("   %02d Strange ACK %d to %d",
+                    m_nSession, nBlock, (UINT16)m_nBlockSent));
+        Nak(EBADOP);
+        return;
+    }
+
+    m_nBlockAcked += nNewlyAcked;
+
+    if (m_nBlockLast != 0 && m_nBlockAcked == m_nBlockLast) {
+        // Client ACK'd our last packet, we're out of here.
+        if (m_pEventSink) {
+            m_pEventSink->OnTftpAccessEnd(m_nAddr, m_nPort, TRUE);
+        }
+        if (m_pWorker != NULL) {
+            m_pWorker->m_nFinished++;
+        }
+        DeactivateSession();
+        return;
+    }
+
+    if (m_nBlockSent > m_nBlockAcked) {
+        VERBOSE(Log("   %02d resending from block %d",
+                    m_nSession, m_nBlockAcked + 1));
+        if (m_pWorker != NULL) {
+            m_pWorker->m_nResends += m_nBlockSent - m_nBlockAcked;
+        }
+        m_nBlockSent = m_nBlockAcked;
+    }
+
+    SendWindow();
+    ReadAhead();
+}
+
 BOOL CTftpNode::ValidateName(PCHAR pszDst, PCHAR pszSrc)
 {
     PCHAR pszBeg = pszDst;
@@ -797,9 +1567,11 @@ BOOL CTftpNode::ValidateName(PCHAR pszDst, PCHAR pszSrc)
         if (strncmp(pszBeg, "pxe.com.", 8) == 0) {
             UINT n = atoi(pszBeg + 8);
 
+            EnterCriticalSection(&s_csRenames);
             if (n != 0 && n >= s_nRenamesBase && n < s_nRenamesBase + s_nRenames) {
                 strcpy(pszBeg, s_rszRenames[n - s_nRenamesBase]);
             }
+            LeaveCriticalSection(&s_csRenames);
         }
     }
     return TRUE;
@@ -840,6 +1612,9 @@ VOID CTftpNode::OnSessionRecv(UINT dwError, PBYTE pbData, UINT cbData)
         m_szFilename[0] = '\0';
         m_cbBlock = DEFAULT_BLOCKSIZE;
         m_cbBlockOpt = 0;
+        m_nWindow = DEFAULT_WINDOWSIZE;
+        m_nWindowOpt = 0;
+        m_fUseOack = FALSE;
         m_nTimeout = DEFAULT_TIMEOUT;
         m_nTimeoutOpt = 0;
         m_fHadTsize = FALSE;
@@ -918,6 +1693,14 @@ VOID CTftpNode::OnSessionRecv(UINT dwError, PBYTE pbData, UINT cbData)
                 m_fUseOack = TRUE;
                 VERBOSE(Log("   %02d tsize: %d", m_nSession, atoi(pszVal)));
             }
+            else if (_stricmp(pszOpt, "windowsize") == 0 && !m_fWrite) {
+                //
+                // "windowsize" option: (#blocks per ACK), reads only.
+                //
+                m_nWindowOpt = min(max(atoi(pszVal), 1), MAX_WINDOWSIZE);
+                m_fUseOack = TRUE;
+                VERBOSE(Log("   %02d windowsize: %d", m_nSession, m_nWindowOpt));
+            }
             else {
                 // Just ignore the unknown option.
                 VERBOSE(Log("   %02d unknown option: `%s'",
@@ -934,25 +1717,54 @@ VOID CTftpNode::OnSessionRecv(UINT dwError, PBYTE pbData, UINT cbData)
             return;
         }
 
+        if (m_nWindowOpt) {
+            // Options can come in any order, so trim against blksize here.
+            if (m_nWindowOpt * m_cbBlock > MAX_WINDOW_BYTES) {
+                m_nWindowOpt = max(MAX_WINDOW_BYTES / m_cbBlock, 1);
+            }
+            m_nWindow = m_nWindowOpt;
+        }
+
         //
         // Open the file.
         //
         // PBAR       UINT nErr = CheckAndOpenFile(m_szFilename, &m_hFile);
-        UINT nErr = CheckAndCreateFile(m_szFilename, m_fWrite, &m_hFile);
+        UINT nErr;
+
+        if (!m_fWrite && IsStreamName(m_szFilename)) {
+            nErr = CheckAndOpenStream(m_szFilename);
+        }
+        else if (!m_fWrite && CheckAndOpenCached(m_szFilename) == 0) {
+            nErr = 0;
+        }
+        else {
+            // Writes, and files too large to map, go through a file handle.
+            nErr = CheckAndCreateFile(m_szFilename, m_fWrite, &m_hFile);
+        }
 
         if (nErr != 0) {
             Nak((UINT16)nErr);
             return;
         }
 
-        m_cbFileSize = GetFileSize(m_hFile, NULL);
-        if (m_cbFileSize < 0) {
-            m_cbFileSize = 0;
+        if (m_pFile != NULL) {
+            m_cbFileSize = m_pFile->m_cbData;
+        }
+        else if (m_pMembers == NULL) {
+            m_cbFileSize = GetFileSize(m_hFile, NULL);
+            if (m_cbFileSize < 0) {
+                m_cbFileSize = 0;
+            }
         }
         VERBOSE(Log("   %02d File is %d bytes or %d blocks.",
                     m_nSession, m_cbFileSize,
                     (m_cbFileSize + m_cbBlock - 1) / m_cbBlock));
 
+        if (!AllocateRing()) {
+            Nak(ENOSPACE);
+            return;
+        }
+
         //
         // Set final variables...
         //
@@ -962,20 +1774,28 @@ VOID CTftpNode::OnSessionRecv(UINT dwError, PBYTE pbData, UINT cbData)
         m_fIoDone = TRUE;
         m_nIoOffset = 0;
         m_nBlockLogLow = 3;
-        m_nBlockLogHigh = (m_cbFileSize / m_cbBlockRead) - 3;
+        m_nBlockLogHigh = (m_cbFileSize / m_cbBlock) - 3;
         m_nBlockLogHigh = m_nBlockLogHigh <= 0 ? 0 : m_nBlockLogHigh;
 
-        if (m_fUseOack) {
-            m_nBlock = 0;
-            ResendPacket(FALSE);
-        }
-        else if (m_fWrite) {
-            m_nBlock = 0;
+        m_nBlock = 0;
+        m_fOackPending = m_fUseOack && !m_fWrite;
+        m_nBlockAcked = 0;
+        m_nBlockSent = 0;
+        m_nBlockRead = 1;
+        m_nBlockLast = 0;
+
+        if (m_fWrite) {
             ResendPacket(FALSE);
         }
         else {
-            m_nBlock = 1;
-            ReadBlock(0);
+            //
+            // Start filling the ring right away; the first window goes out
+            // as soon as the client ACKs our OACK (or immediately, without).
+            //
+            if (m_fOackPending) {
+                ResendPacket(FALSE);
+            }
+            ReadAhead();
         }
     }
     else if (nOpcode == TFTP_DATA ||
@@ -1014,11 +1834,17 @@ VOID CTftpNode::OnSessionRecv(UINT dwError, PBYTE pbData, UINT cbData)
                            m_nSession, m_nBlock,
                            cbData - OFFSETOF(TftpHdr, Data));
 
+                    if (cbData - OFFSETOF(TftpHdr, Data) > m_cbBlock) {
+                        VERBOSE(Log("   %02d data block larger than blksize\n",
+                                    m_nSession));
+                        Nak(EBADOP);
+                        return;
+                    }
                     if (m_fIoDone) {
                         m_cbBlockRead = cbData - OFFSETOF(TftpHdr, Data);
                         //printf("WRITEBLOCK\n");
                         // Buffer is available, initiate the write.
-                        CopyMemory(m_bIoBuffer, pPacket->Data, m_cbBlockRead);
+                        CopyMemory(m_pbRing, pPacket->Data, m_cbBlockRead);
                         WriteBlock(m_cbBlockRead);
                     }
                     else {
@@ -1052,28 +1878,21 @@ VOID CTftpNode::OnSessionRecv(UINT dwError, PBYTE pbData, UINT cbData)
             // Read requests...
             //
             if (nOpcode == TFTP_ACK) {
-                if (nBlock == m_nBlock) {
-                    // Client ACK'd our packet, read the next block.
-                    if (m_cbBlockRead == m_cbBlock) {
-                        ReadBlock(++m_nBlock);
+                if (m_fOackPending) {
+                    if (nBlock == 0) {
+                        // Client ACK'd our OACK, start sending data.
+                        m_fOackPending = FALSE;
+                        SendWindow();
                     }
                     else {
-                        // Client ACK'd our last packet, we're out of here.
-                        if (m_pEventSink) {
-                            m_pEventSink->OnTftpAccessEnd(m_nAddr, m_nPort, TRUE);
-                        }
-                        DeactivateSession();
+                        VERBOSE(Log("   %02d Strange ACK %d to OACK",
+                                    m_nSession, nBlock));
+                        Nak(EBADOP);
+                        return;
                     }
                 }
-                else if (nBlock == (UINT16)(m_nBlock - 1)) {
-                    // Client ACK'd the previous block, resend it.
-                    ResendPacket(FALSE);
-                }
                 else {
-                    VERBOSE(Log("   %02d Strange ACK %d to %d",
-                                m_nSession, nBlock, m_nBlock));
-                    Nak(EBADOP);
-                    return;
+                    AckWindow(nBlock);
                 }
             }
             else {
@@ -1095,7 +1914,111 @@ VOID CTftpNode::OnSessionRecv(UINT dwError, PBYTE pbData, UINT cbData)
 
 //////////////////////////////////////////////////////////////////////////////
 //
-UINT32 CTftp::s_nSession = 1;
+BOOL CTftpWorker::Start(UINT nIndex)
+{
+    m_nIndex = nIndex;
+    m_fReady = FALSE;
+
+    m_hReady = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (m_hReady == NULL) {
+        return FALSE;
+    }
+
+    DWORD dwThread;
+    m_hThread = CreateThread(NULL, 0, ThreadProc, this, 0, &dwThread);
+    if (m_hThread != NULL) {
+        // Requests can't be queued until the worker has its socket loop.
+        WaitForSingleObject(m_hReady, INFINITE);
+    }
+
+    CloseHandle(m_hReady);
+    m_hReady = NULL;
+    return m_fReady;
+}
+
+DWORD WINAPI CTftpWorker::ThreadProc(PVOID pvContext)
+{
+    CTftpWorker *pWorker = (CTftpWorker *)pvContext;
+
+    pWorker->m_fReady = SocketInit();
+    SetEvent(pWorker->m_hReady);
+
+    if (!pWorker->m_fReady) {
+        return 1;
+    }
+
+    while (SocketPoll()) {
+    }
+    return 0;
+}
+
+BOOL CTftpWorker::Queue(ITftpSink *pSink, UINT32 nLocalAddr,
+                        UINT32 nPeerAddr, UINT16 nPeerPort, PBYTE pbData, UINT cbData)
+{
+    TftpRequest *pRequest
+        = (TftpRequest *)new BYTE [OFFSETOF(TftpRequest, rbData) + cbData];
+    if (pRequest == NULL) {
+        return FALSE;
+    }
+
+    pRequest->pWorker = this;
+    pRequest->pSink = pSink;
+    pRequest->nLocalAddr = nLocalAddr;
+    pRequest->nPeerAddr = nPeerAddr;
+    pRequest->nPeerPort = nPeerPort;
+    pRequest->cbData = cbData;
+    memcpy(pRequest->rbData, pbData, cbData);
+
+    if (!QueueUserAPC(OnRequest, m_hThread, (ULONG_PTR)pRequest)) {
+        delete[] (PBYTE)pRequest;
+        return FALSE;
+    }
+    m_nQueued++;
+    return TRUE;
+}
+
+//
+// Runs on the worker thread.
+//
+VOID CALLBACK CTftpWorker::OnRequest(ULONG_PTR dwContext)
+{
+    TftpRequest *pRequest = (TftpRequest *)dwContext;
+    CTftpWorker *pWorker = pRequest->pWorker;
+
+    CTftpNode *pClient = new CTftpNode(NULL, pRequest->pSink,
+                                       pRequest->nPeerAddr, pRequest->nPeerPort,
+                                       InterlockedIncrement(&CTftp::s_nSession) - 1);
+    if (pClient == NULL) {
+        pRequest->pSink->OnTftpMessage(pRequest->nPeerAddr, "Out of memory!");
+        delete[] (PBYTE)pRequest;
+        return;
+    }
+
+    pClient->m_pWorker = pWorker;
+    pWorker->m_nSessions++;
+    pWorker->m_nActive++;
+
+    UINT nError = SessionCreate(pRequest->nLocalAddr,
+                                pRequest->nPeerAddr, pRequest->nPeerPort, pClient);
+    if (nError != 0) {
+        pRequest->pSink->OnTftpSocketError(nError);
+        delete pClient;
+    }
+    else {
+        VERBOSE(pRequest->pSink->OnTftpMessage(pRequest->nPeerAddr,
+                                               "** %02d session opened port %d on worker %d",
+                                               pClient->m_nSession,
+                                               pRequest->nPeerPort,
+                                               pWorker->m_nIndex));
+        pClient->OnSessionRecv(0, pRequest->rbData, pRequest->cbData);
+    }
+
+    delete[] (PBYTE)pRequest;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+volatile LONG CTftp::s_nSession = 1;
 
 CTftp::CTftp(CTftp *pNext)
 {
@@ -1103,6 +2026,8 @@ CTftp::CTftp(CTftp *pNext)
     m_pSink = NULL;
     m_nAddr = 0;
     m_nPort = 0;
+    m_nRecent = 0;
+    memset(m_rRecent, 0, sizeof(m_rRecent));
 }
 
 CTftp::~CTftp()
@@ -1167,6 +2092,11 @@ VOID CTftp::OnNetworkDelete(UINT32 nAddr, CTftp **ppNext)
 
 VOID CTftp::ConfigureFiles(ITftpSink *pSink, INT argc, PCHAR *argv)
 {
+    UINT nWorkers = 0;
+
+    CFileCache::Initialize();
+    InitializeCriticalSection(&s_csRenames);
+
     for (INT arg = 0; arg < argc; arg++) {
         if (argv[arg][0] == '-' || argv[arg][0] == '/') {
             CHAR args[1024];
@@ -1190,6 +2120,13 @@ VOID CTftp::ConfigureFiles(ITftpSink *pSink, INT argc, PCHAR *argv)
               case 'R':
                 s_fRenames = FALSE;
                 break;
+              case 't':                                 // Worker threads.
+              case 'T':
+                nWorkers = atoi(argp);
+                if (nWorkers > MAX_WORKERS) {
+                    nWorkers = MAX_WORKERS;
+                }
+                break;
               case 'v':
               case 'V':
                 s_fVerboseOutput = TRUE;
@@ -1225,12 +2162,57 @@ VOID CTftp::ConfigureFiles(ITftpSink *pSink, INT argc, PCHAR *argv)
     if (s_fRenames) {
         OnFilesChange(pSink);
     }
+
+    // Start the workers last; the tables above are read-only from here on.
+    while (s_nWorkers < nWorkers) {
+        if (!s_rWorkers[s_nWorkers].Start(s_nWorkers)) {
+            if (pSink) {
+                pSink->OnTftpMessage(0, "Failed to start worker %d: %d",
+                                     s_nWorkers, GetLastError());
+            }
+            break;
+        }
+        s_nWorkers++;
+    }
+    if (pSink && s_nWorkers != 0) {
+        pSink->OnTftpMessage(0, "Workers: %d", s_nWorkers);
+    }
+}
+
+VOID CTftp::ReportStats(ITftpSink *pSink)
+{
+    for (UINT n = 0; n < s_nWorkers; n++) {
+        CTftpWorker *pWorker = &s_rWorkers[n];
+        LONG nPackets = pWorker->m_nPackets;
+
+        if (nPackets == pWorker->m_nReported && pWorker->m_nActive == 0) {
+            continue;
+        }
+        pWorker->m_nReported = nPackets;
+
+        pSink->OnTftpMessage(0,
+                             "Worker %d: %d active, %d sessions, %d done, "
+                             "%d failed, %d packets, %d resent, %I64u bytes",
+                             n,
+                             pWorker->m_nActive,
+                             pWorker->m_nSessions,
+                             pWorker->m_nFinished,
+                             pWorker->m_nFailed,
+                             nPackets,
+                             pWorker->m_nResends,
+                             pWorker->m_cbSent);
+    }
 }
 
 VOID CTftp::OnFilesChange(ITftpSink *pSink)
 {
-    s_nRenames = 0;
-    s_nRenamesBase = 0;
+    // Build the new rename table aside and publish it at the end, so lookups
+    // never see it half built.
+    CHAR rszRenames[ARRAYOF(s_rszRenames)][ARRAYOF(s_rszRenames[0])];
+    UINT nRenames = 0;
+    UINT nRenamesBase = 0;
+
+    CFileCache::Invalidate();
 
     // First, could the pxe.com files:
     for (UINT nPath = 0; nPath < s_nPaths; nPath++) {
@@ -1245,8 +2227,8 @@ VOID CTftp::OnFilesChange(ITftpSink *pSink)
             if ((wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
                 if (strlen(wfd.cFileName) > 8) {
                     UINT num = atoi(wfd.cFileName + 8);
-                    if (s_nRenamesBase <= num) {
-                        s_nRenamesBase = num + 1;
+                    if (nRenamesBase <= num) {
+                        nRenamesBase = num + 1;
                     }
                 }
             }
@@ -1275,7 +2257,7 @@ VOID CTftp::OnFilesChange(ITftpSink *pSink)
             strcpy(szPath, s_rszReadPaths[nPath]);
             strcat(szPath, wfd.cFileName);
 
-            if (s_nRenames >= ARRAYOF(s_rszRenames)) {
+            if (nRenames >= ARRAYOF(rszRenames)) {
                 goto next;
             }
 
@@ -1293,13 +2275,13 @@ VOID CTftp::OnFilesChange(ITftpSink *pSink)
                 if (rbBlock[0] = 'M' && rbBlock[1] == 'Z' &&
                     *(DWORD*)&rbBlock[64] == 0) {
 
-                    sprintf(s_rszRenames[s_nRenames], "%ls", &rbBlock[68]);
+                    sprintf(rszRenames[nRenames], "%ls", &rbBlock[68]);
                     if (pSink) {
                         pSink->OnTftpMessage(0, "Rename pxe.com.%d to %s",
-                                             s_nRenamesBase + s_nRenames,
-                                             s_rszRenames[s_nRenames]);
+                                             nRenamesBase + nRenames,
+                                             rszRenames[nRenames]);
                     }
-                    s_nRenames++;
+                    nRenames++;
                 }
             }
             CloseHandle(hFile);
@@ -1311,6 +2293,12 @@ VOID CTftp::OnFilesChange(ITftpSink *pSink)
             }
         }
     }
+
+    EnterCriticalSection(&s_csRenames);
+    CopyMemory(s_rszRenames, rszRenames, nRenames * sizeof(rszRenames[0]));
+    s_nRenames = nRenames;
+    s_nRenamesBase = nRenamesBase;
+    LeaveCriticalSection(&s_csRenames);
 }
 
 VOID CTftp::Configure(UINT32 nAddr, UINT16 nPort,
@@ -1357,7 +2345,39 @@ VOID CTftp::OnSessionCreate(UINT32 nPeerAddr,
 {
     (void)pvContext;
 
-    *ppSink = new CTftpNode(pSource, m_pSink, nPeerAddr, nPeerPort, s_nSession++);
+    *ppSink = new CTftpNode(pSource, m_pSink, nPeerAddr, nPeerPort,
+                            InterlockedIncrement(&s_nSession) - 1);
+}
+
+//
+// A client retransmits its request until it hears from us.  Without workers
+// the retransmission finds the session by address and port, but a worker's
+// session answers from its own port, so remember recent requests here.
+//
+BOOL CTftp::IsRecentRequest(UINT32 nAddr, UINT16 nPort, PBYTE pbData, UINT cbData)
+{
+    UINT64 nId = MakeId(nAddr, nPort);
+    UINT32 nHash = 2166136261;
+    DWORD dwNow = GetTickCount();
+
+    for (UINT n = 0; n < cbData; n++) {
+        nHash ^= pbData[n];
+        nHash *= 16777619;
+    }
+
+    for (UINT n = 0; n < ARRAYOF(m_rRecent); n++) {
+        if (m_rRecent[n].nId == nId &&
+            m_rRecent[n].nHash == nHash &&
+            dwNow - m_rRecent[n].dwTick < RECENT_REQUEST_TIME) {
+            return TRUE;
+        }
+    }
+
+    m_rRecent[m_nRecent].nId = nId;
+    m_rRecent[m_nRecent].nHash = nHash;
+    m_rRecent[m_nRecent].dwTick = dwNow;
+    m_nRecent = (m_nRecent + 1) % ARRAYOF(m_rRecent);
+    return FALSE;
 }
 
 VOID CTftp::OnFactoryRecv(UINT dwError,
@@ -1386,6 +2406,29 @@ VOID CTftp::OnFactoryRecv(UINT dwError,
         return;
     }
 
+    if (s_nWorkers != 0) {
+        if (IsRecentRequest(nAddr, nPort, pbData, cbData)) {
+            VERBOSE(Log(nAddr, "<= repeated request from port %d dropped", nPort));
+            return;
+        }
+
+        // Least loaded worker, taking turns on ties.
+        CTftpWorker *pWorker = NULL;
+        for (UINT n = 0; n < s_nWorkers; n++) {
+            CTftpWorker *pNext = &s_rWorkers[(s_nNextWorker + n) % s_nWorkers];
+            if (pWorker == NULL || pNext->Load() < pWorker->Load()) {
+                pWorker = pNext;
+            }
+        }
+        s_nNextWorker = (s_nNextWorker + 1) % s_nWorkers;
+
+        if (!pWorker->Queue(m_pSink, m_nAddr, nAddr, nPort, pbData, cbData)) {
+            Log(nAddr, "Couldn't queue request to worker %d: %d",
+                pWorker->m_nIndex, GetLastError());
+        }
+        return;
+    }
+
     // New request.
     ISessionSink *pSession = NULL;
     FactorySessionCreate(nAddr, nPort, &pSession, NULL);
@@ -13,6 +13,9 @@
 
 #define TFTP_PORT 69  // Internet standard
 
+#define RECENT_REQUESTS     32      // Requests remembered per server.
+#define RECENT_REQUEST_TIME 5000    // Milliseconds a request is remembered.
+
 class ITftpSink
 {
   public:
@@ -26,12 +29,14 @@ class CTftp : public CSessionFactorySink
 {
   public:
     friend class CTftpNode;
+    friend class CTftpWorker;
 
     CTftp(CTftp *pNext);
     ~CTftp();
 
     static VOID ConfigureFiles(ITftpSink *pSink, INT argc, PCHAR *argv);
     static VOID OnFilesChange(ITftpSink *pSink);
+    static VOID ReportStats(ITftpSink *pSink);
 
     VOID    Configure(UINT32 nAddr, UINT16 nPort,
                       ITftpSink *pSink, INT argc, PCHAR *argv);
@@ -57,6 +62,7 @@ class CTftp : public CSessionFactorySink
 
   protected:
     VOID    Log(ULONG nAddr, PCSTR pszMsg, ...);
+    BOOL    IsRecentRequest(UINT32 nAddr, UINT16 nPort, PBYTE pbData, UINT cbData);
 
     inline UINT64 MakeId(UINT32 nAddr, UINT16 nPort) {
         return (UINT64)nAddr | ((UINT64)nPort << 32);
@@ -68,7 +74,16 @@ class CTftp : public CSessionFactorySink
     UINT16          m_nPort;
     CTftp *         m_pNext;
 
-    static UINT32   s_nSession;
+    // Requests handed to workers, for dropping retransmissions.
+    struct RecentRequest {
+        UINT64      nId;
+        UINT32      nHash;
+        DWORD       dwTick;
+    };
+    RecentRequest   m_rRecent[RECENT_REQUESTS];
+    UINT            m_nRecent;
+
+    static volatile LONG s_nSession;
 };
 //
 ///////////////////////////////////////////////////////////////// End of File.
@@ -0,0 +1,293 @@
+////////////////////////////////////////////////////////////////////////////
+//
+// KD network bridge.
+//
+// Copyright Microsoft Corporation
+//
+// Relays the kernel's network KD datagrams (Kernel\Native\halkdnet.cpp) to
+// a TCP byte stream, which the debugger opens as a serial port:
+//
+//      kdnetbridge [-u udpport] [-t tcpport] [-v]
+//      windbg -k com:port=<bridge host>,ipport=<tcpport>
+//
+// Every datagram is a KDNET header (signature, sequence) followed by a
+// slice of the serial KD byte stream, so KD's own packet checksums and
+// resends recover anything the network drops.  The target's address is
+// learned from the first datagram it sends.
+//
+// kdranges connects to the same TCP port to read memory in bulk.
+//
+// For QEMU, give the guest an e1000 on user-mode networking; the guest's
+// datagrams to 10.0.2.2 then arrive here on the loopback:
+//
+//      qemu-system-i386 ... -netdev user,id=kd -device e1000,netdev=kd
+//
+// Builds with nmake here, or elsewhere with "c++ -o kdnetbridge kdnetbridge.cpp".
+//
+#ifdef _WIN32
+#include <winlean.h>
+#include <winsock.h>
+typedef int socklen_t;
+#define closesocket_(s)     closesocket(s)
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+typedef int SOCKET;
+#define INVALID_SOCKET      (-1)
+#define closesocket_(s)     close(s)
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KDNET_SIGNATURE     0x544e444b      // "KDNT", little-endian on the wire
+#define KDNET_HEADER_SIZE   8
+#define KDNET_MAX_PAYLOAD   1464
+#define KDNET_DEFAULT_UDP   50000
+#define KDNET_DEFAULT_TCP   50001
+
+static bool             fVerbose = false;
+
+static SOCKET           sUdp = INVALID_SOCKET;
+static SOCKET           sListen = INVALID_SOCKET;
+static SOCKET           sDebugger = INVALID_SOCKET;
+
+static bool             fTargetKnown = false;
+static sockaddr_in      saTarget;
+static unsigned         nTargetSequence;
+static unsigned         nHostSequence;
+static unsigned         nLost;
+
+static void PutUint32(unsigned char *pb, unsigned value)
+{
+    pb[0] = (unsigned char)value;
+    pb[1] = (unsigned char)(value >> 8);
+    pb[2] = (unsigned char)(value >> 16);
+    pb[3] = (unsigned char)(value >> 24);
+}
+
+static unsigned GetUint32(const unsigned char *pb)
+{
+    return pb[0] | (pb[1] << 8) | (pb[2] << 16) | ((unsigned)pb[3] << 24);
+}
+
+static SOCKET OpenSocket(int type, unsigned short port)
+{
+    SOCKET s = socket(AF_INET, type, 0);
+    if (s == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    int on = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    sa.sin_port = htons(port);
+
+    if (bind(s, (sockaddr *)&sa, sizeof(sa)) != 0 ||
+        (type == SOCK_STREAM && listen(s, 1) != 0)) {
+        closesocket_(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+static void CloseDebugger()
+{
+    if (sDebugger != INVALID_SOCKET) {
+        closesocket_(sDebugger);
+        sDebugger = INVALID_SOCKET;
+        printf("kdnetbridge: debugger disconnected\n");
+    }
+}
+
+static void AcceptDebugger()
+{
+    sockaddr_in sa;
+    socklen_t cb = sizeof(sa);
+    SOCKET s = accept(sListen, (sockaddr *)&sa, &cb);
+    if (s == INVALID_SOCKET) {
+        return;
+    }
+
+    // A newer debugger replaces the old one, as if the cable were moved.
+    CloseDebugger();
+    sDebugger = s;
+
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+    printf("kdnetbridge: debugger connected from %s:%d\n",
+           inet_ntoa(sa.sin_addr), ntohs(sa.sin_port));
+}
+
+// Target to debugger.
+static void ReceiveTarget()
+{
+    unsigned char rb[KDNET_HEADER_SIZE + KDNET_MAX_PAYLOAD];
+    sockaddr_in sa;
+    socklen_t cb = sizeof(sa);
+
+    int len = recvfrom(sUdp, (char *)rb, sizeof(rb), 0, (sockaddr *)&sa, &cb);
+    if (len < KDNET_HEADER_SIZE || GetUint32(rb) != KDNET_SIGNATURE) {
+        return;
+    }
+
+    unsigned sequence = GetUint32(rb + 4);
+
+    if (!fTargetKnown ||
+        sa.sin_addr.s_addr != saTarget.sin_addr.s_addr ||
+        sa.sin_port != saTarget.sin_port) {
+
+        printf("kdnetbridge: target at %s:%d\n",
+               inet_ntoa(sa.sin_addr), ntohs(sa.sin_port));
+        saTarget = sa;
+        fTargetKnown = true;
+        nTargetSequence = sequence - 1;
+        nHostSequence = 0;
+    }
+
+    if (sequence == nTargetSequence) {
+        return;                                 // duplicate
+    }
+    if (sequence != nTargetSequence + 1) {
+        nLost++;
+        if (fVerbose) {
+            printf("kdnetbridge: lost %u datagram(s) before %u\n",
+                   sequence - nTargetSequence - 1, sequence);
+        }
+    }
+    nTargetSequence = sequence;
+
+    len -= KDNET_HEADER_SIZE;
+    if (fVerbose) {
+        printf("kdnetbridge: target seq %u, %d bytes\n", sequence, len);
+    }
+
+    // With no debugger attached the bytes are dropped; KD retries.
+    if (len > 0 && sDebugger != INVALID_SOCKET) {
+        if (send(sDebugger, (const char *)rb + KDNET_HEADER_SIZE, len, 0) != len) {
+            CloseDebugger();
+        }
+    }
+}
+
+// Debugger to target.
+static void ReceiveDebugger()
+{
+    unsigned char sb[KDNET_HEADER_SIZE + KDNET_MAX_PAYLOAD];
+
+    int len = recv(sDebugger, (char *)sb + KDNET_HEADER_SIZE, KDNET_MAX_PAYLOAD, 0);
+    if (len <= 0) {
+        CloseDebugger();
+        return;
+    }
+    if (!fTargetKnown) {
+        return;
+    }
+
+    PutUint32(sb, KDNET_SIGNATURE);
+    PutUint32(sb + 4, ++nHostSequence);
+
+    if (fVerbose) {
+        printf("kdnetbridge: host seq %u, %d bytes\n", nHostSequence, len);
+    }
+
+    sendto(sUdp, (const char *)sb, KDNET_HEADER_SIZE + len, 0,
+           (sockaddr *)&saTarget, sizeof(saTarget));
+}
+
+static void Usage()
+{
+    printf("Usage:\n"
+           "    kdnetbridge [options]\n"
+           "Options:\n"
+           "    -u port    UDP port the target sends to (default %d).\n"
+           "    -t port    TCP port the debugger connects to (default %d).\n"
+           "    -v         Trace every datagram.\n",
+           KDNET_DEFAULT_UDP, KDNET_DEFAULT_TCP);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned short udpPort = KDNET_DEFAULT_UDP;
+    unsigned short tcpPort = KDNET_DEFAULT_TCP;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            udpPort = (unsigned short)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            tcpPort = (unsigned short)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-v") == 0) {
+            fVerbose = true;
+        }
+        else {
+            Usage();
+            return 1;
+        }
+    }
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(1, 1), &wsaData) != 0) {
+        fprintf(stderr, "kdnetbridge: WSAStartup failed\n");
+        return 1;
+    }
+#endif
+
+    sUdp = OpenSocket(SOCK_DGRAM, udpPort);
+    sListen = OpenSocket(SOCK_STREAM, tcpPort);
+    if (sUdp == INVALID_SOCKET || sListen == INVALID_SOCKET) {
+        fprintf(stderr, "kdnetbridge: cannot bind udp:%d / tcp:%d\n", udpPort, tcpPort);
+        return 1;
+    }
+
+    printf("kdnetbridge: target udp:%d, debugger tcp:%d\n", udpPort, tcpPort);
+    fflush(stdout);
+
+    for (;;) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(sUdp, &fds);
+        FD_SET(sListen, &fds);
+        SOCKET sMax = (sUdp > sListen) ? sUdp : sListen;
+        SOCKET sPolled = sDebugger;
+        if (sDebugger != INVALID_SOCKET) {
+            FD_SET(sDebugger, &fds);
+            if (sDebugger > sMax) {
+                sMax = sDebugger;
+            }
+        }
+
+        if (select((int)sMax + 1, &fds, NULL, NULL, NULL) < 0) {
+#ifndef _WIN32
+            if (errno == EINTR) {
+                continue;
+            }
+#endif
+            fprintf(stderr, "kdnetbridge: select failed\n");
+            return 1;
+        }
+
+        if (FD_ISSET(sUdp, &fds)) {
+            ReceiveTarget();
+        }
+        if (FD_ISSET(sListen, &fds)) {
+            AcceptDebugger();
+        }
+        if (sPolled != INVALID_SOCKET && sDebugger == sPolled && FD_ISSET(sDebugger, &fds)) {
+            ReceiveDebugger();
+        }
+        fflush(stdout);
+    }
+}
@@ -0,0 +1,896 @@
+////////////////////////////////////////////////////////////////////////////
+//
+// KD memory range reader.
+//
+// Copyright Microsoft Corporation
+//
+// Reads target memory with the kernel's DbgKdReadMemoryRangesApi
+// (Kernel\Native\halkd.cpp), which streams any number of ranges back in
+// full KD packets instead of taking one request per packet.  It speaks the
+// serial KD packet protocol over TCP, so it connects where the debugger
+// would: to kdnetbridge, or to a virtual machine's serial port served on a
+// TCP port (qemu -serial tcp::50001,server).
+//
+//      kdranges [-s host] [-t tcpport] [-p] [-z] [-o file] [-v] address length ...
+//
+// Addresses and lengths are hex.  The tool breaks in, reads the ranges,
+// writes them back to back to the output file with unreadable spans
+// zero-filled, lists those spans, and lets the target continue.  With -z
+// it asks for DbgKdReadPackedMemoryRangesApi instead, whose data packets
+// are run-length packed; worth it on a serial link when memory is sparse.
+//
+// Builds with nmake here, or elsewhere with "c++ -o kdranges kdranges.cpp".
+//
+#ifdef _WIN32
+#include <winlean.h>
+#include <winsock.h>
+#define closesocket_(s)     closesocket(s)
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET      (-1)
+#define closesocket_(s)     close(s)
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef unsigned long long  UINT64;
+
+#define KDNET_DEFAULT_TCP               50001
+
+//
+// Serial KD framing, from Kernel\Native\halkd.h.
+//
+#define PACKET_LEADER                   0x30303030
+#define PACKET_LEADER_BYTE              0x30
+#define CONTROL_PACKET_LEADER           0x69696969
+#define CONTROL_PACKET_LEADER_BYTE      0x69
+#define PACKET_TRAILING_BYTE            0xAA
+#define BREAKIN_PACKET_BYTE             0x62
+#define PACKET_HEADER_SIZE              16
+#define PACKET_MAX_SIZE                 4000
+#define INITIAL_PACKET_ID               0x80800000
+#define SYNC_PACKET_ID                  0x00000800
+
+#define PACKET_TYPE_KD_STATE_MANIPULATE 2
+#define PACKET_TYPE_KD_ACKNOWLEDGE      4
+#define PACKET_TYPE_KD_RESEND           5
+#define PACKET_TYPE_KD_RESET            6
+#define PACKET_TYPE_KD_STATE_CHANGE64   7
+
+#define DbgKdContinueApi                0x00003136
+#define DbgKdReadMemoryRangesApi        0x000031F0
+#define DbgKdReadPackedMemoryRangesApi  0x000031F1
+
+#define DBG_CONTINUE                    0x00010002
+#define STATUS_BUFFER_OVERFLOW          0x80000005
+#define MMDBG_COPY_PHYSICAL             0x00000002
+
+//
+// DBGKD_MANIPULATE_STATE64: ApiNumber, ProcessorLevel, Processor and
+// ReturnStatus, then the per-API union at offset 16; 56 bytes in all.
+// DBGKD_READ_MEMORY_RANGES and DBGKD_CONTINUE sit at the start of the union.
+//
+#define MANIPULATE_SIZE                 56
+#define MANIPULATE_API                  0
+#define MANIPULATE_STATUS               8
+#define MANIPULATE_CONTINUE_STATUS      16
+#define MANIPULATE_RANGE_COUNT          16
+#define MANIPULATE_RANGE_FLAGS          20
+#define MANIPULATE_RANGE_INDEX          24
+#define MANIPULATE_RANGE_OFFSET         28
+#define MANIPULATE_RANGE_FINAL          32
+
+// DBGKD_MEMORY_RANGE: BaseAddress, Length, Flags.
+#define MEMORY_RANGE_SIZE               16
+#define MAX_REQUEST_RANGES              ((PACKET_MAX_SIZE - MANIPULATE_SIZE) / MEMORY_RANGE_SIZE)
+
+#define KD_TIMEOUT_MS                   5000
+#define KD_RETRIES                      5
+
+enum { KD_TIMEOUT, KD_RECEIVED, KD_BAD };
+
+struct KdPacket {
+    unsigned        leader;
+    unsigned        type;
+    unsigned        id;
+    unsigned        cb;
+    unsigned char   data[PACKET_MAX_SIZE];
+};
+
+struct Range {
+    UINT64          address;
+    unsigned        length;
+    unsigned char * pbData;
+    unsigned        cbSkipped;
+};
+
+// Where a reply packet's first byte lands, to check the stream against.
+struct Mark {
+    unsigned        ibStream;
+    unsigned        index;
+    unsigned        offset;
+};
+
+static bool             fVerbose = false;
+static bool             fPhysical = false;
+static bool             fPacked = false;
+
+static SOCKET           sTarget = INVALID_SOCKET;
+static unsigned char    rgbReceive[4096];
+static int              ibReceive;
+static int              cbReceive;
+
+static unsigned         nHostPacketId = INITIAL_PACKET_ID;
+static unsigned         nLastTargetId;
+static KdPacket         kpPending;
+static bool             fPending = false;
+
+static unsigned char *  pbStream;
+static unsigned         cbStream;
+static unsigned         cbStreamMax;
+static Mark *           pMarks;
+static unsigned         cMarks;
+static unsigned         cMarksMax;
+
+static void Fatal(const char *pszMessage)
+{
+    fprintf(stderr, "kdranges: %s\n", pszMessage);
+    exit(1);
+}
+
+static void PutUint32(unsigned char *pb, unsigned value)
+{
+    pb[0] = (unsigned char)value;
+    pb[1] = (unsigned char)(value >> 8);
+    pb[2] = (unsigned char)(value >> 16);
+    pb[3] = (unsigned char)(value >> 24);
+}
+
+static unsigned GetUint32(const unsigned char *pb)
+{
+    return pb[0] | (pb[1] << 8) | (pb[2] << 16) | ((unsigned)pb[3] << 24);
+}
+
+static void PutUint64(unsigned char *pb, UINT64 value)
+{
+    PutUint32(pb, (unsigned)value);
+    PutUint32(pb + 4, (unsigned)(value >> 32));
+}
+
+static UINT64 GetUint64(const unsigned char *pb)
+{
+    return GetUint32(pb) | ((UINT64)GetUint32(pb + 4) << 32);
+}
+
+static const char *FormatAddress(char *psz, UINT64 address)
+{
+    sprintf(psz, "%08x`%08x", (unsigned)(address >> 32), (unsigned)address);
+    return psz;
+}
+
+static bool ParseHex(const char *psz, UINT64 *pValue)
+{
+    UINT64 value = 0;
+
+    if (psz[0] == '0' && (psz[1] == 'x' || psz[1] == 'X')) {
+        psz += 2;
+    }
+    if (*psz == '\0') {
+        return false;
+    }
+    for (; *psz != '\0'; psz++) {
+        if (*psz == '`') {
+            continue;
+        }
+        int digit;
+        if (*psz >= '0' && *psz <= '9') {
+            digit = *psz - '0';
+        }
+        else if (*psz >= 'a' && *psz <= 'f') {
+            digit = *psz - 'a' + 10;
+        }
+        else if (*psz >= 'A' && *psz <= 'F') {
+            digit = *psz - 'A' + 10;
+        }
+        else {
+            return false;
+        }
+        value = (value << 4) | digit;
+    }
+    *pValue = value;
+    return true;
+}
+
+static void *Grow(void *pv, unsigned *pcMax, unsigned cNeeded, unsigned cbItem)
+{
+    if (cNeeded <= *pcMax) {
+        return pv;
+    }
+
+    unsigned cMax = (*pcMax == 0) ? 4096 : *pcMax;
+    while (cMax < cNeeded) {
+        cMax *= 2;
+    }
+    pv = realloc(pv, (size_t)cMax * cbItem);
+    if (pv == NULL) {
+        Fatal("out of memory");
+    }
+    *pcMax = cMax;
+    return pv;
+}
+
+////////////////////////////////////////////////////////////// Byte Stream.
+//
+
+// Returns the next byte from the target, or -1 if none arrives in time.
+static int ReceiveByte(int msTimeout)
+{
+    if (ibReceive == cbReceive) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(sTarget, &fds);
+
+        timeval tv;
+        tv.tv_sec = msTimeout / 1000;
+        tv.tv_usec = (msTimeout % 1000) * 1000;
+
+        if (select((int)sTarget + 1, &fds, NULL, NULL, &tv) <= 0) {
+            return -1;
+        }
+
+        int cb = recv(sTarget, (char *)rgbReceive, sizeof(rgbReceive), 0);
+        if (cb <= 0) {
+            Fatal("connection closed");
+        }
+        ibReceive = 0;
+        cbReceive = cb;
+    }
+    return rgbReceive[ibReceive++];
+}
+
+static void Send(const unsigned char *pb, int cb)
+{
+    while (cb > 0) {
+        int sent = send(sTarget, (const char *)pb, cb, 0);
+        if (sent <= 0) {
+            Fatal("connection closed");
+        }
+        pb += sent;
+        cb -= sent;
+    }
+}
+
+////////////////////////////////////////////////////////////////// Packets.
+//
+
+static unsigned Checksum(const unsigned char *pb, unsigned cb)
+{
+    unsigned sum = 0;
+    while (cb-- > 0) {
+        sum += *pb++;
+    }
+    return sum;
+}
+
+static void SendPacket(unsigned leader, unsigned type, unsigned id,
+                       const unsigned char *pb, unsigned cb)
+{
+    unsigned char rgb[PACKET_HEADER_SIZE + PACKET_MAX_SIZE + 1];
+
+    PutUint32(rgb, leader);
+    rgb[4] = (unsigned char)type;
+    rgb[5] = (unsigned char)(type >> 8);
+    rgb[6] = (unsigned char)cb;
+    rgb[7] = (unsigned char)(cb >> 8);
+    PutUint32(rgb + 8, id);
+    PutUint32(rgb + 12, Checksum(pb, cb));
+    memcpy(rgb + PACKET_HEADER_SIZE, pb, cb);
+
+    cb += PACKET_HEADER_SIZE;
+    if (leader == PACKET_LEADER) {
+        rgb[cb++] = PACKET_TRAILING_BYTE;
+    }
+    Send(rgb, cb);
+}
+
+static void SendControl(unsigned type, unsigned id)
+{
+    if (fVerbose) {
+        printf("kdranges: send control %u id %08x\n", type, id);
+    }
+    SendPacket(CONTROL_PACKET_LEADER, type, id, NULL, 0);
+}
+
+static int ReceivePacket(KdPacket *pp, int msTimeout)
+{
+    unsigned char rgb[PACKET_HEADER_SIZE - 4];
+    int leader = 0;
+    int run = 0;
+    int b;
+    unsigned i;
+
+    // Hunt for four identical leader bytes.
+    while (run < 4) {
+        if ((b = ReceiveByte(msTimeout)) < 0) {
+            return KD_TIMEOUT;
+        }
+        if (b == PACKET_LEADER_BYTE || b == CONTROL_PACKET_LEADER_BYTE) {
+            run = (b == leader) ? run + 1 : 1;
+            leader = b;
+        }
+        else {
+            run = 0;
+            leader = 0;
+        }
+    }
+
+    for (i = 0; i < sizeof(rgb); i++) {
+        if ((b = ReceiveByte(msTimeout)) < 0) {
+            return KD_TIMEOUT;
+        }
+        rgb[i] = (unsigned char)b;
+    }
+
+    pp->leader = (leader == PACKET_LEADER_BYTE) ? PACKET_LEADER : CONTROL_PACKET_LEADER;
+    pp->type = rgb[0] | (rgb[1] << 8);
+    pp->cb = rgb[2] | (rgb[3] << 8);
+    pp->id = GetUint32(rgb + 4);
+
+    if (fVerbose) {
+        printf("kdranges: receive %s %u id %08x, %u bytes\n",
+               (pp->leader == PACKET_LEADER) ? "packet" : "control",
+               pp->type, pp->id, pp->cb);
+    }
+
+    if (pp->leader == CONTROL_PACKET_LEADER) {
+        pp->cb = 0;
+        return KD_RECEIVED;
+    }
+    if (pp->cb > PACKET_MAX_SIZE) {
+        return KD_BAD;
+    }
+
+    for (i = 0; i <= pp->cb; i++) {
+        if ((b = ReceiveByte(msTimeout)) < 0) {
+            return KD_TIMEOUT;
+        }
+        if (i < pp->cb) {
+            pp->data[i] = (unsigned char)b;
+        }
+        else if (b != PACKET_TRAILING_BYTE) {
+            return KD_BAD;
+        }
+    }
+
+    return (Checksum(pp->data, pp->cb) == GetUint32(rgb + 8)) ? KD_RECEIVED : KD_BAD;
+}
+
+// Stops the target and resets both packet ids, so the exchange does not
+// depend on what an earlier debugger left behind.  The target answers a
+// reset by resending its state change, stopped or not.
+static void BreakIn()
+{
+    for (int tries = 0; tries < KD_RETRIES; tries++) {
+        unsigned char b = BREAKIN_PACKET_BYTE;
+        Send(&b, 1);
+        SendControl(PACKET_TYPE_KD_RESET, 0);
+
+        time_t tReset = time(NULL);
+        bool fReset = false;
+        KdPacket *pp = &kpPending;
+        int result;
+
+        while ((result = ReceivePacket(pp, KD_TIMEOUT_MS / 2)) != KD_TIMEOUT) {
+            if (result == KD_BAD) {
+                continue;
+            }
+            if (pp->leader == CONTROL_PACKET_LEADER) {
+                if (pp->type == PACKET_TYPE_KD_RESET) {
+                    fReset = true;
+                }
+                continue;
+            }
+            if (!fReset) {
+                // Sent before the reset was seen.  The target drops what it
+                // received before its first state change, so the reset may
+                // be gone; repeat it, at most once a second.
+                if (time(NULL) != tReset) {
+                    SendControl(PACKET_TYPE_KD_RESET, 0);
+                    tReset = time(NULL);
+                }
+                continue;
+            }
+
+            SendControl(PACKET_TYPE_KD_ACKNOWLEDGE, pp->id & ~SYNC_PACKET_ID);
+            nLastTargetId = pp->id;
+            if (pp->type == PACKET_TYPE_KD_STATE_CHANGE64) {
+                nHostPacketId = INITIAL_PACKET_ID;
+                printf("kdranges: target stopped\n");
+                return;
+            }
+        }
+    }
+    Fatal("target does not respond");
+}
+
+// Sends a manipulate request and returns once the target has it, or false
+// if it never acknowledges it.
+static bool SendRequest(const unsigned char *pb, unsigned cb)
+{
+    KdPacket *pp = &kpPending;
+
+    for (int tries = 0; tries < KD_RETRIES; tries++) {
+        SendPacket(PACKET_LEADER, PACKET_TYPE_KD_STATE_MANIPULATE, nHostPacketId, pb, cb);
+
+        for (;;) {
+            int result = ReceivePacket(pp, KD_TIMEOUT_MS);
+            if (result == KD_TIMEOUT) {
+                break;
+            }
+            if (result == KD_BAD) {
+                SendControl(PACKET_TYPE_KD_RESEND, 0);
+                continue;
+            }
+            if (pp->leader == CONTROL_PACKET_LEADER) {
+                if (pp->type == PACKET_TYPE_KD_ACKNOWLEDGE && pp->id == nHostPacketId) {
+                    nHostPacketId ^= 1;
+                    return true;
+                }
+                if (pp->type == PACKET_TYPE_KD_RESEND) {
+                    break;
+                }
+                continue;
+            }
+            if (pp->id == nLastTargetId) {
+                // Our acknowledgement of its last packet got lost.
+                SendControl(PACKET_TYPE_KD_ACKNOWLEDGE, pp->id & ~SYNC_PACKET_ID);
+                continue;
+            }
+
+            // A new packet means the request arrived and only its
+            // acknowledgement got lost; keep the packet for the reader.
+            nHostPacketId ^= 1;
+            fPending = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the target's next new manipulate packet, acknowledged.
+static void ReceiveReply(KdPacket *pp)
+{
+    int timeouts = 0;
+
+    for (;;) {
+        int result;
+
+        if (fPending) {
+            memcpy(pp, &kpPending, sizeof(*pp));
+            fPending = false;
+            result = KD_RECEIVED;
+        }
+        else {
+            result = ReceivePacket(pp, KD_TIMEOUT_MS);
+        }
+
+        if (result == KD_TIMEOUT) {
+            if (++timeouts == KD_RETRIES) {
+                Fatal("target stopped replying");
+            }
+            continue;
+        }
+        if (result == KD_BAD) {
+            SendControl(PACKET_TYPE_KD_RESEND, 0);
+            continue;
+        }
+        if (pp->leader == CONTROL_PACKET_LEADER) {
+            continue;
+        }
+
+        SendControl(PACKET_TYPE_KD_ACKNOWLEDGE, pp->id & ~SYNC_PACKET_ID);
+        if (pp->id == nLastTargetId) {
+            continue;
+        }
+        nLastTargetId = pp->id;
+
+        if (pp->type == PACKET_TYPE_KD_STATE_MANIPULATE && pp->cb >= MANIPULATE_SIZE) {
+            return;
+        }
+    }
+}
+
+static void Continue()
+{
+    unsigned char rgb[MANIPULATE_SIZE];
+
+    memset(rgb, 0, sizeof(rgb));
+    PutUint32(rgb + MANIPULATE_API, DbgKdContinueApi);
+    PutUint32(rgb + MANIPULATE_CONTINUE_STATUS, DBG_CONTINUE);
+
+    // A running target no longer answers, so a lost acknowledgement of the
+    // continue looks the same as a target that never got it.
+    if (SendRequest(rgb, sizeof(rgb))) {
+        printf("kdranges: target continued\n");
+    }
+    else {
+        printf("kdranges: continue not acknowledged; the target may be running\n");
+    }
+}
+
+/////////////////////////////////////////////////////////////// Range Reads.
+//
+
+// Appends a packed data packet to the stream (see DbgKdReadPackedMemoryRangesApi
+// in Kernel\Native\halkd.h).
+static void Unpack(const unsigned char *pb, unsigned cb)
+{
+    unsigned ib = 0;
+
+    while (ib < cb) {
+        unsigned control = pb[ib++];
+
+        if (control < 0x80) {
+            unsigned count = control + 1;
+            if (ib + count > cb) {
+                Fatal("packed data ends inside a literal");
+            }
+            pbStream = (unsigned char *)Grow(pbStream, &cbStreamMax, cbStream + count, 1);
+            memcpy(pbStream + cbStream, pb + ib, count);
+            cbStream += count;
+            ib += count;
+        }
+        else {
+            unsigned count = control - 0x80 + 3;
+            if (ib >= cb) {
+                Fatal("packed data ends inside a run");
+            }
+            pbStream = (unsigned char *)Grow(pbStream, &cbStreamMax, cbStream + count, 1);
+            memset(pbStream + cbStream, pb[ib], count);
+            cbStream += count;
+            ib++;
+        }
+    }
+}
+
+// Lays the streamed bytes of ranges [index, stop) out in the ranges'
+// buffers, stepping over the skipped spans, and checks every packet landed
+// where its RangeIndex/RangeOffset said.  Only the first range starts at
+// offset; the request's ranges are numbered from index.
+static void PlaceStream(Range *pr, unsigned index, unsigned offset,
+                        unsigned stopIndex, unsigned stopOffset,
+                        const unsigned char *pbSkipped, unsigned cSkipped)
+{
+    unsigned ibStream = 0;
+    unsigned iMark = 0;
+    unsigned iSkipped = 0;
+    char sz1[20];
+    char sz2[20];
+
+    for (unsigned i = index; i <= stopIndex; i++) {
+        unsigned start = (i == index) ? offset : 0;
+        unsigned end = (i == stopIndex) ? stopOffset : pr[i].length;
+
+        if (i == stopIndex && end == 0) {
+            break;
+        }
+
+        while (start < end) {
+            unsigned readable = end - start;
+            unsigned skipped = 0;
+
+            if (iSkipped < cSkipped &&
+                GetUint32(pbSkipped + iSkipped * MEMORY_RANGE_SIZE + 12) == i - index) {
+
+                const unsigned char *pb = pbSkipped + iSkipped * MEMORY_RANGE_SIZE;
+                unsigned skipStart = (unsigned)(GetUint64(pb) - pr[i].address);
+
+                if (skipStart < start || skipStart > end) {
+                    Fatal("skipped span outside its range");
+                }
+                readable = skipStart - start;
+                skipped = GetUint32(pb + 8);
+                if (skipped > end - skipStart) {
+                    Fatal("skipped span outside its range");
+                }
+                iSkipped++;
+            }
+
+            if (ibStream + readable > cbStream) {
+                Fatal("reply stream shorter than its ranges");
+            }
+            for (; iMark < cMarks && pMarks[iMark].ibStream < ibStream + readable; iMark++) {
+                if (pMarks[iMark].index != i - index ||
+                    pMarks[iMark].offset + ((i == index) ? offset : 0) !=
+                    start + (pMarks[iMark].ibStream - ibStream)) {
+                    Fatal("reply packet out of place");
+                }
+            }
+
+            memcpy(pr[i].pbData + start, pbStream + ibStream, readable);
+            ibStream += readable;
+            start += readable;
+
+            if (skipped > 0) {
+                printf("kdranges:   %s..%s unreadable\n",
+                       FormatAddress(sz1, pr[i].address + start),
+                       FormatAddress(sz2, pr[i].address + start + skipped));
+                pr[i].cbSkipped += skipped;
+                start += skipped;
+            }
+        }
+    }
+
+    if (ibStream != cbStream || iSkipped != cSkipped) {
+        Fatal("reply stream longer than its ranges");
+    }
+}
+
+// Reads the ranges with as few requests as the packet size allows.  A
+// request the target stops early (its table of skipped spans filled up)
+// goes out again from where it stopped.
+static void ReadRanges(Range *pr, unsigned count)
+{
+    unsigned char rgb[PACKET_MAX_SIZE];
+    KdPacket *pp = (KdPacket *)malloc(sizeof(KdPacket));
+    unsigned index = 0;
+    unsigned offset = 0;
+    unsigned api = fPacked ? DbgKdReadPackedMemoryRangesApi : DbgKdReadMemoryRangesApi;
+    unsigned requests = 0;
+    unsigned packets = 0;
+    UINT64 cbWire = 0;
+    UINT64 cbData = 0;
+
+    if (pp == NULL) {
+        Fatal("out of memory");
+    }
+
+    while (index < count) {
+        unsigned n = count - index;
+        if (n > MAX_REQUEST_RANGES) {
+            n = MAX_REQUEST_RANGES;
+        }
+
+        memset(rgb, 0, MANIPULATE_SIZE);
+        PutUint32(rgb + MANIPULATE_API, api);
+        PutUint32(rgb + MANIPULATE_RANGE_COUNT, n);
+        PutUint32(rgb + MANIPULATE_RANGE_FLAGS, fPhysical ? MMDBG_COPY_PHYSICAL : 0);
+
+        for (unsigned i = 0; i < n; i++) {
+            unsigned char *pb = rgb + MANIPULATE_SIZE + i * MEMORY_RANGE_SIZE;
+            unsigned skip = (i == 0) ? offset : 0;
+
+            PutUint64(pb, pr[index + i].address + skip);
+            PutUint32(pb + 8, pr[index + i].length - skip);
+            PutUint32(pb + 12, 0);
+        }
+
+        if (!SendRequest(rgb, MANIPULATE_SIZE + n * MEMORY_RANGE_SIZE)) {
+            Fatal("target does not acknowledge the request");
+        }
+        requests++;
+
+        cbStream = 0;
+        cMarks = 0;
+
+        for (;;) {
+            ReceiveReply(pp);
+            packets++;
+
+            unsigned status = GetUint32(pp->data + MANIPULATE_STATUS);
+            if (GetUint32(pp->data + MANIPULATE_API) != api ||
+                (status & 0xC0000000) == 0xC0000000) {
+                fprintf(stderr, "kdranges: target refused the request (status %08x)\n", status);
+                Continue();
+                exit(1);
+            }
+
+            unsigned rangeIndex = GetUint32(pp->data + MANIPULATE_RANGE_INDEX);
+            unsigned rangeOffset = GetUint32(pp->data + MANIPULATE_RANGE_OFFSET);
+            const unsigned char *pbData = pp->data + MANIPULATE_SIZE;
+            unsigned cbPacket = pp->cb - MANIPULATE_SIZE;
+
+            if (GetUint32(pp->data + MANIPULATE_RANGE_FINAL) == 0) {
+                pMarks = (Mark *)Grow(pMarks, &cMarksMax, cMarks + 1, sizeof(Mark));
+                pMarks[cMarks].ibStream = cbStream;
+                pMarks[cMarks].index = rangeIndex;
+                pMarks[cMarks].offset = rangeOffset;
+                cMarks++;
+
+                cbWire += cbPacket;
+                if (fPacked) {
+                    unsigned cbBefore = cbStream;
+                    Unpack(pbData, cbPacket);
+                    cbData += cbStream - cbBefore;
+                }
+                else {
+                    pbStream = (unsigned char *)Grow(pbStream, &cbStreamMax, cbStream + cbPacket, 1);
+                    memcpy(pbStream + cbStream, pbData, cbPacket);
+                    cbStream += cbPacket;
+                    cbData += cbPacket;
+                }
+                continue;
+            }
+
+            if (rangeIndex > n ||
+                (rangeIndex < n &&
+                 rangeOffset + ((rangeIndex == 0) ? offset : 0) > pr[index + rangeIndex].length)) {
+                Fatal("final packet out of range");
+            }
+
+            PlaceStream(pr, index, offset, index + rangeIndex,
+                        rangeOffset + ((rangeIndex == 0) ? offset : 0),
+                        pbData, cbPacket / MEMORY_RANGE_SIZE);
+
+            if (status == STATUS_BUFFER_OVERFLOW) {
+                if (rangeIndex == 0 && rangeOffset == 0) {
+                    Fatal("target made no progress");
+                }
+                offset = rangeOffset + ((rangeIndex == 0) ? offset : 0);
+            }
+            else {
+                offset = 0;
+            }
+            index += rangeIndex;
+            break;
+        }
+    }
+
+    printf("kdranges: %u range(s) in %u request(s), %u reply packet(s)\n",
+           count, requests, packets);
+    if (fPacked) {
+        printf("kdranges: %llu bytes packed into %llu\n", cbData, cbWire);
+    }
+    free(pp);
+}
+
+static SOCKET Connect(const char *pszHost, unsigned short port)
+{
+    hostent *phe = gethostbyname(pszHost);
+    if (phe == NULL) {
+        return INVALID_SOCKET;
+    }
+
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    memcpy(&sa.sin_addr, phe->h_addr, sizeof(sa.sin_addr));
+    sa.sin_port = htons(port);
+
+    if (connect(s, (sockaddr *)&sa, sizeof(sa)) != 0) {
+        closesocket_(s);
+        return INVALID_SOCKET;
+    }
+
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+    return s;
+}
+
+static void Usage()
+{
+    printf("Usage:\n"
+           "    kdranges [options] address length [address length ...]\n"
+           "Options:\n"
+           "    -s host    Host of the KD byte stream (default localhost).\n"
+           "    -t port    TCP port of the KD byte stream (default %d).\n"
+           "    -p         Addresses are physical.\n"
+           "    -z         Ask for run-length packed replies.\n"
+           "    -o file    Write the ranges back to back to file.\n"
+           "    -v         Trace every packet.\n",
+           KDNET_DEFAULT_TCP);
+}
+
+int main(int argc, char **argv)
+{
+    const char *pszHost = "localhost";
+    const char *pszOutput = NULL;
+    unsigned short tcpPort = KDNET_DEFAULT_TCP;
+    Range *pr = (Range *)calloc(argc, sizeof(Range));
+    unsigned count = 0;
+    int i;
+
+    if (pr == NULL) {
+        Fatal("out of memory");
+    }
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            pszHost = argv[++i];
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            tcpPort = (unsigned short)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            pszOutput = argv[++i];
+        }
+        else if (strcmp(argv[i], "-p") == 0) {
+            fPhysical = true;
+        }
+        else if (strcmp(argv[i], "-z") == 0) {
+            fPacked = true;
+        }
+        else if (strcmp(argv[i], "-v") == 0) {
+            fVerbose = true;
+        }
+        else {
+            Usage();
+            return 1;
+        }
+    }
+
+    for (; i + 1 < argc; i += 2) {
+        UINT64 length;
+
+        if (!ParseHex(argv[i], &pr[count].address) ||
+            !ParseHex(argv[i + 1], &length) || length == 0 || length > 0xffffffff) {
+            Usage();
+            return 1;
+        }
+        pr[count].length = (unsigned)length;
+        pr[count].pbData = (unsigned char *)calloc(pr[count].length, 1);
+        if (pr[count].pbData == NULL) {
+            Fatal("out of memory");
+        }
+        count++;
+    }
+    if (i != argc || count == 0) {
+        Usage();
+        return 1;
+    }
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(1, 1), &wsaData) != 0) {
+        Fatal("WSAStartup failed");
+    }
+#endif
+
+    sTarget = Connect(pszHost, tcpPort);
+    if (sTarget == INVALID_SOCKET) {
+        fprintf(stderr, "kdranges: cannot connect to %s:%d\n", pszHost, tcpPort);
+        return 1;
+    }
+
+    BreakIn();
+    ReadRanges(pr, count);
+    Continue();
+    closesocket_(sTarget);
+
+    FILE *pf = NULL;
+    if (pszOutput != NULL && (pf = fopen(pszOutput, "wb")) == NULL) {
+        fprintf(stderr, "kdranges: cannot create %s\n", pszOutput);
+        return 1;
+    }
+
+    for (unsigned r = 0; r < count; r++) {
+        char sz[20];
+
+        printf("kdranges: %s %08x bytes, %08x unreadable\n",
+               FormatAddress(sz, pr[r].address), pr[r].length, pr[r].cbSkipped);
+        if (pf != NULL && fwrite(pr[r].pbData, 1, pr[r].length, pf) != pr[r].length) {
+            fprintf(stderr, "kdranges: cannot write %s\n", pszOutput);
+            return 1;
+        }
+    }
+    if (pf != NULL) {
+        fclose(pf);
+    }
+    return 0;
+}
@@ -17,6 +17,9 @@ class GCTracing : public EventingEnumerator
 public:
 
     GCTracing ();
+    ~GCTracing ();
+
+    bool WriteFolded;       // Folded allocation stacks instead of the CLR profiler log
 
     //  Override callouts
 
@@ -29,6 +32,9 @@ public:
 
 private:
     void InitFile();
+    void RecordFolded(EventTypeEntry * entryDescriptor);
+    void FlushFolded();
+    void ClearFolded();
 
     FILE * f;
 
@@ -49,6 +55,16 @@ private:
     UINT64 TypeStorageHandle;
     bool ParsingMetadata;
 
+    //
+    //  Folded output state, per controller. Names and stacks are malloc'ed
+    //  and stored as pointers.
+    //
+
+    IpTable Functions;      // FnIdx + 1 -> function name
+    IpTable Types;          // TypeId + 1 -> type name
+    IpTable Stacks;         // StkNo + 1 -> (TypeId, Size, count, FnIdx...)
+    IpTable Allocations;    // StkNo + 1 -> number of allocations
+
 };
 
 #define MAX_PAGE_SIZE 4096
@@ -271,17 +287,22 @@ GCTracing::GCTracing ()
     f = NULL;
     EventStorageHandle = 0;
     TypeStorageHandle = 0;
+    WriteFolded = false;
+
+}
 
+GCTracing::~GCTracing ()
+{
+    ClearFolded();
 }
 
 void GCTracing::InitFile()
 {
     if (f == NULL) {
-        char fname[128];
-
         char * controllerName = controller->GetControllerName();
 
-        _snprintf(fname, sizeof(fname), "%s_%s.LOG", prefixName, controllerName);
+        _snprintf(fname, sizeof(fname), "%s_%s.%s",
+                  prefixName, controllerName, WriteFolded ? "folded" : "LOG");
 
         free(controllerName);
         f = fopen( fname, "wt" );
@@ -335,6 +356,14 @@ bool GCTracing::TypeCallout(EventTypeEntry * entryDescriptor)
 
 bool GCTracing::ControllerCallout( ControllerObject *ctrl, bool finished)
 {
+    if (WriteFolded) {
+
+        if (finished) {
+            FlushFolded();
+        }
+        ClearFolded();
+    }
+
     if (finished) {
         controller = NULL;
     } else {
@@ -404,6 +433,12 @@ bool GCTracing::EntryCallout(EntryHeader *header, EventTypeEntry * entryDescript
         return FALSE;
     }
 
+    if (WriteFolded) {
+
+        RecordFolded(entryDescriptor);
+        return TRUE;
+    }
+
     if (entryDescriptor->Key == TypeHandle) {
 
         InitFile();
@@ -533,9 +568,197 @@ bool GCTracing::EntryCallout(EntryHeader *header, EventTypeEntry * entryDescript
 
 }
 
+//
+//  Folded allocation stacks. The log only names each distinct allocation
+//  stack once (GC_STACK, with the size of the object allocated there) and
+//  then refers to it by number from each allocation, so the records are
+//  collected per controller and turned into weighted stacks at the end.
+//
 
-void
-WriteCLRProfileFile(PCSTR fname, bool Kernel)
+void GCTracing::RecordFolded(EventTypeEntry * entryDescriptor)
+{
+    if (entryDescriptor->Key == FunctionHandle) {
+
+        ULONG64 displacement = 0;
+        ULONG64 funcPtr = entryDescriptor->GetField("IP")->GetFieldNumericValue();
+        UINT64 * slot = Functions.Lookup(entryDescriptor->GetField("FnIdx")->GetFieldNumericValue() + 1, true);
+
+        if (slot == NULL || *slot != 0) {
+
+            return;
+        }
+
+        if (g_ExtSymbols->GetNameByOffset(funcPtr,
+                                          szSymbol,
+                                          arrayof(szSymbol),
+                                          NULL,
+                                          &displacement) != S_OK) {
+
+            _snprintf(szSymbol, arrayof(szSymbol), "0x%p", (ULONG)funcPtr);
+        }
+
+        *slot = (UINT64)(ULONG_PTR)_strdup(szSymbol);
+
+    } else if (entryDescriptor->Key == TypeHandle) {
+
+        UINT64 * slot = Types.Lookup(entryDescriptor->GetField("TypeId")->GetFieldNumericValue() + 1, true);
+
+        PCHAR str = entryDescriptor->GetExtendedString(1);
+
+        if (slot != NULL && *slot == 0 && str != NULL) {
+
+            *slot = (UINT64)(ULONG_PTR)_strdup(str);
+        }
+
+    } else if (entryDescriptor->Key == StackHandle) {
+
+        UINT64 stackNo = entryDescriptor->GetField("StkNo")->GetFieldNumericValue();
+        UINT64 * slot = Stacks.Lookup(stackNo + 1, true);
+
+        if (slot == NULL || *slot != 0) {
+
+            return;
+        }
+
+        FieldEntry * array = entryDescriptor->GetField("fncList");
+        void * buffer = entryDescriptor->GetFieldArray((int)array->GetFieldNumericValue());
+
+        //
+        //  Same frames as the CLR profiler log: the list starts at the root
+        //  and the last two entries are dropped.
+        //
+
+        int count = array->GetArraySize(buffer) - 2;
+
+        if (count < 0) {
+
+            count = 0;
+        }
+
+        UINT64 * stack = (UINT64 *)malloc((3 + count) * sizeof(UINT64));
+
+        if (stack == NULL) {
+
+            return;
+        }
+
+        stack[0] = entryDescriptor->GetField("TypeId")->GetFieldNumericValue();
+        stack[1] = entryDescriptor->GetField("Size")->GetFieldNumericValue();
+        stack[2] = count;
+
+        for (int i = 0; i < count; i++) {
+
+            stack[3 + i] = array->GetFieldNumericValue(buffer, i);
+        }
+
+        *slot = (UINT64)(ULONG_PTR)stack;
+
+    } else if (entryDescriptor->Key == AllocationHandle) {
+
+        UINT64 stackNo = entryDescriptor->GetField("StkNo")->GetFieldNumericValue();
+
+        //
+        //  Stack numbers start at 1; 0 marks an allocation logged without a
+        //  stack, which has no frames to fold.
+        //
+
+        if (stackNo != 0) {
+
+            UINT64 * slot = Allocations.Lookup(stackNo + 1, true);
+
+            if (slot != NULL) {
+
+                *slot += 1;
+            }
+        }
+    }
+}
+
+void GCTracing::FlushFolded()
+{
+    FoldedStacks folded;
+    UINT64 key;
+    UINT64 allocations;
+
+    for (int iterator = 0; Allocations.Enumerate(iterator, &key, &allocations);) {
+
+        UINT64 * value = Stacks.Lookup(key, false);
+
+        if (value == NULL) {
+
+            continue;
+        }
+
+        UINT64 * stack = (UINT64 *)(ULONG_PTR)*value;
+
+        folded.BeginStack();
+
+        for (UINT64 i = 0; i < stack[2]; i++) {
+
+            UINT64 * name = Functions.Lookup(stack[3 + i] + 1, false);
+
+            if (name != NULL) {
+
+                folded.AddFrame((PCSTR)(ULONG_PTR)*name);
+
+            } else {
+
+                _snprintf(szSymbol, arrayof(szSymbol), "fn#%I64u", stack[3 + i]);
+                folded.AddFrame(szSymbol);
+            }
+        }
+
+        //
+        //  The allocated type is the leaf, so objects of different types
+        //  allocated from the same call site stay apart.
+        //
+
+        UINT64 * type = Types.Lookup(stack[0] + 1, false);
+
+        if (type != NULL) {
+
+            folded.AddFrame((PCSTR)(ULONG_PTR)*type);
+
+        } else {
+
+            _snprintf(szSymbol, arrayof(szSymbol), "type#%I64u", stack[0]);
+            folded.AddFrame(szSymbol);
+        }
+
+        folded.EndStack(allocations * stack[1]);
+    }
+
+    if (Allocations.Count() != 0) {
+
+        InitFile();
+
+        if (f != NULL) {
+
+            ExtOut("Wrote %d folded allocation stacks to %s\n", folded.Write(f), fname);
+        }
+    }
+}
+
+void GCTracing::ClearFolded()
+{
+    IpTable * owners[] = {&Functions, &Types, &Stacks};
+    UINT64 key;
+    UINT64 value;
+
+    for (int i = 0; i < (int)arrayof(owners); i++) {
+
+        for (int iterator = 0; owners[i]->Enumerate(iterator, &key, &value);) {
+
+            free((void *)(ULONG_PTR)value);
+        }
+        owners[i]->Clear();
+    }
+
+    Allocations.Clear();
+}
+
+static void
+WalkGCProfile(PCSTR fname, bool folded)
 {
     prefixName = fname;
 
@@ -546,6 +769,7 @@ WriteCLRProfileFile(PCSTR fname, bool Kernel)
 
         if (dump) {
 
+            dump->WriteFolded = folded;
             collector->TypeHandle = 0;
             collector->GroupByController = TRUE;
             collector->cascadeEnumerator = dump;
@@ -559,5 +783,14 @@ WriteCLRProfileFile(PCSTR fname, bool Kernel)
     }
 }
 
+void
+WriteCLRProfileFile(PCSTR fname, bool Kernel)
+{
+    WalkGCProfile(fname, false);
+}
 
-
+void
+WriteGCFoldedStacks(PCSTR fname)
+{
+    WalkGCProfile(fname, true);
+}
@@ -16,6 +16,7 @@ BOOL IncludeExecutables;
 BOOL IncludeRegisterReferences;
 void AddMemoryReference(UINT64 address);
 BOOL FullMemoryDump;
+BOOL SkipFreePages;
 
 //
 //  Cross-platform utility functions
@@ -229,6 +230,7 @@ static HRESULT Usage()
            "    -f : Include all memory pages in the dump\n"
            "    -x : Include images in dumps\n"
            "    -r : Include register references\n"
+           "    -z : Leave out pages the kernel page table marks free\n"
            "    -t : Start tracing mode. All memory references used by compliant extensions are logged\n"
            "         to be available for offline usage\n"
           );
@@ -243,6 +245,9 @@ static HRESULT Usage()
 
 #define MAX_MEMORY_RANGE 100*1024*1024
 #define MEMORY_PAGE_SIZE 4096
+#define DUMP_BATCH_SIZE (1024*1024)                 // Target memory read per batch
+#define DUMP_BUFFERS 2
+#define LOW_MEMORY_LIMIT (MEMORY_PAGE_SIZE * 16)    // AddRange ignores ranges below
 
 struct _MEMORY_STREAM {
     UINT32                  MemoryCount;
@@ -313,153 +318,151 @@ StructType ProcessInfoStruct = StructType(kernel_Process,
 //  to be included in the crashdump at various phases.
 //  There is a strict requirement of the crashdump to never include overlapped
 //  descriptors for the memory ranges. but practically, memory collected
-//  from various areas may in fact partially or totally overlap
-//  After the collection is done, CompactItems method takes care of
-//  sanitazing and coalescing overlapped ranges
+//  from various areas may in fact partially or totally overlap.
+//  The ranges are therefore kept sorted by address, and each new range is
+//  merged on insert with every range it overlaps or touches, so the array
+//  never holds overlapped descriptors and can be binary searched.
 //
 
-static int ItemCompare(const void * e1, const void * e2)
+//
+//  Returns the index of the last range starting at or below address,
+//  or -1 if there is none.
+//
+
+int MemoryRagesCollection::FindRange(UINT64 address)
 {
-    UINT64 *ptr1 = (UINT64 *) e1;
-    UINT64 *ptr2 = (UINT64 *) e2;
+    int low = 0;
+    int high = GetRangesCount() - 1;
+    int found = -1;
+
+    while (low <= high) {
 
-    if (ptr1[0] < ptr2[0]) {
-        return -1;
-    } else if (ptr1[0] == ptr2[0]) {
-        return 0;
+        int middle = (low + high) / 2;
+
+        if (GetStartAddress(middle) <= address) {
+
+            found = middle;
+            low = middle + 1;
+
+        } else {
+
+            high = middle - 1;
+        }
     }
 
-    return 1;
+    return found;
 }
 
 void MemoryRagesCollection::AddRange(UINT64 startRVA, UINT64 rangeSize)
 {
-    if (startRVA > MEMORY_PAGE_SIZE * 16) {
-
-        //  ExtVerb("Adding range %p %p ->", startRVA, rangeSize);
+    if (startRVA > LOW_MEMORY_LIMIT) {
 
         UINT64 endRVA = ROUND_UP_TO_POWER2(startRVA + rangeSize, (UINT64)MEMORY_PAGE_SIZE);
         startRVA = ROUND_DOWN_TO_POWER2(startRVA, (UINT64)MEMORY_PAGE_SIZE);
-        rangeSize = endRVA - startRVA;
 
-        if ((PreviousAddress == startRVA) && (PreviousSize == rangeSize)) {
+        //
+        //  Find the ranges [first, last) that the new one overlaps or touches.
+        //  Ranges usually arrive in ascending order, in which case this only
+        //  extends or appends past the last one.
+        //
 
-            // ExtVerb(" %p %p (skipped)\n", startRVA, rangeSize);
+        int count = GetRangesCount();
+        int first = FindRange(startRVA);
 
-            return;
-        }
+        if ((first >= 0) && (startRVA <= GetStartAddress(first) + GetRangeSize(first))) {
 
-        //  ExtVerb(" %p %p\n", startRVA, rangeSize);
+            startRVA = GetStartAddress(first);
 
-        Add(startRVA);
-        Add(rangeSize);
-        PreviousAddress = startRVA;
-        PreviousSize = rangeSize;
-    }
-}
+        } else {
 
-void MemoryRagesCollection::CompactItems()
-{
-    //
-    //  Sort all ranges by address to make easier searching for overlapped ranges
-    //
+            first += 1;
+        }
 
-    qsort(Array, GetRangesCount(), 2*sizeof(UINT64), ItemCompare);
+        int last = first;
 
-    int lastValidRange = 0;
-    UINT64 prevAddr = GetStartAddress(0);
-    UINT64 prevSize = GetRangeSize(0);
-    UINT64 prevLimit = prevAddr + prevSize;
+        while ((last < count) && (GetStartAddress(last) <= endRVA)) {
 
-    for (int i = 1; i < GetRangesCount(); i++) {
+            UINT64 limit = GetStartAddress(last) + GetRangeSize(last);
 
-        //
-        //  Itterate through ranges, and see if the current one
-        //  has any non-empty intersection.
-        //
+            if (limit > endRVA) {
 
-        UINT64 addr = GetStartAddress(i);
-        UINT64 size = GetRangeSize(i);
-        UINT64 limit = addr + size;
+                endRVA = limit;
+            }
+            last += 1;
+        }
 
-        if (addr < (prevAddr + prevSize)) {
+        if (last == first) {
 
             //
-            //  There is an overlap. If this range is completly included
-            //  clear it completly from the array, otherwise adjust the
-            //  previous range to capture this new limit.
+            //  Nothing to merge with, open a slot for a new range.
             //
 
-            ExtVerb("%p %p %p %p\n", prevAddr, prevLimit, addr, limit);
+            if (!Add(0) || !Add(0)) {
 
-            if (limit > prevLimit) {
-
-                prevSize += limit - prevLimit;
-                Array[lastValidRange * 2 + 1] = prevSize;
-                prevLimit = limit;
+                return;
             }
 
-            //
-            //  This range has been already taken care of
-            //  we need to exclude from the list
-            //
+            memmove(&Array[(first + 1) * 2],
+                    &Array[first * 2],
+                    (count - first) * 2 * sizeof(UINT64));
+            last = first + 1;
+        }
 
-            Array[i * 2] = 0;
-            Array[i * 2 + 1] = 0;
+        Array[first * 2] = startRVA;
+        Array[first * 2 + 1] = endRVA - startRVA;
 
-            //
-            //  Keep track of the discarded ranges to get an accurate value of
-            //  the valid entries that will have to be copied
-            //
+        //
+        //  Drop the ranges that were absorbed into the first one.
+        //
 
-            DiscardedRanges += 1;
+        if (last > first + 1) {
 
-        } else {
+            memmove(&Array[(first + 1) * 2],
+                    &Array[last * 2],
+                    (GetRangesCount() - last) * 2 * sizeof(UINT64));
+            InUse -= (last - first - 1) * 2;
+        }
 
-            //
-            //  No overlap here, set the new current range values
-            //
+        RangeRVAs.InUse = 0;
+    }
+}
 
-            lastValidRange = i;
-            prevAddr = addr;
-            prevSize = size;
-            prevLimit = limit;
-        }
+void MemoryRagesCollection::CompactItems()
+{
+    //
+    //  The ranges are already disjoint and sorted. Record where each one
+    //  lands in the dump, since they are written back to back.
+    //
+
+    UINT64 RVA = 0;
+
+    RangeRVAs.InUse = 0;
+
+    for (int i = 0; i < GetRangesCount(); i++) {
+
+        RangeRVAs.Add(RVA);
+        RVA += GetRangeSize(i);
     }
 }
 
 
 UINT64 MemoryRagesCollection::GetRVA(UINT64 address)
 {
-    UINT64 RVA = 0;
-
     //
     //  This function is getting the coresponding RVA in the crashdump,
     //  from a given address
     //
 
-    for (int i = 0; i < GetRangesCount(); i++) {
-
-        UINT64 addr = GetStartAddress(i);
-        UINT64 size = GetRangeSize(i);
-        UINT64 limit = addr + size;
+    if (RangeRVAs.InUse != GetRangesCount()) {
 
-        if ((address >= addr) && (address < limit)) {
-
-            //
-            //  Found it. return the value, including also the offset inside the
-            //  current range
-            //
+        CompactItems();
+    }
 
-            RVA += address - addr;
-            return RVA;
-        }
+    int i = FindRange(address);
 
-        //
-        //  Keep track of the actual RVA as we walk the ranges
-        //
+    if ((i >= 0) && (address < GetStartAddress(i) + GetRangeSize(i))) {
 
-        RVA += size;
+        return RangeRVAs.Array[i] + (address - GetStartAddress(i));
     }
 
     return 0;
@@ -474,13 +477,15 @@ void ResetGlobals()
     IncludeExecutables = FALSE;
     IncludeRegisterReferences = FALSE;
     FullMemoryDump = FALSE;
+    SkipFreePages = FALSE;
 }
 
 
 //
 //  Functions to support memory access references to include them in minidump
 //  An extension would have to switch to use TraceRead instead of g_ExtData->ReadVirtual
-//  if the memory accessed will be required in offline analysis
+//  if the memory accessed will be required in offline analysis. The reads go to
+//  g_MemorySource, so the same code also runs over memory captured in files.
 //
 
 MemoryRagesCollection * TracingStore = NULL;
@@ -501,7 +506,7 @@ HRESULT TraceRead(UINT64 address, void * buffer, ULONG size)
         }
     }
 
-    return g_ExtData->ReadVirtual(address, buffer, size, NULL);
+    return g_MemorySource->ReadMemory(address, buffer, size, NULL);
 }
 
 HRESULT TraceReadPointer(int count, UINT64 address, PULONG64 buffer)
@@ -513,7 +518,7 @@ HRESULT TraceReadPointer(int count, UINT64 address, PULONG64 buffer)
         }
     }
 
-    return g_ExtData->ReadPointersVirtual(count, address, buffer);
+    return g_MemorySource->ReadPointers(count, address, buffer);
 }
 
 
@@ -965,50 +970,320 @@ Exit:
     return NULL;
 }
 
-void IncludeUsedMemory()
+//
+//  Returns a local copy of the FlatPages page table, to be released with
+//  free, or NULL if it cannot be read.
+//
+
+ULONG * ReadPageTable(ULONG64 * pageCount)
 {
     HRESULT status;
 
     ULONG64 pageTable;
-    ULONG64 pageCount;
 
     ExtVerb("Scanning flat pages for in-use memory");
     EXT_CHECK(FindBound("Microsoft_Singularity_Memory_FlatPages::pageTable", &pageTable));
-    EXT_CHECK(FindBound("Microsoft_Singularity_Memory_FlatPages::pageCount", &pageCount));
+    EXT_CHECK(FindBound("Microsoft_Singularity_Memory_FlatPages::pageCount", pageCount));
 
-    ExtOut("%p %p\n", pageTable, pageCount);
-    ULONG * pageTableCopy = (ULONG *)malloc((SIZE_T)pageCount * sizeof(ULONG));
+    ExtOut("%p %p\n", pageTable, *pageCount);
+    ULONG * pageTableCopy = (ULONG *)malloc((SIZE_T)*pageCount * sizeof(ULONG));
 
     if(pageTableCopy == NULL) {
 
         ExtOut("Not enough memory to cache the page table");
-        return;
+        return NULL;
     }
 
-    if (g_ExtData->ReadVirtual(pageTable, pageTableCopy, (ULONG)pageCount * sizeof(ULONG), NULL) != S_OK) {
+    if (g_ExtData->ReadVirtual(pageTable, pageTableCopy, (ULONG)*pageCount * sizeof(ULONG), NULL) != S_OK) {
 
        ExtOut("Error reading the page table");
        free(pageTableCopy);
-       return;
+       return NULL;
     }
 
-    for (ULONG64 i = 1; i < pageCount; i++) {
+    return pageTableCopy;
+
+Exit:
+    //  Error path
+
+    ExtOut("Invalid symbols information\n");
+    return NULL;
+}
+
+void IncludeUsedMemory()
+{
+    ULONG64 pageCount;
+    ULONG * pageTableCopy = ReadPageTable(&pageCount);
+
+    if (pageTableCopy == NULL) {
+
+        return;
+    }
+
+    //
+    //  Add each run of in-use pages as one range. AddRange ignores the pages
+    //  below LOW_MEMORY_LIMIT, so the scan starts above it.
+    //
+
+    ULONG64 runStart = 0;
+
+    for (ULONG64 i = LOW_MEMORY_LIMIT / MEMORY_PAGE_SIZE + 1; i <= pageCount; i++) {
+
+        bool inUse = (i < pageCount) && ((USHORT)(pageTableCopy[i]) != 0);
+
+        if (inUse && (runStart == 0)) {
 
-        if ((USHORT)(pageTableCopy[i]) != 0) {
+            runStart = i;
 
-            ExtVerb("Adding pages %p %lx\n", i * MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
-            MemoryRanges->AddRange(i * MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+        } else if (!inUse && (runStart != 0)) {
+
+            ExtVerb("Adding pages %p %p\n", runStart * MEMORY_PAGE_SIZE, (i - runStart) * MEMORY_PAGE_SIZE);
+            MemoryRanges->AddRange(runStart * MEMORY_PAGE_SIZE, (i - runStart) * MEMORY_PAGE_SIZE);
+            runStart = 0;
         }
     }
 
     free(pageTableCopy);
-    return;
+}
 
-Exit:
-    //  Error path
+//
+//  Rebuilds the range list without the pages the page table marks free.
+//  Pages past the end of the table are kept.
+//
 
-    ExtOut("Invalid symbols information\n");
-    return;
+void ExcludeFreePages()
+{
+    ULONG64 pageCount;
+    ULONG * pageTableCopy = ReadPageTable(&pageCount);
+
+    if (pageTableCopy == NULL) {
+
+        return;
+    }
+
+    MemoryRagesCollection * usedRanges = new MemoryRagesCollection();
+    UINT64 freePages = 0;
+
+    for (int i = 0; i < MemoryRanges->GetRangesCount(); i++) {
+
+        UINT64 address = MemoryRanges->GetStartAddress(i);
+        UINT64 limit = address + MemoryRanges->GetRangeSize(i);
+        UINT64 runStart = address;
+
+        while (address < limit) {
+
+            UINT64 page = address / MEMORY_PAGE_SIZE;
+            UINT64 next = min((page + 1) * MEMORY_PAGE_SIZE, limit);
+
+            if ((page < pageCount) && ((USHORT)(pageTableCopy[page]) == 0)) {
+
+                if (address > runStart) {
+
+                    usedRanges->AddRange(runStart, address - runStart);
+                }
+
+                runStart = next;
+                freePages += 1;
+            }
+
+            address = next;
+        }
+
+        if (limit > runStart) {
+
+            usedRanges->AddRange(runStart, limit - runStart);
+        }
+    }
+
+    free(pageTableCopy);
+
+    ExtOut("Leaving out %I64d free pages\n", freePages);
+
+    if (TracingStore == MemoryRanges) {
+
+        TracingStore = usedRanges;
+    }
+
+    delete MemoryRanges;
+    MemoryRanges = usedRanges;
+}
+
+//
+//  Streams target memory into the dump file. Memory is read in batches of
+//  up to DUMP_BATCH_SIZE on the calling thread, the only one that may use
+//  the debugger engine, while a second thread writes the previous batch.
+//
+
+struct DumpWriter
+{
+    FILE * File;
+    HANDLE Thread;
+    HANDLE Filled;                      // Counts batches ready to write
+    HANDLE Emptied;                     // Counts buffers free to fill
+    char * Buffers[DUMP_BUFFERS];
+    ULONG Lengths[DUMP_BUFFERS];
+    int Current;                        // Buffer being filled
+    ULONG Used;
+    bool Acquired;
+
+    bool Start(FILE * file);
+    void Write(UINT64 address, UINT64 size);
+    void Finish();
+
+private:
+
+    void Submit();
+    static DWORD WINAPI WriterThread(LPVOID context);
+};
+
+bool DumpWriter::Start(FILE * file)
+{
+    File = file;
+    Current = 0;
+    Used = 0;
+    Acquired = false;
+
+    for (int i = 0; i < DUMP_BUFFERS; i++) {
+
+        Buffers[i] = (char *)malloc(DUMP_BATCH_SIZE);
+        Lengths[i] = 0;
+    }
+
+    Filled = CreateSemaphore(NULL, 0, DUMP_BUFFERS, NULL);
+    Emptied = CreateSemaphore(NULL, DUMP_BUFFERS, DUMP_BUFFERS, NULL);
+    Thread = NULL;
+
+    bool ready = (Filled != NULL) && (Emptied != NULL);
+
+    for (int i = 0; i < DUMP_BUFFERS; i++) {
+
+        ready = ready && (Buffers[i] != NULL);
+    }
+
+    if (ready) {
+
+        Thread = CreateThread(NULL, 0, WriterThread, this, 0, NULL);
+    }
+
+    if (Thread == NULL) {
+
+        for (int i = 0; i < DUMP_BUFFERS; i++) {
+
+            free(Buffers[i]);
+        }
+        if (Filled != NULL) CloseHandle(Filled);
+        if (Emptied != NULL) CloseHandle(Emptied);
+        return false;
+    }
+
+    return true;
+}
+
+DWORD WINAPI DumpWriter::WriterThread(LPVOID context)
+{
+    DumpWriter * writer = (DumpWriter *)context;
+
+    for (int i = 0;; i = (i + 1) % DUMP_BUFFERS) {
+
+        WaitForSingleObject(writer->Filled, INFINITE);
+
+        if (writer->Lengths[i] == 0) {
+
+            //  An empty batch marks the end of the dump.
+
+            break;
+        }
+
+        fwrite(writer->Buffers[i], writer->Lengths[i], 1, writer->File);
+        ReleaseSemaphore(writer->Emptied, 1, NULL);
+    }
+
+    return 0;
+}
+
+void DumpWriter::Submit()
+{
+    Lengths[Current] = Used;
+    Current = (Current + 1) % DUMP_BUFFERS;
+    Used = 0;
+    Acquired = false;
+    ReleaseSemaphore(Filled, 1, NULL);
+}
+
+void DumpWriter::Write(UINT64 address, UINT64 size)
+{
+    while (size > 0) {
+
+        if (!Acquired) {
+
+            WaitForSingleObject(Emptied, INFINITE);
+            Acquired = true;
+        }
+
+        ULONG batchSize = DUMP_BATCH_SIZE - Used;
+
+        if (size < batchSize) {
+
+            batchSize = (ULONG)size;
+        }
+
+        char * batch = Buffers[Current] + Used;
+        ULONG bytesRead = 0;
+
+        if ((g_ExtData->ReadVirtual(address, batch, batchSize, &bytesRead) != S_OK) ||
+            (bytesRead != batchSize)) {
+
+            //
+            //  Some page in the batch is not readable. Go page by page so
+            //  the rest still makes it into the dump, zero filling the holes.
+            //
+
+            for (ULONG offset = 0; offset < batchSize; offset += MEMORY_PAGE_SIZE) {
+
+                ULONG pageSize = min(batchSize - offset, (ULONG)MEMORY_PAGE_SIZE);
+
+                if (g_ExtData->ReadVirtual(address + offset, batch + offset, pageSize, NULL) != S_OK) {
+
+                    ZeroMemory(batch + offset, pageSize);
+                }
+            }
+        }
+
+        Used += batchSize;
+        address += batchSize;
+        size -= batchSize;
+
+        if (Used == DUMP_BATCH_SIZE) {
+
+            Submit();
+        }
+    }
+}
+
+void DumpWriter::Finish()
+{
+    if (Acquired && (Used > 0)) {
+
+        Submit();
+    }
+
+    if (!Acquired) {
+
+        WaitForSingleObject(Emptied, INFINITE);
+    }
+
+    Used = 0;
+    Submit();
+
+    WaitForSingleObject(Thread, INFINITE);
+    CloseHandle(Thread);
+    CloseHandle(Filled);
+    CloseHandle(Emptied);
+
+    for (int i = 0; i < DUMP_BUFFERS; i++) {
+
+        free(Buffers[i]);
+    }
 }
 
 
@@ -1174,6 +1449,11 @@ void CrashDump(PCSTR fname)
         IncludeUsedMemory();
     }
 
+    if (SkipFreePages) {
+
+        ExcludeFreePages();
+    }
+
     //
     //  The memory ranges might be overlapped. This is not allowed in a crashdump
     //  we need to compact and coalesce the adjacent ranges to provide a full list
@@ -1234,8 +1514,14 @@ void CrashDump(PCSTR fname)
     fwrite(ThreadContexts, threadList->NumberOfThreads * GetTargetContextSize(), 1, file);
     fwrite(memoryStream, dump->Directories[2].Location.DataSize, 1, file);
 
-    void * tmpBuffer = malloc (MEMORY_PAGE_SIZE);
-    if (tmpBuffer == NULL) goto Exit;
+    DumpWriter writer;
+
+    if (!writer.Start(file)) {
+
+        ExtOut("Not enough resources to write the memory\n");
+        fclose(file);
+        goto Exit;
+    }
 
     for (ULONG32 i = 0; i < memoryStream->MemoryCount; i++) {
 
@@ -1243,26 +1529,11 @@ void CrashDump(PCSTR fname)
             (UINT64)(memoryStream->Memory[i].StartOfMemoryRange + memoryStream->Memory[i].Memory.DataSize),
             (UINT64)memoryStream->Memory[i].Memory.Rva );
 
-        UINT64 RemainingSize = memoryStream->Memory[i].Memory.DataSize;
-        UINT64 currentAddress = memoryStream->Memory[i].StartOfMemoryRange;
-
-        while (RemainingSize > 0) {
-
-            ULONG32 readSize = MEMORY_PAGE_SIZE;
-
-            if (RemainingSize < readSize) {
-
-                readSize = (ULONG32)RemainingSize;
-            }
-
-            g_ExtData->ReadVirtual(currentAddress, tmpBuffer, readSize, NULL);
-            fwrite(tmpBuffer, readSize, 1, file);
-            RemainingSize -= readSize;
-            currentAddress += readSize;
-        }
+        writer.Write(memoryStream->Memory[i].StartOfMemoryRange,
+                     memoryStream->Memory[i].Memory.DataSize);
     }
 
-    free(tmpBuffer);
+    writer.Finish();
     ExtOut("done\n");
 
     fclose(file);
@@ -1336,6 +1607,13 @@ EXT_DECL(crashdump) // Defines: PDEBUG_CLIENT Client, PCSTR args
               }
                 break;
 
+              case 'z':
+              case 'Z': {
+
+                SkipFreePages = TRUE;
+              }
+                break;
+
               case 's':
               case 'S': {
 
@@ -52,6 +52,8 @@ static HRESULT Usage()
            "    Garbage collector commands:\n"
            "    -g <prefix>           : Write all profile logs that have been collected in files\n"
            "                            named based upon provided prefix\n"
+           "    -gf <prefix>          : As above, but write the allocation stacks in folded format\n"
+           "                            for flame graphs, weighted by the bytes allocated\n"
            "    -ek <MemSize> [break] : Enable kernel GC profiling with a buffer of specified size in MBytes.\n"
            "                            Optionally break into the debugger before recycling buffers\n"
            "    -es <MemSize> [break] : As above, but for SIP GC profiling rather than Kernel GC profiling\n"
@@ -219,6 +221,9 @@ char * ReadToken(PCSTR& args)
 
 
 char EntryBuffer[4096];
+char ZoneBuffer[0x10000];
+UINT64 ZoneAddress = 0;
+ULONG ZoneLength = 0;
 ULONG_PTR HeaderSize = 0;
 ULONG_PTR Stacksize = 0;
 ULONG_PTR MetadataSize = 0;
@@ -307,6 +312,158 @@ bool VariableArray::Add(UINT64 value) {
     return TRUE;
 }
 
+//
+//  Folded stack support
+//
+
+FoldedStacks::FoldedStacks()
+{
+    Text = NULL;
+    TextUsed = 0;
+    TextSize = 0;
+    LineStart = 0;
+}
+
+FoldedStacks::~FoldedStacks()
+{
+    if (Text != NULL) {
+
+        free(Text);
+    }
+}
+
+bool FoldedStacks::Reserve(ULONG length)
+{
+    if (TextUsed + length <= TextSize) {
+
+        return TRUE;
+    }
+
+    ULONG newSize = (TextSize == 0) ? 64 * 1024 : TextSize * 2;
+
+    while (TextUsed + length > newSize) {
+
+        newSize *= 2;
+    }
+
+    PCHAR newText = (PCHAR)realloc(Text, newSize);
+
+    if (newText == NULL) {
+
+        return FALSE;
+    }
+
+    Text = newText;
+    TextSize = newSize;
+    return TRUE;
+}
+
+void FoldedStacks::BeginStack()
+{
+    TextUsed = LineStart;
+}
+
+void FoldedStacks::AddFrame(PCSTR frame)
+{
+    ULONG length = (ULONG)strlen(frame);
+
+    if (!Reserve(length + 1)) {
+
+        return;
+    }
+
+    if (TextUsed != LineStart) {
+
+        Text[TextUsed++] = ';';
+    }
+
+    //
+    //  ';' separates the frames and a line break ends the stack, so neither
+    //  can appear inside a frame name.
+    //
+
+    for (ULONG i = 0; i < length; i++) {
+
+        CHAR c = frame[i];
+        Text[TextUsed++] = (c == ';' || c == '\n' || c == '\r') ? ':' : c;
+    }
+}
+
+void FoldedStacks::EndStack(UINT64 weight)
+{
+    if (TextUsed == LineStart || !Reserve(1)) {
+
+        TextUsed = LineStart;
+        return;
+    }
+
+    Text[TextUsed++] = 0;
+
+    //
+    //  FNV-1a over the line. Lines with the same hash but a different text
+    //  are rehashed until a free or matching key is found.
+    //
+
+    UINT64 key = 0xcbf29ce484222325ULL;
+
+    for (ULONG i = LineStart; i < TextUsed; i++) {
+
+        key = (key ^ (UCHAR)Text[i]) * 0x100000001b3ULL;
+    }
+
+    for (;;) {
+
+        if (key == 0) {
+
+            key = 1;
+        }
+
+        UINT64 * slot = Index.Lookup(key, true);
+
+        if (slot == NULL) {
+
+            break;
+        }
+
+        if (*slot == 0) {
+
+            int line = Lines.InUse;
+
+            if (Lines.Add(LineStart) && Lines.Add(weight)) {
+
+                *slot = line / 2 + 1;
+                LineStart = TextUsed;
+                return;
+            }
+
+            Lines.InUse = line;
+            break;
+        }
+
+        UINT64 * entry = Lines.Array + (*slot - 1) * 2;
+
+        if (strcmp(Text + entry[0], Text + LineStart) == 0) {
+
+            entry[1] += weight;
+            break;
+        }
+
+        key = IpTable::Hash(key, 0);
+    }
+
+    TextUsed = LineStart;
+}
+
+int FoldedStacks::Write(FILE * file)
+{
+    for (int i = 0; i < Lines.InUse; i += 2) {
+
+        fprintf(file, "%s %I64u\n", Text + Lines.Array[i], Lines.Array[i + 1]);
+    }
+
+    return Lines.InUse / 2;
+}
+
 //
 //  Symbolic enum and flag support
 //
@@ -1026,10 +1183,14 @@ EventTypeEntry::EventTypeEntry()
     NumFields = 0;
     filterCount = 0;
     FilterApplied = FALSE;
+    filterProgram = NULL;
+    filterCompiled = FALSE;
 }
 
 EventTypeEntry::~EventTypeEntry() {
 
+    delete [] filterProgram;
+
     for (int i = 0; i < NumFields; i++) {
         delete Fields[i];
     }
@@ -1117,6 +1278,7 @@ bool EventTypeEntry::ApplyFilter(FieldFilter * newFilter)
 
             fieldsFilterList[filterCount] = field;
             filterList[filterCount++] = newFilter;
+            filterCompiled = FALSE;
             return TRUE;
         }
     }
@@ -1127,6 +1289,8 @@ bool EventTypeEntry::ApplyFilter(FieldFilter * newFilter)
 void EventTypeEntry::ClearFilters()
 {
     filterCount = 0;
+    FilterApplied = FALSE;
+    filterCompiled = FALSE;
 }
 
 void EventTypeEntry::AddNewField(FieldEntry * field) {
@@ -1209,35 +1373,204 @@ bool EventTypeEntry::FilterMatch()
         return FALSE;
     }
 
+    if (!filterCompiled) {
+
+        CompileFilters();
+    }
+
+    char * entry = EntryBuffer + MetadataSize;
+
+    //  Extended strings are located lazily, in one forward walk shared by
+    //  all the string filters of this entry.
+
+    char * strings[MAX_FIELDS + 1];
+    int stringsFound = 0;
+    int stringOffset = ROUND_UP_TO_POWER2((int)MetadataSize + size, (int)pointerSize);
 
     for (int i = 0; i < filterCount; i++) {
 
-        FieldEntry * field = fieldsFilterList[i];
+        FilterStep * step = &filterProgram[i];
+        UINT64 value = 0;
 
-        if (field->Type & FIELD_TYPE_VARIABLE_ANY_STRING) {
+        switch (step->Kind) {
 
-            int index = (int)field->GetFieldNumericValue();
+            case FILTER_STEP_NUMERIC:
+            case FILTER_STEP_STRING:
+                memcpy(&value, entry + step->Offset, step->Width);
+                break;
 
-            char * str = NULL;
+            case FILTER_STEP_GENERIC:
+                value = step->Field->GetFieldNumericValue();
+                break;
+        }
 
-            if (index) {
+        if (step->Kind != FILTER_STEP_STRING) {
 
-                str = GetExtendedString(index);
+            if (!step->Filter->MatchFieldValue((INT64)value)) {
+                return FALSE;
             }
+            continue;
+        }
 
-            if (!filterList[i]->MatchFieldValue(str)) {
-                return FALSE;
+        char * str = "";
+
+        if ((value > 0) && (value <= (UINT64)ExtendedFieldsCount) && (value <= MAX_FIELDS)) {
+
+            while (stringsFound < (int)value) {
+
+                USHORT length;
+
+                memcpy(&length, EntryBuffer + stringOffset, sizeof(USHORT));
+                strings[++stringsFound] = EntryBuffer + stringOffset + sizeof(USHORT);
+                stringOffset += length + sizeof(USHORT);
             }
 
-        } else {
+            str = strings[value];
+        }
+
+        if (!step->MatchString(str)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+void EventTypeEntry::CompileFilters()
+{
+    if (filterProgram == NULL) {
+
+        filterProgram = new FilterStep[MAX_FILTERS];
+    }
+
+    for (int i = 0; i < filterCount; i++) {
+
+        filterProgram[i].Compile(filterList[i], fieldsFilterList[i]);
+    }
+
+    filterCompiled = TRUE;
+}
+
+//
+//  FilterStep implementation
+//
+
+void FilterStep::Compile(FieldFilter * filter, FieldEntry * field)
+{
+    Filter = filter;
+    Field = field;
+    Offset = field->Offset;
+    Width = 0;
+    Kind = FILTER_STEP_NUMERIC;
+
+    if (field->Type & FIELD_TYPE_VARIABLE_ANY_STRING) {
+
+        Kind = FILTER_STEP_STRING;
+        Width = sizeof(USHORT);
+
+    } else {
+
+        switch (field->Type) {
+
+            case FIELD_TYPE__int8:
+            case FIELD_TYPE__uint8:
+                Width = sizeof(BYTE);
+                break;
+
+            case FIELD_TYPE__int16:
+            case FIELD_TYPE__uint16:
+                Width = sizeof(USHORT);
+                break;
+
+            case FIELD_TYPE__int32:
+            case FIELD_TYPE__uint32:
+                Width = sizeof(UINT);
+                break;
+
+            case FIELD_TYPE__int64:
+            case FIELD_TYPE__uint64:
+                Width = sizeof(UINT64);
+                break;
+
+            case FIELD_TYPE__IntPtr:
+            case FIELD_TYPE__UIntPtr:
+                Width = sizeof(UINT_PTR);
+                break;
+
+            case FIELD_TYPE_GENERIC_TYPE:
+                Kind = FILTER_STEP_GENERIC;
+                break;
+
+            default:
+                Kind = FILTER_STEP_CONSTANT;
+                break;
+        }
+    }
+
+    PatternLength = 0;
+
+    if ((Kind == FILTER_STEP_STRING) && (filter->StringValuePattern != NULL)) {
+
+        PatternLength = (int)strlen(filter->StringValuePattern);
+
+        for (int i = 0; i < (int)sizeof(Shift); i++) {
+
+            Shift[i] = (unsigned char)PatternLength;
+        }
+
+        for (int i = 0; i < PatternLength - 1; i++) {
+
+            Shift[(unsigned char)filter->StringValuePattern[i]] =
+                (unsigned char)(PatternLength - 1 - i);
+        }
+    }
+}
+
+//
+//  Same results as FieldFilter::MatchFieldValue(char *), with the substring
+//  search done by Boyer-Moore-Horspool over the table built in Compile.
+//
+
+bool FilterStep::MatchString(char * value)
+{
+    char * pattern = Filter->StringValuePattern;
+
+    switch (Filter->Operation) {
+
+        case contains:
+        case different:
+        {
+            if (pattern == NULL) {
 
-            if (!filterList[i]->MatchFieldValue(field->GetFieldNumericValue())) {
                 return FALSE;
             }
+
+            bool found = (PatternLength == 0);
+            int length = (int)strlen(value);
+            int last = PatternLength - 1;
+
+            int pos = 0;
+
+            while (!found && (pos + PatternLength <= length)) {
+
+                unsigned char c = (unsigned char)value[pos + last];
+
+                if ((c == (unsigned char)pattern[last]) &&
+                    (memcmp(value + pos, pattern, last) == 0)) {
+
+                    found = TRUE;
+
+                } else {
+
+                    pos += Shift[c];
+                }
+            }
+
+            return (Filter->Operation == contains) ? found : !found;
         }
     }
 
-    return TRUE;
+    return Filter->MatchFieldValue(value);
 }
 
 static int argIndexOffset = 0;
@@ -1437,7 +1770,7 @@ void EventTypeEntry::EnumerateEntries(EventingEnumerator * enumerator, UINT64 ad
 
     for (ULONG j = 0; j < count; j++) {
 
-        TraceRead(address, EntryBuffer, (ULONG)readSize);
+        ZoneRead(address, EntryBuffer, (ULONG)readSize);
         MetadataSize = 0;
 
         if (enumerator->ActiveEntryCallout(this, FALSE)) {
@@ -1453,6 +1786,65 @@ void EventTypeEntry::EnumerateEntries(EventingEnumerator * enumerator, UINT64 ad
     }
 }
 
+//
+//  Zone cache
+//
+//  ReadMemoryZone fetches a whole zone (at most 64K) with a single remote
+//  read and keeps it in ZoneBuffer while both passes over its ready list
+//  run. The entry readers go through ZoneRead and ZoneReadStruct, which
+//  serve anything inside the cached zone locally and fall back to
+//  TraceRead otherwise.
+//
+
+void LoadZone(UINT64 zoneAddress, ULONG zoneSize)
+{
+    ZoneLength = 0;
+
+    if (zoneSize > sizeof(ZoneBuffer)) {
+
+        zoneSize = sizeof(ZoneBuffer);
+    }
+
+    if (TraceRead(zoneAddress, ZoneBuffer, zoneSize) == S_OK) {
+
+        ZoneAddress = zoneAddress;
+        ZoneLength = zoneSize;
+    }
+}
+
+void FlushZone()
+{
+    ZoneLength = 0;
+}
+
+bool IsInZone(UINT64 address, ULONG size)
+{
+    return (ZoneLength != 0) &&
+           (address >= ZoneAddress) &&
+           (address + size <= ZoneAddress + ZoneLength);
+}
+
+HRESULT ZoneRead(UINT64 address, void * buffer, ULONG size)
+{
+    if (IsInZone(address, size)) {
+
+        memcpy(buffer, ZoneBuffer + (address - ZoneAddress), size);
+        return S_OK;
+    }
+
+    return TraceRead(address, buffer, size);
+}
+
+HRESULT ZoneReadStruct(StructType & type, UINT64 address, PVOID local)
+{
+    if (IsInZone(address, type.size)) {
+
+        return type.ReadLocal(ZoneBuffer + (address - ZoneAddress), local);
+    }
+
+    return type.Read(address, local);
+}
+
 //
 //  SourceEntry class implementation
 //
@@ -1588,16 +1980,58 @@ bool EventingEnumerator::StorageCallout(UINT64 storageAddress, bool finished)
 //
 //  Controller objects managements
 //
+//  Controllers and the types, fields, enums and sources read from their
+//  repositories stay cached between commands. A cached controller is reused
+//  as long as its repository storage address and generation are unchanged;
+//  everything is flushed when the target resumes (see DebugExtensionNotify).
+//
 
 ControllerObject * Controllers[MAX_CONTROLLERS];
 int ControllersCount = 0;
 
+UINT64 ReadRepositoryGeneration(UINT64 storageAddress)
+{
+    SMEMORY_STORAGE log;
+
+    if ((storageAddress == 0) ||
+        (StructMEMORY_STORAGE.Read(storageAddress, &log) != S_OK)) {
+
+        return 0;
+    }
+
+    return log.Generation;
+}
+
 ControllerObject * AllocateController(UINT64 handle,
                                       UINT64 contextHandle,
                                       UINT64 storageAddress,
                                       UINT64 storageListHead)
 {
-    if (ControllersCount >= MAX_CONTROLLERS) {
+    UINT64 generation = ReadRepositoryGeneration(storageAddress);
+    int slot;
+
+    for (slot = 0; slot < ControllersCount; slot++) {
+
+        ControllerObject * ctrl = Controllers[slot];
+
+        if ((ctrl->ControllerHandle == handle) &&
+            (ctrl->ContextHandle == contextHandle)) {
+
+            if ((ctrl->RepositoryAddress == storageAddress) &&
+                (ctrl->RepositoryGeneration == generation)) {
+
+                ctrl->StorageListHead = storageListHead;
+                ctrl->ClearFilters();
+                return ctrl;
+            }
+
+            delete ctrl;
+            Controllers[slot] = NULL;
+            break;
+        }
+    }
+
+    if (slot >= MAX_CONTROLLERS) {
 
         return NULL;
     }
@@ -1607,7 +2041,13 @@ ControllerObject * AllocateController(UINT64 handle,
                                                    storageAddress,
                                                    storageListHead);
 
-    Controllers[ControllersCount++] = ctrl;
+    ctrl->RepositoryGeneration = generation;
+    Controllers[slot] = ctrl;
+
+    if (slot == ControllersCount) {
+
+        ControllersCount++;
+    }
     return ctrl;
 }
 
@@ -1631,8 +2071,10 @@ ControllerObject::ControllerObject(UINT64 handle,
     SourcesCount = 0;
     ControllerHandle = handle;
     RepositoryAddress = storageAddress;
+    RepositoryGeneration = 0;
     StorageListHead = storageListHead;
     ContextHandle = contextHandle;
+    MetadataCached = false;
 
     for (int i = 0; i < MAX_FIELDS; i++) {
 
@@ -1748,6 +2190,14 @@ void ControllerObject::FlushTypeArray()
 
     for (int i = 0; i < TypesCount; i++) {
 
+        //  Other controllers may still be cached; only forget the system
+        //  header type if it is ours.
+
+        if (RegisteredTypes[i] == SystemHeaderType) {
+
+            SystemHeaderType = NULL;
+        }
+
         delete RegisteredTypes[i];
     }
     TypesCount = 0;
@@ -1762,9 +2212,16 @@ void ControllerObject::FlushTypeArray()
 
          RegisteredFieldsTypes[i] = NULL;
     }
+}
 
+//  Drops the filters a previous command attached to the cached types.
 
-    SystemHeaderType = NULL;
+void ControllerObject::ClearFilters()
+{
+    for (int i = 0; i < TypesCount; i++) {
+
+        RegisteredTypes[i]->ClearFilters();
+    }
 }
 
 SourceEntry * ControllerObject::FindSource(ULONG64 Key)
@@ -1865,7 +2322,7 @@ void ControllerObject::ReadSource(UINT64 entryAddress)
 
     SSOURCE_DESCRIPTOR log;
 
-    EXT_CHECK(StructSOURCE_DESCRIPTOR.Read(entryAddress, &log));
+    EXT_CHECK(ZoneReadStruct(StructSOURCE_DESCRIPTOR, entryAddress, &log));
 
     SourceEntry * sourceEntry;
     sourceEntry = new SourceEntry();
@@ -1899,7 +2356,7 @@ void ControllerObject::ReadEventDescriptor(UINT64 entryAddress)
 
     SEVENT_DESCRIPTOR log;
 
-    EXT_CHECK(StructEVENT_DESCRIPTOR.Read(entryAddress, &log));
+    EXT_CHECK(ZoneReadStruct(StructEVENT_DESCRIPTOR, entryAddress, &log));
 
     EventTypeEntry * TypeEntry;
     TypeEntry = new EventTypeEntry();
@@ -1944,7 +2401,7 @@ void ControllerObject::ReadEnumDescriptor(UINT64 entryAddress)
 
     SENUM_DESCRIPTOR log;
 
-    EXT_CHECK(StructENUM_DESCRIPTOR.Read(entryAddress, &log));
+    EXT_CHECK(ZoneReadStruct(StructENUM_DESCRIPTOR, entryAddress, &log));
 
     EnumType * TypeEntry;
     TypeEntry = new EnumType();
@@ -1977,7 +2434,7 @@ void ControllerObject::ReadValueDescriptor(UINT64 entryAddress, UINT64 parent)
 
     SEVENT_VALUE_DESCRIPTOR log;
 
-    EXT_CHECK(StructEVENT_VALUE_DESCRIPTOR.Read(entryAddress, &log));
+    EXT_CHECK(ZoneReadStruct(StructEVENT_VALUE_DESCRIPTOR, entryAddress, &log));
 
     SymbolicValue * fieldEntry;
     fieldEntry = new SymbolicValue;
@@ -2018,7 +2475,7 @@ void ControllerObject::ReadFieldDescriptor(UINT64 entryAddress, UINT64 parent)
 
     SEVENT_FIELD_DESCRIPTOR log;
 
-    EXT_CHECK(StructEVENT_FIELD_DESCRIPTOR.Read(entryAddress, &log));
+    EXT_CHECK(ZoneReadStruct(StructEVENT_FIELD_DESCRIPTOR, entryAddress, &log));
 
     FieldEntry * fieldEntry;
     fieldEntry = new FieldEntry;
@@ -2059,7 +2516,7 @@ void ControllerObject::ReadGenericFieldDescriptor(UINT64 entryAddress, UINT64 pa
 
     SEVENT_GENERIC_TYPE_DESCRIPTOR log;
 
-    EXT_CHECK(StructEVENT_GENERIC_TYPE_DESCRIPTOR.Read(entryAddress, &log));
+    EXT_CHECK(ZoneReadStruct(StructEVENT_GENERIC_TYPE_DESCRIPTOR, entryAddress, &log));
 
     FieldEntry * fieldEntry;
     fieldEntry = new FieldEntry;
@@ -2110,7 +2567,7 @@ UINT64 ControllerObject::ReadMemoryHeader(EventingEnumerator * enumerator,
 
     ReadSize = sizeof(EntryBuffer);
 
-    EXT_CHECK(StructMEMORY_HEADER.Read(entryAddress, &log));
+    EXT_CHECK(ZoneReadStruct(StructMEMORY_HEADER, entryAddress, &log));
 
     header.address = entryAddress;
     header.size = (int)log.Size;
@@ -2131,7 +2588,7 @@ UINT64 ControllerObject::ReadMemoryHeader(EventingEnumerator * enumerator,
 
     Stacksize = 0;
     MetadataSize = (ULONG_PTR)CrtOffset;
-    EXT_CHECK(TraceRead(entryAddress, EntryBuffer, (ULONG)ReadSize));
+    EXT_CHECK(ZoneRead(entryAddress, EntryBuffer, (ULONG)ReadSize));
 
 
     if (log.Flags & RECORD_STACK_TRACES) {
@@ -2198,7 +2655,7 @@ UINT64 ControllerObject::ReadMetadataMemoryHeader(EventingEnumerator * enumerato
 
     ReadSize = sizeof(EntryBuffer);
 
-    EXT_CHECK(StructMEMORY_HEADER.Read(entryAddress, &log));
+    EXT_CHECK(ZoneReadStruct(StructMEMORY_HEADER, entryAddress, &log));
 
     header.address = entryAddress;
     header.size = (int)log.Size;
@@ -2216,7 +2673,7 @@ UINT64 ControllerObject::ReadMetadataMemoryHeader(EventingEnumerator * enumerato
 
     Stacksize = 0;
     MetadataSize = (ULONG_PTR)CrtOffset;
-    EXT_CHECK(TraceRead(entryAddress, EntryBuffer, (ULONG)ReadSize));
+    EXT_CHECK(ZoneRead(entryAddress, EntryBuffer, (ULONG)ReadSize));
 
     ExtVerb("Reading entry %p\n", entryAddress);
 
@@ -2270,6 +2727,11 @@ UINT64 ControllerObject::ReadMemoryZone(EventingEnumerator * enumerator, UINT64
     SMEMORY_ZONE log;
 
     EXT_CHECK(StructMEMORY_ZONE.Read(zoneAddress, &log));
+
+    //  Bring the whole zone over once; both passes below parse from it.
+
+    LoadZone(zoneAddress, (ULONG)log.ZoneSize);
+
     UINT64 Blocks = (USHORT)log.ReadyList;
 
     while (Blocks) {
@@ -2284,11 +2746,13 @@ UINT64 ControllerObject::ReadMemoryZone(EventingEnumerator * enumerator, UINT64
         Blocks = ReadMemoryHeader(enumerator, zoneAddress + Blocks);
     }
 
+    FlushZone();
     return log.Link;
 
 Exit:
     //  Error path
 
+    FlushZone();
     ERRORBREAK("Invalid symbols information\n");
     return 0;
 }
@@ -2384,7 +2848,15 @@ void RevertToSystemDomainAddressSpace(ULONG64 Context)
 
 void ControllerObject::FetchMetadata(EventingEnumerator * enumerator)
 {
-    ReadStorage(enumerator, RepositoryAddress, true);
+    //  The repository only holds descriptors, so once it has been read the
+    //  cached types and sources are all we need.
+
+    if (!MetadataCached) {
+
+        ReadStorage(enumerator, RepositoryAddress, true);
+        MetadataCached = true;
+    }
+
     WalkTypes(enumerator);
     WalkSources(enumerator);
     WalkActiveSourcesEntries(enumerator);
@@ -2411,8 +2883,6 @@ void WalkTracingDatabase(EventingEnumerator * enumerator, bool typesOnly)
     ULONG64 SystemContextHandle;
     ULONG64 ControllerLink;
 
-    FlushControllers();
-
     if (!enumerator->SystemCallout(FALSE)) {
 
         return;
@@ -2606,6 +3076,14 @@ void Tracing(PCSTR args)
                     ExtOut("Kernel GC collection triggered. Press \'g\' to resume the execution.\n"
                         "It will break in debugger when GS collection completes\n");
                 }
+                else if ((*args == 'f') || (*args == 'F'))
+                {
+                    args += 1;
+                    SKIP_WHITESPACES(args);
+
+                    //  Write the allocation stacks of the GC logs as folded stacks
+                    WriteGCFoldedStacks(args);
+                }
                 else
                 {
                     SKIP_WHITESPACES(args);
@@ -337,6 +337,31 @@ struct FieldFilter
     char * ParseInput(char * arg);
 };
 
+//
+//  A FieldFilter compiled against one field of one type. The field's offset
+//  and width are resolved once, and string patterns get their search table
+//  built once, so FilterMatch is a flat loop over the entry buffer.
+//
+
+#define FILTER_STEP_CONSTANT    0   // Non-numeric field, always reads as 0
+#define FILTER_STEP_NUMERIC     1
+#define FILTER_STEP_STRING      2   // USHORT index of an extended string
+#define FILTER_STEP_GENERIC     3   // Enum or flags, via FieldEntry
+
+struct FilterStep
+{
+    FieldFilter * Filter;
+    FieldEntry * Field;
+    int Kind;
+    int Offset;
+    int Width;
+    int PatternLength;
+    unsigned char Shift[256];       // Horspool shifts for substring searches
+
+    void Compile(FieldFilter * filter, FieldEntry * field);
+    bool MatchString(char * value);
+};
+
 //  Simple variable size array implementation
 
 struct VariableArray
@@ -354,6 +379,170 @@ private:
     bool Extend();
 };
 
+//  Open addressing hash table from a non-zero 64-bit key to a 64-bit value.
+//  The table is kept at most half full, so probe runs stay short.
+
+class IpTable
+{
+    UINT64 * Keys;
+    UINT64 * Values;
+    int Size;
+    int InUse;
+
+    static inline UINT64 Mix(UINT64 key)
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    inline int Probe(UINT64 key)
+    {
+        int mask = Size - 1;
+        int slot = (int)Mix(key) & mask;
+
+        while (Keys[slot] != 0 && Keys[slot] != key) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    bool Resize(int newSize)
+    {
+        UINT64 * oldKeys = Keys;
+        UINT64 * oldValues = Values;
+        int oldSize = Size;
+
+        Keys = (UINT64 *)calloc(newSize, sizeof(UINT64));
+        Values = (UINT64 *)calloc(newSize, sizeof(UINT64));
+
+        if (Keys == NULL || Values == NULL) {
+
+            free(Keys);
+            free(Values);
+            Keys = oldKeys;
+            Values = oldValues;
+            return false;
+        }
+
+        Size = newSize;
+
+        for (int i = 0; i < oldSize; i++) {
+            if (oldKeys[i] != 0) {
+                int slot = Probe(oldKeys[i]);
+                Keys[slot] = oldKeys[i];
+                Values[slot] = oldValues[i];
+            }
+        }
+
+        free(oldKeys);
+        free(oldValues);
+        return true;
+    }
+
+  public:
+
+    IpTable() : Keys(NULL), Values(NULL), Size(0), InUse(0)
+    {
+    }
+
+    ~IpTable()
+    {
+        free(Keys);
+        free(Values);
+    }
+
+    static UINT64 Hash(UINT64 seed, UINT64 value)
+    {
+        return Mix(seed ^ value) + 0x9e3779b97f4a7c15ULL;
+    }
+
+    //
+    //  Returns the value slot of key. A missing key is added with a zero
+    //  value when insert is set. NULL for key 0, a missing key or no memory.
+    //
+
+    UINT64 * Lookup(UINT64 key, bool insert)
+    {
+        if (key == 0 || (Size == 0 && (!insert || !Resize(1024)))) {
+            return NULL;
+        }
+
+        int slot = Probe(key);
+
+        if (Keys[slot] == 0) {
+
+            if (!insert) {
+                return NULL;
+            }
+
+            if ((InUse + 1) * 2 > Size) {
+
+                if (!Resize(Size * 2)) {
+                    return NULL;
+                }
+                slot = Probe(key);
+            }
+
+            Keys[slot] = key;
+            InUse++;
+        }
+        return &Values[slot];
+    }
+
+    inline int Count() const { return InUse; }
+
+    void Clear()
+    {
+        if (Size != 0) {
+            memset(Keys, 0, Size * sizeof(UINT64));
+            memset(Values, 0, Size * sizeof(UINT64));
+        }
+        InUse = 0;
+    }
+
+    bool Enumerate(int& iterator, UINT64 * key, UINT64 * value)
+    {
+        for (; iterator < Size; iterator++) {
+            if (Keys[iterator] != 0) {
+                *key = Keys[iterator];
+                *value = Values[iterator++];
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+//  Folded stacks, the input format of flame graph tools: one line per
+//  distinct stack with its frames from the root down separated by ';',
+//  followed by the total weight of all the samples that had that stack.
+
+class FoldedStacks
+{
+    VariableArray Lines;        // (text offset, weight) pairs
+    IpTable Index;              // Hash of the line text -> pair index + 1
+    PCHAR Text;
+    ULONG TextUsed;
+    ULONG TextSize;
+    ULONG LineStart;            // Offset of the line being built
+
+    bool Reserve(ULONG length);
+
+public:
+
+    FoldedStacks();
+    ~FoldedStacks();
+
+    void BeginStack();
+    void AddFrame(PCSTR frame);
+    void EndStack(UINT64 weight);
+    int Write(FILE * file);
+};
+
 
 
 struct EventTypeEntry {
@@ -371,6 +560,8 @@ struct EventTypeEntry {
     FieldEntry * fieldsFilterList[MAX_FILTERS];
     int filterCount;
     bool FilterApplied;
+    FilterStep * filterProgram;     // filterCount steps, built on first use
+    bool filterCompiled;
 
     EventTypeEntry();
     ~EventTypeEntry();
@@ -380,6 +571,7 @@ struct EventTypeEntry {
     bool ApplyFilter(FieldFilter * newFilter);
     void ClearFilters();
     bool FilterMatch();
+    void CompileFilters();
 
     void UpdateFieldsOffsets();
     void WalkFields(EventingEnumerator * enumerator);
@@ -436,7 +628,9 @@ struct ControllerObject {
     UINT64 ControllerHandle;
     UINT64 ContextHandle;
     UINT64 RepositoryAddress;
+    UINT64 RepositoryGeneration;
     UINT64 StorageListHead;
+    bool MetadataCached;
 
     ControllerObject(UINT64 handle,
                      UINT64 contextHandle,
@@ -446,6 +640,7 @@ struct ControllerObject {
 
 
     void FetchMetadata(EventingEnumerator * enumerator);
+    void ClearFilters();
     void WalkEntries(EventingEnumerator * enumerator);
     EventTypeEntry * FindType(ULONG64 Key);
     UINT64 ReadMemoryHeader(EventingEnumerator * enumerator, UINT64 entryAddress);
@@ -631,6 +826,7 @@ public:
 void DumpMemory(PCSTR fname);
 void WriteFileRange (int Base, int Size, PCSTR fname);
 void WriteCLRProfileFile(PCSTR fname, bool Kernel);
+void WriteGCFoldedStacks(PCSTR fname);
 void EnableKernelGCProfiler(ULONG64 MemorySize, bool breakOnRecycle);
 void DisableKernelGCProfiler();
 void EnableSIPGCProfiler(ULONG64 MemorySize, bool breakOnRecycle);
@@ -639,17 +835,23 @@ extern char * MetadataInfo;
 
 
 
+//
+//  Sorted set of disjoint page ranges, as (start, size) pairs. Overlapping
+//  and adjacent ranges are merged as they are added, and RVAs are looked up
+//  with a binary search.
+//
+
 class MemoryRagesCollection : public VariableArray {
-    int DiscardedRanges;
-    UINT64 PreviousAddress;
-    UINT64 PreviousSize;
+    VariableArray RangeRVAs;    // Dump offset of each range, from CompactItems
+
+    int FindRange(UINT64 address);
 
 public:
 
-    MemoryRagesCollection() : VariableArray(){DiscardedRanges=0; PreviousAddress = 0; PreviousSize = 0;};
+    MemoryRagesCollection() : VariableArray(){};
     void AddRange(UINT64 startRVA, UINT64 rangeSize);
 
-    int GetEffectiveRanges(){return GetRangesCount() - DiscardedRanges;}
+    int GetEffectiveRanges(){return GetRangesCount();}
     UINT64 GetStartAddress(int i){return Array[i * 2];}
     UINT64 GetRangeSize(int i){return Array[i * 2 + 1];}
     int GetRangesCount(){return InUse / 2;}
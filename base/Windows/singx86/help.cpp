@@ -20,6 +20,7 @@ EXT_DECL(help) // Defines: PDEBUG_CLIENT Client, PCSTR args
            "  !diag                     - Diagnosis utilities.\n"
            "  !ioapic                   - Dump I/O APIC state.\n"
            "  !log                      - Dump system log.\n"
+           "  !memsource                - Select the debugger or snapshot files as memory source.\n"
            "  !object <address> <args>  - Display the object at address; args are same as `dt'.\n"
            "  !procs                    - List all processes.\n"
            "  !singreload               - Reloads types from kernel dll\n"
@@ -12,7 +12,7 @@ HRESULT FindBound(const char *symbol, ULONG64 *ptrval)
     ULONG64 address;
 
     EXT_CHECK(g_ExtSymbols->GetOffsetByName(symbol, &address));
-    EXT_CHECK(g_ExtData->ReadPointersVirtual(1, address, ptrval));
+    EXT_CHECK(g_MemorySource->ReadPointers(1, address, ptrval));
 
   Exit:
     ExtVerb("Find(%s) = %p\n", symbol, *ptrval);
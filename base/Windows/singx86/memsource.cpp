@@ -0,0 +1,342 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//  memsource.cpp - Memory sources for the analysis code, and !memsource.
+//
+//  Copyright Microsoft Corporation.  All rights reserved.
+//
+
+#include "singx86.h"
+#include "diagnose.h"
+
+static DebuggerMemorySource DebuggerMemory;
+static SnapshotMemorySource * Snapshot = NULL;
+
+MemorySource * g_MemorySource = &DebuggerMemory;
+
+//
+//  Debugger backend
+//
+
+HRESULT DebuggerMemorySource::ReadMemory(UINT64 address, void * buffer, ULONG size, PULONG bytesRead)
+{
+    return g_ExtData->ReadVirtual(address, buffer, size, bytesRead);
+}
+
+HRESULT DebuggerMemorySource::ReadPointers(ULONG count, UINT64 address, PULONG64 buffer)
+{
+    return g_ExtData->ReadPointersVirtual(count, address, buffer);
+}
+
+void DebuggerMemorySource::Describe()
+{
+    ExtOut("Reading memory from the debugger target\n");
+}
+
+//
+//  Snapshot file backend
+//
+
+SnapshotMemorySource::SnapshotMemorySource(ULONG pointerSize)
+{
+    SegmentCount = 0;
+    PointerSize = pointerSize;
+}
+
+SnapshotMemorySource::~SnapshotMemorySource()
+{
+    for (int i = 0; i < SegmentCount; i++) {
+
+        fclose(Segments[i].File);
+    }
+}
+
+bool SnapshotMemorySource::AddSegment(PCSTR fileName, UINT64 base)
+{
+    if (SegmentCount >= MAX_SNAPSHOT_SEGMENTS) {
+
+        ExtOut("No more than %d files can be used\n", MAX_SNAPSHOT_SEGMENTS);
+        return FALSE;
+    }
+
+    FILE * file = fopen(fileName, "rb");
+
+    if (file == NULL) {
+
+        ExtOut("Cannot open %s\n", fileName);
+        return FALSE;
+    }
+
+    _fseeki64(file, 0, SEEK_END);
+
+    Segment * segment = &Segments[SegmentCount++];
+
+    segment->File = file;
+    segment->Base = base;
+    segment->Size = _ftelli64(file);
+    _snprintf(segment->Name, sizeof(segment->Name), "%s", fileName);
+    segment->Name[sizeof(segment->Name) - 1] = 0;
+
+    return TRUE;
+}
+
+HRESULT SnapshotMemorySource::ReadMemory(UINT64 address, void * buffer, ULONG size, PULONG bytesRead)
+{
+    ULONG done = 0;
+
+    //
+    //  A read may cross from one file into the next one
+    //
+
+    while (done < size) {
+
+        Segment * segment = NULL;
+
+        for (int i = 0; i < SegmentCount; i++) {
+
+            if ((address >= Segments[i].Base) &&
+                (address - Segments[i].Base < Segments[i].Size)) {
+
+                segment = &Segments[i];
+                break;
+            }
+        }
+
+        if (segment == NULL) {
+
+            break;
+        }
+
+        UINT64 offset = address - segment->Base;
+        ULONG length = size - done;
+
+        if (length > segment->Size - offset) {
+
+            length = (ULONG)(segment->Size - offset);
+        }
+
+        if ((_fseeki64(segment->File, offset, SEEK_SET) != 0) ||
+            (fread((char *)buffer + done, 1, length, segment->File) != length)) {
+
+            break;
+        }
+
+        done += length;
+        address += length;
+    }
+
+    if (bytesRead != NULL) {
+
+        *bytesRead = done;
+    }
+
+    return (done == size) ? S_OK : E_FAIL;
+}
+
+HRESULT SnapshotMemorySource::ReadPointers(ULONG count, UINT64 address, PULONG64 buffer)
+{
+    HRESULT status;
+
+    if (PointerSize == 8) {
+
+        return ReadMemory(address, buffer, count * sizeof(ULONG64), NULL);
+    }
+
+    //
+    //  Widen 32-bit pointers in place from the end, sign extended the way
+    //  the debugger returns them.
+    //
+
+    ULONG * narrow = (ULONG *)buffer;
+
+    EXT_CHECK(ReadMemory(address, buffer, count * sizeof(ULONG), NULL));
+
+    for (ULONG i = count; i > 0; i--) {
+
+        buffer[i - 1] = (ULONG64)(LONG64)(LONG)narrow[i - 1];
+    }
+
+  Exit:
+    return status;
+}
+
+void SnapshotMemorySource::Describe()
+{
+    ExtOut("Reading memory from %d file(s):\n", SegmentCount);
+
+    for (int i = 0; i < SegmentCount; i++) {
+
+        ExtOut("    %p - %p  %s\n",
+               Segments[i].Base,
+               Segments[i].Base + Segments[i].Size,
+               Segments[i].Name);
+    }
+}
+
+//
+//  Saves size bytes of the debugger target at address into fileName, in
+//  the layout !memsource -f reads back.
+//
+
+static void SaveSnapshot(PCSTR fileName, UINT64 address, UINT64 size)
+{
+    FILE * file = fopen(fileName, "wb");
+
+    if (file == NULL) {
+
+        ExtOut("Cannot open %s\n", fileName);
+        return;
+    }
+
+    char * buffer = (char *)malloc(1024 * 1024);
+
+    if (buffer != NULL) {
+
+        UINT64 saved = 0;
+
+        while (saved < size) {
+
+            ULONG length = (ULONG)min(size - saved, 1024 * 1024);
+            ULONG bytesRead = 0;
+
+            DebuggerMemory.ReadMemory(address + saved, buffer, length, &bytesRead);
+
+            if (bytesRead < length) {
+
+                ZeroMemory(buffer + bytesRead, length - bytesRead);
+            }
+
+            fwrite(buffer, length, 1, file);
+            saved += length;
+        }
+
+        free(buffer);
+        ExtOut("Saved %I64x bytes at %p to %s\n", size, address, fileName);
+    }
+
+    fclose(file);
+}
+
+static void UseDebugger()
+{
+    if (Snapshot != NULL) {
+
+        delete Snapshot;
+        Snapshot = NULL;
+    }
+    g_MemorySource = &DebuggerMemory;
+}
+
+static HRESULT Usage()
+{
+    ExtOut("Usage:\n"
+           "    !memsource [options]\n"
+           "Options:\n"
+           "    -f <file> <base>         : Read memory at base from file, a raw memory\n"
+           "                               snapshot or a saved trace buffer. Can be repeated\n"
+           "    -d                       : Read memory from the debugger target again\n"
+           "    -w <file> <base> <size>  : Save target memory to file, for use with -f\n"
+           "    -p <file>                : Save all physical pages to file, for use with -f <file> 0\n"
+           "With no options, shows where memory is read from\n"
+          );
+
+    return S_FALSE;
+}
+
+EXT_DECL(memsource) // Defines: PDEBUG_CLIENT Client, PCSTR args
+{
+    EXT_ENTER();    // Defines: HRESULT status = S_OK;
+
+    char fileName[128];
+
+    SKIP_WHITESPACES(args);
+
+    if (*args == '\0') {
+
+        g_MemorySource->Describe();
+        goto Exit;
+    }
+
+    while (*args != '\0') {
+
+        SKIP_WHITESPACES(args);
+
+        if (*args != '-' && *args != '/') {
+
+            Usage();
+            goto Exit;
+        }
+
+        args++;
+
+        switch (tolower(*args++)) {
+
+          case 'd': {
+
+                UseDebugger();
+
+                //
+                //  The cached eventing metadata came from the other source
+                //
+
+                FlushControllers();
+              }
+                break;
+
+          case 'f':
+          case 'p':
+          case 'w': {
+
+                CHAR option = (CHAR)tolower(args[-1]);
+                int length = 0;
+
+                SKIP_WHITESPACES(args);
+
+                while (*args != ' ' && *args != '\t' && *args != '\0') {
+
+                    if (length < (int)sizeof(fileName) - 1) {
+
+                        fileName[length++] = *args;
+                    }
+                    args++;
+                }
+                fileName[length] = 0;
+
+                if (option == 'p') {
+
+                    DumpMemory(fileName);
+                    break;
+                }
+
+                SKIP_WHITESPACES(args);
+                UINT64 base = GetValue(args, true);
+
+                if (option == 'w') {
+
+                    SKIP_WHITESPACES(args);
+                    SaveSnapshot(fileName, base, GetValue(args, true));
+                    break;
+                }
+
+                if (Snapshot == NULL) {
+
+                    Snapshot = new SnapshotMemorySource((g_ExtControl->IsPointer64Bit() == S_OK) ? 8 : 4);
+                }
+
+                if (Snapshot->AddSegment(fileName, base)) {
+
+                    g_MemorySource = Snapshot;
+                    FlushControllers();
+                }
+              }
+                break;
+
+          default:
+            Usage();
+            goto Exit;
+        }
+    }
+
+    g_MemorySource->Describe();
+
+    EXT_LEAVE();    // Macro includes: return status;
+}
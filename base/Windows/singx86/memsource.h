@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+//  memsource.h - Target memory access for the analysis code.
+//
+//  Copyright Microsoft Corporation.  All rights reserved.
+//
+//  The eventing walkers, filters and profilers read target memory only
+//  through g_MemorySource. It is the live debugger by default, and can be
+//  switched to memory captured in files with !memsource. This header does
+//  not depend on dbgeng.
+//
+
+#pragma once
+
+class MemorySource
+{
+public:
+    virtual ~MemorySource() {}
+
+    //  Fails unless all size bytes are read; *bytesRead has the count read.
+    virtual HRESULT ReadMemory(UINT64 address, void * buffer, ULONG size, PULONG bytesRead) = 0;
+    virtual HRESULT ReadPointers(ULONG count, UINT64 address, PULONG64 buffer) = 0;
+    virtual void Describe() = 0;
+};
+
+//
+//  The target of the debugger session, through IDebugDataSpaces.
+//
+
+class DebuggerMemorySource : public MemorySource
+{
+public:
+    HRESULT ReadMemory(UINT64 address, void * buffer, ULONG size, PULONG bytesRead);
+    HRESULT ReadPointers(ULONG count, UINT64 address, PULONG64 buffer);
+    void Describe();
+};
+
+//
+//  Memory captured in files: raw physical memory snapshots, or saved trace
+//  buffers. Each file holds the bytes of one contiguous range starting at
+//  the base address given for it.
+//
+
+#define MAX_SNAPSHOT_SEGMENTS 16
+
+class SnapshotMemorySource : public MemorySource
+{
+    struct Segment {
+        FILE * File;
+        UINT64 Base;
+        UINT64 Size;
+        char Name[128];
+    };
+
+    Segment Segments[MAX_SNAPSHOT_SEGMENTS];
+    int SegmentCount;
+    ULONG PointerSize;
+
+public:
+    SnapshotMemorySource(ULONG pointerSize);
+    ~SnapshotMemorySource();
+
+    bool AddSegment(PCSTR fileName, UINT64 base);
+
+    HRESULT ReadMemory(UINT64 address, void * buffer, ULONG size, PULONG bytesRead);
+    HRESULT ReadPointers(ULONG count, UINT64 address, PULONG64 buffer);
+    void Describe();
+};
+
+extern MemorySource * g_MemorySource;
@@ -66,29 +66,270 @@ void GetMethodName(ULONG64 ip, PSTR buffer, ULONG bufferLength)
 
 #else // TEST
 
-ULONG64 RoundIp(ULONG64 ip)
+///////////////////////////////////////////////////////////////////////////////
+//
+// Symbol cache
+//
+//  The symbols of a module are enumerated the first time one of its IPs is
+//  seen, and kept sorted by address. An IP then resolves to the closest
+//  symbol below it with a binary search, without asking the debugger again.
+//  IPs outside any module, or that no symbol of their module covers, fall
+//  back to GetNameByOffset, once per IP.
+//
+
+class SymbolCache
+{
+    VariableArray Symbols;      // (address, name offset) pairs, sorted per module
+    VariableArray Modules;      // (base, limit, first symbol, symbol count)
+    IpTable Unmapped;           // IP without a module symbol -> name offset + 1
+    IpTable UnmappedStarts;     // IP without a module symbol -> symbol address
+    PCHAR Names;
+    ULONG NamesUsed;
+    ULONG NamesSize;
+
+    ULONG AddName(PCSTR name);
+    int LoadModule(ULONG64 ip);
+    int FindModule(ULONG64 ip);
+    bool Resolve(ULONG64 ip, ULONG64 * start, PCSTR * name);
+
+  public:
+
+    SymbolCache() : Names(NULL), NamesUsed(0), NamesSize(0)
+    {
+    }
+
+    ~SymbolCache()
+    {
+        free(Names);
+    }
+
+    ULONG64 FunctionStart(ULONG64 ip);
+    bool GetName(ULONG64 ip, PSTR buffer, ULONG bufferLength, bool withDisplacement);
+};
+
+static int ItemCompare(const void * e1, const void * e2);
+
+static SymbolCache * SampleSymbols = NULL;
+
+ULONG SymbolCache::AddName(PCSTR name)
+{
+    ULONG length = (ULONG)strlen(name) + 1;
+
+    if (NamesUsed + length > NamesSize) {
+
+        ULONG newSize = (NamesSize == 0) ? 64 * 1024 : NamesSize * 2;
+
+        while (NamesUsed + length > newSize) {
+            newSize *= 2;
+        }
+
+        PCHAR newNames = (PCHAR)realloc(Names, newSize);
+
+        if (newNames == NULL) {
+            return (ULONG)-1;
+        }
+
+        Names = newNames;
+        NamesSize = newSize;
+    }
+
+    ULONG offset = NamesUsed;
+    memcpy(Names + offset, name, length);
+    NamesUsed += length;
+    return offset;
+}
+
+int SymbolCache::FindModule(ULONG64 ip)
+{
+    for (int i = 0; i < Modules.InUse; i += 4) {
+        if (ip >= Modules.Array[i] && ip < Modules.Array[i + 1]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int SymbolCache::LoadModule(ULONG64 ip)
+{
+    ULONG64 base;
+    DEBUG_MODULE_PARAMETERS params;
+    CHAR moduleName[128];
+    CHAR pattern[160];
+    CHAR name[512];
+    ULONG64 handle;
+
+    if (g_ExtSymbols->GetModuleByOffset(ip, 0, NULL, &base) != S_OK ||
+        g_ExtSymbols->GetModuleParameters(1, &base, 0, &params) != S_OK ||
+        g_ExtSymbols->GetModuleNames(DEBUG_ANY_ID, base, NULL, 0, NULL,
+                                     moduleName, sizeof(moduleName), NULL,
+                                     NULL, 0, NULL) != S_OK) {
+        return -1;
+    }
+
+    ULONG64 limit = base + params.Size;
+    int first = Symbols.InUse;
+
+    _snprintf(pattern, sizeof(pattern), "%s!*", moduleName);
+    pattern[sizeof(pattern) - 1] = 0;
+
+    ExtVerb("Caching symbols for %s\n", moduleName);
+
+    if (g_ExtSymbols->StartSymbolMatch(pattern, &handle) == S_OK) {
+
+        ULONG64 offset;
+
+        while (g_ExtSymbols->GetNextSymbolMatch(handle, name, sizeof(name), NULL, &offset) == S_OK) {
+
+            if (offset < base || offset >= limit) {
+                continue;
+            }
+
+            ULONG nameOffset = AddName(name);
+
+            if (nameOffset == (ULONG)-1 ||
+                !Symbols.Add(offset) || !Symbols.Add(nameOffset)) {
+                break;
+            }
+        }
+        g_ExtSymbols->EndSymbolMatch(handle);
+    }
+
+    int count = (Symbols.InUse - first) / 2;
+    qsort(Symbols.Array + first, count, 2 * sizeof(UINT64), ItemCompare);
+
+    int module = Modules.InUse;
+
+    if (!Modules.Add(base) || !Modules.Add(limit) ||
+        !Modules.Add(first) || !Modules.Add(count)) {
+        Modules.InUse = module;
+        return -1;
+    }
+    return module;
+}
+
+bool SymbolCache::Resolve(ULONG64 ip, ULONG64 * start, PCSTR * name)
 {
-    ULONG64 displacement;
-    if (g_ExtSymbols->GetNameByOffset(ip, NULL, 0, NULL, &displacement) == S_OK) {
-        return (ip - displacement);
+    int module = FindModule(ip);
+    UINT64 * cached = NULL;
+
+    if (module < 0) {
+
+        cached = Unmapped.Lookup(ip, false);
+
+        if (cached == NULL) {
+            module = LoadModule(ip);
+        }
+    }
+
+    if (module >= 0) {
+
+        //
+        //  Binary search for the last symbol at or below ip
+        //
+
+        UINT64 * symbols = Symbols.Array + Modules.Array[module + 2];
+        int low = 0;
+        int high = (int)Modules.Array[module + 3];
+
+        while (low < high) {
+            int middle = (low + high) / 2;
+            if (symbols[middle * 2] <= ip) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+
+        if (low > 0) {
+            *start = symbols[(low - 1) * 2];
+            *name = Names + symbols[(low - 1) * 2 + 1];
+            return true;
+        }
+
+        //
+        //  The module has no symbols, or none at or below ip (an export-only
+        //  or stripped image); let the debugger try it as an unmapped IP.
+        //
+
+        cached = Unmapped.Lookup(ip, false);
+    }
+
+    if (cached == NULL) {
+
+        CHAR buffer[512];
+        ULONG64 displacement;
+
+        cached = Unmapped.Lookup(ip, true);
+
+        if (cached == NULL) {
+            return false;
+        }
+
+        if (g_ExtSymbols->GetNameByOffset(ip, buffer, sizeof(buffer), NULL, &displacement) == S_OK) {
+
+            ULONG nameOffset = AddName(buffer);
+            UINT64 * symbolStart = UnmappedStarts.Lookup(ip, true);
+
+            if (nameOffset != (ULONG)-1 && symbolStart != NULL) {
+                *cached = (UINT64)nameOffset + 1;
+                *symbolStart = ip - displacement;
+            }
+        }
+    }
+
+    if (*cached == 0) {
+        return false;
+    }
+
+    *start = *UnmappedStarts.Lookup(ip, false);
+    *name = Names + (*cached - 1);
+    return true;
+}
+
+ULONG64 SymbolCache::FunctionStart(ULONG64 ip)
+{
+    ULONG64 start;
+    PCSTR name;
+
+    if (Resolve(ip, &start, &name)) {
+        return start;
     }
     return ip;
 }
 
-void GetMethodName(ULONG64 ip, PSTR buffer, ULONG bufferLength)
+//
+//  Formats the symbol of ip into buffer, or the hex value of ip when it has
+//  no symbol. Returns false in the latter case.
+//
+
+bool SymbolCache::GetName(ULONG64 ip, PSTR buffer, ULONG bufferLength, bool withDisplacement)
 {
-    ULONG64 displacement;
-    ULONG   bufferUsed = 0;
+    ULONG64 start;
+    PCSTR name;
+    bool found = Resolve(ip, &start, &name);
 
-    int status = g_ExtSymbols->GetNameByOffset(ip, buffer, bufferLength,
-                                               &bufferUsed, &displacement);
-    if (status != S_OK) {
+    if (!found) {
         _snprintf(buffer, bufferLength, "%I64x", ip);
-        return;
     }
-    else if (displacement != 0) {
-        _snprintf(buffer + bufferUsed - 1, bufferLength - bufferUsed, "+0x%I64x", displacement);
+    else if (withDisplacement && ip != start) {
+        _snprintf(buffer, bufferLength, "%s+0x%I64x", name, ip - start);
     }
+    else {
+        _snprintf(buffer, bufferLength, "%s", name);
+    }
+    buffer[bufferLength - 1] = 0;
+    return found;
+}
+
+ULONG64 RoundIp(ULONG64 ip)
+{
+    return SampleSymbols->FunctionStart(ip);
+}
+
+void GetMethodName(ULONG64 ip, PSTR buffer, ULONG bufferLength)
+{
+    SampleSymbols->GetName(ip, buffer, bufferLength, true);
 }
 #endif // TEST
 
@@ -104,8 +345,8 @@ struct TargetNode
     struct TargetNode* next;
     struct TargetNode* prev;
 
-    TargetNode(ULONG64 theJumpTarget = 0)
-        : jumpTarget(theJumpTarget), jumpCount(1)
+    TargetNode(ULONG64 theJumpTarget = 0, int theJumpCount = 1)
+        : jumpTarget(theJumpTarget), jumpCount(theJumpCount)
     {
         next = this;
         prev = this;
@@ -170,21 +411,21 @@ struct OriginNode
         }
     }
 
-    void AddJump(ULONG64 theJumpTarget)
+    void AddJump(ULONG64 theJumpTarget, int theJumpCount = 1)
     {
-        jumpCount++;
+        jumpCount += theJumpCount;
 
         TargetNode* node = sentinel.next;
         TargetNode* stop = &sentinel;
 
         while (node != stop) {
             if (node->jumpTarget == theJumpTarget) {
-                node->jumpCount++;
+                node->jumpCount += theJumpCount;
                 return;
             }
             node = node->next;
         }
-        Append(new TargetNode(theJumpTarget));
+        Append(new TargetNode(theJumpTarget, theJumpCount));
     }
 
     inline int JumpCount() const
@@ -247,7 +488,7 @@ struct OriginNode
 
 class JumpTable
 {
-    static const int hashBins = 32;
+    static const int hashBins = 1024;
 
     OriginNode hashTable[hashBins];
     int totalJumps;
@@ -281,7 +522,7 @@ class JumpTable
         }
     }
 
-    void AddJump(ULONG64 theJumpOrigin, ULONG64 theJumpTarget)
+    void AddJump(ULONG64 theJumpOrigin, ULONG64 theJumpTarget, int theJumpCount = 1)
     {
         int bin = Hash(theJumpOrigin);
 
@@ -289,8 +530,8 @@ class JumpTable
         OriginNode* node = sentinel->next;
         while (node != sentinel) {
             if (node->JumpOrigin() == theJumpOrigin) {
-                node->AddJump(theJumpTarget);
-                totalJumps++;
+                node->AddJump(theJumpTarget, theJumpCount);
+                totalJumps += theJumpCount;
                 return;
             }
             node = node->next;
@@ -299,8 +540,8 @@ class JumpTable
         node = new OriginNode(theJumpOrigin);
         nodeCount++;
 
-        node->AddJump(theJumpTarget);
-        totalJumps++;
+        node->AddJump(theJumpTarget, theJumpCount);
+        totalJumps += theJumpCount;
 
         node->next = sentinel->next;
         node->prev = sentinel;
@@ -405,6 +646,7 @@ static HRESULT Usage()
            "    -k       : Print callee-caller information\n"
            "    -l       : Analyze call graph leafs only\n"
            "    -n count : Print count most recent sample stack traces\n"
+           "    -o file  : Write the sample stacks to file in folded format for flame graphs\n"
            "    -t       : Print sample stack traces\n"
            "    -x       : Use exact IP values rather than rounding to method start\n"
           );
@@ -490,10 +732,77 @@ static int ItemCompareFreq(const void * e1, const void * e2)
 void SampleStats::Sort()
 {
     //
-    //  Sort all ranges by address to make easier searching for overlapped ranges
+    //  Sort the (ip, hits) pairs by decreasing number of hits
     //
 
-    qsort(Array, InUse / 2, 2*sizeof(UINT64), ItemCompare);
+    qsort(Array, InUse / 2, 2*sizeof(UINT64), ItemCompareFreq);
+}
+
+//
+//  Distinct raw stacks and the number of samples that had each of them.
+//  A stack is stored in Stacks as (count, length, ip...), and Index maps
+//  the hash of the stack to its offset + 1. Different stacks with the same
+//  hash are rehashed until a free or matching key is found.
+//
+
+class StackTable
+{
+
+public:
+    VariableArray Stacks;
+    IpTable Index;
+
+    bool Add(UINT64 * ips, int length);
+};
+
+bool StackTable::Add(UINT64 * ips, int length)
+{
+    UINT64 key = (UINT64)length;
+
+    for (int i = 0; i < length; i++) {
+        key = IpTable::Hash(key, ips[i]);
+    }
+
+    for (;;) {
+
+        if (key == 0) {
+            key = 1;
+        }
+
+        UINT64 * slot = Index.Lookup(key, true);
+
+        if (slot == NULL) {
+            return false;
+        }
+
+        if (*slot == 0) {
+
+            int offset = Stacks.InUse;
+            bool added = Stacks.Add(1) && Stacks.Add(length);
+
+            for (int i = 0; added && i < length; i++) {
+                added = Stacks.Add(ips[i]);
+            }
+
+            if (!added) {
+                Stacks.InUse = offset;
+                return false;
+            }
+
+            *slot = offset + 1;
+            return true;
+        }
+
+        UINT64 * stack = Stacks.Array + (*slot - 1);
+
+        if (stack[1] == (UINT64)length &&
+            memcmp(stack + 2, ips, length * sizeof(UINT64)) == 0) {
+            stack[0] += 1;
+            return true;
+        }
+
+        key = IpTable::Hash(key, 0);
+    }
 }
 
 class SampleTracing : public EventingEnumerator
@@ -507,7 +816,8 @@ public:
     bool doTraces;
     bool doFrequencies;
     int  mostRecent;
-    SampleStats * Stats;
+    CHAR foldedFile[256];
+    SymbolCache Symbols;
 
     SampleTracing();
     ~SampleTracing();
@@ -518,10 +828,13 @@ public:
     bool virtual EntryCallout(EntryHeader *header, EventTypeEntry * entryDescriptor);
 
     void AnalyzeTraces();
+    void WriteFoldedStacks();
 
 private:
     JumpTable foreTable;
     JumpTable backTable;
+    StackTable stackTable;
+    VariableArray frames;
     UINT64 profileType;
     UINT64 LastTimestamp;
     int CrtItem;
@@ -536,16 +849,14 @@ SampleTracing::SampleTracing()
     doTraces       = false;
     doFrequencies  = false;
     mostRecent = 0;
+    foldedFile[0] = 0;
     profileType = 0;
 
     LastTimestamp = 0;
     CrtItem = 0;
-
-    Stats = new SampleStats();
 }
 SampleTracing::~SampleTracing()
 {
-    if (Stats) delete Stats;
 }
 
 bool SampleTracing::TypeCallout(EventTypeEntry * entryDescriptor)
@@ -616,59 +927,48 @@ bool SampleTracing::EntryCallout(EntryHeader *header, EventTypeEntry * entryDesc
 
         int count = array->GetArraySize(buffer);
 
-        int doneFirst = 0;
-        ULONG64 lastIp = 0;
-        bool leafJumpDone = false;
-        bool leafIpDone  = false;
         CHAR name[512];
 
-        for (int i = 0; i < count; i++) {
-
-            UINT64 eip = (UINT64)array->GetFieldNumericValue(buffer, i);
-
-            if (!doExactIps) {
-                eip = RoundIp(eip);
-            }
+        //
+        //  Only the raw stack is recorded here. Rounding and the caller-callee
+        //  tables are computed once per distinct stack in AnalyzeTraces.
+        //
 
-            if ((leafIpDone == false || doLeavesOnly == false) && eip != 0) {
-                Stats->Add(eip);
-                Stats->Add(0);
-                leafIpDone = true;
-            }
+        frames.InUse = 0;
 
-            if (lastIp != 0 && eip != 0 &&
-                (leafJumpDone == false || doLeavesOnly == false)) {
-                foreTable.AddJump(lastIp, eip);
-                backTable.AddJump(eip, lastIp);
-                leafJumpDone = true;
-            }
+        for (int i = 0; i < count; i++) {
 
-            lastIp = eip;
+            UINT64 eip = (UINT64)array->GetFieldNumericValue(buffer, i);
 
             if (eip == 0) {
                 break;
             }
 
-            doneFirst |= 1;
+            frames.Add(eip);
 
             if (doTraces == false)
                 continue;
 
+            if (!doExactIps) {
+                eip = RoundIp(eip);
+            }
 
-            if (g_ExtSymbols->GetNameByOffset(eip, (PSTR)&name, sizeof(name), NULL, NULL) == S_OK) {
-                if (doneFirst)
+            if (Symbols.GetName(eip, name, sizeof(name), false)) {
+                if (i != 0)
                     ExtOut(" <- %s (%p)", name, eip);
                 else
                     ExtOut(" %s (%p)", name, eip);
             }
             else {
-                if (doneFirst)
+                if (i != 0)
                     ExtOut(" <- %p", eip);
                 else
                     ExtOut(" %p", eip);
             }
         }
 
+        stackTable.Add(frames.Array, frames.InUse);
+
         if (doTraces)
             ExtOut("\n");
     }
@@ -680,46 +980,72 @@ bool SampleTracing::EntryCallout(EntryHeader *header, EventTypeEntry * entryDesc
 void SampleTracing::AnalyzeTraces()
 {
     CHAR name[512];
-    if (doFrequencies) {
-        ExtOut("==================================================================\n");
-        ExtOut("Raw instruction hits\n");
+    IpTable hits;
+    VariableArray & stacks = stackTable.Stacks;
+
+    for (int offset = 0; offset < stacks.InUse; offset += 2 + (int)stacks.Array[offset + 1]) {
 
-        if (Stats->InUse > 0) {
+        int samples = (int)stacks.Array[offset];
+        int length = (int)stacks.Array[offset + 1];
+        ULONG64 lastIp = 0;
 
-            Stats->Sort();
+        for (int i = 0; i < length; i++) {
 
-            int outIndex = 0;
-            ULONG64 lastIp = Stats->Array[0];
-            for (int i = 0; i < Stats->InUse;  i+= 2) {
-                if (Stats->Array[i] == lastIp) {
-                    Stats->Array[outIndex + 1] += 1;
-                }
-                else {
-                    outIndex += 2;
-                    Stats->Array[outIndex] = Stats->Array[i];
-                    Stats->Array[outIndex + 1] = 1;
-                    lastIp = Stats->Array[i];
-                }
+            UINT64 eip = stacks.Array[offset + 2 + i];
+
+            if (!doExactIps) {
+                eip = RoundIp(eip);
             }
 
-            // Sort on frequency and display
-            qsort(Stats->Array, outIndex / 2, 2*sizeof(UINT64), ItemCompareFreq);
-            ExtOut("Top of the pops has %d entries:\n", outIndex);
+            if (i == 0 || doLeavesOnly == false) {
 
-            for (int i = 0; i < outIndex; i += 2) {
-                if (g_ExtSymbols->GetNameByOffset(Stats->Array[i],
-                                                  (PSTR)&name,
-                                                  sizeof(name),
-                                                  NULL, NULL) == S_OK) {
-                    ExtOut("% 7d %p %s\n", (int)Stats->Array[i + 1], Stats->Array[i], name);
-                }
-                else {
-                    ExtOut("% 7d %p (unknown symbol)\n", (int)Stats->Array[i + 1], Stats->Array[i]);
+                UINT64 * count = hits.Lookup(eip, true);
+
+                if (count != NULL) {
+                    *count += samples;
                 }
             }
+
+            if (i == 1 || (i > 1 && doLeavesOnly == false)) {
+                foreTable.AddJump(lastIp, eip, samples);
+                backTable.AddJump(eip, lastIp, samples);
+            }
+
+            lastIp = eip;
+        }
+    }
+
+    if (doFrequencies) {
+        ExtOut("==================================================================\n");
+        ExtOut("Raw instruction hits\n");
+
+        SampleStats stats;
+        UINT64 ip;
+        UINT64 count;
+
+        for (int iterator = 0; hits.Enumerate(iterator, &ip, &count);) {
+            stats.Add(ip);
+            stats.Add(count);
+        }
+
+        // Sort on frequency and display
+        stats.Sort();
+        ExtOut("Top of the pops has %d entries:\n", stats.InUse / 2);
+
+        for (int i = 0; i < stats.InUse; i += 2) {
+            if (Symbols.GetName(stats.Array[i], name, sizeof(name), false)) {
+                ExtOut("% 7d %p %s\n", (int)stats.Array[i + 1], stats.Array[i], name);
+            }
+            else {
+                ExtOut("% 7d %p (unknown symbol)\n", (int)stats.Array[i + 1], stats.Array[i]);
+            }
         }
     }
 
+    if (foldedFile[0] != 0) {
+        WriteFoldedStacks();
+    }
+
     if (doCallerCallee) {
         ExtOut("==================================================================\n");
         ExtOut("Calls by target method to other methods:\n");
@@ -733,6 +1059,51 @@ void SampleTracing::AnalyzeTraces()
     }
 }
 
+void SampleTracing::WriteFoldedStacks()
+{
+    CHAR name[512];
+    FoldedStacks folded;
+    VariableArray & stacks = stackTable.Stacks;
+
+    for (int offset = 0; offset < stacks.InUse; offset += 2 + (int)stacks.Array[offset + 1]) {
+
+        int samples = (int)stacks.Array[offset];
+        int length = (int)stacks.Array[offset + 1];
+
+        //
+        //  The log has the leaf first, folded stacks start from the root
+        //
+
+        folded.BeginStack();
+
+        for (int i = length - 1; i >= 0; i--) {
+
+            UINT64 eip = stacks.Array[offset + 2 + i];
+
+            if (!doExactIps) {
+                eip = RoundIp(eip);
+            }
+
+            Symbols.GetName(eip, name, sizeof(name), doExactIps);
+            folded.AddFrame(name);
+        }
+
+        folded.EndStack(samples);
+    }
+
+    FILE * file = fopen(foldedFile, "wt");
+
+    if (file == NULL) {
+        ExtOut("Cannot open %s\n", foldedFile);
+        return;
+    }
+
+    int lines = folded.Write(file);
+    fclose(file);
+
+    ExtOut("Wrote %d folded stacks to %s\n", lines, foldedFile);
+}
+
 
 EXT_DECL(sample) // Defines: PDEBUG_CLIENT Client, PCSTR args
 {
@@ -797,6 +1168,18 @@ EXT_DECL(sample) // Defines: PDEBUG_CLIENT Client, PCSTR args
                 args++;
             }
             break;
+          case 'o': {
+                SKIP_WHITESPACES(args);
+                int length = 0;
+                while (*args != ' ' && *args != '\t' && *args != '\0') {
+                    if (length < (int)sizeof(dump->foldedFile) - 1) {
+                        dump->foldedFile[length++] = *args;
+                    }
+                    args++;
+                }
+                dump->foldedFile[length] = 0;
+              }
+            break;
           case 't':
             dump->doTraces = true;
             break;
@@ -812,7 +1195,8 @@ EXT_DECL(sample) // Defines: PDEBUG_CLIENT Client, PCSTR args
     if (dump->doCallerCallee == false &&
         dump->doCalleeCaller == false &&
         dump->doTraces       == false &&
-        dump->doFrequencies  == false) {
+        dump->doFrequencies  == false &&
+        dump->foldedFile[0]  == 0) {
         Usage();
         EXT_CHECK(~S_OK);
     }
@@ -836,11 +1220,14 @@ EXT_DECL(sample) // Defines: PDEBUG_CLIENT Client, PCSTR args
         ExtOut("Exact IPs\n");
     }
 
+    SampleSymbols = &dump->Symbols;
+
     WalkTracingDatabase(collector, FALSE);
     dump->AnalyzeTraces();
 
 
   Exit:
+    SampleSymbols = NULL;
     if (collector) delete collector;
     if (dump) delete dump;
     ExtRelease();
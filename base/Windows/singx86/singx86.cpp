@@ -301,6 +301,15 @@ DebugExtensionNotify(ULONG Notify, ULONG64 Argument)
         }
     }
 
+    //
+    // Cached eventing metadata is only good while the target stays stopped.
+    //
+
+    if ((Notify == DEBUG_NOTIFY_SESSION_INACCESSIBLE) ||
+        (Notify == DEBUG_NOTIFY_SESSION_INACTIVE)) {
+        FlushControllers();
+    }
+
     if (Notify == DEBUG_NOTIFY_SESSION_INACTIVE) {
         Connected = FALSE;
         TargetMachine = 0;
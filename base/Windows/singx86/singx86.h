@@ -458,6 +458,7 @@ struct StructType
 
     HRESULT Clear();
     HRESULT Read(ULONG64 address, PVOID local);
+    HRESULT ReadLocal(PVOID buffer, PVOID local);
     HRESULT RawAccess(ULONG remoteOffset, PVOID *raw);
     HRESULT Update(PVOID local);
     HRESULT Flush(ULONG64 address);
@@ -713,4 +714,9 @@ extern char *KernelTable[];
 HRESULT TraceRead(UINT64 address, void * buffer, ULONG size);
 HRESULT TraceReadPointer(int count, UINT64 address, PULONG64 buffer);
 
+#include "memsource.h"
+
+// Drops the eventing metadata cached by !diagnose and friends.
+void FlushControllers();
+
 
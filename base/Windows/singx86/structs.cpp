@@ -537,6 +537,21 @@ HRESULT StructType::Read(ULONG64 address, PVOID local)
     ZeroMemory(local, localSize);
 
     EXT_CHECK(TraceRead(address, temp, size));
+    EXT_CHECK(ReadLocal(temp, local));
+
+  Exit:
+    return status;
+}
+
+// Like Read, but from a copy of the remote structure already in buffer.
+HRESULT StructType::ReadLocal(PVOID buffer, PVOID local)
+{
+    HRESULT status = S_OK;
+
+    if (buffer != temp) {
+        CopyMemory(temp, buffer, size);
+    }
+    ZeroMemory(local, localSize);
 
     for (ULONG f = 0; f < fieldCount; f++) {
         FieldType *field = &fields[f];
@@ -566,7 +581,6 @@ HRESULT StructType::Read(ULONG64 address, PVOID local)
         }
     }
 
-  Exit:
     return status;
 }
 
@@ -29,11 +29,13 @@
 //
 
 #define ACPI_VERBOSE                    0
+#define AP_VERBOSE                      0
 #define APM_VERBOSE                     0
 #define CDROM_VERBOSE                   0
 #define COM_VERBOSE                     0
 #define DISTRO_VERBOSE                  1
 #define FAT_VERBOSE                     0
+#define FSCACHE_VERBOSE                 0
 #define KD_VERBOSE                      0
 #define MM_VERBOSE                      0
 #define MPS_VERBOSE                     0
@@ -463,6 +465,86 @@ BlGetCpuidEdx(
     UINT32 reg
     );
 
+//
+// Time stamp counter support.
+//
+
+extern UINT64 BlRtlTscFrequency;
+
+VOID
+BlRtlCalibrateTsc(
+    VOID
+    );
+
+UINT64
+BlRtlTscToMicroseconds(
+    UINT64 Ticks
+    );
+
+VOID
+BlRtlStallExecution(
+    UINT32 Microseconds
+    );
+
+//
+// Boot phase profiler.
+//
+
+#define BL_PROF_MAX_PHASES              64
+#define BL_PROF_NAME_LENGTH             24
+#define BL_PROF_NO_PHASE                0xFFFFFFFF
+
+typedef struct _BL_PROF_PHASE {
+    UINT64 StartTicks;
+    UINT64 EndTicks;
+    UINT64 IoBytes;
+    UINT32 BiosCalls;
+    UINT32 Parent;
+    CHAR Name[BL_PROF_NAME_LENGTH];
+} BL_PROF_PHASE, *PBL_PROF_PHASE;
+
+C_ASSERT(sizeof(BL_PROF_PHASE) == 56);
+
+extern UINT32 BlProfBiosCalls;
+
+UINT32
+BlProfBeginPhase(
+    PCSTR Name
+    );
+
+VOID
+BlProfEndPhase(
+    UINT32 Handle
+    );
+
+VOID
+BlProfAddIoBytes(
+    UINT32 NumberOfBytes
+    );
+
+UINT32
+BlProfCopyPhases(
+    PBL_PROF_PHASE Buffer
+    );
+
+VOID
+BlProfDump(
+    VOID
+    );
+
+//
+// MD5 support.
+//
+
+#define BL_MD5_DIGEST_SIZE              16
+
+VOID
+BlRtlComputeMd5(
+    PCVOID Buffer,
+    UINT32 Length,
+    PUINT8 Digest
+    );
+
 //
 // Constants and macros for accessing the keyboard controller.
 //
@@ -650,6 +732,8 @@ BlVideoInitialize(
 
 extern const UINT16 BlComBasePort[COM_MAX_PORT + 1];
 
+extern UINT32 BlComBaudRate[COM_MAX_PORT + 1];
+
 BOOLEAN
 BlComInitialize(
     UINT8 PortNumber,
@@ -715,6 +799,7 @@ typedef struct _KD_DEBUG_IO {
 } KD_DEBUG_IO, *PKD_DEBUG_IO;
 
 extern UINT8 BlSingularityOhci1394Buffer[3 * PAGE_SIZE];
+extern UINT8 BlSingularityKdNetBuffer[9 * PAGE_SIZE];
 
 extern UINT8 BlKdComPort;
 
@@ -895,6 +980,7 @@ typedef struct _PCI_INSTALLATION_CHECK {
 
 extern PCI_INSTALLATION_CHECK BlPciInstallationCheck;
 extern UINT32 BlPciOhci1394BaseAddress;
+extern UINT32 BlPciKdNicBaseAddress;
 
 VOID
 BlPciInitialize(
@@ -905,8 +991,53 @@ BlPciInitialize(
 // ACPI support.
 //
 
+#define BL_NUMA_MAX_PROCESSORS              256
+#define BL_NUMA_MAX_MEMORY_RANGES           64
+#define BL_NUMA_MAX_DOMAINS                 64
+#define BL_NUMA_NO_DOMAIN                   0xFFFFFFFF
+
+typedef struct _BL_NUMA_PROCESSOR {
+    UINT32 ApicId;
+    UINT32 Domain;
+} BL_NUMA_PROCESSOR, *PBL_NUMA_PROCESSOR;
+
+typedef struct _BL_NUMA_MEMORY {
+    UINT64 Base;
+    UINT64 Size;
+    UINT32 Domain;
+    UINT32 Flags;
+} BL_NUMA_MEMORY, *PBL_NUMA_MEMORY;
+
+typedef struct _BL_NUMA_TOPOLOGY {
+    UINT32 ProcessorCount;
+    UINT32 MemoryCount;
+    UINT32 DomainCount;
+    BOOLEAN HasDistances;
+    BL_NUMA_PROCESSOR Processor[BL_NUMA_MAX_PROCESSORS];
+    BL_NUMA_MEMORY Memory[BL_NUMA_MAX_MEMORY_RANGES];
+    UINT8 Distance[BL_NUMA_MAX_DOMAINS * BL_NUMA_MAX_DOMAINS];
+} BL_NUMA_TOPOLOGY, *PBL_NUMA_TOPOLOGY;
+
 extern UINT32 BlAcpiNumberOfProcessors;
 extern PVOID BlAcpiRsdpAddress;
+extern ULONG_PTR BlAcpiLocalApicAddress;
+extern BL_NUMA_TOPOLOGY BlAcpiNumaTopology;
+
+BOOLEAN
+BlAcpiGetProcessorApicId(
+    UINT32 Index,
+    PUINT8 ApicId
+    );
+
+UINT32
+BlAcpiGetProcessorProximityDomain(
+    UINT8 ApicId
+    );
+
+UINT32
+BlAcpiGetMemoryProximityDomain(
+    UINT64 Address
+    );
 
 VOID
 BlAcpiInitialize(
@@ -1123,6 +1254,7 @@ typedef struct _BL_MM_PHYSICAL_REGION {
     UINT64 Size;
     UINT64 Limit;
     UINT32 Type;
+    UINT32 ProximityDomain;
 } BL_MM_PHYSICAL_REGION, *PBL_MM_PHYSICAL_REGION;
 
 extern ULONG_PTR BlMmBootCr3;
@@ -1148,6 +1280,18 @@ BlMmAllocatePhysicalRegion(
     UINT32 Type
     );
 
+UINT64
+BlMmAllocatePhysicalRegionInDomain(
+    UINT32 Size,
+    UINT32 Type,
+    UINT32 Domain
+    );
+
+VOID
+BlMmSetProximityDomains(
+    VOID
+    );
+
 BOOLEAN
 BlMmAllocateSpecificPhysicalRegion(
     UINT64 Base,
@@ -1214,6 +1358,49 @@ BOOLEAN
     UINT32 NumberOfBytes
     );
 
+//
+// File system directory cache.
+//
+// Each file system registers its root directory, and entries are added by
+// scanning a whole directory the first time any name in it is looked up.
+// After that, size queries and reads resolve a path with one hashed lookup.
+//
+
+#define BL_FS_CACHE_RECORD_SIZE         40
+
+typedef struct _BL_FS_CACHE_ENTRY {
+    struct _BL_FS_CACHE_ENTRY *Next;
+    UINT32 Hash;
+    UINT32 PathLength;
+    BOOLEAN Directory;
+    BOOLEAN Scanned;
+    UINT8 Record[BL_FS_CACHE_RECORD_SIZE];
+    CHAR Path[1];
+} BL_FS_CACHE_ENTRY, *PBL_FS_CACHE_ENTRY;
+
+typedef
+BOOLEAN
+(*PBL_FS_CACHE_SCAN_ROUTINE)(
+    PBL_FS_CACHE_ENTRY Directory
+    );
+
+PBL_FS_CACHE_ENTRY
+BlFsCacheInsert(
+    PBL_FS_CACHE_ENTRY Directory,
+    PCSTR Name,
+    UINT32 NameLength,
+    PCVOID Record,
+    UINT32 RecordSize,
+    BOOLEAN IsDirectory
+    );
+
+PBL_FS_CACHE_ENTRY
+BlFsCacheFindPath(
+    PBL_FS_CACHE_ENTRY Root,
+    PCSTR Path,
+    PBL_FS_CACHE_SCAN_ROUTINE ScanDirectory
+    );
+
 //
 // CDROM support.
 //
@@ -1432,6 +1619,63 @@ BlTrapSetIdtr(
     PIDTR Idtr
     );
 
+extern IDTR BlIdtr;
+
+//
+// Application processor work queue.
+//
+
+typedef struct _BL_AP_WORK_ITEM *PBL_AP_WORK_ITEM;
+
+typedef
+VOID
+(*PBL_AP_WORK_ROUTINE)(
+    PBL_AP_WORK_ITEM WorkItem
+    );
+
+typedef struct _BL_AP_WORK_ITEM {
+    PBL_AP_WORK_ROUTINE Routine;
+    PVOID Context;
+    PVOID Buffer;
+    ULONG_PTR Length;
+    ULONG_PTR Parameter;
+    volatile UINT32 Status;
+} BL_AP_WORK_ITEM, *PBL_AP_WORK_ITEM;
+
+#define BL_AP_WORK_PENDING              0
+#define BL_AP_WORK_SUCCESS              1
+#define BL_AP_WORK_FAILURE              2
+
+extern volatile INT32 BlApOnlineCount;
+
+VOID
+BlApInitialize(
+    UINT32 NumberOfProcessors,
+    PFAR_POINTER ApEntry16,
+    PFAR_POINTER ApStartupLock
+    );
+
+VOID
+BlApQueueWorkItem(
+    PBL_AP_WORK_ITEM WorkItem
+    );
+
+VOID
+BlApWaitForWorkItems(
+    VOID
+    );
+
+VOID
+BlApZeroMemory(
+    PVOID Buffer,
+    ULONG_PTR Length
+    );
+
+VOID
+BlApShutdown(
+    VOID
+    );
+
 
 //
 // Singularity bridge.
@@ -1455,3 +1699,23 @@ extern "C" void * _ReturnAddress(void);
 
 #pragma intrinsic(_ReturnAddress)
 
+//
+// Compiler intrinsics used for synchronization with application processors.
+//
+
+extern "C" long _InterlockedIncrement(long volatile *Addend);
+extern "C" long _InterlockedCompareExchange(long volatile *Destination, long Exchange, long Comparand);
+extern "C" void _ReadWriteBarrier(void);
+extern "C" void _mm_pause(void);
+extern "C" void _disable(void);
+extern "C" void __halt(void);
+extern "C" unsigned __int64 __rdtsc(void);
+
+#pragma intrinsic(_InterlockedIncrement)
+#pragma intrinsic(_InterlockedCompareExchange)
+#pragma intrinsic(_ReadWriteBarrier)
+#pragma intrinsic(_mm_pause)
+#pragma intrinsic(_disable)
+#pragma intrinsic(__halt)
+#pragma intrinsic(__rdtsc)
+
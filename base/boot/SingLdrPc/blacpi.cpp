@@ -176,6 +176,31 @@ typedef struct _ACPI_SRAT_MEM_AFFINITY_ENTRY {
     UINT8 Reserved3[8];
 } ACPI_SRAT_MEM_AFFINITY_ENTRY, *PACPI_SRAT_MEM_AFFINITY_ENTRY;
 
+C_ASSERT(sizeof(ACPI_SRAT_PROC_AFFINITY_ENTRY) == 16);
+C_ASSERT(sizeof(ACPI_SRAT_MEM_AFFINITY_ENTRY) == 40);
+
+#define ACPI_SRAT_FLAGS_ENABLED         0x1
+
+//
+// System Locality Distance Information Table (SLIT)
+//
+
+typedef struct _ACPI_SLIT {
+    UINT8 Signature[4];
+    UINT32 Length;
+    UINT8 Revision;
+    UINT8 Checksum;
+    UINT8 OemId[6];
+    UINT8 OemTableId[8];
+    UINT32 OemRevision;
+    UINT32 CreatorId;
+    UINT32 CreatorRevision;
+    UINT64 NumberOfLocalities;
+    UINT8 Entry[];
+} ACPI_SLIT, *PACPI_SLIT;
+
+C_ASSERT(sizeof(ACPI_SLIT) == 44);
+
 //
 // Fixed ACPI Description Table (FADT)
 //
@@ -213,6 +238,10 @@ PACPI_RSDP BlAcpiRsdp;
 PVOID BlAcpiRsdpAddress;
 PACPI_RSDT BlAcpiRsdt;
 PACPI_SRAT BlAcpiSrat;
+PACPI_SLIT BlAcpiSlit;
+ULONG_PTR BlAcpiLocalApicAddress;
+
+BL_NUMA_TOPOLOGY BlAcpiNumaTopology;
 
 PACPI_RSDP
 BlAcpiLocateRsdp(
@@ -430,31 +459,87 @@ BlAcpiLocateSrat(
     return NULL;
 }
 
+PACPI_SLIT
+BlAcpiLocateSlit(
+    PACPI_RSDT Rsdt
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function locates the ACPI SLIT structure.
+//
+//  Arguments:
+//
+//    Rsdt    - Supplies a pointer to the ACPI RSDT structure.
+//
+//  Return Value:
+//
+//    ACPI SLIT structure, if located.
+//    NULL, otherwise.
+//
+//--
+
+{
+    UINT32 Index;
+    PACPI_SLIT Slit;
+    UINT32 NumberOfTables;
+
+    NumberOfTables = (Rsdt->Length - FIELD_OFFSET(ACPI_RSDT, Entry)) / sizeof(Rsdt->Entry[0]);
+
+    for (Index = 0; Index < NumberOfTables; Index += 1) {
+
+        Slit = (PACPI_SLIT) (ULONG_PTR) Rsdt->Entry[Index];
+
+        if ((Slit->Signature[0] == 'S') &&
+            (Slit->Signature[1] == 'L') &&
+            (Slit->Signature[2] == 'I') &&
+            (Slit->Signature[3] == 'T') &&
+            (Slit->Length >= sizeof(ACPI_SLIT)) &&
+            (BlRtlComputeChecksum8(Slit, Slit->Length) == 0)) {
+
+#if ACPI_VERBOSE
+
+            BlRtlPrintf("ACPI: Found SLIT Table\n");
+
+#endif
+
+            return Slit;
+        }
+    }
+
+    return NULL;
+}
+
 VOID
-BlAcpiDumpSratEntries(
+BlAcpiParseSrat(
     VOID
     )
+
 //++
 //
 //  Routine Description:
 //
-//    This function prints out the SRAT table.
+//    This function collects the enabled processor and memory affinity entries
+//    of the SRAT into the NUMA topology.
+//
 //--
+
 {
+    UINT32 Domain;
     PACPI_SRAT_ENTRY Entry;
     PCHAR Limit;
-    PACPI_SRAT_PROC_AFFINITY_ENTRY ProcAffinityEntry;
     PACPI_SRAT_MEM_AFFINITY_ENTRY MemAffinityEntry;
     PCHAR Next;
-    UINT32 hbits;
-    UINT32 totalbits;
+    PACPI_SRAT_PROC_AFFINITY_ENTRY ProcAffinityEntry;
+    PBL_NUMA_MEMORY Memory;
+    PBL_NUMA_PROCESSOR Processor;
 
-    if (BlAcpiSrat == NULL) {
-        BlRtlPrintf("ACPI: No Srat??\n");
-        return;
-    }
 #if ACPI_VERBOSE
+
     BlRtlPrintf("SRAT:\n");
+
 #endif
 
     Next = (PCHAR) &BlAcpiSrat->SratStructures[0];
@@ -464,45 +549,210 @@ BlAcpiDumpSratEntries(
 
         Entry = (PACPI_SRAT_ENTRY) Next;
 
+        if (Entry->Length == 0) {
+
+            break;
+        }
+
         if ((Entry->Type == ACPI_SRAT_TYPE_PROC_AFFINITY_ENTRY) &&
             (Entry->Length >= sizeof(ACPI_SRAT_PROC_AFFINITY_ENTRY))) {
 
             ProcAffinityEntry = (PACPI_SRAT_PROC_AFFINITY_ENTRY) Next;
+
+            Domain = ((UINT32) ProcAffinityEntry->ProximityDomainLowEightBits) |
+                     ((UINT32) ProcAffinityEntry->ProximityDomainHighTwentyFourBits[0] << 8) |
+                     ((UINT32) ProcAffinityEntry->ProximityDomainHighTwentyFourBits[1] << 16) |
+                     ((UINT32) ProcAffinityEntry->ProximityDomainHighTwentyFourBits[2] << 24);
+
 #if ACPI_VERBOSE
-            BlRtlPrintf(" Processor:\n");
-#endif
-            hbits = 0;
-            hbits += ProcAffinityEntry->ProximityDomainHighTwentyFourBits[0] << 24;
-            hbits += ProcAffinityEntry->ProximityDomainHighTwentyFourBits[1] << 16;
-            hbits += ProcAffinityEntry->ProximityDomainHighTwentyFourBits[2] << 8;
-            totalbits = hbits | ProcAffinityEntry->ProximityDomainLowEightBits;
-#if ACPI_VERBOSE
-            BlRtlPrintf("  HighDomain 0x%06x LowDomain 0x%02x totalbits 0x%08x\n",
-                        hbits, ProcAffinityEntry->ProximityDomainLowEightBits,
-                        totalbits);
-            BlRtlPrintf("  ApicID: %d flags 0x%08x\n", ProcAffinityEntry->ApicID,
+
+            BlRtlPrintf(" Processor: ApicID %d Domain %d Flags 0x%08x\n",
+                        ProcAffinityEntry->ApicID,
+                        Domain,
                         ProcAffinityEntry->Flags);
+
 #endif
-        }
-        else if ((Entry->Type == ACPI_SRAT_TYPE_MEM_AFFINITY_ENTRY) &&
+
+            if (((ProcAffinityEntry->Flags & ACPI_SRAT_FLAGS_ENABLED) != 0) &&
+                (Domain < BL_NUMA_MAX_DOMAINS) &&
+                (BlAcpiNumaTopology.ProcessorCount < BL_NUMA_MAX_PROCESSORS)) {
+
+                Processor = &BlAcpiNumaTopology.Processor[BlAcpiNumaTopology.ProcessorCount];
+                Processor->ApicId = ProcAffinityEntry->ApicID;
+                Processor->Domain = Domain;
+
+                BlAcpiNumaTopology.ProcessorCount += 1;
+
+                if (Domain >= BlAcpiNumaTopology.DomainCount) {
+
+                    BlAcpiNumaTopology.DomainCount = Domain + 1;
+                }
+            }
+
+        } else if ((Entry->Type == ACPI_SRAT_TYPE_MEM_AFFINITY_ENTRY) &&
                    (Entry->Length >= sizeof(ACPI_SRAT_MEM_AFFINITY_ENTRY))) {
 
             MemAffinityEntry = (PACPI_SRAT_MEM_AFFINITY_ENTRY) Next;
+            Domain = MemAffinityEntry->ProximityDomain;
+
 #if ACPI_VERBOSE
-            BlRtlPrintf(" Memory:\n");
-            BlRtlPrintf("  BaseAddress 0x%08x.%08x ..  0x%08x.%08x",
+
+            BlRtlPrintf(" Memory: 0x%08x.%08x .. 0x%08x.%08x Domain %d Flags 0x%08x\n",
                         MemAffinityEntry->BaseAddressHigh, MemAffinityEntry->BaseAddressLow,
-                        MemAffinityEntry->LengthHigh, MemAffinityEntry->LengthLow);
-            BlRtlPrintf("  Domain %d  Flags 0x%08x\n",
-                        MemAffinityEntry->ProximityDomain,
+                        MemAffinityEntry->LengthHigh, MemAffinityEntry->LengthLow,
+                        Domain,
                         MemAffinityEntry->Flags);
+
 #endif
+
+            if (((MemAffinityEntry->Flags & ACPI_SRAT_FLAGS_ENABLED) != 0) &&
+                (Domain < BL_NUMA_MAX_DOMAINS) &&
+                (BlAcpiNumaTopology.MemoryCount < BL_NUMA_MAX_MEMORY_RANGES)) {
+
+                Memory = &BlAcpiNumaTopology.Memory[BlAcpiNumaTopology.MemoryCount];
+                Memory->Base = ((UINT64) MemAffinityEntry->BaseAddressHigh << 32) | MemAffinityEntry->BaseAddressLow;
+                Memory->Size = ((UINT64) MemAffinityEntry->LengthHigh << 32) | MemAffinityEntry->LengthLow;
+                Memory->Domain = Domain;
+                Memory->Flags = MemAffinityEntry->Flags;
+
+                BlAcpiNumaTopology.MemoryCount += 1;
+
+                if (Domain >= BlAcpiNumaTopology.DomainCount) {
+
+                    BlAcpiNumaTopology.DomainCount = Domain + 1;
+                }
+            }
         }
 
         Next += Entry->Length;
     }
 }
 
+VOID
+BlAcpiParseSlit(
+    VOID
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function copies the SLIT distance matrix into the NUMA topology.
+//    Without a usable SLIT, local accesses are given distance 10 and remote
+//    accesses distance 20, as the ACPI specification suggests.
+//
+//--
+
+{
+    UINT32 Count;
+    UINT32 From;
+    UINT32 To;
+
+    Count = BlAcpiNumaTopology.DomainCount;
+
+    if ((BlAcpiSlit != NULL) &&
+        (BlAcpiSlit->NumberOfLocalities >= Count) &&
+        (BlAcpiSlit->NumberOfLocalities <= BL_NUMA_MAX_DOMAINS) &&
+        (FIELD_OFFSET(ACPI_SLIT, Entry) + BlAcpiSlit->NumberOfLocalities * BlAcpiSlit->NumberOfLocalities <= BlAcpiSlit->Length)) {
+
+        for (From = 0; From < Count; From += 1) {
+
+            for (To = 0; To < Count; To += 1) {
+
+                BlAcpiNumaTopology.Distance[From * BL_NUMA_MAX_DOMAINS + To] =
+                    BlAcpiSlit->Entry[From * (UINT32) BlAcpiSlit->NumberOfLocalities + To];
+            }
+        }
+
+        BlAcpiNumaTopology.HasDistances = TRUE;
+
+        return;
+    }
+
+    for (From = 0; From < Count; From += 1) {
+
+        for (To = 0; To < Count; To += 1) {
+
+            BlAcpiNumaTopology.Distance[From * BL_NUMA_MAX_DOMAINS + To] = (UINT8) ((From == To) ? 10 : 20);
+        }
+    }
+}
+
+UINT32
+BlAcpiGetProcessorProximityDomain(
+    UINT8 ApicId
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function returns the proximity domain of the specified processor.
+//
+//  Arguments:
+//
+//    ApicId  - Supplies the local APIC ID of the processor.
+//
+//  Return Value:
+//
+//    Proximity domain of the processor, if the SRAT describes it.
+//    BL_NUMA_NO_DOMAIN, otherwise.
+//
+//--
+
+{
+    UINT32 Index;
+
+    for (Index = 0; Index < BlAcpiNumaTopology.ProcessorCount; Index += 1) {
+
+        if (BlAcpiNumaTopology.Processor[Index].ApicId == ApicId) {
+
+            return BlAcpiNumaTopology.Processor[Index].Domain;
+        }
+    }
+
+    return BL_NUMA_NO_DOMAIN;
+}
+
+UINT32
+BlAcpiGetMemoryProximityDomain(
+    UINT64 Address
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function returns the proximity domain of the specified physical address.
+//
+//  Arguments:
+//
+//    Address - Supplies the physical address.
+//
+//  Return Value:
+//
+//    Proximity domain of the address, if the SRAT describes it.
+//    BL_NUMA_NO_DOMAIN, otherwise.
+//
+//--
+
+{
+    UINT32 Index;
+    PBL_NUMA_MEMORY Memory;
+
+    for (Index = 0; Index < BlAcpiNumaTopology.MemoryCount; Index += 1) {
+
+        Memory = &BlAcpiNumaTopology.Memory[Index];
+
+        if ((Address >= Memory->Base) && ((Address - Memory->Base) < Memory->Size)) {
+
+            return Memory->Domain;
+        }
+    }
+
+    return BL_NUMA_NO_DOMAIN;
+}
+
 UINT32
 BlAcpiGetNumberOfProcessors(
     VOID
@@ -564,6 +814,73 @@ BlAcpiGetNumberOfProcessors(
     return NumberOfProcessors;
 }
 
+BOOLEAN
+BlAcpiGetProcessorApicId(
+    UINT32 Index,
+    PUINT8 ApicId
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function returns the local APIC ID of the specified enabled processor.
+//
+//  Arguments:
+//
+//    Index   - Supplies the index of the processor, in MADT order.
+//
+//    ApicId  - Receives the local APIC ID of the processor.
+//
+//  Return Value:
+//
+//    TRUE, if the processor was found.
+//    FALSE, otherwise.
+//
+//--
+
+{
+    PACPI_MADT_ENTRY Entry;
+    PCHAR Limit;
+    PACPI_PROCESSOR_LOCAL_APIC LocalApic;
+    PCHAR Next;
+
+    if (BlAcpiMadt == NULL) {
+
+        return FALSE;
+    }
+
+    Next = (PCHAR) &BlAcpiMadt->ApicStructures[0];
+    Limit = ((PCHAR) BlAcpiMadt) + BlAcpiMadt->Length;
+
+    while (Next < Limit) {
+
+        Entry = (PACPI_MADT_ENTRY) Next;
+
+        if ((Entry->Type == ACPI_APIC_TYPE_PROCESSOR_LOCAL) &&
+            (Entry->Length >= sizeof(ACPI_PROCESSOR_LOCAL_APIC))) {
+
+            LocalApic = (PACPI_PROCESSOR_LOCAL_APIC) Next;
+
+            if (LocalApic->u1.s1.Enabled != FALSE) {
+
+                if (Index == 0) {
+
+                    *ApicId = LocalApic->ApicId;
+
+                    return TRUE;
+                }
+
+                Index -= 1;
+            }
+        }
+
+        Next += Entry->Length;
+    }
+
+    return FALSE;
+}
+
 PACPI_FADT
 BlAcpiLocateFadt(
     PACPI_RSDT Rsdt
@@ -713,8 +1030,14 @@ BlAcpiInitialize(
     }
 
     BlAcpiSrat = BlAcpiLocateSrat(BlAcpiRsdt);
+
     if (BlAcpiSrat != NULL) {
-        BlAcpiDumpSratEntries();
+
+        BlAcpiParseSrat();
+
+        BlAcpiSlit = BlAcpiLocateSlit(BlAcpiRsdt);
+
+        BlAcpiParseSlit();
     }
 
 
@@ -753,5 +1076,7 @@ BlAcpiInitialize(
                             TRUE,
                             FALSE,
                             FALSE);
+
+        BlAcpiLocalApicAddress = (ULONG_PTR) BlAcpiMadt->LocalApicAddress;
     }
 }
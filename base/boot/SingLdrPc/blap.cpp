@@ -0,0 +1,638 @@
+//++
+//
+//  Copyright (c) Microsoft Corporation
+//
+//  Module Name:
+//
+//    blap.cpp
+//
+//  Abstract:
+//
+//    This module starts the application processors early and lets the boot
+//    loader hand them independent work (distro checksums, relocations, and
+//    zeroing) while the bootstrap processor is loading. Before the kernel is
+//    entered, the application processors are parked with interrupts disabled
+//    so the kernel can restart them with INIT / SIPI as usual.
+//
+//  Environment:
+//
+//    Boot loader.
+//
+//--
+
+#include "bl.h"
+
+#define BL_AP_WORKERS_ENABLED           1
+
+#define BL_AP_STACK_SIZE                0x4000
+#define BL_AP_MAX_WORK_ITEMS            1024
+#define BL_AP_MAX_ZERO_ITEMS            16
+#define BL_AP_MIN_ZERO_CHUNK            0x40000
+#define BL_AP_CHECK_IN_TIMEOUT          1000000
+
+//
+// Local APIC interrupt command register.
+//
+
+#define APIC_ICR_LOW                    0x300
+#define APIC_ICR_HIGH                   0x310
+
+#define APIC_ICR_DELIVERY_INIT          0x00000500
+#define APIC_ICR_DELIVERY_STARTUP       0x00000600
+#define APIC_ICR_DELIVERY_PENDING       0x00001000
+#define APIC_ICR_LEVEL_ASSERT           0x00004000
+
+#define APIC_INIT_DELAY                 10000
+#define APIC_STARTUP_DELAY              200
+
+volatile INT32 BlApOnlineCount;
+volatile INT32 BlApParkedCount;
+volatile BOOLEAN BlApShutdownRequested;
+
+UINT32 BlApMaxProcessors;
+UINT32 BlApProcessorCount;
+PVOID *BlApStackLimit;
+UINT32 BlApEnteringIndex;
+volatile UINT32 *BlApStartupLock;
+UINT32 BlApSavedEntry;
+
+PBL_AP_WORK_ITEM volatile BlApWorkQueue[BL_AP_MAX_WORK_ITEMS];
+volatile INT32 BlApWorkHead;
+volatile INT32 BlApWorkTail;
+volatile INT32 BlApWorkCompleted;
+
+BL_AP_WORK_ITEM BlApZeroWorkItem[BL_AP_MAX_ZERO_ITEMS];
+
+BOOLEAN
+BlApWorkersAvailable(
+    VOID
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function checks whether application processors are accepting work.
+//
+//  Return Value:
+//
+//    TRUE, if at least one application processor is running the work loop.
+//    FALSE, otherwise.
+//
+//--
+
+{
+    return (BlApShutdownRequested == FALSE) && (BlApOnlineCount > 0);
+}
+
+VOID
+BlApExecuteWorkItem(
+    PBL_AP_WORK_ITEM WorkItem
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function runs the specified work item and marks it complete.
+//
+//  Arguments:
+//
+//    WorkItem    - Supplies the work item to run.
+//
+//--
+
+{
+    WorkItem->Status = BL_AP_WORK_SUCCESS;
+
+    WorkItem->Routine(WorkItem);
+
+    _ReadWriteBarrier();
+
+    _InterlockedIncrement((long volatile *) &BlApWorkCompleted);
+}
+
+PBL_AP_WORK_ITEM
+BlApClaimWorkItem(
+    VOID
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function claims the next queued work item.
+//
+//  Return Value:
+//
+//    The claimed work item, if one was queued.
+//    NULL, otherwise.
+//
+//--
+
+{
+    INT32 Head;
+
+    for (;;) {
+
+        Head = BlApWorkHead;
+
+        if (Head >= BlApWorkTail) {
+
+            return NULL;
+        }
+
+        if (_InterlockedCompareExchange((long volatile *) &BlApWorkHead, Head + 1, Head) == Head) {
+
+            return BlApWorkQueue[Head];
+        }
+    }
+}
+
+VOID
+BlApZeroRoutine(
+    PBL_AP_WORK_ITEM WorkItem
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function zeroes the buffer described by the work item.
+//
+//  Arguments:
+//
+//    WorkItem    - Supplies the work item.
+//
+//--
+
+{
+    BlRtlZeroMemory(WorkItem->Buffer, WorkItem->Length);
+}
+
+VOID
+BlApQueueWorkItem(
+    PBL_AP_WORK_ITEM WorkItem
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function queues a work item for the application processors. If no
+//    application processor is running, or the queue is full, the item is run
+//    on the calling (bootstrap) processor.
+//
+//  Arguments:
+//
+//    WorkItem    - Supplies the work item to queue.
+//
+//--
+
+{
+    INT32 Tail;
+
+    WorkItem->Status = BL_AP_WORK_PENDING;
+
+    Tail = BlApWorkTail;
+
+    if ((BlApWorkersAvailable() == FALSE) || (Tail == BL_AP_MAX_WORK_ITEMS)) {
+
+        WorkItem->Status = BL_AP_WORK_SUCCESS;
+
+        WorkItem->Routine(WorkItem);
+
+        return;
+    }
+
+    BlApWorkQueue[Tail] = WorkItem;
+
+    //
+    // Publish the item before advancing the tail.
+    //
+
+    _ReadWriteBarrier();
+
+    BlApWorkTail = Tail + 1;
+}
+
+VOID
+BlApWaitForWorkItems(
+    VOID
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function waits for all queued work items to complete. The bootstrap
+//    processor helps drain the queue while waiting.
+//
+//--
+
+{
+    PBL_AP_WORK_ITEM WorkItem;
+
+    for (;;) {
+
+        WorkItem = BlApClaimWorkItem();
+
+        if (WorkItem == NULL) {
+
+            break;
+        }
+
+        BlApExecuteWorkItem(WorkItem);
+    }
+
+    while (BlApWorkCompleted != BlApWorkTail) {
+
+        _mm_pause();
+    }
+
+    //
+    // The queue is idle; rewind it so that subsequent batches start at the front.
+    // The tail is cleared first so that a concurrent claim never sees a stale slot.
+    //
+
+    BlApWorkTail = 0;
+
+    _ReadWriteBarrier();
+
+    BlApWorkHead = 0;
+    BlApWorkCompleted = 0;
+}
+
+VOID
+BlApZeroMemory(
+    PVOID Buffer,
+    ULONG_PTR Length
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function zeroes the specified buffer, splitting it across the
+//    application processors if any are running.
+//
+//  Arguments:
+//
+//    Buffer  - Supplies a pointer to the buffer to zero.
+//
+//    Length  - Supplies the length of the buffer.
+//
+//--
+
+{
+    ULONG_PTR ChunkSize;
+    UINT32 Index;
+    ULONG_PTR Next;
+    UINT32 NumberOfChunks;
+
+    if ((BlApWorkersAvailable() == FALSE) || (Length < (2 * BL_AP_MIN_ZERO_CHUNK))) {
+
+        BlRtlZeroMemory(Buffer, Length);
+
+        return;
+    }
+
+    //
+    // One chunk per processor (including the bootstrap processor), page aligned.
+    //
+
+    NumberOfChunks = BlApOnlineCount + 1;
+
+    if (NumberOfChunks > BL_AP_MAX_ZERO_ITEMS) {
+
+        NumberOfChunks = BL_AP_MAX_ZERO_ITEMS;
+    }
+
+    ChunkSize = ROUND_UP_TO_PAGES(Length / NumberOfChunks);
+
+    if (ChunkSize < BL_AP_MIN_ZERO_CHUNK) {
+
+        ChunkSize = BL_AP_MIN_ZERO_CHUNK;
+    }
+
+    Next = (ULONG_PTR) Buffer;
+
+    for (Index = 0; (Index < NumberOfChunks) && (Length > 0); Index += 1) {
+
+        BlApZeroWorkItem[Index].Routine = BlApZeroRoutine;
+        BlApZeroWorkItem[Index].Buffer = (PVOID) Next;
+        BlApZeroWorkItem[Index].Length = (Length < ChunkSize) ? Length : ChunkSize;
+
+        Next += BlApZeroWorkItem[Index].Length;
+        Length -= BlApZeroWorkItem[Index].Length;
+
+        BlApQueueWorkItem(&BlApZeroWorkItem[Index]);
+    }
+
+    BLASSERT(Length == 0);
+
+    BlApWaitForWorkItems();
+}
+
+VOID
+BlApWorkerLoop(
+    VOID
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function runs on an application processor's private stack. It
+//    releases the startup lock, executes queued work items until shutdown is
+//    requested, and then parks the processor.
+//
+//--
+
+{
+    PBL_AP_WORK_ITEM WorkItem;
+
+    //
+    // The shared real-mode and entry stacks are no longer in use, so let the next
+    // application processor in.
+    //
+
+    *BlApStartupLock = 0;
+
+    _InterlockedIncrement((long volatile *) &BlApOnlineCount);
+
+    while (BlApShutdownRequested == FALSE) {
+
+        WorkItem = BlApClaimWorkItem();
+
+        if (WorkItem == NULL) {
+
+            _mm_pause();
+
+            continue;
+        }
+
+        BlApExecuteWorkItem(WorkItem);
+    }
+
+    _InterlockedIncrement((long volatile *) &BlApParkedCount);
+
+    //
+    // Park. The kernel restarts this processor with INIT / SIPI.
+    //
+
+    for (;;) {
+
+        _disable();
+
+        __halt();
+    }
+}
+
+VOID
+BlApWorkerEntry(
+    VOID
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function is the boot loader entry point for application processors.
+//    It runs on the shared entry stack while holding the AP startup lock, and
+//    switches to the stack allocated for its local APIC ID.
+//
+//--
+
+{
+    UINT8 ApicId;
+    UINT32 Index;
+    UINT8 SelfApicId;
+
+    BlTrapSetIdtr(&BlIdtr);
+
+    SelfApicId = (UINT8) (BlGetCpuidEbx(1) >> 24);
+
+    for (Index = 0; Index < BlApProcessorCount; Index += 1) {
+
+        if ((BlAcpiGetProcessorApicId(Index, &ApicId) != FALSE) && (ApicId == SelfApicId)) {
+
+            break;
+        }
+    }
+
+    if ((Index >= BlApProcessorCount) ||
+        (BlApStackLimit[Index] == NULL) ||
+        (BlApEnteringIndex >= BlApMaxProcessors) ||
+        (BlApShutdownRequested != FALSE)) {
+
+        *BlApStartupLock = 0;
+
+        for (;;) {
+
+            _disable();
+
+            __halt();
+        }
+    }
+
+    BlApEnteringIndex += 1;
+
+    BlMmSwitchStack((PVOID) ((ULONG_PTR) BlApStackLimit[Index] + BL_AP_STACK_SIZE), BlApWorkerLoop);
+}
+
+VOID
+BlApSendIpi(
+    UINT8 ApicId,
+    UINT32 Command
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function sends an interprocessor interrupt through the local APIC.
+//
+//  Arguments:
+//
+//    ApicId  - Supplies the local APIC ID of the target processor.
+//
+//    Command - Supplies the low ICR value.
+//
+//--
+
+{
+    volatile UINT32 *IcrHigh;
+    volatile UINT32 *IcrLow;
+
+    IcrHigh = (volatile UINT32 *) (BlAcpiLocalApicAddress + APIC_ICR_HIGH);
+    IcrLow = (volatile UINT32 *) (BlAcpiLocalApicAddress + APIC_ICR_LOW);
+
+    *IcrHigh = ((UINT32) ApicId) << 24;
+    *IcrLow = Command;
+
+    while ((*IcrLow & APIC_ICR_DELIVERY_PENDING) != 0) {
+
+        _mm_pause();
+    }
+}
+
+VOID
+BlApInitialize(
+    UINT32 NumberOfProcessors,
+    PFAR_POINTER ApEntry16,
+    PFAR_POINTER ApStartupLock
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function starts the application processors in the boot loader work loop.
+//
+//  Arguments:
+//
+//    NumberOfProcessors  - Supplies the number of processors on the system.
+//
+//    ApEntry16           - Supplies a pointer to the 16-bit entry point for
+//                          application processors.
+//
+//    ApStartupLock       - Supplies a pointer to the lock used for AP startup
+//                          synchronization.
+//
+//--
+
+{
+    UINT8 ApicId;
+    UINT8 BspApicId;
+    UINT32 Index;
+    UINT64 Limit;
+    UINT32 Pass;
+    UINT32 Vector;
+
+    if ((BL_AP_WORKERS_ENABLED == 0) ||
+        (NumberOfProcessors < 2) ||
+        (BlAcpiLocalApicAddress == 0) ||
+        (BlRtlTscFrequency == 0)) {
+
+        return;
+    }
+
+    BspApicId = (UINT8) (BlGetCpuidEbx(1) >> 24);
+
+    //
+    // Allocate one stack per application processor, indexed in MADT order, from
+    // the proximity domain of that processor.
+    //
+
+    BlApMaxProcessors = NumberOfProcessors - 1;
+    BlApProcessorCount = NumberOfProcessors;
+    BlApStackLimit = (PVOID *) BlPoolAllocateBlock(sizeof(PVOID) * BlApProcessorCount);
+
+    for (Index = 0; Index < BlApProcessorCount; Index += 1) {
+
+        if ((BlAcpiGetProcessorApicId(Index, &ApicId) == FALSE) || (ApicId == BspApicId)) {
+
+            continue;
+        }
+
+        BlApStackLimit[Index] = (PVOID) (ULONG_PTR) BlMmAllocatePhysicalRegionInDomain(BL_AP_STACK_SIZE,
+                                                                                       BL_MM_PHYSICAL_REGION_BOOT_STACK,
+                                                                                       BlAcpiGetProcessorProximityDomain(ApicId));
+    }
+
+    BlApStartupLock = (volatile UINT32 *) BlRtlConvertFarPointerToLinearPointer(ApStartupLock);
+
+    //
+    // Redirect the 32-bit AP entry to the work loop until the kernel takes over.
+    //
+
+    BlApSavedEntry = BlGetBeb()->ApEntry;
+    BlGetBeb()->ApEntry = (UINT32) (ULONG_PTR) BlApWorkerEntry;
+
+    Vector = (UINT32) (((ULONG_PTR) BlRtlConvertFarPointerToLinearPointer(ApEntry16)) >> 12);
+
+    //
+    // INIT all application processors, then send them the startup IPI twice (per the MP spec).
+    //
+
+    for (Pass = 0; Pass < 3; Pass += 1) {
+
+        for (Index = 0; Index < NumberOfProcessors; Index += 1) {
+
+            if ((BlAcpiGetProcessorApicId(Index, &ApicId) == FALSE) || (ApicId == BspApicId)) {
+
+                continue;
+            }
+
+            if (Pass == 0) {
+
+                BlApSendIpi(ApicId, APIC_ICR_LEVEL_ASSERT | APIC_ICR_DELIVERY_INIT);
+
+            } else {
+
+                BlApSendIpi(ApicId, APIC_ICR_LEVEL_ASSERT | APIC_ICR_DELIVERY_STARTUP | Vector);
+            }
+        }
+
+        BlRtlStallExecution((Pass == 0) ? APIC_INIT_DELAY : APIC_STARTUP_DELAY);
+    }
+
+    //
+    // Wait for the application processors to leave the shared entry stacks before the
+    // bootstrap processor makes further legacy calls.
+    //
+
+    Limit = __rdtsc() + ((BlRtlTscFrequency / 1000000) * BL_AP_CHECK_IN_TIMEOUT);
+
+    while ((BlApOnlineCount < (INT32) BlApMaxProcessors) && (__rdtsc() < Limit)) {
+
+        _mm_pause();
+    }
+
+    while (*BlApStartupLock != 0) {
+
+        _mm_pause();
+    }
+
+#if AP_VERBOSE
+
+    BlRtlPrintf("AP: %u of %u application processor(s) online.\n",
+                BlApOnlineCount,
+                BlApMaxProcessors);
+
+#endif
+
+    return;
+}
+
+VOID
+BlApShutdown(
+    VOID
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function parks the application processors and restores the kernel AP entry point.
+//
+//--
+
+{
+    BlApWaitForWorkItems();
+
+    BlApShutdownRequested = TRUE;
+
+    while (BlApParkedCount != BlApOnlineCount) {
+
+        _mm_pause();
+    }
+
+    if (BlApSavedEntry != 0) {
+
+        BlGetBeb()->ApEntry = BlApSavedEntry;
+    }
+
+    return;
+}
@@ -158,9 +158,12 @@ C_ASSERT(sizeof(ISO9660_VOLUME_DESCRIPTOR) == ISO9660_LOGICAL_BLOCK_SIZE);
 
 #pragma pack()
 
+C_ASSERT(sizeof(ISO9660_DIRECTORY_RECORD) <= BL_FS_CACHE_RECORD_SIZE);
+
 UINT8 BlCdDriveId;
 INT13_DRIVE_PARAMETERS BlCdDriveParameters;
 ISO9660_VOLUME_DESCRIPTOR BlCdVolumeDescriptor;
+PBL_FS_CACHE_ENTRY BlCdRootCacheEntry;
 
 ISO9660_LOGICAL_BLOCK BlCdTemporaryBlock[32];
 UINT16 BlCdTemporaryBlockCount = sizeof(BlCdTemporaryBlock) / sizeof(BlCdTemporaryBlock[0]);
@@ -218,6 +221,8 @@ BlCdReadLogicalBlock(
             BlRtlHalt();
         }
 
+        BlProfAddIoBytes(ChunkSize * sizeof(ISO9660_LOGICAL_BLOCK));
+
         BlRtlCopyMemory(LogicalBlock,
                         BlCdTemporaryBlock,
                         ChunkSize * sizeof(ISO9660_LOGICAL_BLOCK));
@@ -231,26 +236,24 @@ BlCdReadLogicalBlock(
 }
 
 BOOLEAN
-BlCdFindDirectoryRecord(
-    PCSTR Path,
-    PISO9660_DIRECTORY_RECORD DirectoryRecord
+BlCdScanDirectory(
+    PBL_FS_CACHE_ENTRY Directory
     )
 
 //++
 //
 //  Routine Description:
 //
-//    This function finds the directory record for the specified path.
+//    This function reads the extent of the specified directory and adds all of
+//    its records to the directory cache.
 //
 //  Arguments:
 //
-//    Path                - Supplies the path to look up.
-//
-//    DirectoryRecord     - Receives directory record.
+//    Directory   - Supplies the cache entry of the directory to scan.
 //
 //  Return Value:
 //
-//    TRUE, if directory record was found.
+//    TRUE, if the directory was scanned.
 //    FALSE, otherwise.
 //
 //--
@@ -261,118 +264,111 @@ BlCdFindDirectoryRecord(
     ULONG_PTR DirectoryDataLimit;
     UINT32 DirectoryDataExtentStart;
     UINT32 DirectoryDataExtentSize;
+    PISO9660_DIRECTORY_RECORD DirectoryRecord;
     PISO9660_DIRECTORY_RECORD Entry;
     UINT32 Index;
-    PCSTR NextToken;
-    PCSTR Separator;
-    CHAR Temp[ISO9660_MAX_PATH];
-    CHAR Token[ISO9660_MAX_PATH];
-    UINT32 TokenSize;
-
-    DirectoryDataExtentStart = BlCdVolumeDescriptor.u1.Supplementary.RootDirectory.ExtentLocation;
-    DirectoryDataExtentSize = ROUND_UP_TO_POWER2(BlCdVolumeDescriptor.u1.Supplementary.RootDirectory.DataLength, ISO9660_LOGICAL_BLOCK_SIZE) / ISO9660_LOGICAL_BLOCK_SIZE;
-
-    NextToken = Path;
-
-    for (;;) {
-
-        BLASSERT(DirectoryDataExtentStart > ISO9660_VOLUME_SPACE_DATA_AREA_LBN);
+    CHAR Name[ISO9660_MAX_PATH];
+    UINT32 NameLength;
 
-        BLASSERT(DirectoryDataExtentSize > 0);
+    DirectoryRecord = (PISO9660_DIRECTORY_RECORD) Directory->Record;
 
-        BLASSERT((*NextToken != 0) && (*NextToken != '/'));
+    DirectoryDataExtentStart = DirectoryRecord->ExtentLocation;
+    DirectoryDataExtentSize = ROUND_UP_TO_POWER2(DirectoryRecord->DataLength, ISO9660_LOGICAL_BLOCK_SIZE) / ISO9660_LOGICAL_BLOCK_SIZE;
 
-        Separator = NextToken;
+    BLASSERT(DirectoryDataExtentStart > ISO9660_VOLUME_SPACE_DATA_AREA_LBN);
 
-        while ((*Separator != '/') && (*Separator != 0)) {
+    BLASSERT(DirectoryDataExtentSize > 0);
 
-            Separator += 1;
-        }
+    DirectoryData = (PISO9660_LOGICAL_BLOCK) BlPoolAllocateBlock(DirectoryDataExtentSize * ISO9660_LOGICAL_BLOCK_SIZE);
+    DirectoryDataLimit = (ULONG_PTR) DirectoryData + (DirectoryDataExtentSize * ISO9660_LOGICAL_BLOCK_SIZE);
 
-        TokenSize = (UINT32) (Separator - NextToken);
+    BlCdReadLogicalBlock(DirectoryDataExtentStart,
+                         DirectoryDataExtentSize,
+                         DirectoryData);
 
-        for (Index = 0; Index < TokenSize; Index += 1) {
+    for (DirectoryDataIndex = 0; DirectoryDataIndex < DirectoryDataExtentSize; DirectoryDataIndex += 1) {
 
-            Token[Index] = BlRtlConvertCharacterToUpperCase(NextToken[Index]);
-        }
+        Entry = (PISO9660_DIRECTORY_RECORD) &DirectoryData[DirectoryDataIndex];
 
-        Token[TokenSize] = 0;
+        //
+        // Records do not cross logical blocks; a zero length pads to the next block.
+        //
 
-        DirectoryData = (PISO9660_LOGICAL_BLOCK) BlPoolAllocateBlock(DirectoryDataExtentSize * ISO9660_LOGICAL_BLOCK_SIZE);
-        DirectoryDataLimit = (ULONG_PTR) DirectoryData + (DirectoryDataExtentSize * ISO9660_LOGICAL_BLOCK_SIZE);
+        while (((ULONG_PTR) Entry < DirectoryDataLimit) && (Entry->DirectoryRecordLength != 0)) {
 
-        BlCdReadLogicalBlock(DirectoryDataExtentStart,
-                             DirectoryDataExtentSize,
-                             DirectoryData);
+            //
+            // Joliet identifiers are big-endian UCS-2; the self and parent records
+            // have a single-byte identifier and are skipped.
+            //
 
-        Entry = NULL;
+            if ((Entry->FileIdentifierLength > 0) && ((Entry->FileIdentifierLength % 2) == 0)) {
 
-        for (DirectoryDataIndex = 0; (Entry == NULL) && (DirectoryDataIndex < DirectoryDataExtentSize); DirectoryDataIndex += 1) {
+                NameLength = Entry->FileIdentifierLength / 2;
 
-            Entry = (PISO9660_DIRECTORY_RECORD) &DirectoryData[DirectoryDataIndex];
+                for (Index = 0; Index < NameLength; Index += 1) {
 
-            for (;;) {
-
-                if (Entry->DirectoryRecordLength == 0) {
-
-                    Entry = NULL;
-                    break;
-                }
-
-                if (Entry->FileIdentifierLength == (TokenSize * 2)) {
-
-                    for (Index = 0; Index < TokenSize; Index += 1) {
-
-                        Temp[Index] = BlRtlConvertCharacterToUpperCase(Entry->FileIdentifier[(Index * 2) + 1]);
-                    }
-
-                    if (BlRtlCompareMemory(Temp, Token, TokenSize) != FALSE) {
-
-                        break;
-                    }
+                    Name[Index] = Entry->FileIdentifier[(Index * 2) + 1];
                 }
 
-                Entry = (PISO9660_DIRECTORY_RECORD) ROUND_UP_TO_POWER2((((ULONG_PTR) Entry) + Entry->DirectoryRecordLength), 2);
-
-                if ((ULONG_PTR) Entry >= DirectoryDataLimit) {
-
-                    Entry = NULL;
-                    break;
-                }
+                BlFsCacheInsert(Directory,
+                                Name,
+                                NameLength,
+                                Entry,
+                                sizeof(ISO9660_DIRECTORY_RECORD),
+                                (BOOLEAN) (Entry->u1.s1.Directory != FALSE));
             }
-        }
 
-        if (Entry == NULL) {
-
-            BlPoolFreeBlock(DirectoryData);
-
-            return FALSE;
+            Entry = (PISO9660_DIRECTORY_RECORD) ROUND_UP_TO_POWER2((((ULONG_PTR) Entry) + Entry->DirectoryRecordLength), 2);
         }
+    }
 
-        if (*Separator == 0) {
+    BlPoolFreeBlock(DirectoryData);
 
-            BlRtlCopyMemory(DirectoryRecord,
-                            Entry,
-                            sizeof(ISO9660_DIRECTORY_RECORD));
+    return TRUE;
+}
 
-            BlPoolFreeBlock(DirectoryData);
+BOOLEAN
+BlCdFindDirectoryRecord(
+    PCSTR Path,
+    PISO9660_DIRECTORY_RECORD DirectoryRecord
+    )
 
-            return TRUE;
-        }
+//++
+//
+//  Routine Description:
+//
+//    This function finds the directory record for the specified path.
+//
+//  Arguments:
+//
+//    Path                - Supplies the path to look up.
+//
+//    DirectoryRecord     - Receives directory record.
+//
+//  Return Value:
+//
+//    TRUE, if directory record was found.
+//    FALSE, otherwise.
+//
+//--
 
-        if (Entry->u1.s1.Directory == FALSE) {
+{
+    PBL_FS_CACHE_ENTRY Entry;
 
-            BlPoolFreeBlock(DirectoryData);
+    BLASSERT((*Path != 0) && (*Path != '/'));
 
-            return FALSE;
-        }
+    Entry = BlFsCacheFindPath(BlCdRootCacheEntry, Path, BlCdScanDirectory);
 
-        DirectoryDataExtentStart = Entry->ExtentLocation;
-        DirectoryDataExtentSize = ROUND_UP_TO_POWER2(Entry->DataLength, ISO9660_LOGICAL_BLOCK_SIZE) / ISO9660_LOGICAL_BLOCK_SIZE;
-        NextToken = Separator + 1;
+    if (Entry == NULL) {
 
-        BlPoolFreeBlock(DirectoryData);
+        return FALSE;
     }
+
+    BlRtlCopyMemory(DirectoryRecord,
+                    Entry->Record,
+                    sizeof(ISO9660_DIRECTORY_RECORD));
+
+    return TRUE;
 }
 
 BOOLEAN
@@ -579,6 +575,13 @@ BlCdInitialize(
         LogicalBlockNumber += 1;
     }
 
+    BlCdRootCacheEntry = BlFsCacheInsert(NULL,
+                                         "",
+                                         0,
+                                         &BlCdVolumeDescriptor.u1.Supplementary.RootDirectory,
+                                         sizeof(ISO9660_DIRECTORY_RECORD),
+                                         TRUE);
+
     BlFsGetFileSize = BlCdGetFileSize;
     BlFsReadFile = BlCdReadFile;
 
@@ -42,11 +42,33 @@ const UINT16 BlComBasePort[COM_MAX_PORT + 1] = {
 
 #define COM_CLOCK_RATE                          0x1C200
 
+//
+// Clock rates (crystal / 16) of the UARTs seen in practice.  The standard PC
+// crystal is 1.8432 MHz; the others turn up on serial cards and server boards.
+//
+
+const UINT32 BlComClockRates[] = {
+    115200,                                     // 1.8432 MHz
+    230400,                                     // 3.6864 MHz
+    460800,                                     // 7.3728 MHz
+    921600,                                     // 14.7456 MHz
+    1152000,                                    // 18.432 MHz
+    1500000,                                    // 24 MHz
+    1843200                                     // 29.4912 MHz
+};
+
+#define COM_CLOCK_PROBE_DIVISOR                 12
+#define COM_CLOCK_PROBE_BYTES                   16
+#define COM_CLOCK_PROBE_BITS_PER_BYTE           10
+
+UINT32 BlComBaudRate[COM_MAX_PORT + 1];
+
 #define COM_LINE_CONTROL_8BITS_1STOP            0x03
 #define COM_LINE_CONTROL_DIVISOR_ACCESS         0x80
 
 #define COM_MODEM_CONTROL_DATA_TERMINAL_READY   0x01
 #define COM_MODEM_CONTROL_REQUEST_TO_SEND       0x02
+#define COM_MODEM_CONTROL_LOOPBACK              0x10
 
 #define COM_LINE_STATUS_DATA_READY              0x01
 #define COM_LINE_STATUS_OVERRUN_ERROR           0x02
@@ -54,6 +76,133 @@ const UINT16 BlComBasePort[COM_MAX_PORT + 1] = {
 #define COM_LINE_STATUS_FRAMING_ERROR           0x08
 #define COM_LINE_STATUS_SEND_BUFFER_EMPTY       0x20
 
+UINT32
+BlComMeasureClockRate(
+    UINT16 Base
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function measures the clock rate of a UART.  The UART is put in
+//    loopback at a known divisor and the time a few bytes take to come back
+//    is measured with the TSC.  The result is snapped to the nearest clock in
+//    BlComClockRates; a UART that does not pace its output (as an emulated one
+//    may not) or that does not loop back is taken to have the standard clock.
+//
+//  Arguments:
+//
+//    Base        - Supplies the base port of the UART.
+//
+//  Return Value:
+//
+//    Clock rate of the UART, in baud at divisor 1.
+//
+//--
+
+{
+    UINT32 Clock;
+    UINT64 Deadline;
+    UINT8 Index;
+    UINT64 Measured;
+    UINT32 Rate;
+    UINT64 Start;
+    UINT64 Ticks;
+
+    if (BlRtlTscFrequency == 0) {
+
+        return COM_CLOCK_RATE;
+    }
+
+    BlRtlWritePort8(Base + COM_MODEM_CONTROL_REGISTER, COM_MODEM_CONTROL_LOOPBACK);
+
+    BlRtlWritePort8(Base + COM_LINE_CONTROL_REGISTER, COM_LINE_CONTROL_DIVISOR_ACCESS);
+    BlRtlWritePort8(Base + COM_DIVISOR_LATCH_REGISTER_LOW, COM_CLOCK_PROBE_DIVISOR);
+    BlRtlWritePort8(Base + COM_DIVISOR_LATCH_REGISTER_HIGH, 0);
+
+    BlRtlWritePort8(Base + COM_LINE_CONTROL_REGISTER, COM_LINE_CONTROL_8BITS_1STOP);
+
+    //
+    // Drain whatever is already in the receiver.
+    //
+
+    for (Index = 0; Index < COM_CLOCK_PROBE_BYTES; Index += 1) {
+
+        if ((BlRtlReadPort8(Base + COM_LINE_STATUS_REGISTER) & COM_LINE_STATUS_DATA_READY) == 0) {
+
+            break;
+        }
+
+        BlRtlReadPort8(Base + COM_DATA_REGISTER);
+    }
+
+    //
+    // Send one byte more than is timed, so the measurement starts in step with
+    // the receiver.  Give up after four times as long as the bytes take at the
+    // standard clock.
+    //
+
+    Deadline = __rdtsc() + (BlRtlTscFrequency * 4 * (COM_CLOCK_PROBE_BYTES + 1) *
+                            COM_CLOCK_PROBE_BITS_PER_BYTE * COM_CLOCK_PROBE_DIVISOR) / COM_CLOCK_RATE;
+
+    Measured = 0;
+    Start = 0;
+
+    for (Index = 0; Index <= COM_CLOCK_PROBE_BYTES; Index += 1) {
+
+        BlRtlWritePort8(Base + COM_DATA_REGISTER, Index);
+
+        while ((BlRtlReadPort8(Base + COM_LINE_STATUS_REGISTER) & COM_LINE_STATUS_DATA_READY) == 0) {
+
+            if (__rdtsc() > Deadline) {
+
+                goto Done;
+            }
+        }
+
+        BlRtlReadPort8(Base + COM_DATA_REGISTER);
+
+        if (Index == 0) {
+
+            Start = __rdtsc();
+        }
+    }
+
+    Ticks = __rdtsc() - Start;
+
+    if (Ticks != 0) {
+
+        Measured = (BlRtlTscFrequency * COM_CLOCK_PROBE_BYTES *
+                    COM_CLOCK_PROBE_BITS_PER_BYTE * COM_CLOCK_PROBE_DIVISOR) / Ticks;
+    }
+
+Done:
+
+    BlRtlWritePort8(Base + COM_MODEM_CONTROL_REGISTER, 0);
+
+    Rate = COM_CLOCK_RATE;
+
+    for (Index = 0; Index < ARRAY_SIZE(BlComClockRates); Index += 1) {
+
+        Clock = BlComClockRates[Index];
+
+        if ((Measured >= Clock - (Clock / 10)) && (Measured <= Clock + (Clock / 10))) {
+
+            Rate = Clock;
+            break;
+        }
+    }
+
+#if COM_VERBOSE
+
+    BlVideoPrintf("COM@%x: Measured clock %u, using %u.\n", Base, (UINT32) Measured, Rate);
+
+#endif
+
+    return Rate;
+}
+
 BOOLEAN
 BlComInitialize(
     UINT8 PortNumber,
@@ -64,13 +213,15 @@ BlComInitialize(
 //
 //  Routine Description:
 //
-//    This function initializes the specified COM port.
+//    This function initializes the specified COM port.  The port runs at the
+//    fastest rate its clock can be divided down to that does not exceed the
+//    requested rate; BlComBaudRate receives that rate.
 //
 //  Arguments:
 //
 //    PortNumber  - Supplies the number of the port to initialize.
 //
-//    BaudRate    - Supplies the baud rate.
+//    BaudRate    - Supplies the highest baud rate to use.
 //
 //  Return Value:
 //
@@ -81,7 +232,8 @@ BlComInitialize(
 
 {
     UINT16 Base;
-    UINT16 Divisor;
+    UINT32 ClockRate;
+    UINT32 Divisor;
     UINT8 Index;
     UINT8 Status;
 
@@ -89,25 +241,12 @@ BlComInitialize(
 
     BLASSERT(BaudRate != 0);
 
-    BLASSERT(BaudRate <= COM_CLOCK_RATE);
-
-    BLASSERT((COM_CLOCK_RATE % BaudRate) == 0);
-
-    BLASSERT((COM_CLOCK_RATE / BaudRate) <= 0x10000);
-
     Base = BlComBasePort[PortNumber];
 
+    BlComBaudRate[PortNumber] = 0;
+
     BlRtlWritePort8(Base + COM_LINE_CONTROL_REGISTER, 0);
     BlRtlWritePort8(Base + COM_INTERRUPT_ENABLE_REGISTER, 0);
-    BlRtlWritePort8(Base + COM_MODEM_CONTROL_REGISTER, COM_MODEM_CONTROL_DATA_TERMINAL_READY | COM_MODEM_CONTROL_REQUEST_TO_SEND);
-
-    Divisor = (UINT16) (COM_CLOCK_RATE / BaudRate);
-
-    BlRtlWritePort8(Base + COM_LINE_CONTROL_REGISTER, COM_LINE_CONTROL_DIVISOR_ACCESS);
-    BlRtlWritePort8(Base + COM_DIVISOR_LATCH_REGISTER_LOW, (UINT8) (Divisor & 0xFF));
-    BlRtlWritePort8(Base + COM_DIVISOR_LATCH_REGISTER_HIGH, (UINT8) (Divisor >> 8));
-
-    BlRtlWritePort8(Base + COM_LINE_CONTROL_REGISTER, COM_LINE_CONTROL_8BITS_1STOP);
 
     Index = 0;
 
@@ -131,6 +270,25 @@ BlComInitialize(
         return FALSE;
     }
 
+    ClockRate = BlComMeasureClockRate(Base);
+
+    Divisor = (ClockRate + BaudRate - 1) / BaudRate;
+
+    if (Divisor > 0xFFFF) {
+
+        Divisor = 0xFFFF;
+    }
+
+    BlRtlWritePort8(Base + COM_MODEM_CONTROL_REGISTER, COM_MODEM_CONTROL_DATA_TERMINAL_READY | COM_MODEM_CONTROL_REQUEST_TO_SEND);
+
+    BlRtlWritePort8(Base + COM_LINE_CONTROL_REGISTER, COM_LINE_CONTROL_DIVISOR_ACCESS);
+    BlRtlWritePort8(Base + COM_DIVISOR_LATCH_REGISTER_LOW, (UINT8) (Divisor & 0xFF));
+    BlRtlWritePort8(Base + COM_DIVISOR_LATCH_REGISTER_HIGH, (UINT8) (Divisor >> 8));
+
+    BlRtlWritePort8(Base + COM_LINE_CONTROL_REGISTER, COM_LINE_CONTROL_8BITS_1STOP);
+
+    BlComBaudRate[PortNumber] = ClockRate / Divisor;
+
 #if COM_VERBOSE
 
     if ((Status & COM_LINE_STATUS_OVERRUN_ERROR) != 0) {
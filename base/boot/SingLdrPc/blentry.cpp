@@ -55,6 +55,7 @@ BlInitialize(
 
 {
     PBEB Beb;
+    UINT32 Phase;
 
     Beb = BlGetBeb();
 
@@ -62,6 +63,8 @@ BlInitialize(
     // Check boot type and perform any necessary source specific initialization.
     //
 
+    Phase = BlProfBeginPhase("boot-device");
+
     BlRtlPrintf("Booting from ");
 
     switch (Beb->BootType) {
@@ -119,30 +122,43 @@ BlInitialize(
         }
     }
 
+    BlProfEndPhase(Phase);
+
     //
     // Initialize PNP BIOS support.
     //
 
     if (Beb->BootType != BL_FLASH_BOOT) {
 
+        Phase = BlProfBeginPhase("pnp");
+
         BlPnpInitialize();
 
+        BlProfEndPhase(Phase);
     }
 
     //
     // Initialize MPS support.
     //
 
+    Phase = BlProfBeginPhase("mps");
+
     BlMpsInitialize();
 
+    BlProfEndPhase(Phase);
+
     //
     // Initialize ACPI support.
     //
 
+    Phase = BlProfBeginPhase("acpi");
+
     if (Beb->BootType != BL_FLASH_BOOT) {
 
         BlAcpiInitialize();
 
+        BlMmSetProximityDomains();
+
     }
     else {
 
@@ -150,6 +166,8 @@ BlInitialize(
 
     }
 
+    BlProfEndPhase(Phase);
+
     //
     // Set AP entry address.
     //
@@ -197,6 +215,13 @@ BlEntry(
 
 {
     PBEB Beb;
+    UINT32 Phase;
+
+    //
+    // Open the root boot phase; it stays open until the kernel is entered.
+    //
+
+    BlProfBeginPhase("boot");
 
     Beb = BlGetBeb();
 
@@ -211,6 +236,12 @@ BlEntry(
 
     BlVideoInitialize();
 
+    //
+    // Calibrate the time stamp counter for boot timing and AP startup delays.
+    //
+
+    BlRtlCalibrateTsc();
+
     //
     // Print the welcome banner.
     //
@@ -235,16 +266,23 @@ BlEntry(
     // Initialize memory management (ring transitions must follow this call).
     //
 
+    Phase = BlProfBeginPhase("mm");
+
     BlMmInitializeSystem();
 
+    BlProfEndPhase(Phase);
+
     //
     // Initialize PCI support (probe for 1394 interfaces for KD).
     //
 
     if (Beb->BootType != BL_FLASH_BOOT) {
 
+        Phase = BlProfBeginPhase("pci");
+
         BlPciInitialize();
 
+        BlProfEndPhase(Phase);
     }
 
     //
@@ -252,8 +290,13 @@ BlEntry(
     //
 
     BlRtlPrintf("Looking for debugger.\n");
+
+    Phase = BlProfBeginPhase("kd");
+
     BlKdInitialize();
 
+    BlProfEndPhase(Phase);
+
     //
     // Print the welcome banner.
     //
@@ -189,6 +189,7 @@ typedef struct _FAT_NAME {
 
 #pragma pack()
 
+C_ASSERT(sizeof(FAT_DIRECTORY_ENTRY) <= BL_FS_CACHE_RECORD_SIZE);
 
 FAT_BOOT_SECTOR BlFatBootSector;
 UINT32 BlFatBytesPerCluster;
@@ -203,6 +204,7 @@ UINT32 BlFatPartitionId;
 UINT32 BlFatPartitionStart;
 UINT32 BlFatPartitionSize;
 PFAT_DIRECTORY_ENTRY BlFatRootDirectory;
+PBL_FS_CACHE_ENTRY BlFatRootCacheEntry;
 UINT32 BlFatRootStart;
 UINT32 BlFatSectorsPerCluster;
 UINT32 BlFatTableStart;
@@ -305,6 +307,8 @@ BlFatReadSector(
             return FALSE;
         }
 
+        BlProfAddIoBytes(StepSize * FAT_SECTOR_SIZE);
+
         BlRtlCopyMemory(Buffer,
                         BlFatTemporaryBlock,
                         StepSize * FAT_SECTOR_SIZE);
@@ -494,80 +498,6 @@ BlFatDirectoryEntryToName(
     return TRUE;
 }
 
-PFAT_DIRECTORY_ENTRY
-BlFatFindDirectoryTableEntry(
-    PFAT_DIRECTORY_ENTRY Table,
-    UINT32 NumberOfEntries,
-    PCSTR Name
-    )
-
-//++
-//
-//  Routine Description:
-//
-//    This function finds the directory table entry matching the specified name.
-//
-//  Arguments:
-//
-//    Table           - Supplies a pointer to the table to find in.
-//
-//    NumberOfEntries - Supplies the number of entries in the table.
-//
-//    Name            - Supplies the name to look for.
-//
-//  Return Value:
-//
-//    TRUE, if a matching entry was located.
-//    FALSE, otherwise.
-//
-//--
-
-{
-    PFAT_DIRECTORY_ENTRY Entry;
-    FAT_NAME EntryName;
-    PFAT_DIRECTORY_ENTRY Limit;
-
-    BLASSERT(Name[0] != 0);
-
-    Limit = Table + NumberOfEntries;
-
-    for (Entry = Table; Entry != Limit; Entry += 1) {
-
-        if (Entry->u1.Short.Name[0] == FAT_DIRECTORY_ENTRY_FREE) {
-
-            continue;
-        }
-
-        if (Entry->u1.Short.Name[0] == FAT_DIRECTORY_ENTRY_LAST) {
-
-            break;
-        }
-
-        if (Entry->u1.Short.Name[0] == '.') {
-
-            continue;
-        }
-
-        if ((Entry->u1.Short.Attribute & FAT_ATTRIBUTE_MASK) == FAT_ATTRIBUTE_VOLUME_ID) {
-
-            continue;
-        }
-
-        if (BlFatDirectoryEntryToName(Entry,
-                                      &EntryName,
-                                      Table) != FALSE) {
-
-            if ((BlRtlEqualStringI(Name, (PCSTR) EntryName.ShortName) != FALSE) ||
-                (BlRtlEqualStringI(Name, (PCSTR) EntryName.LongName) != FALSE)) {
-
-                return Entry;
-            }
-        }
-    }
-
-    return NULL;
-}
-
 BOOLEAN
 BlFatGetLengthClusterChain(
     UINT32 Cluster,
@@ -736,180 +666,188 @@ BlFatReadClusterChain(
 }
 
 BOOLEAN
-BlFatFindFileEntry(
-    PCSTR Path,
-    PFAT_DIRECTORY_ENTRY FileEntry
+BlFatScanDirectory(
+    PBL_FS_CACHE_ENTRY Directory
     )
 
 //++
 //
 //  Routine Description:
 //
-//    This function finds the entry matching the specified file path.
+//    This function reads the table of the specified directory and adds all of its
+//    entries to the directory cache, under both their short and long names.
 //
 //  Arguments:
 //
-//    Path        - Supplies a pointer to the path to look up.
-//
-//    FileEntry   - Receives the contents of the entry matching the specified path.
+//    Directory   - Supplies the cache entry of the directory to scan.
 //
 //  Return Value:
 //
-//    TRUE, if a match was found.
+//    TRUE, if the directory was scanned.
 //    FALSE, otherwise.
 //
 //--
 
 {
+    PFAT_DIRECTORY_ENTRY DirectoryEntry;
     UINT32 DirectoryCluster;
     UINT32 DirectoryClusterCount;
-    UINT32 Depth;
-    FAT_DIRECTORY_ENTRY Entry;
-    PFAT_DIRECTORY_ENTRY Match;
-    PCSTR Next;
+    PFAT_DIRECTORY_ENTRY Entry;
+    FAT_NAME EntryName;
+    BOOLEAN IsDirectory;
+    PFAT_DIRECTORY_ENTRY Limit;
     PFAT_DIRECTORY_ENTRY Table;
     UINT32 TableSize;
-    UINT8 Token[FAT_MAX_PATH];
-    UINT32 TokenIndex;
 
-    if ((Path[0] == 0) ||
-        (Path[0] == '/') ||
-        (BlRtlStringLength(Path) >= FAT_MAX_PATH)) {
+    if (Directory == BlFatRootCacheEntry) {
 
-        return FALSE;
-    }
+        Table = BlFatRootDirectory;
+        TableSize = BlFatNumberOfRootDirectoryEntries;
 
-    Next = Path;
-    Depth = 0;
+    } else {
 
-    SATISFY_OVERZEALOUS_COMPILER(BlRtlZeroMemory(&Entry, sizeof(Entry)));
+        DirectoryEntry = (PFAT_DIRECTORY_ENTRY) Directory->Record;
+        DirectoryCluster = DirectoryEntry->u1.Short.FirstClusterLow;
 
-    for (;;) {
+        if (BlFatGetLengthClusterChain(DirectoryCluster, &DirectoryClusterCount) == FALSE) {
 
-        if (*Next == 0) {
+            return FALSE;
+        }
 
-            if ((Entry.u1.Short.Attribute & FAT_ATTRIBUTE_DIRECTORY) != 0) {
+        Table = (PFAT_DIRECTORY_ENTRY)
+            BlPoolAllocateBlock(DirectoryClusterCount * BlFatBytesPerCluster);
 
-#if FAT_VERBOSE
+        if (BlFatReadClusterChain(DirectoryCluster,
+                                  DirectoryClusterCount * BlFatBytesPerCluster,
+                                  Table) == FALSE) {
 
-                BlRtlPrintf("FAT: FindFileEntry: %s is a directory!\n", Path);
+            BlPoolFreeBlock(Table);
 
-#endif
+            return FALSE;
+        }
 
-                return FALSE;
-            }
+        TableSize = (DirectoryClusterCount * BlFatBytesPerCluster) / sizeof(FAT_DIRECTORY_ENTRY);
+    }
 
-            *FileEntry = Entry;
+    Limit = Table + TableSize;
 
-            return TRUE;
-        }
+    for (Entry = Table; Entry != Limit; Entry += 1) {
 
-        //
-        // If the next token is empty (i.e. back to back separators), then this is a malformed path.
-        //
+        if (Entry->u1.Short.Name[0] == FAT_DIRECTORY_ENTRY_FREE) {
 
-        if (*Next == '/') {
+            continue;
+        }
 
-#if FAT_VERBOSE
+        if (Entry->u1.Short.Name[0] == FAT_DIRECTORY_ENTRY_LAST) {
 
-            BlRtlPrintf("FAT: FindFileEntry: %s is a malformed path!\n", Path);
+            break;
+        }
 
-#endif
+        if (Entry->u1.Short.Name[0] == '.') {
 
-            return FALSE;
+            continue;
         }
 
-        //
-        // Extract the next token.
-        //
-
-        TokenIndex = 0;
+        if ((Entry->u1.Short.Attribute & FAT_ATTRIBUTE_MASK) == FAT_ATTRIBUTE_VOLUME_ID) {
 
-        for (;;) {
+            continue;
+        }
 
-            if (*Next == 0) {
+        if (BlFatDirectoryEntryToName(Entry,
+                                      &EntryName,
+                                      Table) != FALSE) {
 
-                break;
-            }
+            IsDirectory = (BOOLEAN) ((Entry->u1.Short.Attribute & FAT_ATTRIBUTE_DIRECTORY) != 0);
 
-            if (*Next == '/') {
+            BlFsCacheInsert(Directory,
+                            (PCSTR) EntryName.ShortName,
+                            BlRtlStringLength((PCSTR) EntryName.ShortName),
+                            Entry,
+                            sizeof(FAT_DIRECTORY_ENTRY),
+                            IsDirectory);
 
-                Next += 1;
+            if (EntryName.LongName[0] != 0) {
 
-                break;
+                BlFsCacheInsert(Directory,
+                                (PCSTR) EntryName.LongName,
+                                BlRtlStringLength((PCSTR) EntryName.LongName),
+                                Entry,
+                                sizeof(FAT_DIRECTORY_ENTRY),
+                                IsDirectory);
             }
-
-            Token[TokenIndex] = *Next;
-            TokenIndex += 1;
-            Next += 1;
         }
+    }
 
-        BLASSERT(TokenIndex > 0);
-
-        Token[TokenIndex] = 0;
+    if (Table != BlFatRootDirectory) {
 
-        if (Depth == 0) {
+        BlPoolFreeBlock(Table);
+    }
 
-            Table = BlFatRootDirectory;
-            TableSize = BlFatNumberOfRootDirectoryEntries;
+    return TRUE;
+}
 
-        } else {
+BOOLEAN
+BlFatFindFileEntry(
+    PCSTR Path,
+    PFAT_DIRECTORY_ENTRY FileEntry
+    )
 
-            DirectoryCluster = Entry.u1.Short.FirstClusterLow;
+//++
+//
+//  Routine Description:
+//
+//    This function finds the entry matching the specified file path.
+//
+//  Arguments:
+//
+//    Path        - Supplies a pointer to the path to look up.
+//
+//    FileEntry   - Receives the contents of the entry matching the specified path.
+//
+//  Return Value:
+//
+//    TRUE, if a match was found.
+//    FALSE, otherwise.
+//
+//--
 
-            if (BlFatGetLengthClusterChain(DirectoryCluster, &DirectoryClusterCount) == FALSE) {
+{
+    PBL_FS_CACHE_ENTRY Entry;
 
-                return FALSE;
-            }
+    if ((Path[0] == 0) ||
+        (Path[0] == '/') ||
+        (BlRtlStringLength(Path) >= FAT_MAX_PATH)) {
 
-            Table = (PFAT_DIRECTORY_ENTRY)
-                BlPoolAllocateBlock(DirectoryClusterCount * BlFatBytesPerCluster);
+        return FALSE;
+    }
 
-            if (BlFatReadClusterChain(DirectoryCluster,
-                                      DirectoryClusterCount * BlFatBytesPerCluster,
-                                      Table) == FALSE) {
+    Entry = BlFsCacheFindPath(BlFatRootCacheEntry, Path, BlFatScanDirectory);
 
-                BlPoolFreeBlock(Table);
+    if (Entry == NULL) {
 
-                return FALSE;
-            }
+#if FAT_VERBOSE
 
-            TableSize = (DirectoryClusterCount * BlFatBytesPerCluster) / sizeof(FAT_DIRECTORY_ENTRY);
-        }
+        BlRtlPrintf("FAT: FindFileEntry: Unable to find directory entry for %s.\n", Path);
 
-        //
-        // Walk the directory table matching the previous token for an entry matching the next token.
-        //
+#endif
 
-        Match = BlFatFindDirectoryTableEntry(Table,
-                                             TableSize,
-                                             (PCSTR) Token);
+        return FALSE;
+    }
 
-        if (Match == NULL) {
+    if (Entry->Directory != FALSE) {
 
 #if FAT_VERBOSE
 
-            BlRtlPrintf("FAT: FindFileEntry: Unable to find directory entry for token %s.\n", Token);
+        BlRtlPrintf("FAT: FindFileEntry: %s is a directory!\n", Path);
 
 #endif
 
-            if (Table != BlFatRootDirectory) {
-
-                BlPoolFreeBlock(Table);
-            }
-
-            return FALSE;
-        }
-
-        Entry = *Match;
-
-        if (Table != BlFatRootDirectory) {
+        return FALSE;
+    }
 
-            BlPoolFreeBlock(Table);
-        }
+    *FileEntry = *((PFAT_DIRECTORY_ENTRY) Entry->Record);
 
-        Depth += 1;
-    }
+    return TRUE;
 }
 
 BOOLEAN
@@ -1462,6 +1400,7 @@ BlFatInitialize(
 
 {
     UINT32 Index;
+    FAT_DIRECTORY_ENTRY RootEntry;
 
     BLASSERT((FatType == MBR_FAT16LBA) || (FatType == MBR_FAT32LBA));
 
@@ -1530,6 +1469,21 @@ BlFatInitialize(
         BlRtlHalt();
     }
 
+    //
+    // The root directory has no entry of its own; cache a placeholder for it.
+    //
+
+    BlRtlZeroMemory(&RootEntry, sizeof(RootEntry));
+
+    RootEntry.u1.Short.Attribute = FAT_ATTRIBUTE_DIRECTORY;
+
+    BlFatRootCacheEntry = BlFsCacheInsert(NULL,
+                                          "",
+                                          0,
+                                          &RootEntry,
+                                          sizeof(FAT_DIRECTORY_ENTRY),
+                                          TRUE);
+
     BlFsGetFileSize = BlFatGetFileSize;
     BlFsReadFile = BlFatReadFile;
 
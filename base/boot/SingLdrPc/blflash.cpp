@@ -174,6 +174,8 @@ BlFlashReadFile(
 
         BlRtlCopyMemory(Buffer, BlFlashBase + File->DataOffset, NumberOfBytes);
 
+        BlProfAddIoBytes(NumberOfBytes);
+
         return TRUE;
     }
 
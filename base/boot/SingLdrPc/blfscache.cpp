@@ -0,0 +1,323 @@
+//++
+//
+//  Copyright (c) Microsoft Corporation
+//
+//  Module Name:
+//
+//    blfscache.cpp
+//
+//  Abstract:
+//
+//    This module implements the directory cache shared by the CDROM and FAT
+//    file systems.
+//
+//  Environment:
+//
+//    Boot loader.
+//
+//--
+
+#include "bl.h"
+
+#define BL_FS_CACHE_BUCKET_COUNT        512
+#define BL_FS_CACHE_CHUNK_SIZE          0x10000
+#define BL_FS_CACHE_MAX_PATH            1024
+
+PBL_FS_CACHE_ENTRY BlFsCacheBucket[BL_FS_CACHE_BUCKET_COUNT];
+
+PUINT8 BlFsCacheChunk;
+UINT32 BlFsCacheChunkUsed;
+
+UINT32
+BlFsCacheHash(
+    PCSTR Path,
+    UINT32 PathLength
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function computes a case-insensitive hash of the specified path.
+//
+//  Arguments:
+//
+//    Path        - Supplies the path.
+//
+//    PathLength  - Supplies the number of characters in the path.
+//
+//  Return Value:
+//
+//    Hash of the path.
+//
+//--
+
+{
+    UINT32 Hash;
+    UINT32 Index;
+
+    Hash = 2166136261;
+
+    for (Index = 0; Index < PathLength; Index += 1) {
+
+        Hash ^= (UINT8) BlRtlConvertCharacterToUpperCase(Path[Index]);
+        Hash *= 16777619;
+    }
+
+    return Hash;
+}
+
+PBL_FS_CACHE_ENTRY
+BlFsCacheLookup(
+    PCSTR Path,
+    UINT32 PathLength
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function looks up the specified path in the cache.
+//
+//  Arguments:
+//
+//    Path        - Supplies the path to look up.
+//
+//    PathLength  - Supplies the number of characters in the path.
+//
+//  Return Value:
+//
+//    Cache entry for the path, if present.
+//    NULL, otherwise.
+//
+//--
+
+{
+    PBL_FS_CACHE_ENTRY Entry;
+    UINT32 Hash;
+    UINT32 Index;
+
+    Hash = BlFsCacheHash(Path, PathLength);
+
+    for (Entry = BlFsCacheBucket[Hash % BL_FS_CACHE_BUCKET_COUNT]; Entry != NULL; Entry = Entry->Next) {
+
+        if ((Entry->Hash != Hash) || (Entry->PathLength != PathLength)) {
+
+            continue;
+        }
+
+        for (Index = 0; Index < PathLength; Index += 1) {
+
+            if (Entry->Path[Index] != BlRtlConvertCharacterToUpperCase(Path[Index])) {
+
+                break;
+            }
+        }
+
+        if (Index == PathLength) {
+
+            return Entry;
+        }
+    }
+
+    return NULL;
+}
+
+PBL_FS_CACHE_ENTRY
+BlFsCacheInsert(
+    PBL_FS_CACHE_ENTRY Directory,
+    PCSTR Name,
+    UINT32 NameLength,
+    PCVOID Record,
+    UINT32 RecordSize,
+    BOOLEAN IsDirectory
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function adds a directory entry to the cache.  If the path is already
+//    cached, the existing entry is kept, matching the first-match semantics of
+//    a linear directory scan.
+//
+//  Arguments:
+//
+//    Directory   - Supplies the cache entry of the containing directory, or NULL
+//                  to insert the root directory.
+//
+//    Name        - Supplies the name of the entry within the directory.
+//
+//    NameLength  - Supplies the number of characters in the name.
+//
+//    Record      - Supplies the file system record for the entry.
+//
+//    RecordSize  - Supplies the size of the record.
+//
+//    IsDirectory - Supplies TRUE if the entry is a directory.
+//
+//  Return Value:
+//
+//    Cache entry for the path.
+//
+//--
+
+{
+    UINT32 EntrySize;
+    PBL_FS_CACHE_ENTRY Entry;
+    UINT32 Index;
+    UINT32 PathLength;
+    CHAR Path[BL_FS_CACHE_MAX_PATH];
+
+    BLASSERT(RecordSize <= BL_FS_CACHE_RECORD_SIZE);
+
+    //
+    // Build the full path: <directory>/<name>, or just <name> in the root.
+    //
+
+    PathLength = 0;
+
+    if ((Directory != NULL) && (Directory->PathLength > 0)) {
+
+        BLASSERT(Directory->PathLength + 1 + NameLength < BL_FS_CACHE_MAX_PATH);
+
+        BlRtlCopyMemory(Path, Directory->Path, Directory->PathLength);
+        PathLength = Directory->PathLength;
+        Path[PathLength] = '/';
+        PathLength += 1;
+    }
+
+    BLASSERT(PathLength + NameLength < BL_FS_CACHE_MAX_PATH);
+
+    for (Index = 0; Index < NameLength; Index += 1) {
+
+        Path[PathLength] = BlRtlConvertCharacterToUpperCase(Name[Index]);
+        PathLength += 1;
+    }
+
+    Entry = BlFsCacheLookup(Path, PathLength);
+
+    if (Entry != NULL) {
+
+        return Entry;
+    }
+
+    //
+    // Carve entries out of large pool blocks; the pool rounds every allocation
+    // up to its granularity, which would more than double the cache footprint.
+    //
+
+    EntrySize = (UINT32) ROUND_UP_TO_POWER2(FIELD_OFFSET(BL_FS_CACHE_ENTRY, Path) + PathLength + 1, sizeof(ULONG_PTR));
+
+    if ((BlFsCacheChunk == NULL) || ((BlFsCacheChunkUsed + EntrySize) > BL_FS_CACHE_CHUNK_SIZE)) {
+
+        BlFsCacheChunk = (PUINT8) BlPoolAllocateBlock(BL_FS_CACHE_CHUNK_SIZE);
+        BlFsCacheChunkUsed = 0;
+    }
+
+    Entry = (PBL_FS_CACHE_ENTRY) (BlFsCacheChunk + BlFsCacheChunkUsed);
+    BlFsCacheChunkUsed += EntrySize;
+
+    Entry->Hash = BlFsCacheHash(Path, PathLength);
+    Entry->PathLength = PathLength;
+    Entry->Directory = IsDirectory;
+    Entry->Scanned = FALSE;
+
+    BlRtlCopyMemory(Entry->Record, Record, RecordSize);
+    BlRtlCopyMemory(Entry->Path, Path, PathLength);
+
+    Entry->Path[PathLength] = 0;
+
+    Entry->Next = BlFsCacheBucket[Entry->Hash % BL_FS_CACHE_BUCKET_COUNT];
+    BlFsCacheBucket[Entry->Hash % BL_FS_CACHE_BUCKET_COUNT] = Entry;
+
+    return Entry;
+}
+
+PBL_FS_CACHE_ENTRY
+BlFsCacheFindPath(
+    PBL_FS_CACHE_ENTRY Root,
+    PCSTR Path,
+    PBL_FS_CACHE_SCAN_ROUTINE ScanDirectory
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function resolves the specified path through the cache.  Each directory
+//    on the path that has not been seen yet is scanned once, adding all of its
+//    entries, so later lookups in the same directory never touch the disk.
+//
+//  Arguments:
+//
+//    Root            - Supplies the cache entry of the root directory.
+//
+//    Path            - Supplies the path to resolve, relative to the root.
+//
+//    ScanDirectory   - Supplies the file system routine that inserts all entries
+//                      of a directory.
+//
+//  Return Value:
+//
+//    Cache entry for the path, if it exists.
+//    NULL, otherwise.
+//
+//--
+
+{
+    PBL_FS_CACHE_ENTRY Directory;
+    PBL_FS_CACHE_ENTRY Entry;
+    PCSTR Separator;
+
+    Entry = BlFsCacheLookup(Path, BlRtlStringLength(Path));
+
+    if (Entry != NULL) {
+
+        return Entry;
+    }
+
+    Directory = Root;
+    Separator = Path;
+
+    for (;;) {
+
+        while ((*Separator != '/') && (*Separator != 0)) {
+
+            Separator += 1;
+        }
+
+        Entry = BlFsCacheLookup(Path, (UINT32) (Separator - Path));
+
+        if ((Entry == NULL) && (Directory->Scanned == FALSE)) {
+
+#if FSCACHE_VERBOSE
+
+            BlRtlPrintf("FSCACHE: Scanning [%s].\n", Directory->Path);
+
+#endif
+
+            if (ScanDirectory(Directory) == FALSE) {
+
+                return NULL;
+            }
+
+            Directory->Scanned = TRUE;
+
+            Entry = BlFsCacheLookup(Path, (UINT32) (Separator - Path));
+        }
+
+        if ((Entry == NULL) || (*Separator == 0)) {
+
+            return Entry;
+        }
+
+        if (Entry->Directory == FALSE) {
+
+            return NULL;
+        }
+
+        Directory = Entry;
+        Separator += 1;
+    }
+}
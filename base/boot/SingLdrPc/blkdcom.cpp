@@ -21,6 +21,16 @@
 
 #define KD_PACKET_TRAILING_BYTE             0xAA
 
+//
+// Highest rate of the KD link.  Each port runs at the fastest rate its clock
+// allows up to this (115200 on a standard 1.8432 MHz UART), and the kernel
+// keeps the divisor programmed here.  Keep in step with HalKdCom.cpp; the
+// host has to be set to the rate the loader reports.
+//
+
+#define KD_COM_BAUD_RATE                    921600
+#define KD_COM_STANDARD_BAUD_RATE           115200
+
 struct {
     KD_PACKET Header;
     UINT8 Data[PAGE_SIZE - sizeof(KD_PACKET)];
@@ -470,7 +480,16 @@ BlKdComConnect(
 
     for (Index = 1; Index <= COM_MAX_PORT; Index += 1) {
 
-        Present[Index] = BlComInitialize(Index, 115200);
+        Present[Index] = BlComInitialize(Index, KD_COM_BAUD_RATE);
+
+        //
+        // A port with a faster clock needs the debugger set to match.
+        //
+
+        if ((Present[Index] != FALSE) && (BlComBaudRate[Index] != KD_COM_STANDARD_BAUD_RATE)) {
+
+            BlVideoPrintf("KD: COM%u runs at %u baud.\n", Index, BlComBaudRate[Index]);
+        }
 
 #if KD_VERBOSE
 
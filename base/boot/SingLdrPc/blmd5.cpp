@@ -0,0 +1,227 @@
+//++
+//
+//  Copyright (c) Microsoft Corporation
+//
+//  Module Name:
+//
+//    blmd5.cpp
+//
+//  Abstract:
+//
+//    This module implements MD5 (RFC 1321) for verifying distro files.
+//
+//  Environment:
+//
+//    Boot loader.
+//
+//--
+
+#include "bl.h"
+
+#define BL_MD5_BLOCK_SIZE               64
+
+#define BL_MD5_ROTATE_LEFT(X, N)        (((X) << (N)) | ((X) >> (32 - (N))))
+
+const UINT32 BlMd5Sine[64] = {
+    0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE,
+    0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+    0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE,
+    0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+    0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA,
+    0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+    0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED,
+    0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+    0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C,
+    0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+    0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05,
+    0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+    0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039,
+    0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+    0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1,
+    0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391,
+};
+
+const UINT8 BlMd5Shift[16] = {
+    7, 12, 17, 22,
+    5,  9, 14, 20,
+    4, 11, 16, 23,
+    6, 10, 15, 21,
+};
+
+VOID
+BlMd5TransformBlock(
+    PUINT32 State,
+    const UINT8 *Block
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function folds one 64-byte block into the MD5 state.
+//
+//  Arguments:
+//
+//    State   - Supplies the MD5 state words to update.
+//
+//    Block   - Supplies the block to process.
+//
+//--
+
+{
+    UINT32 A;
+    UINT32 B;
+    UINT32 C;
+    UINT32 D;
+    UINT32 F;
+    UINT32 Index;
+    UINT32 Message[16];
+    UINT32 Round;
+    UINT32 Temp;
+    UINT32 Word;
+
+    for (Index = 0; Index < 16; Index += 1) {
+
+        Message[Index] = ((UINT32) Block[Index * 4]) |
+                         ((UINT32) Block[Index * 4 + 1] << 8) |
+                         ((UINT32) Block[Index * 4 + 2] << 16) |
+                         ((UINT32) Block[Index * 4 + 3] << 24);
+    }
+
+    A = State[0];
+    B = State[1];
+    C = State[2];
+    D = State[3];
+
+    for (Index = 0; Index < 64; Index += 1) {
+
+        Round = Index / 16;
+
+        switch (Round) {
+
+            case 0: {
+
+                F = (B & C) | (~B & D);
+                Word = Index;
+                break;
+            }
+
+            case 1: {
+
+                F = (D & B) | (~D & C);
+                Word = (5 * Index + 1) % 16;
+                break;
+            }
+
+            case 2: {
+
+                F = B ^ C ^ D;
+                Word = (3 * Index + 5) % 16;
+                break;
+            }
+
+            default: {
+
+                F = C ^ (B | ~D);
+                Word = (7 * Index) % 16;
+                break;
+            }
+        }
+
+        Temp = D;
+        D = C;
+        C = B;
+        F = F + A + BlMd5Sine[Index] + Message[Word];
+        B = B + BL_MD5_ROTATE_LEFT(F, BlMd5Shift[(Round * 4) + (Index % 4)]);
+        A = Temp;
+    }
+
+    State[0] += A;
+    State[1] += B;
+    State[2] += C;
+    State[3] += D;
+}
+
+VOID
+BlRtlComputeMd5(
+    PCVOID Buffer,
+    UINT32 Length,
+    PUINT8 Digest
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function computes the MD5 digest of the specified buffer.
+//
+//  Arguments:
+//
+//    Buffer  - Supplies the data to digest.
+//
+//    Length  - Supplies the length of the data.
+//
+//    Digest  - Receives the 16-byte digest.
+//
+//--
+
+{
+    UINT64 BitLength;
+    UINT8 Tail[2 * BL_MD5_BLOCK_SIZE];
+    UINT32 Index;
+    const UINT8 *Next;
+    UINT32 Remaining;
+    UINT32 State[4];
+    UINT32 TailLength;
+
+    State[0] = 0x67452301;
+    State[1] = 0xEFCDAB89;
+    State[2] = 0x98BADCFE;
+    State[3] = 0x10325476;
+
+    Next = (const UINT8 *) Buffer;
+    Remaining = Length;
+
+    while (Remaining >= BL_MD5_BLOCK_SIZE) {
+
+        BlMd5TransformBlock(State, Next);
+
+        Next += BL_MD5_BLOCK_SIZE;
+        Remaining -= BL_MD5_BLOCK_SIZE;
+    }
+
+    //
+    // Pad the trailing partial block with 0x80, zeroes, and the message length in bits.
+    //
+
+    BlRtlZeroMemory(Tail, sizeof(Tail));
+    BlRtlCopyMemory(Tail, Next, Remaining);
+
+    Tail[Remaining] = 0x80;
+
+    if (Remaining < (BL_MD5_BLOCK_SIZE - 8)) {
+
+        TailLength = BL_MD5_BLOCK_SIZE;
+
+    } else {
+
+        TailLength = 2 * BL_MD5_BLOCK_SIZE;
+    }
+
+    BitLength = ((UINT64) Length) * 8;
+
+    for (Index = 0; Index < 8; Index += 1) {
+
+        Tail[TailLength - 8 + Index] = (UINT8) (BitLength >> (Index * 8));
+    }
+
+    for (Index = 0; Index < TailLength; Index += BL_MD5_BLOCK_SIZE) {
+
+        BlMd5TransformBlock(State, &Tail[Index]);
+    }
+
+    for (Index = 0; Index < BL_MD5_DIGEST_SIZE; Index += 1) {
+
+        Digest[Index] = (UINT8) (State[Index / 4] >> ((Index % 4) * 8));
+    }
+}
@@ -52,7 +52,7 @@ BlMmCompactPhysicalRegionList(
 //  Routine Description:
 //
 //    This function compacts the physical region list by coalescing adjacent
-//    regions of the same type.
+//    regions of the same type and proximity domain.
 //
 //--
 
@@ -92,7 +92,8 @@ BlMmCompactPhysicalRegionList(
         BLASSERT(Next->Start >= Current->Limit);
 
         if ((Next->Start == Current->Limit) &&
-            (Next->Type == Current->Type)) {
+            (Next->Type == Current->Type) &&
+            (Next->ProximityDomain == Current->ProximityDomain)) {
 
             Current->Limit = Next->Limit;
             Current->Size = Current->Limit - Current->Start;
@@ -237,6 +238,7 @@ BlMmCreatePhysicalRegion(
     Region->Size = Size;
     Region->Limit = Limit;
     Region->Type = Type;
+    Region->ProximityDomain = BL_NUMA_NO_DOMAIN;
 
     BlMmInsertPhysicalRegion(Region);
 
@@ -244,17 +246,20 @@ BlMmCreatePhysicalRegion(
 }
 
 UINT64
-BlMmAllocatePhysicalRegion(
+BlMmAllocatePhysicalRegionInDomain(
     UINT32 Size,
-    UINT32 Type
+    UINT32 Type,
+    UINT32 Domain
     )
 
 //++
 //
 //  Routine Description:
 //
-//    This function allocates a physical region from the lowest available and
-//    sufficient free region.
+//    This function allocates a physical region from the highest available and
+//    sufficient free region below 4GB, preferring memory in the specified
+//    proximity domain.  If the domain has no sufficient free region, the
+//    allocation falls back to any free region.
 //
 //  Arguments:
 //
@@ -262,6 +267,8 @@ BlMmAllocatePhysicalRegion(
 //
 //    Type    - Supplies the type of the region to allocate.
 //
+//    Domain  - Supplies the preferred proximity domain, or BL_NUMA_NO_DOMAIN.
+//
 //  Return Value:
 //
 //    The physical address of the allocated region.
@@ -282,22 +289,40 @@ BlMmAllocatePhysicalRegion(
     Size = ROUND_UP_TO_PAGES(Size);
 
     Head = &BlMmPhysicalRegionList;
-    Entry = Head->Blink;
 
-    while (Entry != Head) {
+    for (;;) {
 
-        Region = CONTAINING_RECORD(Entry,
-                                   BL_MM_PHYSICAL_REGION,
-                                   Entry);
+        Entry = Head->Blink;
+
+        while (Entry != Head) {
 
-        if ((Region->Type == BL_MM_PHYSICAL_REGION_FREE) &&
-            (Region->Size >= Size) &&
-            (Region->Limit < 0x100000000UI64)) {
+            Region = CONTAINING_RECORD(Entry,
+                                       BL_MM_PHYSICAL_REGION,
+                                       Entry);
+
+            if ((Region->Type == BL_MM_PHYSICAL_REGION_FREE) &&
+                (Region->Size >= Size) &&
+                (Region->Limit < 0x100000000UI64) &&
+                ((Domain == BL_NUMA_NO_DOMAIN) || (Region->ProximityDomain == Domain))) {
+
+                break;
+            }
+
+            Entry = Entry->Blink;
+        }
+
+        if ((Entry != Head) || (Domain == BL_NUMA_NO_DOMAIN)) {
 
             break;
         }
 
-        Entry = Entry->Blink;
+#if MM_VERBOSE
+
+        BlRtlPrintf("MM: No %x bytes in domain %u; allocating remote.\n", Size, Domain);
+
+#endif
+
+        Domain = BL_NUMA_NO_DOMAIN;
     }
 
     if (Entry == Head) {
@@ -327,6 +352,7 @@ BlMmAllocatePhysicalRegion(
     Region->Size = Size;
     Region->Limit = Region->Start + Region->Size;
     Region->Type = Type;
+    Region->ProximityDomain = FreeRegion->ProximityDomain;
 
     BlRtlZeroMemory((PVOID) (ULONG_PTR) Region->Start, (ULONG_PTR) (UINT32) Region->Size);
 
@@ -335,6 +361,35 @@ BlMmAllocatePhysicalRegion(
     return Region->Start;
 }
 
+UINT64
+BlMmAllocatePhysicalRegion(
+    UINT32 Size,
+    UINT32 Type
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function allocates a physical region from the lowest available and
+//    sufficient free region.
+//
+//  Arguments:
+//
+//    Size    - Supplies the size of the region to allocate.
+//
+//    Type    - Supplies the type of the region to allocate.
+//
+//  Return Value:
+//
+//    The physical address of the allocated region.
+//
+//--
+
+{
+    return BlMmAllocatePhysicalRegionInDomain(Size, Type, BL_NUMA_NO_DOMAIN);
+}
+
 BOOLEAN
 BlMmAllocateSpecificPhysicalRegion(
     UINT64 Base,
@@ -424,6 +479,7 @@ BlMmAllocateSpecificPhysicalRegion(
         PreviousRegion->Size = Start - Region->Start;
         PreviousRegion->Limit = Start;
         PreviousRegion->Type = BL_MM_PHYSICAL_REGION_FREE;
+        PreviousRegion->ProximityDomain = Region->ProximityDomain;
     }
 
     if (Region->Limit > End) {
@@ -438,6 +494,7 @@ BlMmAllocateSpecificPhysicalRegion(
         NextRegion->Size = Region->Limit - End;
         NextRegion->Limit = Region->Limit;
         NextRegion->Type = BL_MM_PHYSICAL_REGION_FREE;
+        NextRegion->ProximityDomain = Region->ProximityDomain;
     }
 
     Region->Start = Start;
@@ -458,6 +515,126 @@ BlMmAllocateSpecificPhysicalRegion(
     return TRUE;
 }
 
+VOID
+BlMmSplitPhysicalRegion(
+    UINT64 Address
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function splits the physical region containing the specified address,
+//    so that a region boundary falls on the address.  Both halves keep the type
+//    and proximity domain of the original region.
+//
+//  Arguments:
+//
+//    Address - Supplies the page aligned address to split at.
+//
+//--
+
+{
+    PLIST_ENTRY Entry;
+    PLIST_ENTRY Head;
+    PBL_MM_PHYSICAL_REGION Region;
+    PBL_MM_PHYSICAL_REGION Upper;
+
+    BLASSERT((Address % PAGE_SIZE) == 0);
+
+    Head = &BlMmPhysicalRegionList;
+
+    for (Entry = Head->Flink; Entry != Head; Entry = Entry->Flink) {
+
+        Region = CONTAINING_RECORD(Entry,
+                                   BL_MM_PHYSICAL_REGION,
+                                   Entry);
+
+        if ((Address > Region->Start) && (Address < Region->Limit)) {
+
+            BLASSERT(BlRtlIsListEmpty(&BlMmPhysicalRegionLookaside.FreeList) == FALSE);
+
+            Upper = CONTAINING_RECORD(BlRtlRemoveHeadList(&BlMmPhysicalRegionLookaside.FreeList),
+                                      BL_MM_PHYSICAL_REGION,
+                                      Entry);
+
+            Upper->Start = Address;
+            Upper->Limit = Region->Limit;
+            Upper->Size = Upper->Limit - Upper->Start;
+            Upper->Type = Region->Type;
+            Upper->ProximityDomain = Region->ProximityDomain;
+
+            Region->Limit = Address;
+            Region->Size = Region->Limit - Region->Start;
+
+            //
+            // Link the upper half directly after the original; inserting through
+            // BlMmInsertPhysicalRegion would coalesce the two halves again.
+            //
+
+            BlRtlInsertTailList(Region->Entry.Flink, &Upper->Entry);
+
+            return;
+        }
+    }
+}
+
+VOID
+BlMmSetProximityDomains(
+    VOID
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function tags the physical region list with the proximity domains
+//    described by the ACPI SRAT.  Regions are split at the boundaries of the
+//    SRAT memory ranges, so that every region lies within a single domain.
+//
+//--
+
+{
+    PLIST_ENTRY Entry;
+    PLIST_ENTRY Head;
+    UINT32 Index;
+    PBL_NUMA_MEMORY Memory;
+    PBL_MM_PHYSICAL_REGION Region;
+
+    if (BlAcpiNumaTopology.MemoryCount == 0) {
+
+        return;
+    }
+
+    for (Index = 0; Index < BlAcpiNumaTopology.MemoryCount; Index += 1) {
+
+        Memory = &BlAcpiNumaTopology.Memory[Index];
+
+        BlMmSplitPhysicalRegion(Memory->Base & ~((UINT64) PAGE_SIZE - 1));
+        BlMmSplitPhysicalRegion((Memory->Base + Memory->Size) & ~((UINT64) PAGE_SIZE - 1));
+    }
+
+    Head = &BlMmPhysicalRegionList;
+
+    for (Entry = Head->Flink; Entry != Head; Entry = Entry->Flink) {
+
+        Region = CONTAINING_RECORD(Entry,
+                                   BL_MM_PHYSICAL_REGION,
+                                   Entry);
+
+        Region->ProximityDomain = BlAcpiGetMemoryProximityDomain(Region->Start);
+    }
+
+    BlMmCompactPhysicalRegionList();
+
+#if MM_VERBOSE
+
+    BlMmDumpPhysicalRegionList();
+
+#endif
+
+}
+
 BOOLEAN
 BlMmFindFreePhysicalRegion(
     PUINT64 Base,
@@ -652,10 +829,21 @@ BlMmDumpPhysicalRegionList(
 
         Region = CONTAINING_RECORD(Entry, BL_MM_PHYSICAL_REGION, Entry);
 
-        BlRtlPrintf("MM:   %016I64x...%016I64x %s\n",
-                    Region->Start,
-                    Region->Limit,
-                    BlMmPhysicalRegionTypeString(Region->Type));
+        if (Region->ProximityDomain == BL_NUMA_NO_DOMAIN) {
+
+            BlRtlPrintf("MM:   %016I64x...%016I64x %s\n",
+                        Region->Start,
+                        Region->Limit,
+                        BlMmPhysicalRegionTypeString(Region->Type));
+
+        } else {
+
+            BlRtlPrintf("MM:   %016I64x...%016I64x %s [Domain %u]\n",
+                        Region->Start,
+                        Region->Limit,
+                        BlMmPhysicalRegionTypeString(Region->Type),
+                        Region->ProximityDomain);
+        }
     }
 
     BlRtlPrintf("\n");
@@ -41,6 +41,12 @@
 #define PCI_BASE_ADDRESS_SHIFT          4
 #define PCI_BASE_ADDRESS_FLAGS_MASK     0xF
 
+#define PCI_COMMAND_MEMORY              0x0002
+#define PCI_COMMAND_MASTER              0x0004
+
+#define PCI_VENDOR_INTEL                0x8086
+#define PCI_DEVICE_82540EM              0x100E
+
 #pragma pack(1)
 
 typedef struct _PCI_CONFIGURATION_SPACE_HEADER {
@@ -139,6 +145,7 @@ C_ASSERT(sizeof(((PPCI_BASE_ADDRESS) 0)->u1.Io) == sizeof(UINT32));
 
 PCI_INSTALLATION_CHECK BlPciInstallationCheck;
 UINT32 BlPciOhci1394BaseAddress;
+UINT32 BlPciKdNicBaseAddress;
 
 BOOLEAN
 BlPciCheckBios(
@@ -555,6 +562,26 @@ BlPciScanDevices(
 
                                             BlPciOhci1394BaseAddress = (UINT32) Address;
                                         }
+
+                                        //
+                                        // Check if this is the register BAR of an 82540EM (the e1000 most
+                                        // emulators provide), which network KD drives.  Singularity has no
+                                        // driver of its own for this part.  KD needs bus mastering for DMA.
+                                        //
+
+                                        if ((Config.VendorId == PCI_VENDOR_INTEL) &&
+                                            (Config.DeviceId == PCI_DEVICE_82540EM) &&
+                                            (Index == 0) &&
+                                            (BlPciKdNicBaseAddress == 0)) {
+
+                                            BlPciKdNicBaseAddress = (UINT32) Address;
+
+                                            BlPciWriteConfigurationRegister(BusNumber,
+                                                                            DeviceNumber,
+                                                                            FunctionNumber,
+                                                                            (UINT8) FIELD_OFFSET(PCI_CONFIGURATION_SPACE_HEADER, Command),
+                                                                            Config.Command | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+                                        }
                                     }
 
                                     break;
@@ -50,6 +50,8 @@ typedef struct _IMAGE_FILE_HEADER {
     UINT16 Characteristics;
 } IMAGE_FILE_HEADER, *PIMAGE_FILE_HEADER;
 
+#define IMAGE_FILE_RELOCS_STRIPPED          0x0001
+
 typedef struct _IMAGE_DATA_DIRECTORY {
     UINT32 VirtualAddress;
     UINT32 Size;
@@ -176,6 +178,31 @@ typedef struct _IMAGE_BASE_RELOCATION {
 #define IMAGE_REL_BASED_HIGHLOW               3
 #define IMAGE_REL_BASED_DIR64                 10
 
+//
+// Each section is loaded by one work item, which copies the raw data, zeroes the
+// uninitialized tail and applies the fixups for the section while it is still in
+// the cache.  Sections beyond the limit are loaded on the bootstrap processor.
+//
+// The relocation blocks are split among the sections once, before any work is
+// queued: Parameter and Length of a work item give the run of blocks that may
+// hold fixups for its section.
+//
+
+#define BL_PE_MAX_SECTION_ITEMS               32
+
+typedef struct _BL_PE_LOAD_CONTEXT {
+    PVOID Image;
+    ULONG_PTR VirtualBase;
+    ULONG_PTR RelocDiff;
+    PUINT8 RelocList;
+    PUINT8 RelocListEnd;
+    BOOLEAN RelocSorted;
+} BL_PE_LOAD_CONTEXT, *PBL_PE_LOAD_CONTEXT;
+
+BL_PE_LOAD_CONTEXT BlPeLoadContext;
+
+BL_AP_WORK_ITEM BlPeSectionWorkItem[BL_PE_MAX_SECTION_ITEMS];
+
 VOID
 BlPeGetVirtualRange(
     PVOID Image,
@@ -258,14 +285,18 @@ VOID
 BlPeApplyFixupBlock(
     PIMAGE_BASE_RELOCATION Block,
     ULONG_PTR VirtualBase,
-    ULONG_PTR RelocDiff
+    ULONG_PTR RelocDiff,
+    UINT32 RvaStart,
+    UINT32 RvaEnd
     )
 
 //++
 //
 //  Routine Description:
 //
-//    This function applies all of the base fixups in the specified block to the image.
+//    This function applies the base fixups in the specified block that fall into
+//    the specified range of the image.  A block covers one page, and a page may
+//    be shared by two sections, so each fixup is checked on its own.
 //
 //  Arguments:
 //
@@ -275,12 +306,17 @@ BlPeApplyFixupBlock(
 //
 //    RelocDiff   - Supplies the offset of the image target address from the base address.
 //
+//    RvaStart    - Supplies the first relative virtual address of the range.
+//
+//    RvaEnd      - Supplies the relative virtual address just past the range.
+//
 //--
 
 {
     PUINT16 Reloc;
     PUINT16 BlockEnd;
     ULONG_PTR BlockBase;
+    UINT32 Rva;
     ULONG_PTR Target;
 
     Reloc = Block->TypeOffset;
@@ -295,6 +331,13 @@ BlPeApplyFixupBlock(
 
     for (; Reloc < BlockEnd; Reloc++) {
 
+        Rva = Block->VirtualAddress + (*Reloc & 0xfff);
+
+        if ((Rva < RvaStart) || (Rva >= RvaEnd)) {
+
+            continue;
+        }
+
         Target = BlockBase + (*Reloc & 0xfff);
 
 #if PECOFF_VERBOSE
@@ -342,7 +385,7 @@ BlPeApplyFixupBlock(
 
             case IMAGE_REL_BASED_DIR64: {
 
-                * (PUINT64 *) Target += (UINT64) RelocDiff;
+                * (PUINT64) Target += (UINT64) RelocDiff;
                 break;
             }
 
@@ -355,6 +398,175 @@ BlPeApplyFixupBlock(
     }
 }
 
+PVOID
+BlPeGetFileData(
+    PIMAGE_NT_HEADERS NtHeader,
+    PVOID Image,
+    UINT32 Rva,
+    UINT32 Size
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function locates the raw data for the specified range of the image
+//    in the image file.
+//
+//  Arguments:
+//
+//    NtHeader    - Supplies a pointer to the NT header of the image.
+//
+//    Image       - Supplies a pointer to the image file.
+//
+//    Rva         - Supplies the relative virtual address of the range.
+//
+//    Size        - Supplies the size of the range.
+//
+//  Return Value:
+//
+//    Pointer to the raw data of the range, if it is backed by the file.
+//    NULL, otherwise.
+//
+//--
+
+{
+    UINT32 Index;
+    PIMAGE_SECTION_HEADER Section;
+
+    Section = (PIMAGE_SECTION_HEADER) (((ULONG_PTR) &NtHeader->OptionalHeader) + NtHeader->FileHeader.SizeOfOptionalHeader);
+
+    for (Index = 0; Index < NtHeader->FileHeader.NumberOfSections; Index += 1) {
+
+        if ((Rva >= Section[Index].VirtualAddress) &&
+            ((Rva - Section[Index].VirtualAddress) + Size <= Section[Index].SizeOfRawData)) {
+
+            return (PVOID) ((ULONG_PTR) Image + Section[Index].PointerToRawData + (Rva - Section[Index].VirtualAddress));
+        }
+    }
+
+    return NULL;
+}
+
+PUINT8
+BlPeFindRelocationBlock(
+    PUINT8 RelocList,
+    PUINT8 RelocListEnd,
+    UINT32 Rva
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function finds the first block in a sorted run of base relocation
+//    blocks whose page lies at or above the specified address.
+//
+//  Arguments:
+//
+//    RelocList       - Supplies the first block to consider.
+//
+//    RelocListEnd    - Supplies the end of the blocks.
+//
+//    Rva             - Supplies the relative virtual address to search for.
+//
+//  Return Value:
+//
+//    Pointer to the block, or RelocListEnd if there is none.
+//
+//--
+
+{
+    PIMAGE_BASE_RELOCATION Block;
+
+    while (RelocList < RelocListEnd) {
+
+        Block = (PIMAGE_BASE_RELOCATION) RelocList;
+
+        if (Block->VirtualAddress >= Rva) {
+
+            break;
+        }
+
+        RelocList += Block->SizeOfBlock;
+    }
+
+    return RelocList;
+}
+
+VOID
+BlPeLoadSection(
+    PBL_AP_WORK_ITEM WorkItem
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function loads one section of an image. It copies the raw data, zeroes
+//    only the part of the section that is not backed by the file, and then applies
+//    the base fixups that fall into the section. It may run on any processor;
+//    sections describe disjoint ranges of the image.
+//
+//  Arguments:
+//
+//    WorkItem    - Supplies the work item; Buffer is the section header, Context
+//                  the load context, and Parameter and Length the relocation
+//                  blocks to search for the fixups of the section.
+//
+//--
+
+{
+    PIMAGE_BASE_RELOCATION Block;
+    ULONG_PTR BytesToCopy;
+    PBL_PE_LOAD_CONTEXT Context;
+    PUINT8 RelocList;
+    PUINT8 RelocListEnd;
+    PIMAGE_SECTION_HEADER Section;
+    ULONG_PTR Target;
+
+    Context = (PBL_PE_LOAD_CONTEXT) WorkItem->Context;
+    Section = (PIMAGE_SECTION_HEADER) WorkItem->Buffer;
+    Target = Context->VirtualBase + Section->VirtualAddress;
+
+    if (Section->SizeOfRawData < Section->Misc.VirtualSize) {
+
+        BytesToCopy = Section->SizeOfRawData;
+
+    } else {
+
+        BytesToCopy = Section->Misc.VirtualSize;
+    }
+
+    BlRtlCopyMemory((PVOID) Target,
+                    (PVOID) (((ULONG_PTR) Context->Image) + Section->PointerToRawData),
+                    BytesToCopy);
+
+    if (BytesToCopy < Section->Misc.VirtualSize) {
+
+        BlRtlZeroMemory((PVOID) (Target + BytesToCopy), Section->Misc.VirtualSize - BytesToCopy);
+    }
+
+    if (Context->RelocDiff == 0) {
+
+        return;
+    }
+
+    RelocList = (PUINT8) WorkItem->Parameter;
+    RelocListEnd = RelocList + WorkItem->Length;
+
+    for (; RelocList < RelocListEnd; RelocList += Block->SizeOfBlock) {
+
+        Block = (PIMAGE_BASE_RELOCATION) RelocList;
+
+        BlPeApplyFixupBlock(Block,
+                            Context->VirtualBase,
+                            Context->RelocDiff,
+                            Section->VirtualAddress,
+                            Section->VirtualAddress + Section->Misc.VirtualSize);
+    }
+}
+
 VOID
 BlPeLoadImage(
     PVOID LoadBase,
@@ -366,10 +578,16 @@ BlPeLoadImage(
 //
 //  Routine Description:
 //
-//    This function loads the specified image.
+//    This function loads the specified image in a single pass over its sections.
+//
+//    An image linked at its load base (or with relocations stripped, as for a
+//    kernel whose fixups were pre-resolved for its default base) is copied without
+//    any fixup pass.
 //
 //  Arguments:
 //
+//    LoadBase    - Supplies the address to load the image at.
+//
 //    Image       - Supplies a pointer to the image to load.
 //
 //    EntryPoint  - Receives a pointer to the entry point of the image.
@@ -377,13 +595,19 @@ BlPeLoadImage(
 //--
 
 {
-    ULONG_PTR BytesToCopy;
+    PIMAGE_BASE_RELOCATION Block;
     PIMAGE_DOS_HEADER DosHeader;
     UINT32 Index;
     PIMAGE_NT_HEADERS NtHeader;
+    PIMAGE_DATA_DIRECTORY RelocDirectory;
+    PUINT8 RelocFirst;
+    PUINT8 RelocLast;
+    PUINT8 RelocList;
+    UINT32 RelocPage;
     PIMAGE_SECTION_HEADER Section;
+    BL_AP_WORK_ITEM SerialWorkItem;
+    PBL_AP_WORK_ITEM WorkItem;
     ULONG_PTR VirtualBase;
-    ULONG_PTR RelocDiff;
 
     VirtualBase = (ULONG_PTR) LoadBase;
     DosHeader = (PIMAGE_DOS_HEADER) Image;
@@ -414,28 +638,84 @@ BlPeLoadImage(
         BlRtlHalt();
     }
 
-    BlRtlCopyMemory((PVOID) VirtualBase,
-                    Image,
-                    NtHeader->OptionalHeader.SizeOfHeaders);
+    BlPeLoadContext.Image = Image;
+    BlPeLoadContext.VirtualBase = VirtualBase;
+    BlPeLoadContext.RelocDiff = VirtualBase - (ULONG_PTR) NtHeader->OptionalHeader.ImageBase;
+    BlPeLoadContext.RelocList = NULL;
+    BlPeLoadContext.RelocListEnd = NULL;
+    BlPeLoadContext.RelocSorted = TRUE;
 
-    Section = (PIMAGE_SECTION_HEADER) (((ULONG_PTR) &NtHeader->OptionalHeader) + NtHeader->FileHeader.SizeOfOptionalHeader);
+    if (BlPeLoadContext.RelocDiff != 0) {
 
-    for (Index = 0; Index < NtHeader->FileHeader.NumberOfSections; Index += 1) {
+        if ((NtHeader->FileHeader.Characteristics & IMAGE_FILE_RELOCS_STRIPPED) != 0) {
 
-        BlRtlZeroMemory((PVOID) (VirtualBase + Section[Index].VirtualAddress), Section[Index].Misc.VirtualSize);
+            BlRtlPrintf("PECOFF: Relocations stripped; image must load at %p.\n", NtHeader->OptionalHeader.ImageBase);
+            BlRtlHalt();
+        }
 
-        if (Section[Index].SizeOfRawData < Section[Index].Misc.VirtualSize) {
+        //
+        // Read the relocations from the file, so that every section can be fixed
+        // up as soon as it is copied, independent of where .reloc lies.
+        //
 
-            BytesToCopy = Section[Index].SizeOfRawData;
+        RelocDirectory = &NtHeader->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
 
-        } else {
+        if (RelocDirectory->Size > 0) {
 
-            BytesToCopy = Section[Index].Misc.VirtualSize;
+            BlPeLoadContext.RelocList = (PUINT8) BlPeGetFileData(NtHeader, Image, RelocDirectory->VirtualAddress, RelocDirectory->Size);
+
+            if (BlPeLoadContext.RelocList == NULL) {
+
+                BlRtlPrintf("PECOFF: Relocations not in file!\n");
+                BlRtlHalt();
+            }
+
+            BlPeLoadContext.RelocListEnd = BlPeLoadContext.RelocList + RelocDirectory->Size;
         }
 
-        BlRtlCopyMemory((PVOID) (VirtualBase + Section[Index].VirtualAddress),
-                        (PVOID) (((ULONG_PTR) Image) + Section[Index].PointerToRawData),
-                        BytesToCopy);
+        //
+        // Linkers emit the blocks sorted by page, which lets each section find its
+        // blocks as one contiguous run.  Check that once; an unsorted list is
+        // searched in full for every section.  A malformed block ends the list.
+        //
+
+        RelocPage = 0;
+
+        for (RelocList = BlPeLoadContext.RelocList; RelocList < BlPeLoadContext.RelocListEnd; RelocList += Block->SizeOfBlock) {
+
+            Block = (PIMAGE_BASE_RELOCATION) RelocList;
+
+            if (Block->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION)) {
+
+                BlPeLoadContext.RelocListEnd = RelocList;
+                break;
+            }
+
+            if (Block->VirtualAddress < RelocPage) {
+
+                BlPeLoadContext.RelocSorted = FALSE;
+            }
+
+            RelocPage = Block->VirtualAddress;
+        }
+
+#if PECOFF_VERBOSE
+
+        BlRtlPrintf("PECOFF: Relocs: %p ... %p\n", BlPeLoadContext.RelocList, BlPeLoadContext.RelocListEnd);
+
+#endif
+
+    }
+
+    BlRtlCopyMemory((PVOID) VirtualBase,
+                    Image,
+                    NtHeader->OptionalHeader.SizeOfHeaders);
+
+    Section = (PIMAGE_SECTION_HEADER) (((ULONG_PTR) &NtHeader->OptionalHeader) + NtHeader->FileHeader.SizeOfOptionalHeader);
+
+    RelocFirst = BlPeLoadContext.RelocList;
+
+    for (Index = 0; Index < NtHeader->FileHeader.NumberOfSections; Index += 1) {
 
 #if PECOFF_VERBOSE
 
@@ -452,43 +732,67 @@ BlPeLoadImage(
                         VirtualBase + Section[Index].VirtualAddress,
                         VirtualBase + Section[Index].VirtualAddress + Section[Index].Misc.VirtualSize - 1,
                         (((ULONG_PTR) Image) + Section[Index].PointerToRawData),
-                        (((ULONG_PTR) Image) + Section[Index].PointerToRawData) + BytesToCopy,
+                        (((ULONG_PTR) Image) + Section[Index].PointerToRawData) + Section[Index].SizeOfRawData,
                         Temp);
         }
 
 #endif
 
-    }
+        //
+        // Find the blocks for the pages the section touches.  Sections are sorted
+        // too, so the search for the next section resumes where this one began;
+        // the last page of a section may also be the first page of the next.
+        //
 
-    RelocDiff = VirtualBase - (ULONG_PTR)NtHeader->OptionalHeader.ImageBase;
+        if (BlPeLoadContext.RelocSorted != FALSE) {
 
-    if (RelocDiff != 0) {
+            if ((Index > 0) && (Section[Index].VirtualAddress < Section[Index - 1].VirtualAddress)) {
 
-        PUINT8 RelocList;
-        PUINT8 RelocListEnd;
-        PIMAGE_BASE_RELOCATION Block;
+                RelocFirst = BlPeLoadContext.RelocList;
+            }
 
-        RelocList = (PUINT8) (VirtualBase + NtHeader->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC].VirtualAddress);
-        RelocListEnd = RelocList + NtHeader->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC].Size;
+            RelocFirst = BlPeFindRelocationBlock(RelocFirst,
+                                                 BlPeLoadContext.RelocListEnd,
+                                                 Section[Index].VirtualAddress & ~(PAGE_SIZE - 1));
 
-#if PECOFF_VERBOSE
+            RelocLast = BlPeFindRelocationBlock(RelocFirst,
+                                                BlPeLoadContext.RelocListEnd,
+                                                Section[Index].VirtualAddress + Section[Index].Misc.VirtualSize);
 
-        BlRtlPrintf("PECOFF: Relocs: %p ... %p\n", RelocList, RelocListEnd);
+        } else {
 
-#endif
+            RelocFirst = BlPeLoadContext.RelocList;
+            RelocLast = BlPeLoadContext.RelocListEnd;
+        }
 
-        while (RelocList < RelocListEnd) {
+        if (Index < BL_PE_MAX_SECTION_ITEMS) {
 
-            Block = (PIMAGE_BASE_RELOCATION) RelocList;
+            WorkItem = &BlPeSectionWorkItem[Index];
+            WorkItem->Routine = BlPeLoadSection;
 
-            BlPeApplyFixupBlock(Block, VirtualBase, RelocDiff);
+        } else {
+
+            WorkItem = &SerialWorkItem;
+        }
+
+        WorkItem->Buffer = &Section[Index];
+        WorkItem->Context = &BlPeLoadContext;
+        WorkItem->Parameter = (ULONG_PTR) RelocFirst;
+        WorkItem->Length = (ULONG_PTR) (RelocLast - RelocFirst);
+
+        if (Index < BL_PE_MAX_SECTION_ITEMS) {
 
-            RelocList += Block->SizeOfBlock;
+            BlApQueueWorkItem(WorkItem);
+
+        } else {
+
+            BlPeLoadSection(WorkItem);
         }
     }
 
+    BlApWaitForWorkItems();
+
     *EntryPoint = (PVOID) (VirtualBase + NtHeader->OptionalHeader.AddressOfEntryPoint);
 
     return;
 }
-
@@ -0,0 +1,272 @@
+//++
+//
+//  Copyright (c) Microsoft Corporation
+//
+//  Module Name:
+//
+//    blprof.cpp
+//
+//  Abstract:
+//
+//    This module implements the boot phase profiler.  Phases are nested time
+//    stamp counter spans that also record the bytes read from the boot device
+//    and the number of legacy BIOS calls made while they were open.
+//
+//    The profiler is only used by the bootstrap processor.
+//
+//  Environment:
+//
+//    Boot loader.
+//
+//--
+
+#include "bl.h"
+
+#define BL_PROF_NAME_COLUMN             32
+
+BL_PROF_PHASE BlProfPhase[BL_PROF_MAX_PHASES];
+UINT32 BlProfPhaseCount;
+UINT32 BlProfCurrentPhase = BL_PROF_NO_PHASE;
+
+UINT64 BlProfIoBytes;
+UINT32 BlProfBiosCalls;
+
+UINT32
+BlProfBeginPhase(
+    PCSTR Name
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function opens a new phase nested in the current phase.
+//
+//  Arguments:
+//
+//    Name    - Supplies the name of the phase.
+//
+//  Return Value:
+//
+//    Handle of the phase, to be passed to BlProfEndPhase.
+//    BL_PROF_NO_PHASE, if the phase table is full.
+//
+//--
+
+{
+    UINT32 Index;
+    PBL_PROF_PHASE Phase;
+
+    if (BlProfPhaseCount == BL_PROF_MAX_PHASES) {
+
+        return BL_PROF_NO_PHASE;
+    }
+
+    Phase = &BlProfPhase[BlProfPhaseCount];
+
+    for (Index = 0; (Index < (BL_PROF_NAME_LENGTH - 1)) && (Name[Index] != 0); Index += 1) {
+
+        Phase->Name[Index] = Name[Index];
+    }
+
+    Phase->Name[Index] = 0;
+    Phase->Parent = BlProfCurrentPhase;
+
+    //
+    // Keep the starting counters in the phase until it ends.
+    //
+
+    Phase->IoBytes = BlProfIoBytes;
+    Phase->BiosCalls = BlProfBiosCalls;
+    Phase->EndTicks = 0;
+    Phase->StartTicks = __rdtsc();
+
+    BlProfCurrentPhase = BlProfPhaseCount;
+    BlProfPhaseCount += 1;
+
+    return BlProfCurrentPhase;
+}
+
+VOID
+BlProfEndPhase(
+    UINT32 Handle
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function closes the specified phase, along with any phase nested in it
+//    that is still open.
+//
+//  Arguments:
+//
+//    Handle  - Supplies the handle returned by BlProfBeginPhase.
+//
+//--
+
+{
+    UINT64 Now;
+    PBL_PROF_PHASE Phase;
+
+    if (Handle >= BlProfPhaseCount) {
+
+        return;
+    }
+
+    Now = __rdtsc();
+
+    while (BlProfCurrentPhase != BL_PROF_NO_PHASE) {
+
+        Phase = &BlProfPhase[BlProfCurrentPhase];
+
+        Phase->EndTicks = Now;
+        Phase->IoBytes = BlProfIoBytes - Phase->IoBytes;
+        Phase->BiosCalls = BlProfBiosCalls - Phase->BiosCalls;
+
+        if (BlProfCurrentPhase == Handle) {
+
+            BlProfCurrentPhase = Phase->Parent;
+            break;
+        }
+
+        BlProfCurrentPhase = Phase->Parent;
+    }
+}
+
+VOID
+BlProfAddIoBytes(
+    UINT32 NumberOfBytes
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function accounts for data read from the boot device.
+//
+//  Arguments:
+//
+//    NumberOfBytes   - Supplies the number of bytes read.
+//
+//--
+
+{
+    BlProfIoBytes += NumberOfBytes;
+}
+
+UINT32
+BlProfCopyPhases(
+    PBL_PROF_PHASE Buffer
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function copies the phase table, for handing it to the kernel. Phases
+//    that are still open are copied with their end time set to the current time
+//    and their counters up to date.
+//
+//  Arguments:
+//
+//    Buffer  - Receives BL_PROF_MAX_PHASES entries.
+//
+//  Return Value:
+//
+//    Number of phases copied.
+//
+//--
+
+{
+    UINT32 Index;
+    UINT64 Now;
+
+    Now = __rdtsc();
+
+    BlRtlCopyMemory(Buffer, BlProfPhase, BlProfPhaseCount * sizeof(BL_PROF_PHASE));
+
+    for (Index = BlProfCurrentPhase; Index != BL_PROF_NO_PHASE; Index = BlProfPhase[Index].Parent) {
+
+        Buffer[Index].EndTicks = Now;
+        Buffer[Index].IoBytes = BlProfIoBytes - BlProfPhase[Index].IoBytes;
+        Buffer[Index].BiosCalls = BlProfBiosCalls - BlProfPhase[Index].BiosCalls;
+    }
+
+    return BlProfPhaseCount;
+}
+
+VOID
+BlProfDump(
+    VOID
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function prints the phase table to the debugger, indented by nesting
+//    depth.  Phases that are still open are reported up to the current time.
+//
+//--
+
+{
+    UINT32 Column;
+    UINT32 Depth;
+    UINT32 Index;
+    UINT32 Parent;
+    BL_PROF_PHASE Phase;
+    CHAR Name[BL_PROF_NAME_COLUMN + 1];
+
+    BlKdPrintf("PROF: Phase                             Start(us)   Time(us)    I/O bytes   BIOS\n");
+
+    for (Index = 0; Index < BlProfPhaseCount; Index += 1) {
+
+        Phase = BlProfPhase[Index];
+
+        if (Phase.EndTicks == 0) {
+
+            Phase.EndTicks = __rdtsc();
+            Phase.IoBytes = BlProfIoBytes - Phase.IoBytes;
+            Phase.BiosCalls = BlProfBiosCalls - Phase.BiosCalls;
+        }
+
+        //
+        // Indent the name by nesting depth and pad it to a fixed column.
+        //
+
+        Depth = 0;
+
+        for (Parent = Phase.Parent; Parent != BL_PROF_NO_PHASE; Parent = BlProfPhase[Parent].Parent) {
+
+            Depth += 1;
+        }
+
+        Column = 0;
+
+        while ((Column < (2 * Depth)) && (Column < (BL_PROF_NAME_COLUMN - BL_PROF_NAME_LENGTH))) {
+
+            Name[Column] = ' ';
+            Column += 1;
+        }
+
+        BlRtlCopyMemory(&Name[Column], Phase.Name, BlRtlStringLength(Phase.Name));
+
+        Column += BlRtlStringLength(Phase.Name);
+
+        while (Column < BL_PROF_NAME_COLUMN) {
+
+            Name[Column] = ' ';
+            Column += 1;
+        }
+
+        Name[Column] = 0;
+
+        BlKdPrintf("PROF: %s %10I64u %10I64u %12I64u %6u\n",
+                   Name,
+                   BlRtlTscToMicroseconds(Phase.StartTicks - BlProfPhase[0].StartTicks),
+                   BlRtlTscToMicroseconds(Phase.EndTicks - Phase.StartTicks),
+                   Phase.IoBytes,
+                   Phase.BiosCalls);
+    }
+}
@@ -114,6 +114,10 @@ typedef UINT16 PXE_STATUS;
 
 #define PXE_OPCODE_TFTP_READ_FILE       0x0023
 #define PXE_OPCODE_TFTP_GET_FILE_SIZE   0x0025
+#define PXE_OPCODE_UDP_OPEN             0x0030
+#define PXE_OPCODE_UDP_CLOSE            0x0031
+#define PXE_OPCODE_UDP_READ             0x0032
+#define PXE_OPCODE_UDP_WRITE            0x0033
 #define PXE_OPCODE_GET_CACHED_INFO      0x0071
 
 #define PXE_PACKET_TYPE_DHCP_ACK        2
@@ -151,18 +155,89 @@ typedef struct _PXE_TFTP_READ_FILE {
     UINT16 ReopenDelay;
 } PXE_TFTP_READ_FILE, *PPXE_TFTP_READ_FILE;
 
+typedef struct _PXE_UDP_OPEN {
+    PXE_STATUS Status;
+    IP_ADDRESS SourceIP;
+} PXE_UDP_OPEN, *PPXE_UDP_OPEN;
+
+typedef struct _PXE_UDP_CLOSE {
+    PXE_STATUS Status;
+} PXE_UDP_CLOSE, *PPXE_UDP_CLOSE;
+
+typedef struct _PXE_UDP_WRITE {
+    PXE_STATUS Status;
+    IP_ADDRESS ServerIP;
+    IP_ADDRESS GatewayIP;
+    UINT16 SourcePort;
+    UINT16 DestinationPort;
+    UINT16 BufferSize;
+    FAR_POINTER Buffer;
+} PXE_UDP_WRITE, *PPXE_UDP_WRITE;
+
+typedef struct _PXE_UDP_READ {
+    PXE_STATUS Status;
+    IP_ADDRESS SourceIP;
+    IP_ADDRESS DestinationIP;
+    UINT16 SourcePort;
+    UINT16 DestinationPort;
+    UINT16 BufferSize;
+    FAR_POINTER Buffer;
+} PXE_UDP_READ, *PPXE_UDP_READ;
+
 typedef struct _PXE_API_PACKET {
     union {
         PXE_GET_CACHED_INFO GetCachedInfo;
         PXE_TFTP_GET_FILE_SIZE TFTPGetFileSize;
         PXE_TFTP_READ_FILE TFTPReadFile;
+        PXE_UDP_OPEN UdpOpen;
+        PXE_UDP_CLOSE UdpClose;
+        PXE_UDP_WRITE UdpWrite;
+        PXE_UDP_READ UdpRead;
     } u1;
 } PXE_API_PACKET, *PPXE_API_PACKET;
 
+//
+// TFTP (RFC 1350) with the blksize (RFC 2348), tsize (RFC 2349) and
+// windowsize (RFC 7440) options.
+//
+
+#define TFTP_OPCODE_RRQ                 1
+#define TFTP_OPCODE_DATA                3
+#define TFTP_OPCODE_ACK                 4
+#define TFTP_OPCODE_ERROR               5
+#define TFTP_OPCODE_OACK                6
+
+#define TFTP_SERVER_PORT                69
+#define TFTP_DEFAULT_BLOCK_SIZE         512
+
+typedef struct _TFTP_HEADER {
+    UINT16 OpCode;
+    UINT16 Block;
+} TFTP_HEADER, *PTFTP_HEADER;
+
 #pragma pack()
 
+//
+// The UDP-based TFTP client negotiates the largest block that fits in an Ethernet
+// frame (1500 - IP - UDP - TFTP headers) and keeps a window of blocks in flight.
+//
+
+#define BL_PXE_TFTP_BLOCK_SIZE          1468
+#define BL_PXE_TFTP_WINDOW_SIZE         8
+#define BL_PXE_TFTP_TIMEOUT             1000000
+#define BL_PXE_TFTP_RETRY_COUNT         5
+#define BL_PXE_TFTP_CLIENT_PORT         0xC000
+
+#define BL_PXE_STRING2(X)               #X
+#define BL_PXE_STRING(X)                BL_PXE_STRING2(X)
+
+#define BL_PXE_SWAP16(X)                ((UINT16) ((((X) & 0xFF) << 8) | (((X) >> 8) & 0xFF)))
+
 PXE_API_PACKET BlPxeApiPacket;
 BOOTP_REPLY BlPxeBootpReply;
+UINT8 BlPxeTftpPacket[sizeof(TFTP_HEADER) + BL_PXE_TFTP_BLOCK_SIZE];
+BOOLEAN BlPxeUdpEnabled = TRUE;
+UINT16 BlPxeTftpNextClientPort;
 UINT16 BlPxeCallFrame[16];
 FAR_POINTER BlPxeEntry16;
 PPXE_EXTENDED_INFORMATION BlPxeExtendedInformation;
@@ -425,6 +500,508 @@ BlPxeGetFileSize(
     return TRUE;
 }
 
+BOOLEAN
+BlPxeUdpSend(
+    UINT16 ClientPort,
+    UINT16 ServerPort,
+    UINT16 Length
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function sends the TFTP packet buffer to the boot server.
+//
+//  Arguments:
+//
+//    ClientPort  - Supplies the local port (host order).
+//
+//    ServerPort  - Supplies the server port (host order).
+//
+//    Length      - Supplies the number of bytes of the packet buffer to send.
+//
+//  Return Value:
+//
+//    TRUE, if the packet was sent.
+//    FALSE, otherwise.
+//
+//--
+
+{
+    PPXE_UDP_WRITE UdpWrite;
+
+    UdpWrite = &BlPxeApiPacket.u1.UdpWrite;
+
+    BlRtlZeroMemory(UdpWrite, sizeof(PXE_UDP_WRITE));
+
+    UdpWrite->ServerIP = BlPxeBootpReply.ServerIP;
+    UdpWrite->GatewayIP = BlPxeBootpReply.GatewayIP;
+    UdpWrite->SourcePort = BL_PXE_SWAP16(ClientPort);
+    UdpWrite->DestinationPort = BL_PXE_SWAP16(ServerPort);
+    UdpWrite->BufferSize = Length;
+
+    BlRtlConvertLinearPointerToFarPointer(BlPxeTftpPacket, &UdpWrite->Buffer);
+
+    BlPxeCallPxeApi(PXE_OPCODE_UDP_WRITE, UdpWrite);
+
+    return (UdpWrite->Status == PXE_STATUS_SUCCESS);
+}
+
+BOOLEAN
+BlPxeUdpReceive(
+    UINT16 ClientPort,
+    PUINT16 ServerPort,
+    PUINT16 Length
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function polls for a packet from the boot server into the TFTP packet buffer.
+//
+//  Arguments:
+//
+//    ClientPort  - Supplies the local port (host order).
+//
+//    ServerPort  - Receives the port the packet was sent from (host order).
+//
+//    Length      - Receives the length of the packet.
+//
+//  Return Value:
+//
+//    TRUE, if a packet was received.
+//    FALSE, otherwise.
+//
+//--
+
+{
+    PPXE_UDP_READ UdpRead;
+
+    UdpRead = &BlPxeApiPacket.u1.UdpRead;
+
+    BlRtlZeroMemory(UdpRead, sizeof(PXE_UDP_READ));
+
+    UdpRead->DestinationPort = BL_PXE_SWAP16(ClientPort);
+    UdpRead->BufferSize = sizeof(BlPxeTftpPacket);
+
+    BlRtlConvertLinearPointerToFarPointer(BlPxeTftpPacket, &UdpRead->Buffer);
+
+    BlPxeCallPxeApi(PXE_OPCODE_UDP_READ, UdpRead);
+
+    if ((UdpRead->Status != PXE_STATUS_SUCCESS) ||
+        (UdpRead->SourceIP.Value != BlPxeBootpReply.ServerIP.Value) ||
+        (UdpRead->BufferSize < sizeof(TFTP_HEADER))) {
+
+        return FALSE;
+    }
+
+    *ServerPort = BL_PXE_SWAP16(UdpRead->SourcePort);
+    *Length = UdpRead->BufferSize;
+
+    return TRUE;
+}
+
+UINT16
+BlPxeTftpBuildRequest(
+    PCSTR Path
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function builds a read request with blksize and windowsize options
+//    in the TFTP packet buffer.
+//
+//  Arguments:
+//
+//    Path    - Supplies the path to the file to read.
+//
+//  Return Value:
+//
+//    Length of the request, or zero if the path is too long.
+//
+//--
+
+{
+    static const CHAR Options[] = "octet\0"
+                                  "blksize\0" BL_PXE_STRING(BL_PXE_TFTP_BLOCK_SIZE) "\0"
+                                  "windowsize\0" BL_PXE_STRING(BL_PXE_TFTP_WINDOW_SIZE) "\0";
+    UINT32 Length;
+    UINT32 PathLength;
+
+    PathLength = BlRtlStringLength(Path) + 1;
+
+    Length = sizeof(UINT16) + PathLength + (sizeof(Options) - 1);
+
+    if (Length > sizeof(BlPxeTftpPacket)) {
+
+        return 0;
+    }
+
+    ((PTFTP_HEADER) BlPxeTftpPacket)->OpCode = BL_PXE_SWAP16(TFTP_OPCODE_RRQ);
+
+    BlRtlCopyMemory(&BlPxeTftpPacket[sizeof(UINT16)], Path, PathLength);
+    BlRtlCopyMemory(&BlPxeTftpPacket[sizeof(UINT16) + PathLength], Options, sizeof(Options) - 1);
+
+    return (UINT16) Length;
+}
+
+VOID
+BlPxeTftpParseOptions(
+    UINT16 Length,
+    PUINT32 BlockSize,
+    PUINT32 WindowSize
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function parses the options the server acknowledged in an OACK.
+//
+//  Arguments:
+//
+//    Length      - Supplies the length of the OACK packet.
+//
+//    BlockSize   - Receives the negotiated block size.
+//
+//    WindowSize  - Receives the negotiated window size.
+//
+//--
+
+{
+    UINT32 Consumed;
+    PCHAR Limit;
+    PCHAR Name;
+    PCHAR Next;
+    UINT32 Value;
+
+    //
+    // Terminate the packet so that a malformed option cannot run off the end.
+    // A full-sized OACK loses its last byte to the terminator.
+    //
+
+    if (Length >= sizeof(BlPxeTftpPacket)) {
+
+        Length = sizeof(BlPxeTftpPacket) - 1;
+    }
+
+    BlPxeTftpPacket[Length] = 0;
+
+    Next = (PCHAR) &BlPxeTftpPacket[sizeof(UINT16)];
+    Limit = (PCHAR) &BlPxeTftpPacket[Length];
+
+    while (Next < Limit) {
+
+        Name = Next;
+        Next += BlRtlStringLength(Name) + 1;
+
+        if (Next >= Limit) {
+
+            break;
+        }
+
+        if (BlRtlParsePositiveDecimal(Next, &Value, &Consumed) != FALSE) {
+
+            if ((BlRtlEqualStringI(Name, "blksize") != FALSE) &&
+                (Value >= 8) &&
+                (Value <= BL_PXE_TFTP_BLOCK_SIZE)) {
+
+                *BlockSize = Value;
+
+            } else if ((BlRtlEqualStringI(Name, "windowsize") != FALSE) &&
+                       (Value >= 1) &&
+                       (Value <= BL_PXE_TFTP_WINDOW_SIZE)) {
+
+                *WindowSize = Value;
+            }
+        }
+
+        Next += BlRtlStringLength(Next) + 1;
+    }
+}
+
+BOOLEAN
+BlPxeTftpReadFile(
+    PCSTR Path,
+    PVOID Buffer,
+    UINT32 NumberOfBytes
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function reads a file with a TFTP client running on the PXE UDP
+//    API. Unlike TFTP_READ_FILE, it negotiates a block size near the MTU and
+//    a window of blocks per acknowledgement, so many blocks are in flight.
+//
+//  Arguments:
+//
+//    Path            - Supplies the path to the file to read.
+//
+//    Buffer          - Receives data.
+//
+//    NumberOfBytes   - Supplies the size of the buffer.
+//
+//  Return Value:
+//
+//    TRUE, if the read operation was successful.
+//    FALSE, otherwise.
+//
+//--
+
+{
+    UINT16 AckBlock;
+    UINT32 BlockSize;
+    UINT16 ClientPort;
+    UINT32 DataLength;
+    UINT64 Deadline;
+    UINT16 ExpectedBlock;
+    BOOLEAN GapAcknowledged;
+    PTFTP_HEADER Header;
+    UINT32 InWindow;
+    UINT16 Length;
+    UINT32 Offset;
+    UINT16 PacketServerPort;
+    UINT16 RequestLength;
+    UINT32 Retries;
+    BOOLEAN Result;
+    UINT16 ServerPort;
+    UINT64 Timeout;
+    PPXE_UDP_OPEN UdpOpen;
+    UINT32 WindowSize;
+
+    if ((BlPxeUdpEnabled == FALSE) || (BlRtlTscFrequency == 0)) {
+
+        return FALSE;
+    }
+
+    RequestLength = BlPxeTftpBuildRequest(Path);
+
+    if (RequestLength == 0) {
+
+        return FALSE;
+    }
+
+    UdpOpen = &BlPxeApiPacket.u1.UdpOpen;
+
+    BlRtlZeroMemory(UdpOpen, sizeof(PXE_UDP_OPEN));
+
+    UdpOpen->SourceIP = BlPxeBootpReply.YourIP;
+
+    BlPxeCallPxeApi(PXE_OPCODE_UDP_OPEN, UdpOpen);
+
+    if (UdpOpen->Status != PXE_STATUS_SUCCESS) {
+
+#if PXE_VERBOSE
+
+        BlRtlPrintf("PXE: UDP_OPEN failed: 0x%04x; using TFTP_READ_FILE.\n", UdpOpen->Status);
+
+#endif
+
+        BlPxeUdpEnabled = FALSE;
+
+        return FALSE;
+    }
+
+    //
+    // Use a fresh transfer ID for every file so that stray packets from a previous
+    // transfer are not mistaken for this one.
+    //
+
+    ClientPort = BL_PXE_TFTP_CLIENT_PORT + (BlPxeTftpNextClientPort & 0x3FFF);
+    BlPxeTftpNextClientPort += 1;
+
+    Timeout = (BlRtlTscFrequency / 1000000) * BL_PXE_TFTP_TIMEOUT;
+
+    BlockSize = TFTP_DEFAULT_BLOCK_SIZE;
+    WindowSize = 1;
+    ServerPort = 0;
+    ExpectedBlock = 1;
+    GapAcknowledged = FALSE;
+    InWindow = 0;
+    Offset = 0;
+    Retries = 0;
+    Result = FALSE;
+
+    Header = (PTFTP_HEADER) BlPxeTftpPacket;
+
+    if (BlPxeUdpSend(ClientPort, TFTP_SERVER_PORT, RequestLength) == FALSE) {
+
+        goto Exit;
+    }
+
+    Deadline = __rdtsc() + Timeout;
+
+    for (;;) {
+
+        if (BlPxeUdpReceive(ClientPort, &PacketServerPort, &Length) == FALSE) {
+
+            if (__rdtsc() < Deadline) {
+
+                continue;
+            }
+
+            Retries += 1;
+
+            if (Retries > BL_PXE_TFTP_RETRY_COUNT) {
+
+                goto Exit;
+            }
+
+            //
+            // Resend the request if the server never answered, otherwise acknowledge
+            // the last block received in order so the server restarts the window there.
+            //
+
+            if (ServerPort == 0) {
+
+                BlPxeTftpBuildRequest(Path);
+
+                BlPxeUdpSend(ClientPort, TFTP_SERVER_PORT, RequestLength);
+
+            } else {
+
+                Header->OpCode = BL_PXE_SWAP16(TFTP_OPCODE_ACK);
+                Header->Block = BL_PXE_SWAP16((UINT16) (ExpectedBlock - 1));
+
+                BlPxeUdpSend(ClientPort, ServerPort, sizeof(TFTP_HEADER));
+            }
+
+            InWindow = 0;
+            Deadline = __rdtsc() + Timeout;
+
+            continue;
+        }
+
+        if (ServerPort == 0) {
+
+            ServerPort = PacketServerPort;
+
+        } else if (PacketServerPort != ServerPort) {
+
+            continue;
+        }
+
+        switch (BL_PXE_SWAP16(Header->OpCode)) {
+
+            case TFTP_OPCODE_OACK: {
+
+                if (ExpectedBlock != 1) {
+
+                    break;
+                }
+
+                BlPxeTftpParseOptions(Length, &BlockSize, &WindowSize);
+
+                Header->OpCode = BL_PXE_SWAP16(TFTP_OPCODE_ACK);
+                Header->Block = 0;
+
+                BlPxeUdpSend(ClientPort, ServerPort, sizeof(TFTP_HEADER));
+
+                Retries = 0;
+                Deadline = __rdtsc() + Timeout;
+
+                break;
+            }
+
+            case TFTP_OPCODE_DATA: {
+
+                if (BL_PXE_SWAP16(Header->Block) != ExpectedBlock) {
+
+                    //
+                    // A block was lost or reordered; acknowledge the last good block once
+                    // so that the server rewinds the window (RFC 7440).
+                    //
+
+                    if (GapAcknowledged == FALSE) {
+
+                        Header->OpCode = BL_PXE_SWAP16(TFTP_OPCODE_ACK);
+                        Header->Block = BL_PXE_SWAP16((UINT16) (ExpectedBlock - 1));
+
+                        BlPxeUdpSend(ClientPort, ServerPort, sizeof(TFTP_HEADER));
+
+                        GapAcknowledged = TRUE;
+                        InWindow = 0;
+                    }
+
+                    break;
+                }
+
+                DataLength = Length - sizeof(TFTP_HEADER);
+
+                if ((DataLength > BlockSize) || (DataLength > (NumberOfBytes - Offset))) {
+
+                    goto Exit;
+                }
+
+                BlRtlCopyMemory((PUINT8) Buffer + Offset, Header + 1, DataLength);
+
+                BlProfAddIoBytes(DataLength);
+
+                Offset += DataLength;
+                AckBlock = ExpectedBlock;
+                ExpectedBlock += 1;
+                InWindow += 1;
+                GapAcknowledged = FALSE;
+                Retries = 0;
+                Deadline = __rdtsc() + Timeout;
+
+                if ((DataLength < BlockSize) || (InWindow == WindowSize)) {
+
+                    Header->OpCode = BL_PXE_SWAP16(TFTP_OPCODE_ACK);
+                    Header->Block = BL_PXE_SWAP16(AckBlock);
+
+                    BlPxeUdpSend(ClientPort, ServerPort, sizeof(TFTP_HEADER));
+
+                    InWindow = 0;
+                }
+
+                if (DataLength < BlockSize) {
+
+                    Result = TRUE;
+
+                    goto Exit;
+                }
+
+                break;
+            }
+
+            case TFTP_OPCODE_ERROR: {
+
+#if PXE_VERBOSE
+
+                BlRtlPrintf("PXE: TFTP error %u on %s.\n", BL_PXE_SWAP16(Header->Block), Path);
+
+#endif
+
+                goto Exit;
+            }
+        }
+    }
+
+  Exit:
+
+#if PXE_VERBOSE
+
+    BlRtlPrintf("PXE: %s: %u bytes, blksize=%u windowsize=%u [%s]\n",
+                Path,
+                Offset,
+                BlockSize,
+                WindowSize,
+                (Result != FALSE) ? "OK" : "FAILED");
+
+#endif
+
+    BlPxeCallPxeApi(PXE_OPCODE_UDP_CLOSE, &BlPxeApiPacket.u1.UdpClose);
+
+    return Result;
+}
+
 BOOLEAN
 BlPxeReadFile(
     PCSTR Path,
@@ -477,6 +1054,16 @@ BlPxeReadFile(
         return FALSE;
     }
 
+    //
+    // Prefer the windowed UDP client; fall back to the PXE TFTP API if the ROM
+    // does not support UDP or the server does not cooperate.
+    //
+
+    if (BlPxeTftpReadFile(Path, Buffer, NumberOfBytes) != FALSE) {
+
+        return TRUE;
+    }
+
     for (Index = 0; Index < PXE_TFTP_READ_FILE_RETRY_COUNT; Index += 1) {
 
         BlRtlZeroMemory(ReadFile, sizeof(PXE_TFTP_READ_FILE));
@@ -496,6 +1083,8 @@ BlPxeReadFile(
 
         if (ReadFile->Status == PXE_STATUS_SUCCESS) {
 
+            BlProfAddIoBytes(NumberOfBytes);
+
             break;
         }
 
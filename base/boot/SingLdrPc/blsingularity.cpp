@@ -16,6 +16,7 @@
 #include "bl.h"
 
 #define SINGULARITY_DISTRO_INI_PATH     "singularity/singboot.ini"
+#define SINGULARITY_DISTRO_STREAM_PATH  SINGULARITY_DISTRO_INI_PATH ".distro"
 #define SINGULARITY_LOG_RECORD_SIZE     0x20000
 #define SINGULARITY_LOG_TEXT_SIZE       0x20000
 #define SINGULARITY_KERNEL_STACK_SIZE   0xC0000
@@ -60,6 +61,9 @@ typedef struct _BL_DISTRO_FILE {
     UINT32 Size;
     CHAR Path[1024];
     PVOID Data;
+    BOOLEAN HasDigest;
+    UINT8 Digest[BL_MD5_DIGEST_SIZE];
+    BL_AP_WORK_ITEM VerifyWorkItem;
 } BL_DISTRO_FILE, *PBL_DISTRO_FILE;
 
 typedef struct _BL_DISTRO {
@@ -97,6 +101,154 @@ UINT32 BlSingularityFileImageTableSize;
 
 __declspec(align(PAGE_SIZE)) UINT8 BlSingularityOhci1394Buffer[3 * PAGE_SIZE];
 
+//
+// e1000 descriptor rings and packet buffers for Singularity network KD.
+//
+
+__declspec(align(PAGE_SIZE)) UINT8 BlSingularityKdNetBuffer[9 * PAGE_SIZE];
+
+BOOLEAN
+BlSingularityParseDigest(
+    PCSTR String,
+    PUINT8 Digest
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function parses a hexadecimal MD5 digest from the distro INI file.
+//
+//  Arguments:
+//
+//    String  - Supplies the hexadecimal digits.
+//
+//    Digest  - Receives the digest.
+//
+//  Return Value:
+//
+//    TRUE, if parse was successful.
+//    FALSE, otherwise.
+//
+//--
+
+{
+    CHAR C;
+    UINT32 Index;
+    UINT8 Nibble;
+
+    for (Index = 0; Index < (2 * BL_MD5_DIGEST_SIZE); Index += 1) {
+
+        C = String[Index];
+
+        if ((C >= '0') && (C <= '9')) {
+
+            Nibble = (UINT8) (C - '0');
+
+        } else if ((C >= 'a') && (C <= 'f')) {
+
+            Nibble = (UINT8) (C - 'a' + 10);
+
+        } else if ((C >= 'A') && (C <= 'F')) {
+
+            Nibble = (UINT8) (C - 'A' + 10);
+
+        } else {
+
+            return FALSE;
+        }
+
+        if ((Index % 2) == 0) {
+
+            Digest[Index / 2] = (UINT8) (Nibble << 4);
+
+        } else {
+
+            Digest[Index / 2] |= Nibble;
+        }
+    }
+
+    return TRUE;
+}
+
+VOID
+BlSingularityVerifyDistroFile(
+    PBL_AP_WORK_ITEM WorkItem
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function checks a distro file against its INI digest. It may run on
+//    any processor.
+//
+//  Arguments:
+//
+//    WorkItem    - Supplies the work item; its context is the distro file.
+//
+//--
+
+{
+    UINT8 Digest[BL_MD5_DIGEST_SIZE];
+    PBL_DISTRO_FILE DistroFile;
+
+    DistroFile = (PBL_DISTRO_FILE) WorkItem->Context;
+
+    BlRtlComputeMd5(DistroFile->Data, DistroFile->Size, Digest);
+
+    if (BlRtlCompareMemory(Digest, DistroFile->Digest, BL_MD5_DIGEST_SIZE) == FALSE) {
+
+        WorkItem->Status = BL_AP_WORK_FAILURE;
+    }
+}
+
+BOOLEAN
+BlSingularityReadDistroStream(
+    VOID
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function reads the whole distro as a single TFTP transfer. bootd
+//    serves the stream path as the concatenation of the files listed in the
+//    INI file, in INI order, which is exactly the layout of the distro region.
+//
+//  Return Value:
+//
+//    TRUE, if the distro was read.
+//    FALSE, if the server does not offer the stream; files must be read one by one.
+//
+//--
+
+{
+    UINT32 StreamSize;
+
+    if (BlFsGetFileSize(SINGULARITY_DISTRO_STREAM_PATH, &StreamSize) == FALSE) {
+
+        return FALSE;
+    }
+
+    if (StreamSize != BlDistro.TotalSize) {
+
+#if DISTRO_VERBOSE
+
+        BlKdPrintf("DISTRO: Stream size %u does not match INI total %u.\n",
+                   StreamSize,
+                   BlDistro.TotalSize);
+
+#endif
+
+        return FALSE;
+    }
+
+    BlVideoPrintf("Reading distro stream ... [%u bytes]\n", StreamSize);
+
+    return BlFsReadFile(SINGULARITY_DISTRO_STREAM_PATH, BlDistro.Data, StreamSize);
+}
+
 VOID
 BlSingularityLoadDistro(
     VOID
@@ -124,6 +276,9 @@ BlSingularityLoadDistro(
     PCHAR Temp;
     PVOID BlIniFileData;
     UINT32 BlIniFileSize;
+    PCHAR Hash;
+    UINT32 Phase;
+    BOOLEAN Streamed;
 
     BlDistro.NumberOfFiles = 0;
     BlRtlInitializeListHead(&BlDistro.FileList);
@@ -132,6 +287,8 @@ BlSingularityLoadDistro(
     // Read the distro INI file.
     //
 
+    Phase = BlProfBeginPhase("distro-ini");
+
     if (BlFsGetFileSize(SINGULARITY_DISTRO_INI_PATH, &BlIniFileSize) == FALSE) {
 
         BlRtlPrintf("BL: Unable to get INI file!\n");
@@ -173,6 +330,8 @@ BlSingularityLoadDistro(
             NewLine += 1;
         }
 
+        Hash = (PCHAR)BlRtlFindSubstring(Next, "Hash-MD5=");
+
         Next = (PCHAR)BlRtlFindSubstring(Next, "Size=");
 
         if (Next == NULL) {
@@ -230,6 +389,16 @@ BlSingularityLoadDistro(
         if (Size == 0) {
             Size = BlIniFileSize;
         }
+        else if ((Hash != NULL) &&
+                 (BlSingularityParseDigest(Hash + 9, DistroFile->Digest) != FALSE)) {
+
+            //
+            // The digest of the INI file itself cannot be recorded in the INI file,
+            // so only the other files are verified.
+            //
+
+            DistroFile->HasDigest = TRUE;
+        }
 
         DistroFile->Size = Size;
 
@@ -239,10 +408,14 @@ BlSingularityLoadDistro(
         BlRtlInsertTailList(&BlDistro.FileList, &DistroFile->Entry);
     }
 
+    BlProfEndPhase(Phase);
+
     //
     // Read distro files.
     //
 
+    Phase = BlProfBeginPhase("distro-read");
+
     BlDistro.Data = (PVOID) BlMmAllocatePhysicalRegion(ROUND_UP_TO_PAGES(BlDistro.TotalSize), BL_MM_PHYSICAL_REGION_DISTRO);
 
 #if DISTRO_VERBOSE
@@ -253,6 +426,17 @@ BlSingularityLoadDistro(
 
 #endif
 
+    //
+    // On a network boot, fetch all files in one transfer to avoid a round trip per file.
+    //
+
+    Streamed = FALSE;
+
+    if (BlGetBeb()->BootType == BL_PXE_BOOT) {
+
+        Streamed = BlSingularityReadDistroStream();
+    }
+
     FilesRead = 0;
     BytesRead = 0;
 
@@ -275,7 +459,8 @@ BlSingularityLoadDistro(
 
 #endif
 
-        if (BlFsReadFile(&DistroFile->Path[1], DistroFile->Data, DistroFile->Size) == FALSE) {
+        if ((Streamed == FALSE) &&
+            (BlFsReadFile(&DistroFile->Path[1], DistroFile->Data, DistroFile->Size) == FALSE)) {
 
             BlRtlPrintf("\n"
                         "BL: Error reading %s!\n",
@@ -284,6 +469,18 @@ BlSingularityLoadDistro(
             BlRtlHalt();
         }
 
+        //
+        // Hand the checksum to an idle processor while the next file is read.
+        //
+
+        if (DistroFile->HasDigest != FALSE) {
+
+            DistroFile->VerifyWorkItem.Routine = BlSingularityVerifyDistroFile;
+            DistroFile->VerifyWorkItem.Context = DistroFile;
+
+            BlApQueueWorkItem(&DistroFile->VerifyWorkItem);
+        }
+
         Next += DistroFile->Size;
 
         FilesRead += 1;
@@ -299,6 +496,30 @@ BlSingularityLoadDistro(
 
     BlVideoPrintf("\n");
 
+    BlProfEndPhase(Phase);
+
+    //
+    // Wait for outstanding checksums and fail the boot on any mismatch.
+    //
+
+    Phase = BlProfBeginPhase("distro-verify");
+
+    BlApWaitForWorkItems();
+
+    for (Entry = Head->Flink; Entry != Head; Entry = Entry->Flink) {
+
+        DistroFile = CONTAINING_RECORD(Entry, BL_DISTRO_FILE, Entry);
+
+        if ((DistroFile->HasDigest != FALSE) &&
+            (DistroFile->VerifyWorkItem.Status != BL_AP_WORK_SUCCESS)) {
+
+            BlRtlPrintf("BL: Checksum mismatch on %s!\n", DistroFile->Path);
+            BlRtlHalt();
+        }
+    }
+
+    BlProfEndPhase(Phase);
+
     //
     // If this is a network boot, then signal the PXE server to exit.
     // This is the only mechanism to notify the server that the boot succeeded.
@@ -742,6 +963,91 @@ unsigned char GetAPIC_ID (void)
     return (unsigned char) ((reg_ebx & INITIAL_APIC_ID_BITS) >> 24);
 }
 
+VOID
+BlSingularityInitializeNumaTopology(
+    VOID
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function copies the NUMA topology collected from the ACPI SRAT and
+//    SLIT into a native platform region and publishes it to the kernel.
+//
+//--
+
+{
+    UINT32 DistanceSize;
+    UINT32 DomainCount;
+    UINT32 From;
+    UINT32 MemorySize;
+    PUINT8 Next;
+    UINT32 ProcessorSize;
+    UINT32 To;
+
+    BlPlatform->NumaProcessors32 = 0;
+    BlPlatform->NumaProcessorCount = 0;
+    BlPlatform->NumaMemory32 = 0;
+    BlPlatform->NumaMemoryCount = 0;
+    BlPlatform->NumaDistance32 = 0;
+    BlPlatform->NumaDomainCount = 0;
+
+    DomainCount = BlAcpiNumaTopology.DomainCount;
+
+    if (DomainCount == 0) {
+
+        return;
+    }
+
+    ProcessorSize = BlAcpiNumaTopology.ProcessorCount * sizeof(BL_NUMA_PROCESSOR);
+    MemorySize = BlAcpiNumaTopology.MemoryCount * sizeof(BL_NUMA_MEMORY);
+    DistanceSize = DomainCount * DomainCount;
+
+    Next = (PUINT8) (ULONG_PTR) BlMmAllocatePhysicalRegion(ProcessorSize + MemorySize + DistanceSize,
+                                                           BL_MM_PHYSICAL_REGION_NATIVE_PLATFORM);
+
+    BlRtlCopyMemory(Next, BlAcpiNumaTopology.Processor, ProcessorSize);
+
+    BlPlatform->NumaProcessors32 = (ULONG_PTR) Next;
+    BlPlatform->NumaProcessorCount = BlAcpiNumaTopology.ProcessorCount;
+
+    Next += ProcessorSize;
+
+    BlRtlCopyMemory(Next, BlAcpiNumaTopology.Memory, MemorySize);
+
+    BlPlatform->NumaMemory32 = (ULONG_PTR) Next;
+    BlPlatform->NumaMemoryCount = BlAcpiNumaTopology.MemoryCount;
+
+    Next += MemorySize;
+
+    //
+    // Pack the distance matrix to the number of domains actually present.
+    //
+
+    for (From = 0; From < DomainCount; From += 1) {
+
+        for (To = 0; To < DomainCount; To += 1) {
+
+            Next[From * DomainCount + To] = BlAcpiNumaTopology.Distance[From * BL_NUMA_MAX_DOMAINS + To];
+        }
+    }
+
+    BlPlatform->NumaDistance32 = (ULONG_PTR) Next;
+    BlPlatform->NumaDomainCount = DomainCount;
+
+#if SINGULARITY_VERBOSE
+
+    BlRtlPrintf("BL: NUMA: %u domain(s), %u processor(s), %u memory range(s)%s.\n",
+                DomainCount,
+                BlAcpiNumaTopology.ProcessorCount,
+                BlAcpiNumaTopology.MemoryCount,
+                (BlAcpiNumaTopology.HasDistances != FALSE) ? "" : ", default distances");
+
+#endif
+
+}
+
 VOID
 BlSingularityInitialize(
     UINT32 NumberOfProcessors,
@@ -769,6 +1075,8 @@ BlSingularityInitialize(
 
 {
     UINT64 Base;
+    UINT8 BspApicId;
+    UINT32 Domain;
     UINT32 Index;
     PVOID PhysicalRegionHandle;
     UINT64 Size;
@@ -780,6 +1088,7 @@ BlSingularityInitialize(
     UINT64 PlayStart;
     int i;
     char* p;
+    UINT32 Phase;
 
     //
     // Allocate processor array and set processor count.
@@ -788,22 +1097,48 @@ BlSingularityInitialize(
     BlProcessor = (PBL_PROCESSOR) BlPoolAllocateBlock(sizeof(BL_PROCESSOR) * NumberOfProcessors);
     BlProcessorCount = NumberOfProcessors;
 
+    //
+    // Start application processors so they can help while the distro loads.
+    //
+
+    Phase = BlProfBeginPhase("ap-start");
+
+    BlApInitialize(NumberOfProcessors, ApEntry16, ApStartupLock);
+
+    BlProfEndPhase(Phase);
+
     //
     // Load distro.
     //
 
+    Phase = BlProfBeginPhase("distro");
+
     BlSingularityLoadDistro();
 
+    BlProfEndPhase(Phase);
+
     //
     // Load kernel image.
     //
 
+    Phase = BlProfBeginPhase("kernel-image");
+
     BlSingularityLoadKernelImage();
 
+    BlProfEndPhase(Phase);
+
+    //
+    // Park the application processors; the kernel restarts them.
+    //
+
+    BlApShutdown();
+
     //
     // Allocate native platform structure.
     //
 
+    Phase = BlProfBeginPhase("platform");
+
     BlPlatform = (Class_Microsoft_Singularity_Hal_Platform *) BlMmAllocatePhysicalRegion(ROUND_UP_TO_PAGES(sizeof(Class_Microsoft_Singularity_Hal_Platform)), BL_MM_PHYSICAL_REGION_NATIVE_PLATFORM);
 
     BlPlatform->Size = sizeof(Class_Microsoft_Singularity_Hal_Platform);
@@ -933,6 +1268,20 @@ BlSingularityInitialize(
         BlPlatform->Ohci1394BufferAddr32 = (ULONG_PTR) BlSingularityOhci1394Buffer;
         BlPlatform->Ohci1394BufferSize32 = sizeof(BlSingularityOhci1394Buffer);
 
+    }
+    else if (BlPciKdNicBaseAddress != 0) {
+
+        //
+        // The kernel drives the NIC itself and falls back to no debugger if
+        // the host does not answer.
+        //
+
+        BlRtlPrintf("Got network debugger base address!\n");
+        BlPlatform->DebuggerType = Class_Microsoft_Singularity_Hal_Platform_DEBUGGER_NET;
+        BlPlatform->KdNicBase = BlPciKdNicBaseAddress;
+        BlPlatform->KdNicBufferAddr32 = (ULONG_PTR) BlSingularityKdNetBuffer;
+        BlPlatform->KdNicBufferSize32 = sizeof(BlSingularityKdNetBuffer);
+
     }
     else {
 
@@ -966,18 +1315,34 @@ BlSingularityInitialize(
     BlPlatform->Cpus = (ULONG_PTR) BlCpuArray;
 
     //
-    // Allocate per-processor resources upfront.
+    // Allocate per-processor resources upfront, from the proximity domain of the
+    // processor when the SRAT describes it.  The kernel starts processor N by
+    // sending its startup IPI to the BSP's APIC ID plus N (see HalDevices.cs),
+    // so that is the APIC ID whose domain processor N's resources come from.
     //
 
+    BspApicId = (UINT8) (BlGetCpuidEbx(1) >> 24);
+
     for (Index = 0; Index < NumberOfProcessors; Index += 1) {
 
+        Domain = BlAcpiGetProcessorProximityDomain((UINT8) (BspApicId + Index));
+
         BlProcessor[Index].Index = Index;
         BlProcessor[Index].Cpu = &BlCpuArray[Index];
-        BlProcessor[Index].ContextPage = (PVOID) BlMmAllocatePhysicalRegion(2 * PAGE_SIZE, BL_MM_PHYSICAL_REGION_CONTEXT);
+        BlProcessor[Index].ContextPage = (PVOID) BlMmAllocatePhysicalRegionInDomain(2 * PAGE_SIZE, BL_MM_PHYSICAL_REGION_CONTEXT, Domain);
         BlProcessor[Index].BasePage = (PVOID) ((ULONG_PTR) BlProcessor[Index].ContextPage + PAGE_SIZE);
-        BlProcessor[Index].TaskPage = (BL_TASK_SEGMENT *) BlMmAllocatePhysicalRegion(PAGE_SIZE, BL_MM_PHYSICAL_REGION_TASK);
+        BlProcessor[Index].TaskPage = (BL_TASK_SEGMENT *) BlMmAllocatePhysicalRegionInDomain(PAGE_SIZE, BL_MM_PHYSICAL_REGION_TASK, Domain);
     }
 
+    BlSingularityInitializeNumaTopology();
+
+    //
+    // Reserve the boot phase table; it is filled in just before the kernel starts.
+    //
+
+    BlPlatform->BootPhases32 = (ULONG_PTR) BlMmAllocatePhysicalRegion(sizeof(BL_PROF_PHASE) * BL_PROF_MAX_PHASES,
+                                                                      BL_MM_PHYSICAL_REGION_NATIVE_PLATFORM);
+
     //
     // Allocate kernel stack for the bootstrap processor.
     //
@@ -1088,6 +1453,17 @@ BlSingularityInitialize(
     BlPlatform->Smap32 = (ULONG_PTR) (PVOID) BlSingularitySmap->Entry;
     BlPlatform->SmapCount = BlSingularitySmap->EntryCount;
 
+    BlProfEndPhase(Phase);
+
+    //
+    // Hand the boot phase profile to the kernel and print it to the debugger.
+    //
+
+    BlPlatform->BootPhaseCount = BlProfCopyPhases((PBL_PROF_PHASE) BlPlatform->BootPhases32);
+    BlPlatform->BootTscFrequency = BlRtlTscFrequency;
+
+    BlProfDump();
+
 #if MM_VERBOSE
 
     BlMmDumpPhysicalRegionList();
@@ -450,6 +450,8 @@ BlRtlMakeLegacyCall(
 //--
 
 {
+    BlProfBiosCalls += 1;
+
     //
     // Return to legacy mode.
     //
@@ -1207,3 +1209,128 @@ BlRtlGetCurrentTime(
     }
 }
 
+
+//
+// Programmable interval timer (PIT) constants used for TSC calibration.
+//
+
+#define PIT_FREQUENCY                   1193182
+#define PIT_CHANNEL2_DATA_PORT          0x42
+#define PIT_COMMAND_PORT                0x43
+#define PIT_CHANNEL2_GATE_PORT          0x61
+
+#define PIT_CHANNEL2_GATE               0x01
+#define PIT_CHANNEL2_SPEAKER            0x02
+#define PIT_CHANNEL2_OUTPUT             0x20
+
+#define PIT_CHANNEL2_ONE_SHOT           0xB0
+
+#define PIT_CALIBRATION_MS              50
+
+UINT64 BlRtlTscFrequency;
+
+VOID
+BlRtlCalibrateTsc(
+    VOID
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function measures the time stamp counter frequency against PIT channel 2.
+//
+//--
+
+{
+    UINT32 Count;
+    UINT64 End;
+    UINT64 Start;
+
+    Count = (PIT_FREQUENCY * PIT_CALIBRATION_MS) / 1000;
+
+    //
+    // Enable the channel 2 gate with the speaker disconnected, and program a one-shot count.
+    //
+
+    BlRtlWritePort8(PIT_CHANNEL2_GATE_PORT,
+                    (UINT8) ((BlRtlReadPort8(PIT_CHANNEL2_GATE_PORT) & ~PIT_CHANNEL2_SPEAKER) | PIT_CHANNEL2_GATE));
+
+    BlRtlWritePort8(PIT_COMMAND_PORT, PIT_CHANNEL2_ONE_SHOT);
+    BlRtlWritePort8(PIT_CHANNEL2_DATA_PORT, (UINT8) (Count & 0xFF));
+    BlRtlWritePort8(PIT_CHANNEL2_DATA_PORT, (UINT8) (Count >> 8));
+
+    Start = __rdtsc();
+
+    while ((BlRtlReadPort8(PIT_CHANNEL2_GATE_PORT) & PIT_CHANNEL2_OUTPUT) == 0) {
+
+    }
+
+    End = __rdtsc();
+
+    BlRtlTscFrequency = ((End - Start) * 1000) / PIT_CALIBRATION_MS;
+}
+
+UINT64
+BlRtlTscToMicroseconds(
+    UINT64 Ticks
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function converts a time stamp counter delta to microseconds.
+//
+//  Arguments:
+//
+//    Ticks   - Supplies the time stamp counter delta.
+//
+//  Return Value:
+//
+//    Number of microseconds, or zero if the TSC has not been calibrated.
+//
+//--
+
+{
+    if (BlRtlTscFrequency == 0) {
+
+        return 0;
+    }
+
+    //
+    // Divide the frequency first to avoid overflowing the multiplication on long intervals.
+    //
+
+    return Ticks / (BlRtlTscFrequency / 1000000);
+}
+
+VOID
+BlRtlStallExecution(
+    UINT32 Microseconds
+    )
+
+//++
+//
+//  Routine Description:
+//
+//    This function busy-waits for the specified number of microseconds.
+//
+//  Arguments:
+//
+//    Microseconds    - Supplies the number of microseconds to wait.
+//
+//--
+
+{
+    UINT64 Limit;
+
+    BLASSERT(BlRtlTscFrequency != 0);
+
+    Limit = __rdtsc() + ((BlRtlTscFrequency / 1000000) * Microseconds);
+
+    while (__rdtsc() < Limit) {
+
+        _mm_pause();
+    }
+}
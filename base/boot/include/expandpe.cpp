@@ -51,6 +51,8 @@ typedef struct _IMAGE_FILE_HEADER {
     uint16  Characteristics;
 } IMAGE_FILE_HEADER, *PIMAGE_FILE_HEADER;
 
+#define IMAGE_FILE_RELOCS_STRIPPED          0x0001
+
 //
 // Directory format.
 //
@@ -245,6 +247,95 @@ uintptr SizeOfPeImage(uintptr source, uintptr& base)
     return size;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Find the first block in a sorted run of base relocation blocks whose page
+// lies at or above va.
+//
+static uint8 * FindRelocBlock(uint8 * pbReloc, uint8 * pbRelocEnd, uint32 va)
+{
+    while (pbReloc < pbRelocEnd && ((uint32 *)pbReloc)[0] < va) {
+        pbReloc += ((uint32 *)pbReloc)[1];
+    }
+    return pbReloc;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Apply the base fixups in the blocks [pbReloc..pbRelocEnd) that lie in
+// [vaStart..vaEnd) of the image expanded at dst.  A block covers one page,
+// and a page may be shared by two sections, so each fixup is checked on its
+// own.
+//
+static bool RelocatePeRange(uintptr dst, uintptr diff,
+                            uint8 * pbReloc, uint8 * pbRelocEnd,
+                            uint32 vaStart, uint32 vaEnd)
+{
+    while (pbReloc < pbRelocEnd) {
+        uint32 * ph = (uint32 *)pbReloc;
+
+        if (ph[1] < 8) {
+            printf("%p: %x --- Bad relocation block size!\n", ph, ph[1]);
+            return false;
+        }
+
+        uint16 * pr = (uint16 *)(pbReloc + 8);
+        uint16 * prEnd = (uint16 *)(pbReloc + ph[1]);
+        uintptr va = dst + ph[0];
+
+        pbReloc = (uint8 *)prEnd;
+
+        if (ph[0] + 0x1000 <= vaStart || ph[0] >= vaEnd) {
+            continue;
+        }
+
+#if EXPANDPE_VERBOSE
+        printf("  %08x..%08x\n", ph[0], ph[1]);
+#endif
+        for (; pr < prEnd; pr++) {
+            uint32 off = ph[0] + (pr[0] & 0xfff);
+            if (off < vaStart || off >= vaEnd) {
+                continue;
+            }
+
+            uintptr rva = va + (pr[0] & 0xfff);
+
+            switch (pr[0] >> 12) {
+                case IMAGE_REL_BASED_ABSOLUTE:
+#if EXPANDPE_VERBOSE
+                    printf("    %p: abs:%x\n", (uint32*)rva, *(uint32*)rva);
+#endif
+                    break;
+                case IMAGE_REL_BASED_HIGHLOW:   // 32-bit reloc
+#if EXPANDPE_VERBOSE
+                    printf("    %p: r32:%x->%x\n",
+                           (uint32*)rva, *(uint32*)rva, *(uint32*)rva + (uint32)diff);
+#endif
+                    *(uint32*)rva += (uint32)diff;
+                    break;
+                case IMAGE_REL_BASED_DIR64:     // 64-bit reloc
+#if EXPANDPE_VERBOSE
+                    printf("    %p: r64:%lx->%lx\n",
+                           (uint64*)rva, *(uint64*)rva, *(uint64*)rva + (uint64)diff);
+#endif
+                    *(uint64*)rva += (uint64)diff;
+                    break;
+                default:
+                    printf("%p: %x --- Unknown relocation type!\n", (uint32*)rva, pr[0] >> 12);
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Expand the image in a single pass: each section is copied, only the part not
+// backed by the file is zeroed, and its relocations are applied right away while
+// the section is still in the cache.  An image expanded at its link base, or
+// linked with its relocations pre-resolved and stripped, needs no fixups at all.
+//
 uintptr ExpandPeImage(uintptr dst, uintptr src)
 {
     UINT8 * pbImage = (UINT8 *)src;
@@ -274,16 +365,19 @@ uintptr ExpandPeImage(uintptr dst, uintptr src)
 
     uintptr entry = 0;
     uintptr diff = 0;
+    IMAGE_DATA_DIRECTORY * pidd = NULL;
 
     if (pinh->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) {
         diff = dst - pinh->OptionalHeader.ImageBase;
         entry = dst + pinh->OptionalHeader.AddressOfEntryPoint;
+        pidd = &pinh->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
 
         CopyDown((uint8*)dst, pbImage, pinh->OptionalHeader.SizeOfHeaders);
     }
     else if (pinh64->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
         diff = dst - (uintptr)pinh64->OptionalHeader.ImageBase;
         entry = dst + pinh64->OptionalHeader.AddressOfEntryPoint;
+        pidd = &pinh64->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
 
         CopyDown((uint8*)dst, pbImage, pinh64->OptionalHeader.SizeOfHeaders);
     }
@@ -292,8 +386,66 @@ uintptr ExpandPeImage(uintptr dst, uintptr src)
         return 0;
     }
 
+    if (diff != 0 && (pinh->FileHeader.Characteristics & IMAGE_FILE_RELOCS_STRIPPED)) {
+        printf("Relocations stripped; image must be expanded at its base!\n");
+        return 0;
+    }
+
     IMAGE_SECTION_HEADER * pish = (IMAGE_SECTION_HEADER *)
         (((uintptr)&pinh->OptionalHeader) + pinh->FileHeader.SizeOfOptionalHeader);
+
+    // Locate the relocations in the source file.  If the expanded image would
+    // overwrite them before the last section is copied, fall back to a separate
+    // pass over the expanded image.
+    uint8* pbRelocSrc = NULL;
+    uint8* pbRelocSrcEnd = NULL;
+    uint32 vaImageEnd = 0;
+
+    for (int i = 0; i < pinh->FileHeader.NumberOfSections; i++) {
+        if (vaImageEnd < pish[i].VirtualAddress + pish[i].VirtualSize) {
+            vaImageEnd = pish[i].VirtualAddress + pish[i].VirtualSize;
+        }
+        if (diff != 0 && pidd->Size != 0 &&
+            pidd->VirtualAddress >= pish[i].VirtualAddress &&
+            pidd->VirtualAddress - pish[i].VirtualAddress + pidd->Size <= pish[i].SizeOfRawData) {
+            pbRelocSrc = pbImage + pish[i].PointerToRawData
+                + (pidd->VirtualAddress - pish[i].VirtualAddress);
+            pbRelocSrcEnd = pbRelocSrc + pidd->Size;
+        }
+    }
+
+    if (pbRelocSrc != NULL &&
+        pbRelocSrc < (uint8 *)dst + vaImageEnd && pbRelocSrcEnd > (uint8 *)dst) {
+#if EXPANDPE_VERBOSE
+        printf("Relocs overlap the expanded image; deferring.\n");
+#endif
+        pbRelocSrc = NULL;
+        pbRelocSrcEnd = NULL;
+    }
+
+    // Linkers sort the blocks by page, so the blocks for each section form one
+    // run that begins at or after the previous section's.  Check that once; an
+    // unsorted list is searched in full for every section.
+    bool fRelocSorted = true;
+    uint8* pbRelocNext = pbRelocSrc;
+
+    if (pbRelocSrc != NULL) {
+        uint32 vaPage = 0;
+
+        for (uint8* pb = pbRelocSrc; pb < pbRelocSrcEnd; pb += ((uint32 *)pb)[1]) {
+            uint32 * ph = (uint32 *)pb;
+
+            if (ph[1] < 8) {
+                printf("%p: %x --- Bad relocation block size!\n", ph, ph[1]);
+                return 0;
+            }
+            if (ph[0] < vaPage) {
+                fRelocSorted = false;
+            }
+            vaPage = ph[0];
+        }
+    }
+
 #if EXPANDPE_VERBOSE
     printf("  Section_ VirtAddr VirtSize _RawAddr _RawSize DestAddr CopySize SorcAddr\n");
 #endif
@@ -315,60 +467,45 @@ uintptr ExpandPeImage(uintptr dst, uintptr src)
                pbSrc);
 #endif
 
-        Zero(pbDst, pish[i].VirtualSize);
         CopyDown(pbDst, pbSrc, cbSrc);
-    }
+        if (cbSrc < pish[i].VirtualSize) {
+            Zero(pbDst + cbSrc, pish[i].VirtualSize - cbSrc);
+        }
 
-    // Process the relocations.
-    if (diff != 0) {
-        IMAGE_DATA_DIRECTORY * pidd
-            = &pinh->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+        if (pbRelocSrc != NULL) {
+            uint8* pbFirst = pbRelocSrc;
+            uint8* pbLast = pbRelocSrcEnd;
 
+            if (fRelocSorted) {
+                // The last page of a section may also be the first of the next.
+                if (i > 0 && pish[i].VirtualAddress < pish[i - 1].VirtualAddress) {
+                    pbRelocNext = pbRelocSrc;
+                }
+                pbRelocNext = FindRelocBlock(pbRelocNext, pbRelocSrcEnd,
+                                             pish[i].VirtualAddress & ~0xfff);
+                pbFirst = pbRelocNext;
+                pbLast = FindRelocBlock(pbFirst, pbRelocSrcEnd,
+                                        pish[i].VirtualAddress + pish[i].VirtualSize);
+            }
+
+            if (!RelocatePeRange(dst, diff, pbFirst, pbLast,
+                                 pish[i].VirtualAddress,
+                                 pish[i].VirtualAddress + pish[i].VirtualSize)) {
+                return 0;
+            }
+        }
+    }
+
+    // Process the relocations that could not be merged with the copy.
+    if (diff != 0 && pbRelocSrc == NULL && pidd->Size != 0) {
         uint8* pbReloc = (uint8*)dst + pidd->VirtualAddress;
         uint8* pbRelocEnd = pbReloc + pidd->Size;
 
 #if EXPANDPE_VERBOSE
         printf("Relocs: %08x..%08x\n", pbReloc, pbRelocEnd);
 #endif
-        while (pbReloc < pbRelocEnd) {
-            uint32 * ph = (uint32 *)pbReloc;
-
-#if EXPANDPE_VERBOSE
-            printf("  %08x..%08x\n", ph[0], ph[1]);
-#endif
-            uint16 * pr = (uint16 *)(pbReloc + 8);
-            uint16 * prEnd = (uint16 *)(pbReloc + ph[1]);
-            uintptr va = dst + ph[0];
-
-            for (; pr < prEnd; pr++) {
-                uintptr rva = va + (pr[0] & 0xfff);
-
-                switch (pr[0] >> 12) {
-                    case IMAGE_REL_BASED_ABSOLUTE:
-#if EXPANDPE_VERBOSE
-                        printf("    %p: abs:%x\n", (uint32*)rva, *(uint32*)rva);
-#endif
-                        break;
-                    case IMAGE_REL_BASED_HIGHLOW:   // 32-bit reloc
-#if EXPANDPE_VERBOSE
-                        printf("    %p: r32:%x->%x\n",
-                               (uint32*)rva, *(uint32*)rva, *(uint32*)rva + (uint32)diff);
-#endif
-                        *(uint32*)rva += (uint32)diff;
-                        break;
-                    case IMAGE_REL_BASED_DIR64:     // 64-bit reloc
-#if EXPANDPE_VERBOSE
-                        printf("    %p: r64:%lx->%lx\n",
-                               (uint64*)rva, *(uint64*)rva, *(uint64*)rva + (uint64)diff);
-#endif
-                        *(uint64*)rva += (uint64)diff;
-                        break;
-                    default:
-                        printf("%p: %x --- Unknown relocation type!\n", (uint32*)rva, pr[0] >> 12);
-                        return 0;
-                }
-            }
-            pbReloc = (uint8 *)prEnd;
+        if (!RelocatePeRange(dst, diff, pbReloc, pbRelocEnd, 0, vaImageEnd)) {
+            return 0;
         }
     }
     return entry;